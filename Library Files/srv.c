@@ -16,16 +16,48 @@
 #include <smsa.h>
 #include <smsa_network.h>
 #include <cmpsc311_log.h>
+#include <server_proxy.h>
+#include <server_tls.h>
+#include <server_bundle.h>
+#include <server_shared.h>
+#include <server_sse.h>
+#include <server_master.h>
+#include <server_affinity.h>
+#include <server_event.h>
+#include <server_listener.h>
+#include <server_capture.h>
+#include <server_replay.h>
+#include <server_warmup.h>
+#include <server_bench.h>
+#include <server_build.h>
+#include <server_config.h>
 
 // Defines
-#define SMSA_ARGUMENTS "vhl:"
+#define SMSA_ARGUMENTS "vhl:f:c:u:s:t:k:b:p:w:a:ie:r:x:m:"
 #define USAGE \
-	"USAGE: smsasrvr [-h] [-v] [-l <logfile>]\n" \
+	"USAGE: smsasrvr [-h] [-v] [-l <logfile>] [-f <configfile>] [-c <hostsfile>] [-u <upstreamfile>]\n" \
+	"       [-s <tlsport> -t <certfile> -k <keyfile>] [-b <bundlefile>] [-p <bundlefile>]\n" \
+	"       [-w <workers>] [-a <cpulist> [-i]] [-e <socketpath>] [-r <capturefile> [-x <speed>]]\n" \
+	"       [-m <resultfile>] [<port>]\n" \
 	"\n" \
 	"where:\n" \
 	"    -h - help mode (display this message)\n" \
 	"    -v - verbose output\n" \
 	"    -l - write log messages to the filename <logfile>\n" \
+	"    -f - read settings from <configfile>, again on SIGHUP. Flags override it\n" \
+	"    -c - serve the virtual hosts listed in <hostsfile>\n" \
+	"    -u - proxy the routes listed in <upstreamfile>\n" \
+	"    -s - also serve HTTPS on <tlsport>, with the PEM <certfile> and <keyfile>\n" \
+	"    -b - serve the default host's files from the asset bundle <bundlefile>\n" \
+	"    -p - pack the default host's docroot into <bundlefile> and exit\n" \
+	"    -w - run <workers> server processes, restarting any that crash\n" \
+	"    -a - run on the CPUs in <cpulist>, like 0-7,16-23 or isolated, with memory on their nodes\n" \
+	"    -i - hand each connection to the worker on the CPU that received it\n" \
+	"    -e - take events to publish on the Unix socket <socketpath>\n" \
+	"    -r - replay the requests in <capturefile> against the server on <port> and exit\n" \
+	"    -x - replay <speed> times faster than captured, 0 for as fast as possible\n" \
+	"    -m - run the request path microbenchmarks, write JSON to <resultfile> (- for stdout) and exit\n" \
+	"    <port> - listen on <port>, unless the config file says where\n" \
 	"\n" \
 
 //
@@ -49,11 +81,13 @@
 int main( int argc, char *argv[] )
 {
 	// Local variables
-	int ch, verbose = 0, log_initialized = 0;
-	int port;
+	int ch, verbose = 0, log_initialized = 0, bad = 0;
+	char *configFile = NULL, *pack = NULL, *replay = NULL, *bench = NULL;
+	double speed = 1.0;
+	SERVER_CONFIG *config;
 
-	port = atoi(argv[1]);
-	// Process the command line parameters
+	// Process the command line parameters. Settings are kept as overrides
+	// of the config file, so a reload doesn't lose them
 	while ((ch = getopt(argc, argv, SMSA_ARGUMENTS)) != -1) {
 
 		switch (ch) {
@@ -70,12 +104,77 @@ int main( int argc, char *argv[] )
 			log_initialized = 1;
 			break;
 
+		case 'f': // Config file
+			configFile = optarg;
+			break;
+
+		case 'c': // Virtual host config file
+			bad |= overrideConfig( "hosts", optarg );
+			break;
+
+		case 'u': // Upstream routes file
+			bad |= overrideConfig( "upstreams", optarg );
+			break;
+
+		case 's': // TLS port
+			bad |= overrideConfig( "tls", optarg );
+			break;
+
+		case 't': // TLS certificate chain
+			bad |= overrideConfig( "certificate", optarg );
+			break;
+
+		case 'k': // TLS private key
+			bad |= overrideConfig( "key", optarg );
+			break;
+
+		case 'b': // Serve from an asset bundle
+			bad |= overrideConfig( "bundle", optarg );
+			break;
+
+		case 'p': // Pack an asset bundle
+			pack = optarg;
+			break;
+
+		case 'w': // Worker processes
+			bad |= overrideConfig( "workers", optarg );
+			break;
+
+		case 'a': // CPUs to run on
+			bad |= overrideConfig( "cpus", optarg );
+			break;
+
+		case 'i': // Steer connections by incoming CPU
+			bad |= overrideConfig( "steer", "on" );
+			break;
+
+		case 'e': // Event publishing socket
+			bad |= overrideConfig( "events-socket", optarg );
+			break;
+
+		case 'r': // Replay a capture
+			replay = optarg;
+			break;
+
+		case 'x': // Replay speed
+			speed = atof( optarg );
+			break;
+
+		case 'm': // Run the microbenchmarks
+			bench = optarg;
+			break;
+
 		default:  // Default (unknown)
 			fprintf( stderr, "Unknown command line option (%c), aborting.\n", ch );
 			return( -1 );
 		}
 	}
 
+	// The port follows the flags
+	if ( optind < argc ) {
+		bad |= overrideConfig( "listen", argv[optind] );
+	}
+
 	// Setup the log as needed
 	if ( ! log_initialized ) {
 		initializeLogWithFilehandle( CMPSC311_LOG_STDERR );
@@ -83,11 +182,92 @@ int main( int argc, char *argv[] )
 	if ( verbose ) {
 		enableLogLevels( LOG_INFO_LEVEL );
 	}
+#if SERVER_TRACE
+	traceLevel = registerLogLevel( "TRACE", 1 );
+#endif
+	logMessage( LOG_INFO_LEVEL, "Running the %s build", SERVER_BUILD );
+
+	// Read the config, with the virtual hosts and bundles it names. Without
+	// them every request uses the default docroot
+	if ( bad || loadConfig( configFile ) ) {
+		fprintf( stderr, "Can't load the configuration, aborting.\n" );
+		return( -1 );
+	}
+	config = serverConfig();
+
+	// A replay is a client of some other server, so it needs nothing else set up
+	if ( replay != NULL ) {
+		return( replayCapture( replay, config->port, speed ) ? -1 : 0 );
+	}
+
+	// The benchmarks only need the config, for the default host
+	if ( bench != NULL ) {
+		return( runBenchmarks( bench ) ? -1 : 0 );
+	}
+
+	// CPU and memory placement, settled before anything is allocated for the workers
+	// Threads that busy poll get a CPU each
+	if ( setupAffinity( ( config->cpus[0] ) ? config->cpus : NULL, config->steer, ( config->busyPoll ) ? MAX_THREADS : 0 ) ) {
+		fprintf( stderr, "Can't place the server on CPUs %s, aborting.\n", ( config->cpus[0] ) ? config->cpus : "(none)" );
+		return( -1 );
+	}
+
+	if ( pack != NULL ) {
+		return( packBundle( config->hosts->defaultHost, pack ) ? -1 : 0 );
+	}
+	if ( config->upstreamsFile[0] && loadUpstreams( config->upstreamsFile ) ) {
+		fprintf( stderr, "Can't load upstream routes from %s, aborting.\n", config->upstreamsFile );
+		return( -1 );
+	}
+	if ( loadListeners( ( config->listenersFile[0] ) ? config->listenersFile : NULL, config->port, config->tlsPort ) ) {
+		fprintf( stderr, "Can't load the listeners%s%s, aborting.\n", ( config->listenersFile[0] ) ? " from " : "", config->listenersFile );
+		return( -1 );
+	}
+	if ( countListeners( LISTEN_TLS ) && ( !config->certFile[0] || !config->keyFile[0] ||
+	     setupTls( config->certFile, config->keyFile ) ) ) {
+		fprintf( stderr, "Can't set up TLS, aborting.\n" );
+		return( -1 );
+	}
+
+	// The counters and file cache every process shares, mapped before any fork
+	if ( setupSharedMemory() ) {
+		fprintf( stderr, "Can't set up the shared memory segment, aborting.\n" );
+		return( -1 );
+	}
+
+	// Event channels, served by every process
+	if ( setupEvents() ) {
+		fprintf( stderr, "Can't set up the event channels, aborting.\n" );
+		return( -1 );
+	}
 
-	printf ( "port = %d", port );
+	// The capture file every process appends to
+	if ( setupCapture( config->captureFile, config->captureSample ) ) {
+		fprintf( stderr, "Can't start capturing to %s, aborting.\n", config->captureFile );
+		return( -1 );
+	}
+
+	// The popular files, read back in once the server is up
+	if ( setupWarmup( config->warmupFile, config->warmupBytes ) ) {
+		fprintf( stderr, "Can't read the warm-up list %s, aborting.\n", config->warmupFile );
+		return( -1 );
+	}
 
-	// Run the server
-	smsa_server( port );
+	// Unix sockets, which every process accepts from
+	if ( openSharedListeners() ) {
+		fprintf( stderr, "Can't open the Unix socket listeners, aborting.\n" );
+		return( -1 );
+	}
+
+	printf ( "port = %ld", config->port );
+
+	// Run the server, in worker processes if asked for
+	if ( config->workers ) {
+		bad = runWorkers( config->workers );
+		closeListeners();
+		return( bad ? -1 : 0 );
+	}
+	smsa_server();
 
 	// Return successfully
 	return( 0 );
@@ -16,13 +16,15 @@
 #include <arpa/inet.h>
 #include <errno.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
 #include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <sys/wait.h>
-#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <poll.h>
 #include <fcntl.h>
 #include <pthread.h>
 
@@ -30,35 +32,38 @@
 #include <smsa.h>
 #include <smsa_network.h>
 #include <cmpsc311_log.h>
-#include <smsa_threads.h>
-
-/* DEBUG */
-#define DEBUG 1
-#define MAXLINE 1000
-#define MAXBUF 100000
-#define MAX_NUM_OF_HEADER_LINES 10
-#define MAX_THREADS 5
+#include <server.h>
+#include <server_threads.h>
+#include <server_admission.h>
+#include <server_event.h>
+#include <server_body.h>
+#include <server_handlers.h>
+#include <server_autoindex.h>
+#include <server_proxy.h>
+#include <server_tls.h>
+#include <server_http2.h>
+#include <server_bundle.h>
+#include <server_shared.h>
+#include <server_master.h>
+#include <server_affinity.h>
+#include <server_iopool.h>
+#include <server_microcache.h>
+#include <server_websocket.h>
+#include <server_sse.h>
+#include <server_shaping.h>
+#include <server_busypoll.h>
+#include <server_listener.h>
+#include <server_capture.h>
+#include <server_warmup.h>
+#include <server_config.h>
 
 
 // Global Variables
-int serverShutdown;
+volatile sig_atomic_t serverShutdown;
+volatile sig_atomic_t configReload;	//SIGHUP asked for the config to be read again
 MY_THREAD backlog[MAX_THREADS];
 
 
-//Functional Prototypes
-int setupServer ( int *server, int port );
-void * processClient ( void * args ); 
-int read_request_hdrs ( int client );
-int parse_uri ( char *uri, char *filename, char *cgiargs );
-int serve_static ( int client,  char *filename, int filesize );
-void get_filetype ( char *filename, char *filetype );
-int serve_dynamic ( int client, char *filename, char *cgiargs );
-int readBytes ( int server, int len, char *block );
-int sendBytes ( int server, int len, char *block );
-int selectData ( int sock, int wait );
-void signalHandler ( int signal );
-
-
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : server
@@ -67,20 +72,24 @@ void signalHandler ( int signal );
 // Inputs       : none
 // Outputs      : 0 if successful, -1 if failure
 
-int server ( int port ) {
+int server ( void ) {
 
 
 	
-	struct sockaddr_in clientAddress;  //holds client address
-	int server;			   //file handle for the socket
-	int client;			   //file handle for the client
-	unsigned int inet_len;		
-	
-
-	//Set up the server to be listening
+	//Set up the worker pool and admission control, then
+	//set up the server to be listening. The event loop runs on this
+	//process's home CPU, and the workers start out on its node. In the
+	//low-latency mode they all spin a while before sleeping
+	setupBusyPoll ( serverConfig()->busyPoll );
 	setupThreads ( backlog, MAX_THREADS );
+	if ( pinEventLoop() || setupAdmission() || startWorkers ( backlog, MAX_THREADS, processClient ) ||
+	     startIoPool() || startMicrocache() || startEvents() || startUpstreamChecks() || startCapture() ||
+	     startWarmup() ) {
+		logMessage ( LOG_ERROR_LEVEL, "_smsa_server:Failed to start the worker threads" );
+		return 1;
+	}
 
-	if ( setupServer ( &server, port ) ) {
+	if ( setupEventLoop () || setupServer () ) {
 		logMessage ( LOG_ERROR_LEVEL, "_smsa_server:Failed to properly set up the server" );
 		return 1;
 	}
@@ -89,39 +98,115 @@ int server ( int port ) {
 	serverShutdown = 0;
 	while ( !serverShutdown ) {
 	
-		logMessage ( LOG_INFO_LEVEL, "Now Waiting for Data to Come In..");
+		//The event loop waits for new connections, for parked connections
+		//to send their request, and for deadlines to expire. Connections
+		//only reach a worker once they have data to read
+		if ( waitForEvents ( acceptClients ) ) {
+			logMessage ( LOG_ERROR_LEVEL, "_smsa_server:Failed to wait for events [%s]", strerror(errno) );
+			return 1;
+		}
+
+		//The event loop is the only thread that publishes a config, so
+		//it reloads between rounds of events
+		if ( configReload ) {
+			configReload = 0;
+			reloadConfig();
+		}
+	}
+
+	//Shutting down the server
+	logMessage ( LOG_INFO_LEVEL, "Shutting Down the Server..." );
+	closeListeners();
+	stopIoPool();
+	stopMicrocache();
+	stopEvents();
+	stopWorkers ( backlog, MAX_THREADS );
+	stopCapture();
+	stopWarmup();
+	stopUpstreamChecks();
+	closeEventLoop();
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : acceptClients
+// Description  : Accept every pending connection on the listener, run it
+//		  through admission control and park it in the event loop
+//
+// Inputs       : server - listening socket file handle
+//		  flags - LISTEN_ flags of the listener
+// Outputs      : 0 if successful, 1 if failure
 
+int acceptClients ( int server, int flags ) {
+
+	struct sockaddr_storage clientAddress;  //holds client address
+	char addressName[INET6_ADDRSTRLEN];	//printable client address
+	int client;			   //file handle for the client
+	socklen_t inet_len;
+	char peek;			   //first byte of a deferred connection's request
+	CLIENT_CONN *conn;		   //state handed to the worker threads
+	int admission;			   //result of admission control
+
+	while ( !serverShutdown ) {
 
-		//The select data function will use the select API to wait for data from
-		//the new connection to come in. Once it detects that there is available data
-		//to read, the process will continue
-		if ( selectData ( server, 1 ) ) {
-			logMessage ( LOG_ERROR_LEVEL, "_smsa_server:Failed to select data [%s]", strerror(errno) );
+		//Accept the connection to the NEW requesting client. We always accept,
+		//so that overload is answered with a 503 instead of silently piling up
+		//in the kernel's listen queue
+		inet_len = sizeof( clientAddress );
+		if ( (client = accept ( server, (struct sockaddr*)&clientAddress, &inet_len)) == -1 ) {
+			if ( errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR )
+				return 0;
+			if ( errno == ECONNABORTED || errno == EMFILE || errno == ENFILE ) {
+				logMessage( LOG_WARNING_LEVEL, "_acceptClients:Failed to accept connection [%s]", strerror(errno) );
+				return 0;
+			}
+			logMessage( LOG_ERROR_LEVEL, "_acceptClients:Failed to accept connection [%s]", strerror(errno) );
 			return 1;
 		}
-		if ( areThreadsMaxedOut( MAX_THREADS) ) {
-		
-			//Accept the connection to the NEW requesting client
-			inet_len = sizeof( clientAddress );
-			if ( (client = accept ( server, (struct sockaddr*)&clientAddress, &inet_len)) == -1 ) {
-				logMessage( LOG_ERROR_LEVEL, "_smsa_server:Failed to accept connection [%s]", strerror(errno) );
-				return 1;
-			}
 
-			logMessage ( LOG_INFO_LEVEL, "New Client Connection Recieved [%s/%d]", inet_ntoa(clientAddress.sin_addr), clientAddress.sin_port ); 
+		if ( (conn = allocateConnection ( client, &clientAddress, inet_len )) == NULL ) {
+			close ( client );
+			continue;
+		}
+		countStat ( STAT_CONNECTIONS, 1 );
+		traceEvent ( "accepted", client );
+
+		if ( DEBUG )
+			logMessage ( LOG_INFO_LEVEL, "New Client Connection Recieved [%s]", connectionAddress ( conn, addressName, sizeof(addressName) ) ); 
+
+		//Connections over the global or per-address limits are turned away right here
+		if ( (admission = admitConnection ( conn )) != ADMIT_OK ) {
+			logMessage ( LOG_WARNING_LEVEL, "Rejecting %s, %s connection limit reached",
+					connectionAddress ( conn, addressName, sizeof(addressName) ),
+					( admission == ADMIT_SERVER_FULL ) ? "server" : "per address" );
+			if ( !( flags & LISTEN_TLS ) )		//There's no session to answer a TLS client with yet
+				rejectConnection ( conn, 503, RETRY_AFTER_SECONDS );
+			else
+				countStat ( STAT_REJECTED, 1 );
+			closeConnection ( conn );
+			continue;
+		}
 
-			pthread_create ( &backlog[findFreeThread(backlog, MAX_THREADS)].thread, NULL, processClient, (void *)&client );
-			
+		//The event loop runs the handshake before the connection reaches a worker
+		if ( ( flags & LISTEN_TLS ) && startTls ( conn ) ) {
+			closeConnection ( conn );
+			continue;
 		}
-		else {
-			waitForThreads ( backlog, MAX_THREADS );
-		
+
+		//Behind TCP_DEFER_ACCEPT or Fast Open the request is usually here
+		//already, and goes straight to a worker without a trip through epoll
+		if ( ( flags & LISTEN_DEFERRED ) && !( flags & LISTEN_TLS ) &&
+		     recv ( client, &peek, 1, MSG_PEEK | MSG_DONTWAIT ) == 1 ) {
+			dispatchConnection ( conn );
+			continue;
 		}
+
+		//Wait in the event loop, not a worker, for the request to arrive
+		if ( watchConnection ( conn ) )
+			closeConnection ( conn );
 	}
 
-	//Shutting down the server
-	logMessage ( LOG_INFO_LEVEL, "Shutting Down the Server..." );
-	close ( server );
 	return 0;
 }
 
@@ -130,60 +215,121 @@ int server ( int port ) {
 // Function     : processClient
 // Description  : Handles all client requests after a new connection comes in
 //
-// Inputs       : server - socket file handle
-// Outputs      : 0 if successful, -1 if failure
-void * processClient ( void * arg ) {
-	int ret = 0;
+// Inputs       : conn - the connection taken off the queue
+// Outputs      : 0 if successful, 1 if failure, CONN_SUSPENDED if the I/O
+//		  pool has the connection
+int processClient ( CLIENT_CONN *conn ) {
+	int retryAfter;				//Seconds until the client may send another request
 	int is_static;				//Boolean variable to hold the return of the parse_uri function
+	int status;				//HTTP status to fail the request with
 	struct stat sbuf;			//Helps determine size of file with stat function
 	char buf[MAXLINE];			//Holds the result of the readBytes function, which reads from the client
-	char method[MAXLINE];			//Part of the buf variable that holds the type of request ( GET )
-	char uri[MAXLINE];			//Part of the buf variable that holds the requested file's PATH	with arguements
-	char version[MAXLINE];			//Part of the buf which specifies the type of request ( HTTP/1.0 )
 	char filename[MAXLINE];			//Name of the requested file without the arguements
 	char cgiargs[MAXLINE];			//Arguements extracted from the uri ( cgiargs = uri - filename )
-
-	int *client = (int *)arg;
-
-	//The select data function will use the select API to wait for data from
-	//the new connection to come in. Once it detects that there is available data
-	//to read, the process will continue
-	if ( selectData ( *client, 1 ) ) {
-		logMessage ( LOG_ERROR_LEVEL, "_smsa_server:Failed to select data [%s]", strerror(errno) );
-		ret = 1;
-		pthread_exit( &ret);
-	}
-	
-	//Now that data has been selected to read, we will read it.
+	HTTP_REQUEST request;			//The request line and the headers we act on
+	REQUEST_BODY body;			//Framing of the request body, if there is one
+	REQUEST_HANDLER handler;		//In-process handler for the uri, if there is one
+	const BUNDLE_ENTRY *entry;		//The file in the host's asset bundle, if it is bundled
+	int found;				//What stat returned, 0 or -1
+
+	int *client = &conn->fd;
+
+	//A request suspended for the I/O pool picks up where it left off
+	if ( conn->pending != NULL )
+		return resumeRequest ( conn );
+
+	//An HTTP/2 session carries on where it left off, or starts right
+	//away when ALPN picked h2
+	if ( conn->http2 != NULL )
+		return serveHttp2 ( conn );
+	if ( conn->websocket != NULL )
+		return serveWebSocket ( conn );
+	if ( conn->protocol == PROTOCOL_HTTP2 )
+		return startHttp2 ( conn, "", NULL );
+
+	//The event loop only dispatches connections with data to read, so we
+	//read it right away, under the header deadline it armed.
 	//This part of the read will be the initial request header from
 	//the client of the format: method uri version. 
         if ( (readBytes( *client, MAXLINE, buf ) == -1 )) {
 		logMessage ( LOG_INFO_LEVEL, "No data was read from new client... Closing connection" );
-		ret = 1;
-		pthread_exit(&ret);
+		return 1;
 	}
 
-	logMessage ( LOG_INFO_LEVEL, "Client Request is = %s", buf );
+	traceEvent ( "request", *client );
+	if ( DEBUG )
+		logMessage ( LOG_INFO_LEVEL, "Client Request is = %s", buf );
+
+	//A client with prior knowledge opens with the HTTP/2 preface instead
+	if ( !strcmp ( buf, HTTP2_PREFACE_LINE ) )
+		return startHttp2 ( conn, buf, NULL );
+	countStat ( STAT_REQUESTS, 1 );
+
+	//Every request spends a token from its address's bucket. Clients
+	//over their rate are told when to come back instead of being served
+	if ( admitRequest ( conn, &retryAfter ) ) {
+		logMessage ( LOG_WARNING_LEVEL, "Client is over its request rate. 429 error" );
+		rejectConnection ( conn, 429, retryAfter );
+		return 1;
+	}
+	captureRequestLine ( conn, buf );
 
         //Now that we have the initial request fromt the client, we will parse 
-	//it into three different, USABLE strings
-        sscanf ( buf, "%s %s %s", method, uri, version );
-
-        //Confirm that it is a "GET" request. If it is not, deny the
-	//the client request
-        if ( strcasecmp( method, ( "GET" ) ) ) {
-                logMessage ( LOG_INFO_LEVEL, "We do not implement the %s function. 501 error", method );
-                ret = 1;
-		pthread_exit( &ret );
-        }
+	//it into three different, USABLE strings, and confirm that it is a
+	//method we implement. If it is not, deny the client request
+	if ( (status = parseRequestLine ( buf, &request )) ) {
+		sendErrorResponse ( *client, status, errorReason ( status ), NULL );
+		return 1;
+	}
 
-	//Now we will read the headers of the request, if it is of the
-	//HTTP/1.1. If it is not, there are no headers, so we will not 
-	//attempt to read them. Right now, we do nothing with the headers
-	//but this function provides future capabilites dealing with these
-	//headers
-        if ( !strcmp ( version, "HTTP/1.1" ) )
-                read_request_hdrs ( *client );
+	//Now we will read the headers of the request. Only a bare HTTP/0.9
+	//style request line has no headers following it. We keep the ones
+	//that frame the request body and describe the request
+        if ( request.version[0] != '\0' && (status = read_request_hdrs ( *client, &request )) ) {
+		sendErrorResponse ( *client, status, ( status == 431 ) ?
+				"Request Header Fields Too Large" : "Bad Request", NULL );
+		return 1;
+	}
+
+	//A sampled request is recorded as it arrived, for replaying later
+	finishCapture ( &request );
+
+	//The Host header picks the site, and with it the docroot and limits.
+	//Requests without one go to the default host
+	request.vhost = findVirtualHost ( conn->config->hosts, request.host );
+
+	//A uri has to be a path from the root before anything routes on it.
+	//Anything else, an empty path included, would be glued onto the
+	//docroot's own name
+	if ( request.uri[0] != '/' ) {
+		logMessage ( LOG_WARNING_LEVEL, "Rejecting uri that doesn't start with /. 400 error" );
+		sendErrorResponse ( *client, 400, "Bad Request", NULL );
+		return 1;
+	}
+	//Never let a path climb out of the document root
+	if ( !uri_is_safe ( request.uri ) ) {
+		logMessage ( LOG_WARNING_LEVEL, "Rejecting uri with a .. segment. 400 error" );
+		sendErrorResponse ( *client, 400, "Bad Request", NULL );
+		return 1;
+	}
+
+	//An h2c upgrade is answered as the first stream of an HTTP/2 session,
+	//and a WebSocket upgrade switches for good on routes that have one
+	if ( canUpgradeHttp2 ( conn, &request ) )
+		return startHttp2 ( conn, "", &request );
+	if ( isWebSocketUpgrade ( &request ) )
+		return startWebSocket ( conn, &request );
+
+	//In-process handlers get first pick of the uri, and take over the
+	//rest of the request, body included
+	if ( (handler = findHandler ( request.uri )) != NULL ) {
+		if ( (status = startRequestBody ( &body, *client, &request )) ) {
+			sendErrorResponse ( *client, status, errorReason ( status ), NULL );
+			return 1;
+		}
+		armDeadline ( conn, hasRequestBody ( &body ) ? CONN_BODY : CONN_SEND );
+		return handler ( conn, &request, &body );
+	}
 
         //Call the parse_uri function to extract the filename and
 	//arguements from the uri we recieved in the request. This 
@@ -191,94 +337,379 @@ void * processClient ( void * arg ) {
 	//any arguements with it. The return of the parse_uri function
 	//tells us whether it is static or dynamic data that has been 
 	//requested
-        is_static = parse_uri ( uri, filename, cgiargs );
+        if ( (is_static = parse_uri ( request.vhost, request.uri, filename, cgiargs )) == -1 ) {
+		sendErrorResponse ( *client, 414, "URI Too Long", NULL );
+		return 1;
+	}
+
+	//A bundled file comes straight out of the mapped bundle, without
+	//touching the filesystem
+	if ( is_static && request.vhost->bundle != NULL &&
+	     (entry = findBundleEntry ( request.vhost->bundle, filename + docrootLength ( request.vhost ) )) != NULL ) {
+		if ( !strcasecmp ( request.method, "POST" ) || !strcasecmp ( request.method, "PUT" ) ) {
+			logMessage ( LOG_INFO_LEVEL, "Can't %s a static file. 405 error", request.method );
+			sendErrorResponse ( *client, 405, "Method Not Allowed", "Allow: GET, HEAD\r\n" );
+			return 1;
+		}
+		armDeadline ( conn, CONN_SEND );
+		return serveBundleEntry ( *client, request.vhost->bundle, entry, &request,
+				!strcasecmp ( request.method, "HEAD" ) ) ? 1 : 0;
+	}
 
 	//Use the stat function to find the needed information of the file 
 	//that was requested. This will give us the permissions as well as,
-	//more importantly, the size of the file. Also if the stat function 
-	//returns less than zero, we know that the file doesn't exist.
-        if ( stat(filename, &sbuf) < 0 ) {
+	//more importantly, the size of the file. A file the kernel would
+	//have to go to the disk for is looked up by the I/O pool instead,
+	//and the request picks up again in serveFile once it is done
+	if ( (found = lookupFile ( filename, &sbuf )) == IO_WOULD_BLOCK ) {
+		if ( suspendRequest ( conn, &request, filename, cgiargs, is_static, NULL, IO_LOOKUP ) == 0 )
+			return CONN_SUSPENDED;
+		found = ( stat ( filename, &sbuf ) ) ? -1 : 0;
+	}
+
+	return serveFile ( conn, &request, filename, cgiargs, is_static, &sbuf, found, 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : serveFile
+// Description  : Serve a request for a file from the docroot, once it has
+//		  been looked up
+//
+// Inputs       : conn - the connection
+//		  request - the parsed request
+//		  filename - the file, with its docroot
+//		  cgiargs - arguments for a CGI program
+//		  is_static - parse_uri's verdict, 1 for static content
+//		  sbuf - what stat said about the file
+//		  found - what stat returned, 0 or -1
+//		  paged - 1 if the I/O pool just read the file into the page cache
+// Outputs      : 0 if successful, 1 if failure, CONN_SUSPENDED if the I/O
+//		  pool has the connection
+int serveFile ( CLIENT_CONN *conn, HTTP_REQUEST *request, char *filename, char *cgiargs,
+		int is_static, struct stat *sbuf, int found, int paged ) {
+	int ret = 0;
+	int status;				//HTTP status to fail the request with
+	char buf[MAXLINE];			//Location header of a redirect
+	REQUEST_BODY body;			//Framing of the request body, if there is one
+
+	//If the stat function failed, we know that the file doesn't exist.
+        if ( found < 0 ) {
+		//A directory with no index page gets a listing of its entries
+		//instead, as json when asked for with ?format=json
+		if ( request->vhost->autoindex && is_static && request->uri[0] && request->uri[strlen(request->uri)-1] == '/' &&
+		     ( !strcasecmp ( request->method, "GET" ) || !strcasecmp ( request->method, "HEAD" ) ) ) {
+			armDeadline ( conn, CONN_SEND );
+			return serveDirectoryListing ( conn->fd, request->vhost, request->uri,
+					( !strcmp ( cgiargs, "format=json" ) ) ? AUTOINDEX_JSON : AUTOINDEX_HTML,
+					!strcasecmp ( request->method, "HEAD" ) ) ? 1 : 0;
+		}
                 logMessage ( LOG_ERROR_LEVEL, "the %s file could not be found", filename );
-		ret = 1;
-                pthread_exit(&ret);
+		sendErrorResponse ( conn->fd, 404, "Not Found", NULL );
+                return 1;
         }
 
         //Here we will use macros, and the result of the stat function stored in sbuf, to
 	//determine if the file is a regular file. Meaning that the file is not a directory,
 	//or anything like that
         if ( is_static ) {	//Static Content
-                if ( !(S_ISREG( sbuf.st_mode )) || !(S_IRUSR & sbuf.st_mode ) ) {
+		//Send directories to their trailing slash form, where relative
+		//links and the index page or listing work
+		if ( S_ISDIR( sbuf->st_mode ) ) {
+			snprintf ( buf, sizeof(buf), "Location: %.900s/\r\n", request->uri );
+			sendErrorResponse ( conn->fd, 301, "Moved Permanently", buf );
+			return 0;
+		}
+                if ( !(S_ISREG( sbuf->st_mode )) || !(S_IRUSR & sbuf->st_mode ) ) {
                         logMessage ( LOG_ERROR_LEVEL, "Can't read the file. 403 ERROR");
-                        ret = 1;
-			pthread_exit(&ret);
+			sendErrorResponse ( conn->fd, 403, "Forbidden", NULL );
+                        return 1;
                 }
-		//Send static data
-                serve_static( *client, filename, sbuf.st_size );
+		//Files can only be read, bodies go to CGI programs and handlers
+		if ( !strcasecmp ( request->method, "POST" ) || !strcasecmp ( request->method, "PUT" ) ) {
+			logMessage ( LOG_INFO_LEVEL, "Can't %s a static file. 405 error", request->method );
+			sendErrorResponse ( conn->fd, 405, "Method Not Allowed", "Allow: GET, HEAD\r\n" );
+			return 1;
+		}
+		//A file that isn't in the page cache would hold the worker while
+		//it sends. The I/O pool reads it in first
+		if ( !paged && strcasecmp ( request->method, "HEAD" ) && probeFile ( filename, sbuf->st_size ) == IO_WOULD_BLOCK &&
+		     suspendRequest ( conn, request, filename, cgiargs, is_static, sbuf, IO_PAGE_IN ) == 0 )
+			return CONN_SUSPENDED;
+		//Send static data, as long as the client keeps up with the minimum rate.
+		//HEAD only needs what stat already told us, the file is never opened.
+		//What is served is what the next start warms up
+		countWarmupHit ( filename );
+		armDeadline ( conn, CONN_SEND );
+                if ( serve_static( conn, filename, sbuf, !strcasecmp ( request->method, "HEAD" ), request->vhost->sendRate ) )
+			return 1;
         }
         else {		       //Dynamic Content
 
-                if ( !(S_ISREG( sbuf.st_mode )) || !(S_IXUSR & sbuf.st_mode ) ) {
+                if ( !(S_ISREG( sbuf->st_mode )) || !(S_IXUSR & sbuf->st_mode ) ) {
                         logMessage ( LOG_ERROR_LEVEL, "Can't read the file. 403 ERROR");
-                        ret = 1;
-			pthread_exit( &ret );
+			sendErrorResponse ( conn->fd, 403, "Forbidden", NULL );
+                        return 1;
                 }
-		//Send dynamic data
-                serve_dynamic( *client, filename, cgiargs );
+		if ( (status = startRequestBody ( &body, conn->fd, request )) ) {
+			sendErrorResponse ( conn->fd, status, errorReason ( status ), NULL );
+			return 1;
+		}
+		//Send dynamic data. The body, if any, is streamed to the CGI program
+		//under the body rate deadline. The CGI child writes to the socket
+		//itself, so there are no transfer counts to enforce a send rate on
+		if ( hasRequestBody ( &body ) )
+			armDeadline ( conn, CONN_BODY );
+		else
+			clearDeadline ( conn );
+		//Repeated GETs are answered from the micro-cache, or wait on the
+		//one request already running the program
+		if ( (ret = serveCachedResponse ( conn, request, filename, cgiargs )) == -1 )
+			ret = serve_dynamic( conn->fd, filename, cgiargs, request, &body );
         }
 
 	buf[0] = '\0';
 			
-	//Done with the request, now close it
-	logMessage( LOG_INFO_LEVEL, "Closing client connection" );
-        close( *client );
+	//Done with the request, the worker closes the connection
+	if ( DEBUG )
+		logMessage( LOG_INFO_LEVEL, "Closing client connection" );
+	return ret;
 
-	pthread_exit (&ret);
+}
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : suspendRequest
+// Description  : Set a request aside while the I/O pool looks its file up,
+//		  or reads it in. The connection comes back to a worker, and
+//		  processClient, when the pool is done.
+//
+// Inputs       : conn - the connection
+//		  request - the parsed request
+//		  filename - the file, with its docroot
+//		  cgiargs - arguments for a CGI program
+//		  is_static - parse_uri's verdict
+//		  sbuf - what stat said about the file, NULL for IO_LOOKUP
+//		  job - IO_ job for the pool
+// Outputs      : 0 if successful, -1 if the request has to be served now
+int suspendRequest ( CLIENT_CONN *conn, HTTP_REQUEST *request, char *filename, char *cgiargs,
+		int is_static, struct stat *sbuf, int job ) {
+
+	PENDING_REQUEST *pending;
+
+	if ( (pending = malloc ( sizeof(PENDING_REQUEST) )) == NULL )
+		return -1;
+	pending->request = *request;
+	snprintf ( pending->filename, MAXLINE, "%s", filename );
+	snprintf ( pending->cgiargs, MAXLINE, "%s", cgiargs );
+	pending->isStatic = is_static;
+	pending->job = job;
+	pending->found = ( sbuf != NULL ) ? 0 : -1;
+	if ( sbuf != NULL )
+		pending->sbuf = *sbuf;
+
+	//Waiting on the disk isn't the client's fault, so the header deadline
+	//stops. serveFile arms the next one
+	clearDeadline ( conn );
+	conn->pending = pending;
+	if ( submitLookup ( conn ) ) {
+		conn->pending = NULL;
+		free ( pending );
+		return -1;
+	}
+	traceEvent ( "suspended", conn->fd );
+	if ( DEBUG )
+		logMessage ( LOG_INFO_LEVEL, "Waiting on the disk for %s", filename );
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : resumeRequest
+// Description  : Finish a request the I/O pool has looked the file up, or
+//		  read it in, for
+//
+// Inputs       : conn - the connection
+// Outputs      : 0 if successful, 1 if failure
+int resumeRequest ( CLIENT_CONN *conn ) {
+
+	PENDING_REQUEST *pending = conn->pending;
+	int ret;
+
+	conn->pending = NULL;
+	traceEvent ( "resumed", conn->fd );
+	ret = serveFile ( conn, &pending->request, pending->filename, pending->cgiargs,
+			pending->isStatic, &pending->sbuf, pending->found, 1 );
+	free ( pending );
+	return ret;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : read_request_hdrs
-// Description  : read the hdrs from the request
+// Description  : read the hdrs from the request, keeping the ones we act on
 //
 // Inputs       : client - socket file handle
-// Outputs      : 0 if successful, -1 if failure
-int read_request_hdrs ( int client ) {
+//		  request - the request to fill in
+// Outputs      : 0 if successful, or the HTTP status to fail the request with
+int read_request_hdrs ( int client, HTTP_REQUEST *request ) {
 
 	char buf[MAXLINE];
-	int count = 0;
+	int count = 0, rb, status;
 
-	while ( (readBytes ( client, MAXLINE, buf )) != -2 && count < MAX_NUM_OF_HEADER_LINES) {
+	while ( (rb = readBytes ( client, MAXLINE, buf )) != -2 ) {
+		if ( rb != 0 ) {
+			logMessage ( LOG_INFO_LEVEL, "Client went away before the end of the headers" );
+			return 400;
+		}
+		if ( ++count > MAX_NUM_OF_HEADER_LINES ) {
+			logMessage ( LOG_INFO_LEVEL, "More than %d header lines. 431 error", MAX_NUM_OF_HEADER_LINES );
+			return 431;
+		}
 		logMessage ( LOG_INFO_LEVEL, "%s", buf );
-		count++;
+		captureHeaderLine ( buf );
+		if ( (status = parse_request_hdr ( buf, request )) )
+			return status;
+	}
+
+	//A body framed both ways is how requests get smuggled past proxies
+	if ( request->chunked && request->contentLength >= 0 ) {
+		logMessage ( LOG_INFO_LEVEL, "Both Content-Length and chunked. 400 error" );
+		return 400;
 	}
 	
 	buf[0] = '\0';
-	logMessage ( LOG_INFO_LEVEL, "%s", buf );
 	return 0;
 
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : parse_request_hdr
+// Description  : pick the value out of a header line we act on
+//
+// Inputs       : line - the header line as read, with its line ending
+//		  request - the request to fill in
+// Outputs      : 0 if successful, or the HTTP status to fail the request with
+int parse_request_hdr ( char *line, HTTP_REQUEST *request ) {
+
+	char *value, *end;
+	int len;
+
+	//Split "Name: value\r\n" and trim the value
+	if ( (value = strchr ( line, ':' )) == NULL )
+		return 400;
+	*value++ = '\0';
+	while ( *value == ' ' || *value == '\t' )
+		value++;
+	len = strlen ( value );
+	while ( len > 0 && ( value[len-1] == '\r' || value[len-1] == '\n' || value[len-1] == ' ' ) )
+		value[--len] = '\0';
+
+	//Validators and encodings matter to bundles, and still go to the proxy
+	if ( !strcasecmp ( line, "If-None-Match" ) )
+		snprintf ( request->ifNoneMatch, sizeof(request->ifNoneMatch), "%s", value );
+	else if ( !strcasecmp ( line, "Accept-Encoding" ) )
+		request->acceptGzip = headerHasToken ( value, "gzip" );
+
+	if ( !strcasecmp ( line, "Content-Length" ) ) {
+		request->contentLength = strtoll ( value, &end, 10 );
+		if ( end == value || *end != '\0' || request->contentLength < 0 )
+			return 400;
+	}
+	else if ( !strcasecmp ( line, "Transfer-Encoding" ) ) {
+		if ( strcasecmp ( value, "chunked" ) )
+			return 400;
+		request->chunked = 1;
+	}
+	else if ( !strcasecmp ( line, "Expect" ) )
+		request->expectContinue = !strcasecmp ( value, "100-continue" );
+	else if ( !strcasecmp ( line, "Content-Type" ) )
+		snprintf ( request->contentType, sizeof(request->contentType), "%s", value );
+	else if ( !strcasecmp ( line, "Host" ) )
+		snprintf ( request->host, sizeof(request->host), "%s", value );
+	else if ( !strcasecmp ( line, "Upgrade" ) )
+		snprintf ( request->upgrade, sizeof(request->upgrade), "%s", value );
+	else if ( !strcasecmp ( line, "HTTP2-Settings" ) )
+		snprintf ( request->http2Settings, sizeof(request->http2Settings), "%s", value );
+	else if ( !strcasecmp ( line, "Sec-WebSocket-Key" ) )
+		snprintf ( request->websocketKey, sizeof(request->websocketKey), "%s", value );
+	else if ( !strcasecmp ( line, "Sec-WebSocket-Version" ) )
+		snprintf ( request->websocketVersion, sizeof(request->websocketVersion), "%s", value );
+
+	//Everything else that isn't hop-by-hop is kept whole for the proxy
+	else if ( strcasecmp ( line, "Connection" ) && strcasecmp ( line, "Keep-Alive" ) &&
+		  strcasecmp ( line, "Proxy-Connection" ) && strcasecmp ( line, "Proxy-Authorization" ) &&
+		  strcasecmp ( line, "TE" ) && strcasecmp ( line, "Trailer" ) ) {
+		len = snprintf ( request->passed + request->passedLength, MAX_PASSED_HEADERS - request->passedLength,
+				"%s: %s\r\n", line, value );
+		if ( len >= MAX_PASSED_HEADERS - request->passedLength ) {
+			logMessage ( LOG_INFO_LEVEL, "More than %d bytes of headers. 431 error", MAX_PASSED_HEADERS );
+			request->passed[request->passedLength] = '\0';
+			return 431;
+		}
+		request->passedLength += len;
+	}
+
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : parseRequestLine
+// Description  : Start a request from its request line
+//
+// Inputs       : line - the request line as read
+//		  request - the request to fill in, cleared first
+// Outputs      : 0 if successful, or the HTTP status to fail it with
+int parseRequestLine ( char *line, HTTP_REQUEST *request ) {
+
+	memset ( request, 0, sizeof(HTTP_REQUEST) );
+	request->contentLength = -1;
+        if ( sscanf ( line, "%s %s %s", request->method, request->uri, request->version ) < 2 )
+		return 400;
+
+        if ( strcasecmp( request->method, "GET" ) && strcasecmp( request->method, "HEAD" ) &&
+	     strcasecmp( request->method, "POST" ) && strcasecmp( request->method, "PUT" ) ) {
+                logMessage ( LOG_INFO_LEVEL, "We do not implement the %s function. 501 error", request->method );
+                return 501;
+        }
+	return 0;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : parse_uri
 // Description  : read the uri, and find the filename and the cgiargs
 //
-// Inputs       : uri - string to decipher
+// Inputs       : host - virtual host whose docroot the uri is under
+//		  uri - string to decipher
 //		  filename - string to place the filename in
 //		  cgiargs - string to hold the arguements
-// Outputs      : 0 if dynamic , 1 if static
-int parse_uri ( char *uri, char *filename, char *cgiargs ) {
+// Outputs      : 0 if dynamic , 1 if static, -1 if the filename is too long
+int parse_uri ( VIRTUAL_HOST *host, char *uri, char *filename, char *cgiargs ) {
 
 	char *ptr;
+	int rootLength = docrootLength ( host );
 	
+	//The docroot and the path are joined with exactly one slash
+	while ( uri[0] == '/' && uri[1] == '/' )
+		uri++;
+
 	//Check if the content is static or dynamic
-	if ( !strstr ( uri, "cgi-bin" ) ) {	//Static Content
-		strcpy ( cgiargs, "" );				//No Arguements
-		strcpy ( filename, ".." );			//Adds the dot to denote current directory
-		strcat ( filename, uri );			//Places the "/blah.blah" on top of the dot
-		if ( uri[strlen(uri)-1] == '/' )
-			strcat ( filename, "pages/index.html");	//if the uri ends in a slash, add home.html
+	if ( strncmp ( uri, host->cgiPrefix, strlen(host->cgiPrefix) ) ) {	//Static Content
+		ptr = index( uri, '?');				//Arguements aren't part of the file name
+		if ( ptr ) {
+			strcpy ( cgiargs, ptr+1 );
+			*ptr = '\0';
+		}
+		else
+			strcpy ( cgiargs, "" );			//No Arguements
+		//Places the "/blah.blah" on top of the docroot, and if the uri
+		//ends in a slash, adds the index page
+		if ( snprintf ( filename, MAXLINE, "%.*s/%s%s", rootLength, host->docroot, ( uri[0] == '/' ) ? uri + 1 : uri,
+				( uri[0] && uri[strlen(uri)-1] == '/' ) ? "pages/index.html" : "" ) >= MAXLINE )
+			return -1;
 		logMessage ( LOG_INFO_LEVEL, "Filename = %s", filename );
 		return 1;					//return as static
 	}
@@ -291,8 +722,8 @@ int parse_uri ( char *uri, char *filename, char *cgiargs ) {
 		else 
 			strcpy ( cgiargs, "");
 		
-		strcpy ( filename, "" );
-		strcat ( filename, uri );
+		if ( snprintf ( filename, MAXLINE, "%.*s/%s", rootLength, host->docroot, ( uri[0] == '/' ) ? uri + 1 : uri ) >= MAXLINE )
+			return -1;				//CGI programs live under the same root
 		return 0;					//return as dynamic
 	}
 	
@@ -300,44 +731,193 @@ int parse_uri ( char *uri, char *filename, char *cgiargs ) {
 				
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : uri_is_safe
+// Description  : check that no segment of the uri's path is ".."
+//
+// Inputs       : uri - the request uri
+// Outputs      : 1 if safe, 0 if not
+int uri_is_safe ( char *uri ) {
+
+	char *seg = uri;
+	int len;
+
+	while ( *seg && *seg != '?' ) {
+		len = strcspn ( seg, "/?" );
+		if ( len == 2 && seg[0] == '.' && seg[1] == '.' )
+			return 0;
+		seg += len;
+		if ( *seg == '/' )
+			seg++;
+	}
+	return 1;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : serve_static
 // Description  : send the static response to the client
 //
-// Inputs       : client - socket file handle
+// Inputs       : conn - the client connection
 //		  filename - name of the file to read
-//		  filesize - size of the file
-// Outputs      : 0 if successful, -1 if failure
-int serve_static ( int client, char *filename, int filesize ) {
-
-	int srcfd;			//file descriptor for our requested file
-	char *srcp;			//pointer to the memory mapped data we dynamically allocate
+//		  sbuf - what stat said about the file
+//		  headOnly - send only the headers, for a HEAD request
+//		  rate - bytes per second the body may use, 0 for no limit
+// Outputs      : 0 if successful, -1 if failure, with the connection to close
+int serve_static ( CLIENT_CONN *conn, char *filename, struct stat *sbuf, int headOnly, long rate ) {
+
+	int client = conn->fd;		//socket file handle
+	int filesize = sbuf->st_size;	//size of the file
+	int headLength;			//length of the headers in buf
+	struct stat opened;		//what fstat said about the file we read
+	int srcfd = -1;			//file descriptor for our requested file
+	int ret = 0;
 	char  filetype[MAXLINE];	//String containting the type of file, so send to the client
 	char  buf[MAXBUF];		//variable to hold the compiled data to be sent
+	off_t offset = 0;		//how much of the file sendfile has sent
+	ssize_t sent;
+	size_t slice;			//bytes the shaper lets us send next
+	SHAPED_TRANSFER transfer;	//pacing and bulk scheduling of the body
 	
 	//Send response headers to client
 	get_filetype ( filename, filetype);
-	sprintf (buf, "HTTP/1.0 200 OK\r\n" );
-	sprintf (buf, "%sServer: Gabe Harms Web Server\r\n", buf );
-	sprintf (buf, "%sContent-length: %d\r\n", buf, filesize );
-	sprintf (buf, "%sContent-type: %s\r\n\r\n", buf, filetype );		//the extra \r\n is explicit and neccessary
-	sendBytes ( client, strlen(buf), buf);					//Send the header to the client
-
-	logMessage ( LOG_INFO_LEVEL, "Header sent to browser" );
-
-	//Send response body to client
-	srcfd = open( filename, O_RDONLY, 0 );					//open the file in read-only format
-	srcp = mmap ( 0, filesize, PROT_READ, MAP_PRIVATE, srcfd, 0 );		//memory map the file, and have srcp point to it
-	close ( srcfd );							//close the file
-	sendBytes ( client, filesize, srcp );					//Send the file content to the client
-	munmap ( srcp, filesize );						//Unallocate the memory for the file
-
-	//Reset values
-	buf[0] = '\0';
-	filetype[0] = '\0';
-	srcp = NULL;
-	return 0;
+	headLength = formatStaticHeaders ( buf, filesize, filetype );
+
+	//Small files go out right behind the header in a single write. They
+	//come from the cache every worker process shares, and a miss reads
+	//the file and puts it there
+	if ( !headOnly && filesize <= SHARED_CACHE_FILE_MAX ) {
+		if ( !sharedCacheFetch ( filename, sbuf, buf + headLength ) )
+			return ( sendBytes ( client, headLength + filesize, buf ) ) ? -1 : 0;
+		if ( readSmallFile ( filename, &opened, buf + headLength, filesize ) == filesize ) {
+			sharedCacheStore ( filename, &opened, buf + headLength, filesize );
+			return ( sendBytes ( client, headLength + filesize, buf ) ) ? -1 : 0;
+		}
+	}
+
+	//The file may have gone since it was stat'd. Until the header is out
+	//the client can still be told so
+	if ( !headOnly && (srcfd = open( filename, O_RDONLY | O_CLOEXEC, 0 )) == -1 ) {	//open the file in read-only format
+		logMessage ( LOG_ERROR_LEVEL, "_serve_static:Can't open %s [%s]", filename, strerror(errno) );
+		sendErrorResponse ( client, 404, "Not Found", NULL );
+		return -1;
+	}
+
+	if ( sendBytes ( client, headLength, buf ) ) {				//Send the header to the client
+		if ( !headOnly )
+			close ( srcfd );
+		return -1;
+	}
+
+	if ( DEBUG )
+		logMessage ( LOG_INFO_LEVEL, "Header sent to browser" );
+
+	//HEAD gets exactly the headers GET would, and nothing else
+	if ( headOnly )
+		return 0;
+
+	//Send response body to client. sendfile moves the file from the page cache
+	//to the socket without a copy, and kTLS encrypts it in the kernel. Only
+	//TLS the kernel couldn't take needs the file read and encrypted here, a
+	//buffer at a time, so a file that shrinks ends the response early
+	//instead of faulting. Either way it goes in the slices the bandwidth
+	//shaper hands out, and a body cut short closes the connection
+	startTransfer ( &transfer, conn, rate, filesize );
+	if ( canSendDirect ( client ) ) {
+		while ( offset < filesize ) {
+			slice = nextSlice ( &transfer, filesize - offset );
+			if ( (sent = sendfile ( client, srcfd, &offset, slice )) <= 0 ) {
+				sliceSent ( &transfer, 0 );
+				if ( sent == -1 && errno == EINTR )
+					continue;
+				logMessage ( LOG_ERROR_LEVEL, "_serve_static:sendfile failed [%s]", ( sent ) ? strerror(errno) : "file shrank" );
+				ret = -1;
+				break;
+			}
+			sliceSent ( &transfer, sent );
+			countTransfer ( client, 0, sent );
+		}
+	}
+	else {
+		while ( offset < filesize ) {
+			slice = nextSlice ( &transfer, ( filesize - offset < (off_t)sizeof(buf) ) ? filesize - offset : (off_t)sizeof(buf) );
+			if ( (sent = pread ( srcfd, buf, slice, offset )) <= 0 ) {
+				sliceSent ( &transfer, 0 );
+				if ( sent == -1 && errno == EINTR )
+					continue;
+				logMessage ( LOG_ERROR_LEVEL, "_serve_static:read failed [%s]", ( sent ) ? strerror(errno) : "file shrank" );
+				ret = -1;
+				break;
+			}
+			if ( sendBytes ( client, sent, buf ) ) {
+				sliceSent ( &transfer, 0 );
+				ret = -1;
+				break;
+			}
+			sliceSent ( &transfer, sent );
+			offset += sent;
+		}
+	}
+	finishTransfer ( &transfer );
+	close ( srcfd );
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : formatStaticHeaders
+// Description  : write the response headers for a static file
+//
+// Inputs       : buf - place to put them, MAXBUF bytes
+//		  filesize - length of the file
+//		  filetype - its content type
+// Outputs      : length of the headers
+int formatStaticHeaders ( char *buf, int filesize, char *filetype ) {
+
+	int length;
+
+	length = snprintf ( buf, MAXBUF, "HTTP/1.0 200 OK\r\n"
+			"Server: Gabe Harms Web Server\r\n"
+			"Content-length: %d\r\n"
+			"Content-type: %s\r\n\r\n",		//the extra \r\n is explicit and neccessary
+			filesize, filetype );
+	if ( length < 0 )
+		return 0;
+	return ( length < MAXBUF ) ? length : MAXBUF - 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : readSmallFile
+// Description  : read a whole file that is expected to be a certain size
+//
+// Inputs       : filename - name of the file to read
+//		  opened - place to put what fstat said about the file
+//		  data - place to put its contents, at least len bytes
+//		  len - expected size of the file
+// Outputs      : bytes read, or -1 if the file couldn't be read or isn't len bytes
+int readSmallFile ( char *filename, struct stat *opened, char *data, int len ) {
+
+	int fd, done = 0;
+	ssize_t rb;
+
+	if ( (fd = open ( filename, O_RDONLY | O_CLOEXEC )) == -1 )
+		return -1;
+	if ( fstat ( fd, opened ) || opened->st_size != len ) {
+		close ( fd );
+		return -1;
+	}
+	while ( done < len ) {
+		if ( (rb = read ( fd, data + done, len - done )) <= 0 ) {
+			if ( rb == -1 && errno == EINTR )
+				continue;
+			break;
+		}
+		done += rb;
+	}
+	close ( fd );
+	return ( done == len ) ? done : -1;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -364,39 +944,280 @@ void get_filetype ( char *filename, char *filetype ) {
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : serve_dynamic
-// Description  : send the dynamic response to the client
+// Description  : send the dynamic response to the client. The CGI program
+//		  writes the rest of the response straight to the socket, and
+//		  any request body is streamed to its stdin through a pipe, one
+//		  bounded chunk at a time. A pipe write blocks while the program
+//		  isn't reading, which in turn stops us reading from the client.
+//		  When the socket needs TLS done in user space, the program's
+//		  output comes back through a second pipe to be encrypted here.
 //
 // Inputs       : client - socket file handle
-//                filename - name of the file to read
-//                filesize - size of the file
+//                filename - name of the program to run
+//                cgiargs - query string for the program
+//		  request - the parsed request
+//		  body - framing of the request body
 // Outputs      : 0 if successful, -1 if failure
-int serve_dynamic ( int client, char *filename, char *cgiargs ) {
-
-	char buf[MAXLINE];
-	//char *emptylist[] = { NULL };
+int serve_dynamic ( int client, char *filename, char *cgiargs, HTTP_REQUEST *request, REQUEST_BODY *body ) {
+
+	char buf[BODY_CHUNK_SIZE];
+	char query[MAXLINE + 16], method[MAXLINE + 16], length[64], type[MAXLINE + 16];
+	char *envp[] = { query, method, length, type, "SERVER_SOFTWARE=" SERVER_NAME, "GATEWAY_INTERFACE=CGI/1.1", NULL };
+	char *argv[] = { filename, NULL };
+	int toChild[2] = { -1, -1 };		//pipe carrying the body to the program's stdin
+	int fromChild[2] = { -1, -1 };		//pipe carrying the program's output, when it is relayed
+	int streaming = hasRequestBody ( body );
+	int relay = !canSendDirect ( client );
+	int rb, ret = 0;
+	pid_t pid;
+
+	//Build the CGI variables before forking, the child only execs. A chunked
+	//body has no length up front, so the program reads stdin to end of file
+	snprintf ( query, sizeof(query), "QUERY_STRING=%s", cgiargs );
+	snprintf ( method, sizeof(method), "REQUEST_METHOD=%s", request->method );
+	if ( request->contentLength >= 0 )
+		snprintf ( length, sizeof(length), "CONTENT_LENGTH=%lld", (long long)request->contentLength );
+	else
+		snprintf ( length, sizeof(length), "CONTENT_LENGTH=" );
+	snprintf ( type, sizeof(type), "CONTENT_TYPE=%s", request->contentType );
+
+	if ( ( streaming && pipe ( toChild ) == -1 ) || ( relay && pipe ( fromChild ) == -1 ) ) {
+		logMessage ( LOG_ERROR_LEVEL, "_serve_dynamic:Failed to create the program's pipes [%s]", strerror(errno) );
+		sendErrorResponse ( client, 500, "Internal Server Error", NULL );
+		if ( streaming && toChild[0] != -1 ) {
+			close ( toChild[0] );
+			close ( toChild[1] );
+		}
+		return -1;
+	}
 
 	//Return first part of HTTP response
-	sprintf ( buf, "HTTP/1.0 200 OK\r\n" );
-	sendBytes ( client, strlen(buf), buf );
-	sprintf( buf, "Server: Gabe Harms Web Server" );
+	sprintf ( buf, "HTTP/1.0 200 OK\r\nServer: " SERVER_NAME "\r\n" );
 	sendBytes ( client, strlen(buf), buf );
 	
-	if ( fork() == 0 ) { //Child
-		//A real server would set all the CGI vars here
-		setenv ( "QUERY_STRING", cgiargs, 1);
-		dup2( client, STDOUT_FILENO);		//redirect stdout to client
-		//Here is where you put your dynmaic function and call it like so
-		//execve ( filename, emptylist, environ );	
+	if ( (pid = fork()) == 0 ) { //Child
+		if ( streaming ) {
+			dup2 ( toChild[0], STDIN_FILENO );	//read the body from stdin
+			close ( toChild[0] );
+			close ( toChild[1] );
+		}
+		if ( relay ) {
+			dup2 ( fromChild[1], STDOUT_FILENO );	//output comes back to us
+			close ( fromChild[0] );
+			close ( fromChild[1] );
+		}
+		else
+			dup2( client, STDOUT_FILENO);		//redirect stdout to client
+		execve ( filename, argv, envp );
+		_exit ( 1 );
+	}
+	if ( pid == -1 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_serve_dynamic:Failed to fork [%s]", strerror(errno) );
+		ret = -1;
 	}
-	wait ( NULL );
 
-	return 0;
+	if ( relay ) {
+		close ( fromChild[1] );
+		if ( streaming )
+			close ( toChild[0] );
+		if ( pid != -1 )
+			relayProgramOutput ( client, ( streaming ) ? toChild[1] : -1, fromChild[0], body );
+		else if ( streaming )
+			close ( toChild[1] );
+		close ( fromChild[0] );
+	}
+	else if ( streaming ) {
+		close ( toChild[0] );
+
+		//Pump the body across. If the program exits without reading all
+		//of it the write fails with EPIPE, and we stop
+		while ( pid != -1 && (rb = readRequestBody ( body, buf, sizeof(buf) )) > 0 ) {
+			if ( sendBytes ( toChild[1], rb, buf ) )
+				break;
+		}
+		close ( toChild[1] );
+	}
+
+	if ( pid != -1 )
+		waitpid ( pid, NULL, 0 );
+
+	return ret;
 }
 
 
 
 
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : relayProgramOutput
+// Description  : Move a CGI program's output to the client while feeding it
+//		  the request body. The body pipe is non-blocking, so a program
+//		  that answers before it has read all of its input can't stall
+//		  us on either pipe.
+//
+// Inputs       : client - socket file handle
+//		  toChild - write end of the program's stdin, -1 without a body
+//		  fromChild - read end of the program's stdout
+//		  body - framing of the request body
+// Outputs      : 0 if successful, -1 if failure
+int relayProgramOutput ( int client, int toChild, int fromChild, REQUEST_BODY *body ) {
+
+	char in[BODY_CHUNK_SIZE], out[BODY_CHUNK_SIZE];
+	struct pollfd fds[2];
+	int pending = 0, offset = 0, n, ret = 0;
+
+	if ( toChild != -1 )
+		fcntl ( toChild, F_SETFL, fcntl ( toChild, F_GETFL ) | O_NONBLOCK );
+
+	while ( 1 ) {
+		//Only pull more of the body once the program took the last chunk
+		if ( toChild != -1 && pending == 0 ) {
+			offset = 0;
+			if ( (pending = readRequestBody ( body, in, sizeof(in) )) <= 0 ) {
+				pending = 0;
+				close ( toChild );
+				toChild = -1;
+			}
+		}
+
+		fds[0].fd = toChild;			//poll skips it once it is -1
+		fds[0].events = POLLOUT;
+		fds[1].fd = fromChild;
+		fds[1].events = POLLIN;
+		if ( poll ( fds, 2, -1 ) == -1 ) {
+			if ( errno == EINTR )
+				continue;
+			ret = -1;
+			break;
+		}
+
+		if ( fds[0].revents ) {
+			if ( (n = write ( toChild, in + offset, pending )) > 0 ) {
+				offset += n;
+				pending -= n;
+			}
+			else if ( errno != EAGAIN ) {	//The program stopped reading
+				pending = 0;
+				close ( toChild );
+				toChild = -1;
+			}
+		}
+		if ( fds[1].revents ) {
+			if ( (n = read ( fromChild, out, sizeof(out) )) <= 0 )
+				break;			//The program is done
+			if ( sendBytes ( client, n, out ) ) {
+				ret = -1;
+				break;
+			}
+		}
+	}
+
+	if ( toChild != -1 )
+		close ( toChild );
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sendErrorResponse
+// Description  : send a complete error response with a short html body
+//
+// Inputs       : client - socket file handle
+//		  status - HTTP status code
+//		  reason - reason phrase for the status line
+//		  headers - extra header lines, each ending in \r\n (may be NULL)
+// Outputs      : 0 if successful, -1 if failure
+int sendErrorResponse ( int client, int status, const char *reason, const char *headers ) {
+
+	char body[MAXLINE];
+	char buf[MAXLINE * 2];
+	int len;
+
+	len = errorPage ( body, sizeof(body), status, reason );
+	snprintf ( buf, sizeof(buf), "HTTP/1.0 %d %s\r\n"
+			"Server: " SERVER_NAME "\r\n"
+			"%s"
+			"Content-length: %d\r\n"
+			"Content-type: text/html\r\n\r\n%s",
+			status, reason, ( headers ) ? headers : "", len, body );
+
+	return sendBytes ( client, strlen(buf), buf );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : errorPage
+// Description  : write the short html body sent with an error status
+//
+// Inputs       : buf - place to write the page
+//		  size - size of buf
+//		  status - HTTP status code
+//		  reason - reason phrase for the status
+// Outputs      : length of the page
+int errorPage ( char *buf, int size, int status, const char *reason ) {
+
+	int len = snprintf ( buf, size, "<html><title>%d %s</title><body>%d %s</body></html>\r\n",
+			status, reason, status, reason );
+
+	return ( len < size ) ? len : size - 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : headerHasToken
+// Description  : check a comma separated header value for a token, like
+//		  "h2c" in Upgrade or "gzip" in Accept-Encoding. Parameters
+//		  after a ';' are ignored.
+//
+// Inputs       : value - the header value
+//		  token - the token, matched without case
+// Outputs      : 1 if it is there, 0 if not
+int headerHasToken ( const char *value, const char *token ) {
+
+	int len = strlen ( token ), span;
+
+	while ( *value ) {
+		value += strspn ( value, " \t," );
+		span = strcspn ( value, " \t,;" );
+		if ( span == len && !strncasecmp ( value, token, len ) )
+			return 1;
+		value += span;
+		value += strcspn ( value, "," );
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : errorReason
+// Description  : reason phrase for the error statuses we send
+//
+// Inputs       : status - HTTP status code
+// Outputs      : the reason phrase
+const char * errorReason ( int status ) {
+
+	switch ( status ) {
+	case 301: return "Moved Permanently";
+	case 400: return "Bad Request";
+	case 403: return "Forbidden";
+	case 404: return "Not Found";
+	case 405: return "Method Not Allowed";
+	case 411: return "Length Required";
+	case 413: return "Payload Too Large";
+	case 414: return "URI Too Long";
+	case 429: return "Too Many Requests";
+	case 431: return "Request Header Fields Too Large";
+	case 502: return "Bad Gateway";
+	case 501: return "Not Implemented";
+	case 503: return "Service Unavailable";
+	case 504: return "Gateway Timeout";
+	default:  return "Internal Server Error";
+	}
+}
+
+
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : readBytes
@@ -415,27 +1236,32 @@ int readBytes ( int server, int len, char *block ) {
 	//Run until all bytes have been read which is when the amount
 	//of bytes that have been read ( readBytes ) is no longer less then
 	//the amount of bytes total that need to be read ( len ).
-	for ( i = 0; i < len; i++ ) {
+	for ( i = 0; i < len - 1; i++ ) {
 
 		//Read byte into "block", at the index of readBytes, from the socket ( server ). 
 		//The readBytes allows us to move across the "block" so that we don't read over stuff
 		//on the "block". rb will contain the amount of bytes that were able to be read. We wish for
 		//this to be the entire len variable, but it might not be ready for us to read the first time.
 		//This loop will allow us to continue reading until we have read the amount of bytes in len.
-		if ( ( rb = read( server, &temp[i], 1 ) ) < 0 ) { //Reading Error
+		if ( ( rb = connRead( server, &temp[i], 1 ) ) < 0 ) { //Reading Error
 			logMessage( LOG_ERROR_LEVEL, "_readBytes:Failed to read a byte [%s]", strerror(errno) );
 			return 1;
 		}
-		else if ( rb == 0 && i == 0 ) {			//No data read 
-			logMessage ( LOG_INFO_LEVEL, "No Data read" );
-			return -1;
+		else if ( rb == 0 ) {
+			if ( i == 0 ) {				//No data read 
+				logMessage ( LOG_INFO_LEVEL, "No Data read" );
+				return -1;
+			}
+			break;					//Closed mid line ( Keep what we have )
 		}
+		countTransfer ( server, rb, 0 );
 		if ( temp[i] == '\n' ) {			//Found line break ( No Action required )
-			if ( temp[i-1] == '\r' && i == 1) {  	//Found end of a request line ( Return, but copy first )
-				strcpy ( block, temp );		
-				block[i+1] = '\0';
+			if ( i == 1 && temp[0] == '\r' ) {  	//Found end of a request line ( Return, but copy first )
+				memcpy ( block, temp, 2 );
+				block[2] = '\0';
 				return -2;
 			}
+			i++;					//Keep the line break
 			break;
 		}
 	}
@@ -443,10 +1269,9 @@ int readBytes ( int server, int len, char *block ) {
 	if ( DEBUG )
 		logMessage ( LOG_INFO_LEVEL, "Successfully Read [%d] Bytes", i );
 	
-	strcpy ( block, temp);
-
-	//reset temp
-	block[i+1] = '\0';
+	//Copy the line out, always terminated and never longer than len
+	memcpy ( block, temp, i );
+	block[i] = '\0';
 	return 0;
 
 }
@@ -471,7 +1296,7 @@ int sendBytes ( int server, int len, char *buf ) {
 	while ( sentBytes < len ) {
 
 		// Read the bytes and check for error
-		if ( (sb = write(server, &buf[sentBytes], len-sentBytes)) < 0 ) {
+		if ( (sb = connWrite(server, &buf[sentBytes], len-sentBytes)) < 0 ) {
 	    		logMessage( LOG_ERROR_LEVEL, "SMSA send bytes failed : [%s]", strerror(errno) );
 	    		return( -1 );
 			}
@@ -485,6 +1310,7 @@ int sendBytes ( int server, int len, char *buf ) {
 
 			// Now process what we read
 			sentBytes += sb;
+			countTransfer ( server, 0, sb );
 	    	}
 
 
@@ -542,19 +1368,18 @@ int selectData ( int sock, int wait ) {
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : setUpServer
-// Description  : Sets up the server by creating the socket, binding it to the right addresss
-//		  and starts the server listening. It then sets the server input equal to the
-//		  socket file handler.
+// Description  : Sets up the server by installing its signal handlers, then
+//		  opening its listeners and starting the event loop watching them.
 //
-// Inputs       : int - server file handler
-// Outputs      : 0 if successful, -1 if failure
+// Inputs       : none
+// Outputs      : 0 if successful, 1 if failure
 
-int setupServer ( int *server, int port ) {
+int setupServer ( void ) {
 
 
 	struct sigaction sigINT;   	   //holds the sigINT signal handler
-	struct sockaddr_in serverAddress;  //holds server addres
-	int optionValue = 1;		   //holds the value for setsocketopt function call
+	struct sigaction sigHUP;	   //holds the sigHUP signal handler
+	struct sigaction sigPIPE;	   //holds the sigPIPE disposition
 
 
 	//Set signal handler
@@ -562,59 +1387,31 @@ int setupServer ( int *server, int port ) {
 	//that we would like by having our smsa_signal_handler be called on reception
 	//of a SIGINT from the OS, rather than the default handler
 	sigINT.sa_handler = signalHandler;
+	sigemptyset ( &sigINT.sa_mask );
 	sigINT.sa_flags = SA_NODEFER | SA_ONSTACK;
 	sigaction ( SIGINT, &sigINT, NULL );
 
+	//SIGHUP reloads the config
+	memset ( &sigHUP, 0, sizeof(sigHUP) );
+	sigHUP.sa_handler = reloadHandler;
+	sigemptyset ( &sigHUP.sa_mask );
+	sigaction ( SIGHUP, &sigHUP, NULL );
 
-	//Create the socket
-	//Set up a socket using TCP protocol ( SOCK_STREAM ), and the address family 
-	//version of inet, while setting the server variable to the file handle
-	if ( ( *server = socket ( AF_INET, SOCK_STREAM, 0 ) ) == -1 ) {
-		logMessage( LOG_ERROR_LEVEL, "_setUpServer:Failed to set up the socket [%s]", strerror(errno) );
-		return 1;
-	}
+	//Ignore SIGPIPE. A deadline shutting down a socket, or a client going
+	//away mid response, must fail the write instead of killing the server
+	memset ( &sigPIPE, 0, sizeof(sigPIPE) );
+	sigPIPE.sa_handler = SIG_IGN;
+	sigaction ( SIGPIPE, &sigPIPE, NULL );
 
-	logMessage( LOG_INFO_LEVEL, "Socket Successfully Initialized. Socket File Handle = %d", *server );
-	
-	//Set the socket to be reusable. 
-	//The setsockopt will allow us to change options of our socket which is 
-	//specified with our file handle, server.
-	if ( setsockopt ( *server, SOL_SOCKET, SO_REUSEADDR, &optionValue, sizeof(optionValue) ) != 0 ) {
-		logMessage ( LOG_ERROR_LEVEL, "_setUpServer:setsockopt failed to make the local address reusable [%s]", strerror(errno) );
-		return 1;
-	}
 
-	if ( DEBUG )
-		logMessage ( LOG_INFO_LEVEL, "Socket Set Up To Reuse Addresses" );
-
-	logMessage ( LOG_INFO_LEVEL, "Port = %d", port );
-
-	//Set up server address
-	serverAddress.sin_family = AF_INET;
-	serverAddress.sin_port = htons( (unsigned short )port );
-	serverAddress.sin_addr.s_addr = htonl( INADDR_ANY );
-
-
-	//bind the server to the socket. bind the server file handle to 
-	//the address we have initialized
-	if ( bind ( *server, (struct sockaddr*)&serverAddress, sizeof( struct sockaddr) ) == -1 ) {
-		logMessage ( LOG_ERROR_LEVEL, "_setUpServer:Failure to bind the server to the socket [%s]", strerror(errno) );
-		return 1;
-	}
-	
-	if ( DEBUG )
-		logMessage ( LOG_INFO_LEVEL, "Socket Is Now Bound To Any Address");
-
-	//listen for connections
-	if ( listen ( *server, SMSA_MAX_BACKLOG ) == -1 ) {
-		logMessage ( LOG_ERROR_LEVEL, "_setUpServer:Failure to properly listen [%s]", strerror(errno) );
+	//Open the listeners, binding each to its address with its options.
+	//Unix sockets were opened before any worker was forked
+	if ( openListeners () ) {
+		logMessage ( LOG_ERROR_LEVEL, "_setUpServer:Failed to open the listeners" );
 		return 1;
 	}
-	
-	logMessage ( LOG_INFO_LEVEL, "Socket Is Now Listening Queueing %d Connections", SMSA_MAX_BACKLOG );
 
-
-	logMessage ( LOG_INFO_LEVEL, "Server Has Now Been Successfully Setup on port %d", port );
+	logMessage ( LOG_INFO_LEVEL, "Server Has Now Been Successfully Setup with %d listeners", countListeners ( 0 ) );
 	return 0;
 
 }
@@ -637,3 +1434,15 @@ void signalHandler ( int signal ) {
 
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : reloadHandler
+// Description  : Handles a SIGHUP by asking the event loop to reload the config
+//
+// Inputs       : signal - the signal received
+// Outputs      : none
+void reloadHandler ( int signal ) {
+
+	(void)signal;
+	configReload = 1;
+}
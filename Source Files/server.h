@@ -0,0 +1,86 @@
+#ifndef SERVER_INCLUDED
+#define SERVER_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server.h
+//  Description   : Shared limits and prototypes for the request processing
+//                  functions in server.c, so the thread and admission modules
+//                  can answer clients without going through processClient.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#include <sys/stat.h>
+#include <server_conn.h>
+#include <server_vhost.h>
+#include <server_build.h>
+
+#define MAXLINE 1000
+#define MAXBUF 100000
+#define MAX_NUM_OF_HEADER_LINES 50
+#define MAX_PASSED_HEADERS 8192
+#define MAX_THREADS 5
+
+#define SERVER_NAME "Gabe Harms Web Server"
+
+//
+// Type Definitions
+
+typedef struct http_request {
+	char method[MAXLINE];		//GET, HEAD, POST or PUT
+	char uri[MAXLINE];		//requested path with arguements
+	char version[MAXLINE];		//HTTP/1.0 or HTTP/1.1, empty for HTTP/0.9
+	int64_t contentLength;		//Content-Length, -1 if there was none
+	int chunked;			//Transfer-Encoding: chunked
+	int expectContinue;		//Expect: 100-continue
+	char contentType[MAXLINE];	//Content-Type, passed on to CGI programs
+	char host[MAXLINE];		//Host
+	VIRTUAL_HOST *vhost;		//The virtual host the Host header names
+	char upgrade[MAXLINE];		//Upgrade, h2c asks to switch to HTTP/2
+	char http2Settings[MAXLINE];	//HTTP2-Settings sent along with the h2c upgrade
+	char websocketKey[MAXLINE];	//Sec-WebSocket-Key, hashed into the handshake answer
+	char websocketVersion[16];	//Sec-WebSocket-Version
+	char ifNoneMatch[MAXLINE];	//If-None-Match, ETags of the client's cached copies
+	int acceptGzip;			//Accept-Encoding includes gzip
+	char passed[MAX_PASSED_HEADERS];	//End-to-end headers we don't act on, for the proxy
+	int passedLength;
+} HTTP_REQUEST;
+
+struct request_body;
+
+//
+// Functional Prototypes
+
+int server ( void );
+int setupServer ( void );
+int acceptClients ( int server, int flags );
+int processClient ( CLIENT_CONN *conn );
+int serveFile ( CLIENT_CONN *conn, HTTP_REQUEST *request, char *filename, char *cgiargs,
+		int is_static, struct stat *sbuf, int found, int paged );
+int suspendRequest ( CLIENT_CONN *conn, HTTP_REQUEST *request, char *filename, char *cgiargs,
+		int is_static, struct stat *sbuf, int job );
+int resumeRequest ( CLIENT_CONN *conn );
+int read_request_hdrs ( int client, HTTP_REQUEST *request );
+int parse_request_hdr ( char *line, HTTP_REQUEST *request );
+int parseRequestLine ( char *line, HTTP_REQUEST *request );
+int parse_uri ( VIRTUAL_HOST *host, char *uri, char *filename, char *cgiargs );
+int uri_is_safe ( char *uri );
+int serve_static ( CLIENT_CONN *conn, char *filename, struct stat *sbuf, int headOnly, long rate );
+int formatStaticHeaders ( char *buf, int filesize, char *filetype );
+int readSmallFile ( char *filename, struct stat *opened, char *data, int len );
+void get_filetype ( char *filename, char *filetype );
+int serve_dynamic ( int client, char *filename, char *cgiargs, HTTP_REQUEST *request, struct request_body *body );
+int relayProgramOutput ( int client, int toChild, int fromChild, struct request_body *body );
+int sendErrorResponse ( int client, int status, const char *reason, const char *headers );
+int errorPage ( char *buf, int size, int status, const char *reason );
+int headerHasToken ( const char *value, const char *token );
+const char * errorReason ( int status );
+int readBytes ( int server, int len, char *block );
+int sendBytes ( int server, int len, char *block );
+int selectData ( int sock, int wait );
+void signalHandler ( int signal );
+void reloadHandler ( int signal );
+
+#endif
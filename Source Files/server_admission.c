@@ -0,0 +1,460 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_admission.c
+//  Description   : Admission control for the server. Every accepted connection
+//                  is checked against the global and per-address connection
+//                  limits, every request spends a token from its address's
+//                  bucket, and workers ask shouldDropQueued before serving a
+//                  connection that has been waiting in the queue.
+//
+//                  Per-address state lives in a hash table split into shards,
+//                  each with its own lock, so the accept loop and the workers
+//                  rarely contend on the same mutex.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+
+// Project Include Files
+#include <cmpsc311_log.h>
+#include <server.h>
+#include <server_admission.h>
+#include <server_http2.h>
+#include <server_shared.h>
+#include <server_config.h>
+
+//
+// Type Definitions
+
+typedef struct address_entry {
+	unsigned char key[17];			//address family followed by the address bytes
+	int connections;			//open connections from this address
+	double tokens;				//requests left in the token bucket
+	uint64_t lastRefill;			//monotonic time (ns) the bucket was last refilled
+	struct address_entry *next;		//next entry in the hash chain
+} ADDRESS_ENTRY;
+
+typedef struct address_shard {
+	pthread_mutex_t lock;
+	int entries;
+	ADDRESS_ENTRY *buckets[ADMISSION_BUCKETS];
+} ADDRESS_SHARD;
+
+// Global Variables
+ADDRESS_SHARD addressShards[ADMISSION_SHARDS];
+int openConnections = 0;
+pthread_mutex_t openConnectionsLock = PTHREAD_MUTEX_INITIALIZER;
+
+// CoDel state, shared by all the workers pulling from the connection queue
+pthread_mutex_t codelLock = PTHREAD_MUTEX_INITIALIZER;
+uint64_t codelFirstAbove = 0;		//when the delay may first be considered standing
+uint64_t codelDropNext = 0;		//when the next drop is due while dropping
+int codelDropping = 0;			//currently in the dropping state
+int codelDropCount = 0;			//drops since entering the dropping state
+
+//Functional Prototypes
+int addressKey ( CLIENT_CONN *conn, unsigned char *key );
+unsigned int hashKey ( unsigned char *key );
+ADDRESS_ENTRY * findAddress ( ADDRESS_SHARD *shard, unsigned int hash, unsigned char *key, uint64_t now, SERVER_CONFIG *config );
+void evictIdleAddresses ( ADDRESS_SHARD *shard, uint64_t now );
+void refillTokens ( ADDRESS_ENTRY *entry, uint64_t now, SERVER_CONFIG *config );
+uint64_t codelControlLaw ( uint64_t now, int count );
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : setupAdmission
+// Description  : Initialize the address table and counters
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+int setupAdmission ( void ) {
+
+	for ( int i = 0; i < ADMISSION_SHARDS; i++ ) {
+		if ( pthread_mutex_init ( &addressShards[i].lock, NULL ) ) {
+			logMessage ( LOG_ERROR_LEVEL, "_setupAdmission:Failed to initialize shard lock %d", i );
+			return -1;
+		}
+		addressShards[i].entries = 0;
+		memset ( addressShards[i].buckets, 0, sizeof(addressShards[i].buckets) );
+	}
+
+	openConnections = 0;
+	logMessage ( LOG_INFO_LEVEL, "Admission control ready: %ld connections, %ld per address, %ld req/s per address",
+			serverConfig()->maxConnections, serverConfig()->maxConnectionsPerIp, serverConfig()->requestRate );
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : admitConnection
+// Description  : Decide whether a freshly accepted connection may be queued,
+//		  and if so charge it against the global and per-address limits
+//
+// Inputs       : conn - the accepted connection
+// Outputs      : ADMIT_OK, ADMIT_SERVER_FULL or ADMIT_ADDRESS_FULL
+int admitConnection ( CLIENT_CONN *conn ) {
+
+	unsigned char key[17];
+	unsigned int hash;
+	ADDRESS_SHARD *shard;
+	ADDRESS_ENTRY *entry;
+	uint64_t now = monotonicTime();
+
+	//Check the global limit first, it doesn't need the table
+	pthread_mutex_lock ( &openConnectionsLock );
+	if ( openConnections >= conn->config->maxConnections ) {
+		pthread_mutex_unlock ( &openConnectionsLock );
+		return ADMIT_SERVER_FULL;
+	}
+	openConnections++;
+	pthread_mutex_unlock ( &openConnectionsLock );
+
+	//Unix domain peers have no address to limit on
+	if ( addressKey ( conn, key ) ) {
+		conn->admitted = 1;
+		return ADMIT_OK;
+	}
+
+	hash = hashKey ( key );
+	shard = &addressShards[hash % ADMISSION_SHARDS];
+
+	pthread_mutex_lock ( &shard->lock );
+	entry = findAddress ( shard, hash, key, now, conn->config );
+	if ( entry != NULL && entry->connections >= conn->config->maxConnectionsPerIp ) {
+		pthread_mutex_unlock ( &shard->lock );
+		pthread_mutex_lock ( &openConnectionsLock );
+		openConnections--;
+		pthread_mutex_unlock ( &openConnectionsLock );
+		return ADMIT_ADDRESS_FULL;
+	}
+	if ( entry != NULL )
+		entry->connections++;
+	pthread_mutex_unlock ( &shard->lock );
+
+	conn->admitted = 1;
+	return ADMIT_OK;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : releaseConnection
+// Description  : Give back the slots taken by admitConnection
+//
+// Inputs       : conn - the connection being closed
+// Outputs      : none
+void releaseConnection ( CLIENT_CONN *conn ) {
+
+	unsigned char key[17];
+	unsigned int hash;
+	ADDRESS_SHARD *shard;
+	ADDRESS_ENTRY *entry;
+
+	if ( !conn->admitted )
+		return;
+	conn->admitted = 0;
+
+	pthread_mutex_lock ( &openConnectionsLock );
+	openConnections--;
+	pthread_mutex_unlock ( &openConnectionsLock );
+
+	if ( addressKey ( conn, key ) )
+		return;
+
+	hash = hashKey ( key );
+	shard = &addressShards[hash % ADMISSION_SHARDS];
+
+	pthread_mutex_lock ( &shard->lock );
+	entry = shard->buckets[(hash / ADMISSION_SHARDS) % ADMISSION_BUCKETS];
+	while ( entry != NULL && memcmp ( entry->key, key, sizeof(entry->key) ) )
+		entry = entry->next;
+	if ( entry != NULL && entry->connections > 0 )
+		entry->connections--;
+	pthread_mutex_unlock ( &shard->lock );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : admitRequest
+// Description  : Spend one token from the address's bucket for a new request
+//
+// Inputs       : conn - the connection the request arrived on
+//		  retryAfter - set to the seconds until a token is available
+// Outputs      : 0 if the request may proceed, 1 if it is over the rate limit
+int admitRequest ( CLIENT_CONN *conn, int *retryAfter ) {
+
+	unsigned char key[17];
+	unsigned int hash;
+	ADDRESS_SHARD *shard;
+	ADDRESS_ENTRY *entry;
+	uint64_t now = monotonicTime();
+	int ret = 0;
+
+	*retryAfter = 0;
+	if ( addressKey ( conn, key ) )
+		return 0;
+
+	hash = hashKey ( key );
+	shard = &addressShards[hash % ADMISSION_SHARDS];
+
+	pthread_mutex_lock ( &shard->lock );
+	if ( (entry = findAddress ( shard, hash, key, now, conn->config )) != NULL ) {
+		refillTokens ( entry, now, conn->config );
+		if ( entry->tokens >= 1.0 )
+			entry->tokens -= 1.0;
+		else {
+			*retryAfter = (int)((1.0 - entry->tokens) / conn->config->requestRate) + 1;
+			ret = 1;
+		}
+	}
+	pthread_mutex_unlock ( &shard->lock );
+
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shouldDropQueued
+// Description  : CoDel style check run by a worker when it takes a connection
+//		  off the queue. Connections that waited past QUEUE_TIMEOUT_MS are
+//		  always dropped, since their clients have most likely given up.
+//		  Otherwise, once the queue delay has stayed above CODEL_TARGET_MS
+//		  for a whole CODEL_INTERVAL_MS, connections are dropped at an
+//		  increasing rate until the delay falls back under the target.
+//
+// Inputs       : conn - the connection just taken off the queue
+//		  now - current monotonic time (ns)
+//		  queueDepth - connections still waiting behind this one
+// Outputs      : 1 if the connection should be shed, 0 if it should be served
+int shouldDropQueued ( CLIENT_CONN *conn, uint64_t now, int queueDepth ) {
+
+	uint64_t sojourn = now - conn->enqueueTime;
+	uint64_t target = (uint64_t)CODEL_TARGET_MS * 1000000ULL;
+	uint64_t interval = (uint64_t)CODEL_INTERVAL_MS * 1000000ULL;
+	int drop = 0;
+
+	if ( sojourn > (uint64_t)QUEUE_TIMEOUT_MS * 1000000ULL )
+		return 1;
+
+	pthread_mutex_lock ( &codelLock );
+
+	//A short or empty queue means there is no standing delay
+	if ( sojourn < target || queueDepth == 0 ) {
+		codelFirstAbove = 0;
+		codelDropping = 0;
+		pthread_mutex_unlock ( &codelLock );
+		return 0;
+	}
+
+	if ( codelDropping ) {
+		if ( now >= codelDropNext ) {
+			drop = 1;
+			codelDropCount++;
+			codelDropNext = codelControlLaw ( codelDropNext, codelDropCount );
+		}
+	}
+	else if ( codelFirstAbove == 0 )
+		codelFirstAbove = now + interval;
+	else if ( now >= codelFirstAbove ) {
+		//Enter the dropping state, resuming near the previous rate if we
+		//were dropping only recently
+		drop = 1;
+		codelDropping = 1;
+		codelDropCount = ( codelDropCount > 2 && now - codelDropNext < 16 * interval ) ? codelDropCount - 2 : 1;
+		codelDropNext = codelControlLaw ( now, codelDropCount );
+	}
+
+	pthread_mutex_unlock ( &codelLock );
+	return drop;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : rejectConnection
+// Description  : Answer a connection that is not going to be served with an
+//		  error status and a Retry-After header
+//
+// Inputs       : conn - the connection to answer
+//		  status - 503 or 429
+//		  retryAfter - seconds the client should wait
+// Outputs      : 0 if successful, -1 if failure
+int rejectConnection ( CLIENT_CONN *conn, int status, int retryAfter ) {
+
+	char headers[64];
+
+	countStat ( STAT_REJECTED, 1 );
+
+	//An HTTP/2 session is turned away with GOAWAY instead
+	if ( conn->http2 != NULL )
+		return refuseHttp2 ( conn );
+
+	snprintf ( headers, sizeof(headers), "Retry-After: %d\r\n", retryAfter );
+	return sendErrorResponse ( conn->fd, status,
+			( status == 429 ) ? "Too Many Requests" : "Service Unavailable", headers );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : addressKey
+// Description  : Build the table key for the connection's peer address. An
+//		  IPv4 client reaching the dual-stack listener arrives as
+//		  ::ffff:a.b.c.d, and is keyed as the IPv4 address it is
+//
+// Inputs       : conn - the connection
+//		  key - 17 byte buffer for the key
+// Outputs      : 0 if successful, 1 if the address can't be limited
+int addressKey ( CLIENT_CONN *conn, unsigned char *key ) {
+
+	struct in6_addr *in6;
+
+	memset ( key, 0, 17 );
+	key[0] = (unsigned char)conn->address.ss_family;
+
+	if ( conn->address.ss_family == AF_INET ) {
+		memcpy ( &key[1], &((struct sockaddr_in *)&conn->address)->sin_addr, 4 );
+		return 0;
+	}
+	if ( conn->address.ss_family == AF_INET6 ) {
+		in6 = &((struct sockaddr_in6 *)&conn->address)->sin6_addr;
+		if ( IN6_IS_ADDR_V4MAPPED ( in6 ) ) {
+			key[0] = (unsigned char)AF_INET;
+			memcpy ( &key[1], &in6->s6_addr[12], 4 );
+			return 0;
+		}
+		memcpy ( &key[1], in6, 16 );
+		return 0;
+	}
+	return 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hashKey
+// Description  : FNV-1a hash of an address key
+//
+// Inputs       : key - 17 byte address key
+// Outputs      : the hash
+unsigned int hashKey ( unsigned char *key ) {
+
+	unsigned int hash = 2166136261u;
+
+	for ( int i = 0; i < 17; i++ ) {
+		hash ^= key[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : findAddress
+// Description  : Look up the entry for an address, creating it with a full
+//		  token bucket if it isn't there. The shard lock must be held.
+//
+// Inputs       : shard - the shard the key hashes to
+//		  hash - hash of the key
+//		  key - address key
+//		  now - current monotonic time (ns)
+//		  config - limits new entries start with
+// Outputs      : the entry, or NULL if it couldn't be created
+ADDRESS_ENTRY * findAddress ( ADDRESS_SHARD *shard, unsigned int hash, unsigned char *key, uint64_t now, SERVER_CONFIG *config ) {
+
+	int bucket = (hash / ADMISSION_SHARDS) % ADMISSION_BUCKETS;
+	ADDRESS_ENTRY *entry;
+
+	for ( entry = shard->buckets[bucket]; entry != NULL; entry = entry->next ) {
+		if ( !memcmp ( entry->key, key, sizeof(entry->key) ) )
+			return entry;
+	}
+
+	if ( shard->entries >= ADMISSION_MAX_ENTRIES )
+		evictIdleAddresses ( shard, now );
+	if ( shard->entries >= ADMISSION_MAX_ENTRIES ) {
+		//Fail open rather than refusing clients we can't track
+		logMessage ( LOG_WARNING_LEVEL, "_findAddress:Admission table shard is full" );
+		return NULL;
+	}
+
+	if ( (entry = calloc ( 1, sizeof(ADDRESS_ENTRY) )) == NULL )
+		return NULL;
+	memcpy ( entry->key, key, sizeof(entry->key) );
+	entry->tokens = config->requestBurst;
+	entry->lastRefill = now;
+	entry->next = shard->buckets[bucket];
+	shard->buckets[bucket] = entry;
+	shard->entries++;
+	return entry;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : evictIdleAddresses
+// Description  : Free entries with no open connections that haven't been
+//		  used in ADMISSION_IDLE_SECONDS. The shard lock must be held.
+//
+// Inputs       : shard - the shard to clean
+//		  now - current monotonic time (ns)
+// Outputs      : none
+void evictIdleAddresses ( ADDRESS_SHARD *shard, uint64_t now ) {
+
+	uint64_t idle = (uint64_t)ADMISSION_IDLE_SECONDS * 1000000000ULL;
+	ADDRESS_ENTRY **link, *entry;
+
+	for ( int i = 0; i < ADMISSION_BUCKETS; i++ ) {
+		link = &shard->buckets[i];
+		while ( (entry = *link) != NULL ) {
+			if ( entry->connections == 0 && now - entry->lastRefill > idle ) {
+				*link = entry->next;
+				free ( entry );
+				shard->entries--;
+			}
+			else
+				link = &entry->next;
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : refillTokens
+// Description  : Add the tokens earned since the last refill to the bucket
+//
+// Inputs       : entry - the address entry
+//		  now - current monotonic time (ns)
+//		  config - rate and burst to refill with
+// Outputs      : none
+void refillTokens ( ADDRESS_ENTRY *entry, uint64_t now, SERVER_CONFIG *config ) {
+
+	entry->tokens += (double)(now - entry->lastRefill) / 1000000000.0 * config->requestRate;
+	if ( entry->tokens > config->requestBurst )
+		entry->tokens = config->requestBurst;
+	entry->lastRefill = now;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : codelControlLaw
+// Description  : Time of the next drop, interval / sqrt(count) after t
+//
+// Inputs       : t - time (ns) to schedule from
+//		  count - drops so far in this dropping state
+// Outputs      : the next drop time
+uint64_t codelControlLaw ( uint64_t t, int count ) {
+
+	uint64_t interval = (uint64_t)CODEL_INTERVAL_MS * 1000000ULL;
+	uint64_t root = 1;
+
+	//Integer square root is plenty accurate for scheduling drops
+	while ( (root + 1) * (root + 1) <= (uint64_t)count )
+		root++;
+
+	return t + interval / root;
+}
@@ -0,0 +1,53 @@
+#ifndef SERVER_ADMISSION_INCLUDED
+#define SERVER_ADMISSION_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_admission.h
+//  Description   : Admission control for new connections and requests. Limits
+//                  total and per-address connections, rate limits requests per
+//                  address with token buckets, and decides when queued work is
+//                  too stale to be worth serving.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#include <stdint.h>
+#include <server_conn.h>
+
+//
+// Admission Limits. The config can change the connection, rate and shed
+// limits, these are their defaults
+
+#define MAX_CONNECTIONS 1024		//open client connections across the server
+#define MAX_CONNECTIONS_PER_IP 32	//open client connections from one address
+#define REQUEST_RATE_PER_IP 50		//requests per second refilled into each bucket
+#define REQUEST_BURST_PER_IP 100	//size of each token bucket
+#define QUEUE_SHED_DEPTH 64		//queued connections before new ones get an early 503
+#define CODEL_TARGET_MS 50		//acceptable standing queue delay
+#define CODEL_INTERVAL_MS 500		//how long the delay may stay above target before dropping
+#define QUEUE_TIMEOUT_MS 10000		//queued connections older than this are always dropped
+#define RETRY_AFTER_SECONDS 1		//Retry-After sent with a 503
+
+#define ADMISSION_SHARDS 16		//independently locked pieces of the address table
+#define ADMISSION_BUCKETS 256		//hash chains per shard
+#define ADMISSION_MAX_ENTRIES 4096	//addresses tracked per shard before idle ones are evicted
+#define ADMISSION_IDLE_SECONDS 60	//idle entries older than this may be evicted
+
+// Results of admitConnection
+#define ADMIT_OK 0
+#define ADMIT_SERVER_FULL 1
+#define ADMIT_ADDRESS_FULL 2
+
+//
+// Functional Prototypes
+
+int setupAdmission ( void );
+int admitConnection ( CLIENT_CONN *conn );
+void releaseConnection ( CLIENT_CONN *conn );
+int admitRequest ( CLIENT_CONN *conn, int *retryAfter );
+int shouldDropQueued ( CLIENT_CONN *conn, uint64_t now, int queueDepth );
+int rejectConnection ( CLIENT_CONN *conn, int status, int retryAfter );
+
+#endif
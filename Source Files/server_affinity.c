@@ -0,0 +1,365 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_affinity.c
+//  Description   : CPU and NUMA placement of the server's threads and memory.
+//                  Worker process n takes the n'th CPU of the -a list as its
+//                  home, wrapping around, and a single process server takes
+//                  the first. The home CPU's node is found in sysfs.
+//
+//                  Worker threads are created already restricted to the home
+//                  node's listed CPUs, so their stacks are first touched, and
+//                  allocated, on that node. The process also prefers that
+//                  node for every allocation, which keeps the connection
+//                  table, caches and buffers next to the threads using them.
+//                  The shared segment is the exception. Every process reads
+//                  it, so its pages are interleaved across all nodes instead.
+//
+//                  Memory policy is set with the raw system calls, so the
+//                  server doesn't need libnuma. Placement failures that only
+//                  cost speed are logged and ignored.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <dirent.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+
+// Project Include Files
+#include <cmpsc311_log.h>
+#include <server_affinity.h>
+
+// Global Variables
+int affinityCpus[AFFINITY_MAX_CPUS];	//the -a list, in order
+int affinityCount = 0;			//0 when nothing is pinned
+int steerIncoming = 0;			//set SO_INCOMING_CPU on listeners
+int exclusiveThreads = 0;		//worker threads given a CPU each, 0 to share the node's
+int homeIndex = 0;			//where the home CPU is in the list
+int homeCpu = -1;			//this process's home CPU, -1 until chosen
+int homeNode = 0;			//NUMA node of the home CPU
+cpu_set_t nodeCpus;			//listed CPUs on the home node, for worker threads
+
+//
+// Functional Prototypes
+
+int parseCpuList ( const char *list, int *cpus, int max );
+int cpuNode ( int cpu );
+int setMemoryPolicy ( int mode, int *nodes, int count, void *addr, size_t length );
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : setupAffinity
+// Description  : Take the CPUs the server may run on, and whether listeners
+//		  steer connections to the CPU that received them
+//
+// Inputs       : cpuList - CPUs like "0-7,16-23", or AFFINITY_ISOLATED, NULL
+//			to leave placement to the kernel
+//		  steer - 1 to set SO_INCOMING_CPU on listeners
+//		  exclusive - worker threads in each process to pin to a CPU
+//			each, 0 to let them share the node's CPUs
+// Outputs      : 0 if successful, -1 if failure
+int setupAffinity ( const char *cpuList, int steer, int exclusive ) {
+
+	char isolated[CPU_SETSIZE * 4];
+	cpu_set_t allowed;
+	FILE *file;
+
+	if ( cpuList == NULL ) {
+		if ( steer ) {
+			logMessage ( LOG_ERROR_LEVEL, "_setupAffinity:Steering connections needs a list of CPUs" );
+			return -1;
+		}
+		return 0;
+	}
+
+	//The kernel lists the CPUs isolcpus set aside, empty when there are none
+	if ( !strcmp ( cpuList, AFFINITY_ISOLATED ) ) {
+		if ( (file = fopen ( AFFINITY_ISOLATED_PATH, "r" )) == NULL || fgets ( isolated, sizeof(isolated), file ) == NULL ||
+		     isolated[0] == '\n' ) {
+			logMessage ( LOG_ERROR_LEVEL, "_setupAffinity:The kernel has no isolated CPUs" );
+			if ( file != NULL )
+				fclose ( file );
+			return -1;
+		}
+		fclose ( file );
+		cpuList = isolated;
+	}
+
+	if ( (affinityCount = parseCpuList ( cpuList, affinityCpus, AFFINITY_MAX_CPUS )) <= 0 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_setupAffinity:Bad list of CPUs %s", cpuList );
+		affinityCount = 0;
+		return -1;
+	}
+
+	//Only CPUs we are allowed to run on, or every pin would fail later
+	if ( sched_getaffinity ( 0, sizeof(allowed), &allowed ) == 0 ) {
+		for ( int i = 0; i < affinityCount; i++ ) {
+			if ( !CPU_ISSET ( affinityCpus[i], &allowed ) ) {
+				logMessage ( LOG_ERROR_LEVEL, "_setupAffinity:CPU %d isn't available to the server", affinityCpus[i] );
+				affinityCount = 0;
+				return -1;
+			}
+		}
+	}
+
+	steerIncoming = steer;
+	exclusiveThreads = exclusive;
+	if ( exclusive && affinityCount < exclusive + 1 )
+		logMessage ( LOG_WARNING_LEVEL, "Only %d CPUs for %d threads that spin, some will share", affinityCount, exclusive + 1 );
+	logMessage ( LOG_INFO_LEVEL, "Placing the server on %d CPUs%s%s", affinityCount,
+			( steer ) ? ", steering connections to the CPU that received them" : "",
+			( exclusive ) ? ", a CPU for each thread" : "" );
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : chooseHomeCpu
+// Description  : Pick this process's home CPU and node, and allocate its
+//		  memory from that node from now on. A worker process calls
+//		  it as soon as it is forked.
+//
+// Inputs       : slot - the worker's number, 0 for a single process server
+// Outputs      : none
+void chooseHomeCpu ( int slot ) {
+
+	if ( affinityCount == 0 )
+		return;
+
+	//A process whose threads each have a CPU takes a block of the list
+	homeIndex = ( slot * ( exclusiveThreads + 1 ) ) % affinityCount;
+	homeCpu = affinityCpus[homeIndex];
+	homeNode = cpuNode ( homeCpu );
+	CPU_ZERO ( &nodeCpus );
+	for ( int i = 0; i < affinityCount; i++ ) {
+		if ( cpuNode ( affinityCpus[i] ) == homeNode )
+			CPU_SET ( affinityCpus[i], &nodeCpus );
+	}
+
+	if ( setMemoryPolicy ( MPOL_PREFERRED, &homeNode, 1, NULL, 0 ) )
+		logMessage ( LOG_WARNING_LEVEL, "Can't prefer memory on node %d [%s]", homeNode, strerror(errno) );
+	logMessage ( LOG_INFO_LEVEL, "Home CPU is %d, on node %d with %d listed CPUs", homeCpu, homeNode, CPU_COUNT ( &nodeCpus ) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : pinEventLoop
+// Description  : Pin the calling thread, the one running the event loop and
+//		  accepting connections, to the home CPU
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+int pinEventLoop ( void ) {
+
+	cpu_set_t home;
+
+	if ( affinityCount == 0 )
+		return 0;
+	if ( homeCpu == -1 )
+		chooseHomeCpu ( 0 );
+
+	CPU_ZERO ( &home );
+	CPU_SET ( homeCpu, &home );
+	if ( (errno = pthread_setaffinity_np ( pthread_self (), sizeof(home), &home )) ) {
+		logMessage ( LOG_ERROR_LEVEL, "_pinEventLoop:Can't pin the event loop to CPU %d [%s]", homeCpu, strerror(errno) );
+		return -1;
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : workerThreadAffinity
+// Description  : Restrict a worker thread about to be created to the home
+//		  node's CPUs, or to its own CPU when the workers have one each
+//
+// Inputs       : attr - attributes the thread will be created with
+//		  index - the worker's number, -1 for a helper thread that
+//			never has a CPU of its own
+// Outputs      : 0 if successful, -1 if failure
+int workerThreadAffinity ( pthread_attr_t *attr, int index ) {
+
+	cpu_set_t own;
+
+	if ( affinityCount == 0 )
+		return 0;
+	if ( homeCpu == -1 )
+		chooseHomeCpu ( 0 );
+
+	if ( exclusiveThreads && index >= 0 ) {
+		CPU_ZERO ( &own );
+		CPU_SET ( affinityCpus[( homeIndex + 1 + index ) % affinityCount], &own );
+		if ( (errno = pthread_attr_setaffinity_np ( attr, sizeof(own), &own )) ) {
+			logMessage ( LOG_ERROR_LEVEL, "_workerThreadAffinity:Can't pin worker %d [%s]", index + 1, strerror(errno) );
+			return -1;
+		}
+		return 0;
+	}
+	if ( (errno = pthread_attr_setaffinity_np ( attr, sizeof(nodeCpus), &nodeCpus )) ) {
+		logMessage ( LOG_ERROR_LEVEL, "_workerThreadAffinity:Can't restrict workers to node %d [%s]", homeNode, strerror(errno) );
+		return -1;
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : steerListener
+// Description  : Ask the kernel to prefer this listener for connections whose
+//		  packets arrive on the home CPU. Among worker processes sharing
+//		  a port, that puts a connection on the CPU that is already
+//		  handling its interrupts and has its socket in cache.
+//
+// Inputs       : fd - the listening socket
+// Outputs      : 0 if successful, -1 if failure
+int steerListener ( int fd ) {
+
+	if ( !steerIncoming || homeCpu == -1 )
+		return 0;
+
+	if ( setsockopt ( fd, SOL_SOCKET, SO_INCOMING_CPU, &homeCpu, sizeof(homeCpu) ) ) {
+		logMessage ( LOG_ERROR_LEVEL, "_steerListener:Can't steer connections to CPU %d [%s]", homeCpu, strerror(errno) );
+		return -1;
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : interleaveMemory
+// Description  : Spread the pages of memory every process uses evenly over
+//		  the NUMA nodes, so no node's memory becomes the hot spot.
+//		  Must be called before the pages are first touched.
+//
+// Inputs       : addr - start of the memory, page aligned
+//		  length - its length
+// Outputs      : 0 if successful, -1 if failure
+int interleaveMemory ( void *addr, size_t length ) {
+
+	int nodes[AFFINITY_MAX_NODES], count;
+	char online[256];
+	FILE *file;
+
+	if ( affinityCount == 0 || (file = fopen ( "/sys/devices/system/node/online", "r" )) == NULL )
+		return 0;
+	count = ( fgets ( online, sizeof(online), file ) != NULL ) ?
+		parseCpuList ( online, nodes, AFFINITY_MAX_NODES ) : -1;
+	fclose ( file );
+	if ( count <= 1 )
+		return 0;
+
+	if ( setMemoryPolicy ( MPOL_INTERLEAVE, nodes, count, addr, length ) ) {
+		logMessage ( LOG_WARNING_LEVEL, "Can't interleave shared memory over %d nodes [%s]", count, strerror(errno) );
+		return -1;
+	}
+	logMessage ( LOG_INFO_LEVEL, "Interleaved shared memory over %d nodes", count );
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : setMemoryPolicy
+// Description  : Set the NUMA policy of the process, or of a range of memory
+//
+// Inputs       : mode - MPOL_ mode
+//		  nodes - the nodes the policy names
+//		  count - how many there are
+//		  addr - start of the range, NULL for the whole process
+//		  length - length of the range
+// Outputs      : 0 if successful, -1 if failure
+int setMemoryPolicy ( int mode, int *nodes, int count, void *addr, size_t length ) {
+
+	unsigned long mask[AFFINITY_MAX_NODES / ( 8 * sizeof(unsigned long) )];
+	int bits = 8 * sizeof(unsigned long);
+
+	memset ( mask, 0, sizeof(mask) );
+	for ( int i = 0; i < count; i++ ) {
+		if ( nodes[i] >= 0 && nodes[i] < AFFINITY_MAX_NODES )
+			mask[nodes[i] / bits] |= 1UL << ( nodes[i] % bits );
+	}
+
+	//The kernel takes one more than the number of bits in the mask
+	if ( addr == NULL )
+		return ( syscall ( SYS_set_mempolicy, mode, mask, AFFINITY_MAX_NODES + 1 ) ) ? -1 : 0;
+	return ( syscall ( SYS_mbind, addr, length, mode, mask, AFFINITY_MAX_NODES + 1, 0 ) ) ? -1 : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cpuNode
+// Description  : Find the NUMA node a CPU belongs to. Its sysfs directory
+//		  holds a nodeN link.
+//
+// Inputs       : cpu - the CPU
+// Outputs      : the node, 0 if it can't be found
+int cpuNode ( int cpu ) {
+
+	char path[64];
+	struct dirent *entry;
+	DIR *dir;
+	int node = 0;
+
+	snprintf ( path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu );
+	if ( (dir = opendir ( path )) == NULL )
+		return 0;
+	while ( (entry = readdir ( dir )) != NULL ) {
+		if ( sscanf ( entry->d_name, "node%d", &node ) == 1 )
+			break;
+	}
+	closedir ( dir );
+	return node;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : parseCpuList
+// Description  : Parse a list in the kernel's cpulist format, like "0-3,8"
+//
+// Inputs       : list - the list
+//		  cpus - place to put the numbers, in order
+//		  max - room in cpus, and one more than the highest number allowed
+// Outputs      : how many numbers there are, -1 if the list is bad
+int parseCpuList ( const char *list, int *cpus, int max ) {
+
+	long first, last;
+	char *end;
+	int count = 0;
+
+	while ( *list && *list != '\n' ) {
+		first = strtol ( list, &end, 10 );
+		if ( end == list || first < 0 )
+			return -1;
+		last = first;
+		if ( *end == '-' ) {
+			list = end + 1;
+			last = strtol ( list, &end, 10 );
+			if ( end == list || last < first )
+				return -1;
+		}
+		if ( last >= max || last >= CPU_SETSIZE || count + ( last - first + 1 ) > max )
+			return -1;
+		for ( long cpu = first; cpu <= last; cpu++ )
+			cpus[count++] = cpu;
+
+		list = end;
+		if ( *list == ',' )
+			list++;
+		else if ( *list && *list != '\n' )
+			return -1;
+	}
+	return count;
+}
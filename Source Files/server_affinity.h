@@ -0,0 +1,50 @@
+#ifndef SERVER_AFFINITY_INCLUDED
+#define SERVER_AFFINITY_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_affinity.h
+//  Description   : CPU and NUMA placement. Given a list of CPUs with -a, each
+//                  server process takes one of them as its home CPU, the one
+//                  its event loop and listeners run on. Its worker threads run
+//                  on the listed CPUs of the home CPU's NUMA node, and its
+//                  memory is allocated from that node. With -i, listeners also
+//                  set SO_INCOMING_CPU, so the kernel hands a connection to the
+//                  worker process whose home CPU received its packets.
+//
+//                  When the threads busy poll, sharing CPUs would have them
+//                  spin against each other, so each thread gets a CPU of its
+//                  own instead. Each process takes a block of the listed CPUs,
+//                  its home CPU and then one for each worker thread. The list
+//                  "isolated" takes the CPUs the kernel was booted to keep
+//                  other tasks off.
+//
+//                  Without -a nothing is pinned and the kernel places threads
+//                  and memory as it always has.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#include <stddef.h>
+#include <pthread.h>
+
+//
+// Constants
+
+#define AFFINITY_MAX_CPUS 1024			//CPUs in the -a list
+#define AFFINITY_MAX_NODES 64			//NUMA nodes we can place memory on
+#define AFFINITY_ISOLATED "isolated"		//CPU list meaning the kernel's isolated CPUs
+#define AFFINITY_ISOLATED_PATH "/sys/devices/system/cpu/isolated"
+
+//
+// Functional Prototypes
+
+int setupAffinity ( const char *cpuList, int steer, int exclusive );
+void chooseHomeCpu ( int slot );
+int pinEventLoop ( void );
+int workerThreadAffinity ( pthread_attr_t *attr, int index );
+int steerListener ( int fd );
+int interleaveMemory ( void *addr, size_t length );
+
+#endif
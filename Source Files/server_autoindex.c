@@ -0,0 +1,603 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_autoindex.c
+//  Description   : Renders and caches directory listings. A rendered listing is
+//                  kept along with the directory's device, inode and mtime, and
+//                  is reused for as long as a stat of the directory still
+//                  matches, so listing a large directory again costs one stat.
+//
+//                  Listings of directories modified within the last second are
+//                  not cached. An mtime can't tell apart two changes made in
+//                  the same clock tick, and one of them could be missed.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+
+// Project Include Files
+#include <cmpsc311_log.h>
+#include <server.h>
+#include <server_autoindex.h>
+
+// Escaping for names used in a link, next to AUTOINDEX_HTML and AUTOINDEX_JSON
+#define ESCAPE_HREF 2
+
+// Append a whole string to a TEXT_BUF
+#define appendString(buf, text) appendText ( (buf), (text), strlen(text) )
+
+//
+// Type Definitions
+
+struct linux_dirent64 {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+typedef struct dir_entry {
+	char *name;			//entry name, in the names arena
+	int isDir;			//entry is a directory
+} DIR_ENTRY;
+
+typedef struct text_buf {
+	char *data;
+	int length;
+	int capacity;
+	int failed;			//ran out of memory, the text is incomplete
+} TEXT_BUF;
+
+typedef struct listing {
+	char path[MAXLINE];		//directory the listing is for
+	VIRTUAL_HOST *host;		//host whose cache budget it counts against
+	int format;			//AUTOINDEX_HTML or AUTOINDEX_JSON
+	dev_t dev;			//identity and version of the directory
+	ino_t ino;
+	struct timespec mtime;
+	char *body;			//the rendered listing
+	int length;
+	int refs;			//workers currently sending this listing
+	int cached;			//still reachable from the cache
+	struct listing *next;		//hash chain
+	struct listing *newer;		//LRU list, most recently used at the head
+	struct listing *older;
+} LISTING;
+
+// Global Variables
+LISTING *listingBuckets[AUTOINDEX_BUCKETS];
+LISTING *listingNewest = NULL;
+LISTING *listingOldest = NULL;
+long listingBytes = 0;
+pthread_mutex_t listingLock = PTHREAD_MUTEX_INITIALIZER;
+
+//Functional Prototypes
+LISTING * renderListing ( char *dirname, char *title, int dirfd, struct stat *sbuf, int format );
+int compareEntries ( const void *a, const void *b );
+void appendText ( TEXT_BUF *buf, const char *text, int len );
+void appendEscaped ( TEXT_BUF *buf, const char *text, int format );
+unsigned int hashListing ( const char *path, int format );
+LISTING * lookupListing ( VIRTUAL_HOST *host, const char *path, int format, struct stat *sbuf );
+void cacheListing ( LISTING *listing );
+void unlinkListing ( LISTING *listing );
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : serveDirectoryListing
+// Description  : Send a listing of a directory, from the cache when the
+//		  directory hasn't changed since it was rendered
+//
+// Inputs       : client - socket file handle
+//		  host - virtual host the request is for
+//		  uri - path of the directory under the host's docroot
+//		  format - AUTOINDEX_HTML or AUTOINDEX_JSON
+//		  headOnly - send only the headers, for a HEAD request
+// Outputs      : 0 if successful, -1 if failure
+int serveDirectoryListing ( int client, VIRTUAL_HOST *host, char *uri, int format, int headOnly ) {
+
+	char header[MAXLINE];
+	LISTING *listing;
+	int status, ret = 0;
+
+	if ( (status = openDirectoryListing ( host, uri, format, &listing )) )
+		return sendErrorResponse ( client, status, errorReason ( status ), NULL );
+
+	snprintf ( header, sizeof(header), "HTTP/1.0 200 OK\r\n"
+			"Server: " SERVER_NAME "\r\n"
+			"Content-length: %d\r\n"
+			"Content-type: %s\r\n\r\n",
+			listing->length, AUTOINDEX_TYPE ( format ) );
+
+	if ( sendBytes ( client, strlen(header), header ) || ( !headOnly && sendBytes ( client, listing->length, listing->body ) ) )
+		ret = -1;
+
+	releaseListing ( listing );
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : openDirectoryListing
+// Description  : Get a directory's listing, from the cache when the directory
+//		  hasn't changed since it was rendered. The caller holds a
+//		  reference until it calls releaseListing.
+//
+// Inputs       : host - virtual host the request is for
+//		  uri - path of the directory under the host's docroot
+//		  format - AUTOINDEX_HTML or AUTOINDEX_JSON
+//		  result - where to put the listing
+// Outputs      : 0 if successful, or the HTTP status to answer with
+int openDirectoryListing ( VIRTUAL_HOST *host, char *uri, int format, LISTING **result ) {
+
+	char dirname[MAXLINE];
+	struct stat sbuf;
+	LISTING *listing;
+	int dirfd;
+
+	if ( snprintf ( dirname, sizeof(dirname), "%s%s", host->docroot, uri ) >= (int)sizeof(dirname) )
+		return 404;
+	if ( (dirfd = open ( dirname, O_RDONLY | O_DIRECTORY | O_CLOEXEC )) == -1 || fstat ( dirfd, &sbuf ) ) {
+		logMessage ( LOG_ERROR_LEVEL, "_openDirectoryListing:Can't open %s [%s]", dirname, strerror(errno) );
+		if ( dirfd != -1 )
+			close ( dirfd );
+		return 404;
+	}
+
+	//Only a miss, or a changed directory, reads the entries
+	if ( (listing = lookupListing ( host, dirname, format, &sbuf )) == NULL ) {
+		if ( (listing = renderListing ( dirname, uri, dirfd, &sbuf, format )) == NULL ) {
+			close ( dirfd );
+			return 500;
+		}
+		listing->host = host;
+		cacheListing ( listing );
+	}
+	close ( dirfd );
+
+	*result = listing;
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : listingBody
+// Description  : The rendered text of a listing
+//
+// Inputs       : listing - the listing
+//		  length - where to put its length
+// Outputs      : the text
+const char * listingBody ( LISTING *listing, int *length ) {
+
+	*length = listing->length;
+	return listing->body;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : renderListing
+// Description  : Read every entry of the directory with getdents64, sort them
+//		  with directories first, and render the listing
+//
+// Inputs       : dirname - path of the directory
+//		  title - the directory as the client named it
+//		  dirfd - the open directory
+//		  sbuf - stat of the directory
+//		  format - AUTOINDEX_HTML or AUTOINDEX_JSON
+// Outputs      : the listing holding one reference, or NULL on failure
+LISTING * renderListing ( char *dirname, char *title, int dirfd, struct stat *sbuf, int format ) {
+
+	char *dents = malloc ( AUTOINDEX_READ_SIZE );
+	TEXT_BUF names = { NULL, 0, 0, 0 }, out = { NULL, 0, 0, 0 };
+	DIR_ENTRY *entries = NULL;
+	int count = 0, capacity = 0, *offsets = NULL, *dirs = NULL, *grown;
+	struct linux_dirent64 *dent;
+	struct stat ebuf;
+	LISTING *listing;
+	long nread;
+
+	if ( dents == NULL )
+		return NULL;
+
+	//Collect names into one arena, remembering where each one starts
+	while ( (nread = syscall ( SYS_getdents64, dirfd, dents, AUTOINDEX_READ_SIZE )) > 0 ) {
+		for ( long pos = 0; pos < nread; pos += dent->d_reclen ) {
+			dent = (struct linux_dirent64 *)( dents + pos );
+			if ( dent->d_name[0] == '.' )
+				continue;			//hidden entries, "." and ".."
+			if ( count == capacity ) {
+				capacity = ( capacity ) ? capacity * 2 : 256;
+				if ( (grown = realloc ( offsets, capacity * sizeof(int) )) != NULL )
+					offsets = grown;
+				if ( grown == NULL || (grown = realloc ( dirs, capacity * sizeof(int) )) == NULL ) {
+					nread = -1;
+					errno = ENOMEM;
+					break;
+				}
+				dirs = grown;
+			}
+			offsets[count] = names.length;
+			if ( dent->d_type == DT_UNKNOWN )	//some filesystems don't fill in d_type
+				dirs[count] = !fstatat ( dirfd, dent->d_name, &ebuf, 0 ) && S_ISDIR ( ebuf.st_mode );
+			else
+				dirs[count] = ( dent->d_type == DT_DIR );
+			appendText ( &names, dent->d_name, strlen(dent->d_name) + 1 );
+			count++;
+		}
+		if ( nread < 0 )
+			break;
+	}
+	free ( dents );
+	if ( nread < 0 || names.failed ) {
+		logMessage ( LOG_ERROR_LEVEL, "_renderListing:Can't read the entries of %s [%s]", dirname,
+				( names.failed ) ? strerror(ENOMEM) : strerror(errno) );
+		free ( names.data ); free ( offsets ); free ( dirs );
+		return NULL;
+	}
+
+	//The arena has stopped moving, so the names can be pointed at now
+	if ( (entries = malloc ( ( count ? count : 1 ) * sizeof(DIR_ENTRY) )) == NULL ) {
+		logMessage ( LOG_ERROR_LEVEL, "_renderListing:Out of memory for the entries of %s", dirname );
+		free ( names.data ); free ( offsets ); free ( dirs );
+		return NULL;
+	}
+	for ( int i = 0; i < count; i++ ) {
+		entries[i].name = names.data + offsets[i];
+		entries[i].isDir = dirs[i];
+	}
+	free ( offsets );
+	free ( dirs );
+	qsort ( entries, count, sizeof(DIR_ENTRY), compareEntries );
+
+	if ( format == AUTOINDEX_JSON ) {
+		appendString ( &out, "{\"directory\":\"" );
+		appendEscaped ( &out, title, format );
+		appendString ( &out, "\",\"entries\":[" );
+		for ( int i = 0; i < count; i++ ) {
+			appendString ( &out, ( i ) ? ",{\"name\":\"" : "{\"name\":\"" );
+			appendEscaped ( &out, entries[i].name, format );
+			appendString ( &out, ( entries[i].isDir ) ? "\",\"type\":\"directory\"}" : "\",\"type\":\"file\"}" );
+		}
+		appendString ( &out, "]}\n" );
+	}
+	else {
+		appendString ( &out, "<html><head><title>Index of " );
+		appendEscaped ( &out, title, format );
+		appendString ( &out, "</title></head><body><h1>Index of " );
+		appendEscaped ( &out, title, format );
+		appendString ( &out, "</h1><hr><pre>\n<a href=\"../\">../</a>\n" );
+		for ( int i = 0; i < count; i++ ) {
+			appendString ( &out, "<a href=\"" );
+			appendEscaped ( &out, entries[i].name, ESCAPE_HREF );
+			appendString ( &out, ( entries[i].isDir ) ? "/\">" : "\">" );
+			appendEscaped ( &out, entries[i].name, format );
+			appendString ( &out, ( entries[i].isDir ) ? "/</a>\n" : "</a>\n" );
+		}
+		appendString ( &out, "</pre><hr></body></html>\n" );
+	}
+	free ( entries );
+	free ( names.data );
+
+	if ( out.data == NULL || out.failed || (listing = calloc ( 1, sizeof(LISTING) )) == NULL ) {
+		logMessage ( LOG_ERROR_LEVEL, "_renderListing:Out of memory for the listing of %s", dirname );
+		free ( out.data );
+		return NULL;
+	}
+	snprintf ( listing->path, sizeof(listing->path), "%s", dirname );
+	listing->format = format;
+	listing->dev = sbuf->st_dev;
+	listing->ino = sbuf->st_ino;
+	listing->mtime = sbuf->st_mtim;
+	listing->body = out.data;
+	listing->length = out.length;
+	listing->refs = 1;
+
+	logMessage ( LOG_INFO_LEVEL, "Rendered listing of %s, %d entries", dirname, count );
+	return listing;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : compareEntries
+// Description  : qsort order for listings, directories first then by name
+//
+// Inputs       : a, b - the entries to compare
+// Outputs      : <0, 0 or >0
+int compareEntries ( const void *a, const void *b ) {
+
+	const DIR_ENTRY *ea = a, *eb = b;
+
+	if ( ea->isDir != eb->isDir )
+		return eb->isDir - ea->isDir;
+	return strcmp ( ea->name, eb->name );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : appendText
+// Description  : Append bytes to a growing buffer. Once it can't grow, the
+//		  buffer is marked failed and nothing more is added.
+//
+// Inputs       : buf - the buffer
+//		  text - bytes to add
+//		  len - number of bytes
+// Outputs      : none
+void appendText ( TEXT_BUF *buf, const char *text, int len ) {
+
+	char *grown;
+
+	if ( buf->failed )
+		return;
+	if ( buf->length + len > buf->capacity ) {
+		int capacity = ( buf->capacity ) ? buf->capacity : 4096;
+		while ( capacity < buf->length + len )
+			capacity *= 2;
+		if ( (grown = realloc ( buf->data, capacity )) == NULL ) {
+			buf->failed = 1;
+			return;
+		}
+		buf->data = grown;
+		buf->capacity = capacity;
+	}
+	memcpy ( buf->data + buf->length, text, len );
+	buf->length += len;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : appendEscaped
+// Description  : Append a name, escaped for an HTML page, a JSON string or
+//		  the path of a link
+//
+// Inputs       : buf - the buffer
+//		  text - the name
+//		  format - AUTOINDEX_HTML, AUTOINDEX_JSON or ESCAPE_HREF
+// Outputs      : none
+void appendEscaped ( TEXT_BUF *buf, const char *text, int format ) {
+
+	char esc[8];
+	const char *start = text;
+
+	for ( ; *text; text++ ) {
+		const char *rep = NULL;
+		unsigned char c = (unsigned char)*text;
+
+		if ( format == ESCAPE_HREF ) {
+			if ( !( ( c >= 'a' && c <= 'z' ) || ( c >= 'A' && c <= 'Z' ) || ( c >= '0' && c <= '9' ) ||
+				c == '-' || c == '.' || c == '_' || c == '~' ) ) {
+				snprintf ( esc, sizeof(esc), "%%%02X", c );
+				rep = esc;
+			}
+		}
+		else if ( format == AUTOINDEX_JSON ) {
+			if ( c == '"' ) rep = "\\\"";
+			else if ( c == '\\' ) rep = "\\\\";
+			else if ( c < 0x20 ) {
+				snprintf ( esc, sizeof(esc), "\\u%04x", c );
+				rep = esc;
+			}
+		}
+		else {
+			if ( c == '&' ) rep = "&amp;";
+			else if ( c == '<' ) rep = "&lt;";
+			else if ( c == '>' ) rep = "&gt;";
+			else if ( c == '"' ) rep = "&quot;";
+			else if ( c == '\'' ) rep = "&#39;";
+		}
+
+		if ( rep ) {
+			appendText ( buf, start, text - start );
+			appendString ( buf, rep );
+			start = text + 1;
+		}
+	}
+	appendText ( buf, start, text - start );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hashListing
+// Description  : FNV-1a hash of a directory path and format
+//
+// Inputs       : path - directory path
+//		  format - listing format
+// Outputs      : the hash
+unsigned int hashListing ( const char *path, int format ) {
+
+	unsigned int hash = 2166136261u ^ (unsigned int)format;
+
+	for ( ; *path; path++ ) {
+		hash ^= (unsigned char)*path;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lookupListing
+// Description  : Find a cached listing that still matches the directory.
+//		  A listing for an older version of the directory is dropped.
+//
+// Inputs       : host - virtual host the listing is for
+//		  path - directory path
+//		  format - listing format
+//		  sbuf - current stat of the directory
+// Outputs      : the listing holding one reference, or NULL on a miss
+LISTING * lookupListing ( VIRTUAL_HOST *host, const char *path, int format, struct stat *sbuf ) {
+
+	LISTING *listing;
+
+	pthread_mutex_lock ( &listingLock );
+	listing = listingBuckets[hashListing ( path, format ) % AUTOINDEX_BUCKETS];
+	while ( listing != NULL && ( listing->format != format || listing->host != host || strcmp ( listing->path, path ) ) )
+		listing = listing->next;
+
+	if ( listing != NULL ) {
+		if ( listing->dev != sbuf->st_dev || listing->ino != sbuf->st_ino ||
+		     listing->mtime.tv_sec != sbuf->st_mtim.tv_sec || listing->mtime.tv_nsec != sbuf->st_mtim.tv_nsec ) {
+			unlinkListing ( listing );
+			listing = NULL;
+		}
+		else {
+			listing->refs++;
+
+			//Move to the head of the LRU list
+			if ( listingNewest != listing ) {
+				listing->newer->older = listing->older;
+				if ( listing->older )
+					listing->older->newer = listing->newer;
+				else
+					listingOldest = listing->newer;
+				listing->newer = NULL;
+				listing->older = listingNewest;
+				listingNewest->newer = listing;
+				listingNewest = listing;
+			}
+		}
+	}
+	pthread_mutex_unlock ( &listingLock );
+
+	return listing;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cacheListing
+// Description  : Add a freshly rendered listing to the cache, evicting the
+//		  host's least recently used listings to stay within its budget
+//
+// Inputs       : listing - the listing
+// Outputs      : none
+void cacheListing ( LISTING *listing ) {
+
+	unsigned int bucket = hashListing ( listing->path, listing->format ) % AUTOINDEX_BUCKETS;
+	VIRTUAL_HOST *host = listing->host;
+	LISTING *old, *newer;
+
+	//Too big, or the directory may still be changing within its mtime tick
+	if ( listing->length > host->cacheBytes || time ( NULL ) - listing->mtime.tv_sec < 1 )
+		return;
+
+	pthread_mutex_lock ( &listingLock );
+
+	//Another worker may have rendered the same directory meanwhile
+	for ( old = listingBuckets[bucket]; old != NULL; old = old->next ) {
+		if ( old->format == listing->format && old->host == host && !strcmp ( old->path, listing->path ) ) {
+			unlinkListing ( old );
+			break;
+		}
+	}
+
+	//Hosts share one LRU list, so walk it for this host's oldest listings
+	for ( old = listingOldest; old != NULL && host->cachedBytes + listing->length > host->cacheBytes; old = newer ) {
+		newer = old->newer;
+		if ( old->host == host )
+			unlinkListing ( old );
+	}
+
+	listing->cached = 1;
+	listing->refs++;
+	listing->next = listingBuckets[bucket];
+	listingBuckets[bucket] = listing;
+	listing->newer = NULL;
+	listing->older = listingNewest;
+	if ( listingNewest )
+		listingNewest->newer = listing;
+	else
+		listingOldest = listing;
+	listingNewest = listing;
+	listingBytes += listing->length;
+	host->cachedBytes += listing->length;
+
+	pthread_mutex_unlock ( &listingLock );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : releaseListing
+// Description  : Drop a reference, freeing the listing once it is out of the
+//		  cache and no worker is sending it
+//
+// Inputs       : listing - the listing
+// Outputs      : none
+void releaseListing ( LISTING *listing ) {
+
+	int last;
+
+	pthread_mutex_lock ( &listingLock );
+	last = ( --listing->refs == 0 );
+	pthread_mutex_unlock ( &listingLock );
+
+	if ( last ) {
+		free ( listing->body );
+		free ( listing );
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : forgetListings
+// Description  : Drop every cached listing of a host that is going away
+//
+// Inputs       : host - the host
+// Outputs      : none
+void forgetListings ( VIRTUAL_HOST *host ) {
+
+	LISTING *old, *newer;
+
+	pthread_mutex_lock ( &listingLock );
+	for ( old = listingOldest; old != NULL && host->cachedBytes > 0; old = newer ) {
+		newer = old->newer;
+		if ( old->host == host )
+			unlinkListing ( old );
+	}
+	pthread_mutex_unlock ( &listingLock );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : unlinkListing
+// Description  : Take a listing out of the cache and drop the cache's
+//		  reference. The listing lock must be held.
+//
+// Inputs       : listing - the listing
+// Outputs      : none
+void unlinkListing ( LISTING *listing ) {
+
+	LISTING **link = &listingBuckets[hashListing ( listing->path, listing->format ) % AUTOINDEX_BUCKETS];
+
+	while ( *link != listing )
+		link = &(*link)->next;
+	*link = listing->next;
+
+	if ( listing->newer )
+		listing->newer->older = listing->older;
+	else
+		listingNewest = listing->older;
+	if ( listing->older )
+		listing->older->newer = listing->newer;
+	else
+		listingOldest = listing->newer;
+
+	listingBytes -= listing->length;
+	listing->host->cachedBytes -= listing->length;
+	listing->cached = 0;
+	if ( --listing->refs == 0 ) {
+		free ( listing->body );
+		free ( listing );
+	}
+}
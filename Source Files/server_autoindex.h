@@ -0,0 +1,40 @@
+#ifndef SERVER_AUTOINDEX_INCLUDED
+#define SERVER_AUTOINDEX_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_autoindex.h
+//  Description   : Directory listings for directories without an index page.
+//                  Listings are read with getdents64, sorted, rendered as HTML
+//                  or JSON, and cached until the directory's mtime changes.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#include <server_vhost.h>
+
+//
+// Constants
+
+#define AUTOINDEX_ENABLED 1			//list directories that have no index page, by default
+#define AUTOINDEX_CACHE_BYTES ( 16 * 1024 * 1024 )	//rendered listings kept per host, by default
+#define AUTOINDEX_BUCKETS 256			//hash chains in the listing cache
+#define AUTOINDEX_READ_SIZE 65536		//getdents64 buffer size
+
+#define AUTOINDEX_HTML 0
+#define AUTOINDEX_JSON 1
+#define AUTOINDEX_TYPE(format) ( ( (format) == AUTOINDEX_JSON ) ? "application/json" : "text/html; charset=utf-8" )
+
+struct listing;
+
+//
+// Functional Prototypes
+
+int serveDirectoryListing ( int client, VIRTUAL_HOST *host, char *uri, int format, int headOnly );
+int openDirectoryListing ( VIRTUAL_HOST *host, char *uri, int format, struct listing **result );
+const char * listingBody ( struct listing *listing, int *length );
+void releaseListing ( struct listing *listing );
+void forgetListings ( VIRTUAL_HOST *host );
+
+#endif
@@ -0,0 +1,478 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_bench.c
+//  Description   : Running the microbenchmarks. The three perf counters are
+//                  opened as one group, so they count exactly the same
+//                  stretch of each benchmark, and are reset and enabled right
+//                  before its measured loop and disabled right after.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/perf_event.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+// Project Include Files
+#include <cmpsc311_log.h>
+#include <server.h>
+#include <server_bench.h>
+#include <server_config.h>
+
+// What each benchmark works on
+#define BENCH_REQUEST_LINE "GET /pages/index.html?lang=en HTTP/1.1\r\n"
+#define BENCH_URI "/pages/index.html?lang=en"
+#define BENCH_FILENAME "../pages/images/banner.jpg"
+#define BENCH_HEADER_LINE "Accept-Language: en-US,en;q=0.9\r\n"
+
+// A benchmark, which measures its own loop between beginMeasure and endMeasure
+typedef int (*BENCH_FUNC) ( BENCH_RESULT *result );
+
+typedef struct benchmark {
+	const char *name;
+	BENCH_FUNC run;
+	long iterations;
+} BENCHMARK;
+
+// The group of counters, as read
+typedef struct counter_values {
+	uint64_t count;				//counters in the group
+	uint64_t values[3];			//instructions, cache misses, branch misses
+} COUNTER_VALUES;
+
+// Global Variables
+int counterFds[3] = { -1, -1, -1 };		//the group, led by the instruction counter
+int counterMode = BENCH_COUNTERS_NONE;
+uint64_t measureStart = 0;
+volatile long benchSink = 0;			//results go here so no loop is optimised away
+
+//
+// Functional Prototypes
+
+int openCounters ( void );
+void closeCounters ( void );
+void beginMeasure ( void );
+void endMeasure ( BENCH_RESULT *result );
+int benchRequestLine ( BENCH_RESULT *result );
+int benchParseUri ( BENCH_RESULT *result );
+int benchFiletype ( BENCH_RESULT *result );
+int benchHeaders ( BENCH_RESULT *result );
+int benchReadLines ( BENCH_RESULT *result );
+int benchSendLoopback ( BENCH_RESULT *result );
+int benchLogOn ( BENCH_RESULT *result );
+int benchLogOff ( BENCH_RESULT *result );
+int writeResults ( const char *output, BENCH_RESULT *results, int count );
+
+// The benchmarks, in the order they run
+BENCHMARK benchmarks[] = {
+	{ "parseRequestLine", benchRequestLine, BENCH_ITERATIONS },
+	{ "parse_uri", benchParseUri, BENCH_ITERATIONS },
+	{ "get_filetype", benchFiletype, BENCH_ITERATIONS },
+	{ "formatStaticHeaders", benchHeaders, BENCH_ITERATIONS },
+	{ "readBytesLine", benchReadLines, BENCH_IO_ITERATIONS },
+	{ "sendBytesLoopback", benchSendLoopback, BENCH_IO_ITERATIONS },
+	{ "logMessageOn", benchLogOn, BENCH_IO_ITERATIONS },
+	{ "logMessageOff", benchLogOff, BENCH_ITERATIONS },
+	{ NULL, NULL, 0 }
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : runBenchmarks
+// Description  : Run every benchmark and write the results
+//
+// Inputs       : output - file to write the JSON to, - for stdout
+// Outputs      : 0 if successful, -1 if failure
+int runBenchmarks ( const char *output ) {
+
+	BENCH_RESULT results[sizeof(benchmarks) / sizeof(benchmarks[0])];
+	int count = 0, failed = 0;
+
+	openCounters ();
+	initializeLogWithFilename ( "/dev/null" );
+	for ( ; benchmarks[count].name != NULL && !failed; count++ ) {
+		memset ( &results[count], 0, sizeof(BENCH_RESULT) );
+		results[count].name = benchmarks[count].name;
+		results[count].iterations = benchmarks[count].iterations;
+		failed = benchmarks[count].run ( &results[count] );
+	}
+	initializeLogWithFilehandle ( CMPSC311_LOG_STDERR );
+	closeCounters ();
+
+	if ( failed ) {
+		logMessage ( LOG_ERROR_LEVEL, "_runBenchmarks:Benchmark %s failed [%s]", results[count - 1].name, strerror(errno) );
+		return -1;
+	}
+	return writeResults ( output, results, count );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : openCounters
+// Description  : Open the perf counters, counting the kernel's work too if
+//		  we are allowed, and only our own if not
+//
+// Inputs       : none
+// Outputs      : 0 if there are counters, -1 if not
+int openCounters ( void ) {
+
+	uint64_t events[3] = { PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES };
+	struct perf_event_attr attr;
+
+	for ( int mode = BENCH_COUNTERS_ALL; mode > BENCH_COUNTERS_NONE; mode-- ) {
+		for ( int i = 0; i < 3; i++ ) {
+			memset ( &attr, 0, sizeof(attr) );
+			attr.size = sizeof(attr);
+			attr.type = PERF_TYPE_HARDWARE;
+			attr.config = events[i];
+			attr.disabled = ( i == 0 );
+			attr.exclude_kernel = ( mode == BENCH_COUNTERS_USER );
+			attr.exclude_hv = 1;
+			attr.read_format = PERF_FORMAT_GROUP;
+			if ( (counterFds[i] = syscall ( SYS_perf_event_open, &attr, 0, -1, counterFds[0], 0 )) == -1 )
+				break;
+		}
+		if ( counterFds[2] != -1 ) {
+			counterMode = mode;
+			return 0;
+		}
+		closeCounters ();
+	}
+
+	logMessage ( LOG_WARNING_LEVEL, "No perf counters, only times are measured [%s]", strerror(errno) );
+	return -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : closeCounters
+// Description  : Close whatever perf counters are open
+//
+// Inputs       : none
+// Outputs      : none
+void closeCounters ( void ) {
+
+	for ( int i = 2; i >= 0; i-- ) {
+		if ( counterFds[i] != -1 )
+			close ( counterFds[i] );
+		counterFds[i] = -1;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : beginMeasure
+// Description  : Start measuring a benchmark's loop
+//
+// Inputs       : none
+// Outputs      : none
+void beginMeasure ( void ) {
+
+	if ( counterMode != BENCH_COUNTERS_NONE ) {
+		ioctl ( counterFds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP );
+		ioctl ( counterFds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP );
+	}
+	measureStart = monotonicTime ();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : endMeasure
+// Description  : Stop measuring a benchmark's loop, and keep what it cost
+//
+// Inputs       : result - the benchmark's result
+// Outputs      : none
+void endMeasure ( BENCH_RESULT *result ) {
+
+	COUNTER_VALUES counters;
+
+	result->nanoseconds = monotonicTime () - measureStart;
+	if ( counterMode == BENCH_COUNTERS_NONE )
+		return;
+
+	ioctl ( counterFds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP );
+	if ( read ( counterFds[0], &counters, sizeof(counters) ) == sizeof(counters) && counters.count == 3 ) {
+		result->instructions = counters.values[0];
+		result->cacheMisses = counters.values[1];
+		result->branchMisses = counters.values[2];
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : benchRequestLine
+// Description  : Parse a request line, as processClient does
+//
+// Inputs       : result - where the cost goes
+// Outputs      : 0 if successful, -1 if failure
+int benchRequestLine ( BENCH_RESULT *result ) {
+
+	char line[MAXLINE] = BENCH_REQUEST_LINE;
+	HTTP_REQUEST request;
+
+	for ( int i = 0; i < BENCH_WARMUP; i++ )
+		benchSink += parseRequestLine ( line, &request );
+	beginMeasure ();
+	for ( long i = 0; i < result->iterations; i++ )
+		benchSink += parseRequestLine ( line, &request );
+	endMeasure ( result );
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : benchParseUri
+// Description  : Find the file of a uri under the default host. parse_uri
+//		  cuts the arguments off the uri, so each iteration gets a
+//		  fresh copy.
+//
+// Inputs       : result - where the cost goes
+// Outputs      : 0 if successful, -1 if failure
+int benchParseUri ( BENCH_RESULT *result ) {
+
+	VIRTUAL_HOST *host = serverConfig()->hosts->defaultHost;
+	char uri[MAXLINE], filename[MAXLINE], cgiargs[MAXLINE];
+
+	for ( int i = 0; i < BENCH_WARMUP; i++ ) {
+		strcpy ( uri, BENCH_URI );
+		benchSink += parse_uri ( host, uri, filename, cgiargs );
+	}
+	beginMeasure ();
+	for ( long i = 0; i < result->iterations; i++ ) {
+		strcpy ( uri, BENCH_URI );
+		benchSink += parse_uri ( host, uri, filename, cgiargs );
+	}
+	endMeasure ( result );
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : benchFiletype
+// Description  : Find the content type of a file, one that takes every test
+//
+// Inputs       : result - where the cost goes
+// Outputs      : 0 if successful, -1 if failure
+int benchFiletype ( BENCH_RESULT *result ) {
+
+	char filename[MAXLINE] = BENCH_FILENAME, filetype[MAXLINE];
+
+	for ( int i = 0; i < BENCH_WARMUP; i++ ) {
+		get_filetype ( filename, filetype );
+		benchSink += filetype[0];
+	}
+	beginMeasure ();
+	for ( long i = 0; i < result->iterations; i++ ) {
+		get_filetype ( filename, filetype );
+		benchSink += filetype[0];
+	}
+	endMeasure ( result );
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : benchHeaders
+// Description  : Format the headers of a static response
+//
+// Inputs       : result - where the cost goes
+// Outputs      : 0 if successful, -1 if failure
+int benchHeaders ( BENCH_RESULT *result ) {
+
+	char buf[MAXBUF], filetype[MAXLINE] = "text/html";
+
+	for ( int i = 0; i < BENCH_WARMUP; i++ )
+		benchSink += formatStaticHeaders ( buf, 12345, filetype );
+	beginMeasure ();
+	for ( long i = 0; i < result->iterations; i++ )
+		benchSink += formatStaticHeaders ( buf, 12345, filetype );
+	endMeasure ( result );
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : benchReadLines
+// Description  : Read header lines with readBytes from a socketpair. The
+//		  lines are written BENCH_LINES at a time, and the writes are
+//		  measured along with the reads.
+//
+// Inputs       : result - where the cost goes
+// Outputs      : 0 if successful, -1 if failure
+int benchReadLines ( BENCH_RESULT *result ) {
+
+	char lines[BENCH_LINES * sizeof(BENCH_HEADER_LINE)], buf[MAXLINE];
+	int length = 0, fds[2], ret = 0;
+	long done;
+
+	for ( int i = 0; i < BENCH_LINES; i++ )
+		length += sprintf ( &lines[length], "%s", BENCH_HEADER_LINE );
+	if ( socketpair ( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds ) )
+		return -1;
+
+	for ( done = -( BENCH_WARMUP / BENCH_LINES ) * BENCH_LINES; done < result->iterations && !ret; done += BENCH_LINES ) {
+		if ( done == 0 )
+			beginMeasure ();
+		if ( write ( fds[1], lines, length ) != length ) {
+			ret = -1;
+			break;
+		}
+		for ( int i = 0; i < BENCH_LINES && !ret; i++ )
+			ret = readBytes ( fds[0], MAXLINE, buf );
+		benchSink += buf[0];
+	}
+	endMeasure ( result );
+	result->iterations = done;
+
+	close ( fds[0] );
+	close ( fds[1] );
+	return ( ret ) ? -1 : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : benchSendLoopback
+// Description  : Send with sendBytes over a loopback TCP connection. The
+//		  other end is drained in the same loop, and that is measured
+//		  too.
+//
+// Inputs       : result - where the cost goes
+// Outputs      : 0 if successful, -1 if failure
+int benchSendLoopback ( BENCH_RESULT *result ) {
+
+	struct sockaddr_in address = { .sin_family = AF_INET };
+	socklen_t addressLength = sizeof(address);
+	char data[BENCH_SEND_SIZE], drain[BENCH_SEND_SIZE];
+	int listener, sender = -1, receiver = -1, ret = -1, got;
+
+	memset ( data, 'x', sizeof(data) );
+	address.sin_addr.s_addr = htonl ( INADDR_LOOPBACK );
+	if ( (listener = socket ( AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0 )) == -1 )
+		return -1;
+	if ( bind ( listener, (struct sockaddr *)&address, sizeof(address) ) || listen ( listener, 1 ) ||
+	     getsockname ( listener, (struct sockaddr *)&address, &addressLength ) ||
+	     (sender = socket ( AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0 )) == -1 ||
+	     connect ( sender, (struct sockaddr *)&address, sizeof(address) ) ||
+	     (receiver = accept4 ( listener, NULL, NULL, SOCK_CLOEXEC )) == -1 )
+		goto done;
+
+	for ( long i = -BENCH_WARMUP; i < result->iterations; i++ ) {
+		if ( i == 0 )
+			beginMeasure ();
+		if ( sendBytes ( sender, sizeof(data), data ) )
+			goto done;
+		for ( int left = sizeof(drain); left > 0; left -= got ) {
+			if ( (got = read ( receiver, drain, left )) <= 0 )
+				goto done;
+		}
+	}
+	endMeasure ( result );
+	ret = 0;
+
+done:
+	close ( listener );
+	if ( sender != -1 )
+		close ( sender );
+	if ( receiver != -1 )
+		close ( receiver );
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : benchLogOn
+// Description  : Log a message at a level that is on, to /dev/null
+//
+// Inputs       : result - where the cost goes
+// Outputs      : 0 if successful, -1 if failure
+int benchLogOn ( BENCH_RESULT *result ) {
+
+	enableLogLevels ( LOG_INFO_LEVEL );
+	for ( int i = 0; i < BENCH_WARMUP; i++ )
+		benchSink += logMessage ( LOG_INFO_LEVEL, "Request will be handled by the number %d thread", i );
+	beginMeasure ();
+	for ( long i = 0; i < result->iterations; i++ )
+		benchSink += logMessage ( LOG_INFO_LEVEL, "Request will be handled by the number %d thread", (int)i );
+	endMeasure ( result );
+	disableLogLevels ( LOG_INFO_LEVEL );
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : benchLogOff
+// Description  : Log a message at a level that is off
+//
+// Inputs       : result - where the cost goes
+// Outputs      : 0 if successful, -1 if failure
+int benchLogOff ( BENCH_RESULT *result ) {
+
+	disableLogLevels ( LOG_INFO_LEVEL );
+	for ( int i = 0; i < BENCH_WARMUP; i++ )
+		benchSink += logMessage ( LOG_INFO_LEVEL, "Request will be handled by the number %d thread", i );
+	beginMeasure ();
+	for ( long i = 0; i < result->iterations; i++ )
+		benchSink += logMessage ( LOG_INFO_LEVEL, "Request will be handled by the number %d thread", (int)i );
+	endMeasure ( result );
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : writeResults
+// Description  : Write the results as JSON, each cost per iteration
+//
+// Inputs       : output - file to write to, - for stdout
+//		  results - the results
+//		  count - how many
+// Outputs      : 0 if successful, -1 if failure
+int writeResults ( const char *output, BENCH_RESULT *results, int count ) {
+
+	const char *modes[] = { "none", "user", "all" };
+	FILE *file = stdout;
+	double per;
+	int failed;
+
+	if ( strcmp ( output, "-" ) && (file = fopen ( output, "w" )) == NULL ) {
+		logMessage ( LOG_ERROR_LEVEL, "_writeResults:Can't create %s [%s]", output, strerror(errno) );
+		return -1;
+	}
+
+	fprintf ( file, "{\"build\":\"%s\",\"counters\":\"%s\",\"benchmarks\":[", SERVER_BUILD, modes[counterMode] );
+	for ( int i = 0; i < count; i++ ) {
+		per = ( results[i].iterations > 0 ) ? 1.0 / results[i].iterations : 0;
+		fprintf ( file, "%s\n{\"name\":\"%s\",\"iterations\":%ld,\"nsPerOp\":%.2f", ( i ) ? "," : "",
+				results[i].name, results[i].iterations, results[i].nanoseconds * per );
+		if ( counterMode == BENCH_COUNTERS_NONE )
+			fprintf ( file, ",\"instructionsPerOp\":null,\"cacheMissesPerOp\":null,\"branchMissesPerOp\":null}" );
+		else
+			fprintf ( file, ",\"instructionsPerOp\":%.2f,\"cacheMissesPerOp\":%.4f,\"branchMissesPerOp\":%.4f}",
+					results[i].instructions * per, results[i].cacheMisses * per, results[i].branchMisses * per );
+	}
+	fprintf ( file, "\n]}\n" );
+
+	failed = ferror ( file );
+	if ( file != stdout )
+		failed |= fclose ( file );
+	else
+		fflush ( file );
+	if ( failed ) {
+		logMessage ( LOG_ERROR_LEVEL, "_writeResults:Can't write %s", output );
+		return -1;
+	}
+	return 0;
+}
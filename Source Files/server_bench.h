@@ -0,0 +1,62 @@
+#ifndef SERVER_BENCH_INCLUDED
+#define SERVER_BENCH_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_bench.h
+//  Description   : Microbenchmarks of the functions every request runs
+//                  through: parsing the request line, parse_uri,
+//                  get_filetype, formatting the response headers, reading
+//                  header lines with readBytes over a socketpair, sendBytes
+//                  over a loopback TCP connection, and logMessage with its
+//                  level on and off.
+//
+//                  Each benchmark runs BENCH_WARMUP untimed iterations, then
+//                  its measured ones. Alongside the time, the instructions,
+//                  cache misses and branch misses of the measured loop are
+//                  read from the kernel's perf counters. Where the kernel
+//                  won't count its own work the counts are user space only,
+//                  and where there are no counters at all they are null.
+//                  Results are written as JSON, so they can be kept and
+//                  compared from commit to commit.
+//
+//                  The log goes to /dev/null while the benchmarks run.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#include <stdint.h>
+
+//
+// Constants
+
+#define BENCH_ITERATIONS 1000000		//iterations of the benchmarks that make no system calls
+#define BENCH_IO_ITERATIONS 100000		//iterations of those that do
+#define BENCH_WARMUP 1000			//untimed iterations before each benchmark
+#define BENCH_LINES 64				//header lines written to the socketpair at a time
+#define BENCH_SEND_SIZE 1024			//bytes sendBytes sends each iteration
+
+// Which perf counters were read
+#define BENCH_COUNTERS_NONE 0			//none, the kernel has no counters for us
+#define BENCH_COUNTERS_USER 1			//user space only
+#define BENCH_COUNTERS_ALL 2			//user space and the kernel
+
+//
+// Type Definitions
+
+typedef struct bench_result {
+	const char *name;
+	long iterations;
+	uint64_t nanoseconds;			//of all the measured iterations
+	uint64_t instructions;
+	uint64_t cacheMisses;
+	uint64_t branchMisses;
+} BENCH_RESULT;
+
+//
+// Functional Prototypes
+
+int runBenchmarks ( const char *output );
+
+#endif
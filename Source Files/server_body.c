@@ -0,0 +1,236 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_body.c
+//  Description   : Request body framing for Content-Length and chunked bodies.
+//                  The headers have already been read byte by byte by readBytes,
+//                  so everything left on the socket belongs to the body.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+// Project Include Files
+#include <cmpsc311_log.h>
+#include <server.h>
+#include <server_body.h>
+
+//Functional Prototypes
+int readChunkSize ( REQUEST_BODY *body );
+int readBodyLine ( int client, char *buf, int len );
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : startRequestBody
+// Description  : Work out how the request body is framed, check it against
+//		  the size limit, and send 100 Continue if the client is
+//		  waiting for one
+//
+// Inputs       : body - body state to fill in
+//		  client - socket file handle
+//		  request - the parsed request headers
+// Outputs      : 0 if successful, or the HTTP status to fail the request with
+int startRequestBody ( REQUEST_BODY *body, int client, HTTP_REQUEST *request ) {
+
+	char *cont = "HTTP/1.1 100 Continue\r\n\r\n";
+
+	memset ( body, 0, sizeof(REQUEST_BODY) );
+	body->client = client;
+	body->limit = request->vhost->maxBodySize;
+
+	if ( request->chunked ) {
+		body->chunked = 1;
+		body->remaining = 0;
+	}
+	else if ( request->contentLength > 0 ) {
+		if ( request->contentLength > body->limit ) {
+			logMessage ( LOG_WARNING_LEVEL, "Request body of %lld bytes is over the limit. 413 error",
+					(long long)request->contentLength );
+			return 413;
+		}
+		body->remaining = request->contentLength;
+	}
+	else {
+		//POST and PUT must say how long the body is
+		if ( request->contentLength < 0 && ( !strcasecmp ( request->method, "POST" ) ||
+				!strcasecmp ( request->method, "PUT" ) ) ) {
+			logMessage ( LOG_WARNING_LEVEL, "%s without a body length. 411 error", request->method );
+			return 411;
+		}
+		body->done = 1;
+	}
+
+	//The client held the body back until we agree to take it
+	if ( request->expectContinue && !body->done && !strcmp ( request->version, "HTTP/1.1" ) ) {
+		if ( sendBytes ( client, strlen(cont), cont ) )
+			return 400;
+	}
+
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hasRequestBody
+// Description  : Whether there are body bytes still to be read
+//
+// Inputs       : body - body state
+// Outputs      : 1 if there is more body, 0 otherwise
+int hasRequestBody ( REQUEST_BODY *body ) {
+	return !body->done;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : readRequestBody
+// Description  : Read the next piece of the body, at most len bytes
+//
+// Inputs       : body - body state
+//		  buf - place to put the bytes
+//		  len - size of buf
+// Outputs      : bytes read, 0 at the end of the body, -1 on a read or
+//		  framing error, -2 if the body went over the size limit
+int readRequestBody ( REQUEST_BODY *body, char *buf, int len ) {
+
+	int rb, want;
+
+	if ( body->done )
+		return 0;
+
+	//Move on to the next chunk when the current one is used up
+	if ( body->chunked && body->remaining == 0 ) {
+		if ( readChunkSize ( body ) )
+			return -1;
+		if ( body->done )
+			return 0;
+	}
+
+	if ( body->chunked && body->received + body->remaining > body->limit ) {
+		logMessage ( LOG_WARNING_LEVEL, "Chunked request body is over the limit" );
+		return -2;
+	}
+
+	want = ( body->remaining < len ) ? (int)body->remaining : len;
+	while ( (rb = connRead ( body->client, buf, want )) < 0 && errno == EINTR )
+		;
+	if ( rb <= 0 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_readRequestBody:Body ended early [%s]", ( rb ) ? strerror(errno) : "closed" );
+		return -1;
+	}
+
+	countTransfer ( body->client, rb, 0 );
+	body->remaining -= rb;
+	body->received += rb;
+	if ( !body->chunked && body->remaining == 0 )
+		body->done = 1;
+
+	return rb;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : discardRequestBody
+// Description  : Read and throw away the rest of the body
+//
+// Inputs       : body - body state
+// Outputs      : 0 if successful, -1 if failure
+int discardRequestBody ( REQUEST_BODY *body ) {
+
+	char buf[BODY_CHUNK_SIZE];
+	int rb;
+
+	while ( (rb = readRequestBody ( body, buf, sizeof(buf) )) > 0 )
+		;
+	return ( rb == 0 ) ? 0 : -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : readChunkSize
+// Description  : Read the CRLF ending the previous chunk (if any) and the next
+//		  chunk size line. A zero size chunk ends the body, and its
+//		  trailer lines are read and ignored.
+//
+// Inputs       : body - body state
+// Outputs      : 0 if successful, -1 if failure
+int readChunkSize ( REQUEST_BODY *body ) {
+
+	char line[MAXLINE];
+	char *end;
+	long long size;
+	int count = 0;
+
+	//Every chunk but the first is followed by an empty line
+	if ( body->received > 0 && readBodyLine ( body->client, line, sizeof(line) ) != 0 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_readChunkSize:Missing CRLF after chunk" );
+		return -1;
+	}
+
+	if ( readBodyLine ( body->client, line, sizeof(line) ) <= 0 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_readChunkSize:Missing chunk size" );
+		return -1;
+	}
+
+	//Chunk extensions after a ';' are ignored
+	size = strtoll ( line, &end, 16 );
+	if ( end == line || size < 0 || ( *end != '\0' && *end != ';' && *end != ' ' && *end != '\t' ) ) {
+		logMessage ( LOG_ERROR_LEVEL, "_readChunkSize:Bad chunk size [%s]", line );
+		return -1;
+	}
+
+	if ( size > 0 ) {
+		body->remaining = size;
+		return 0;
+	}
+
+	//Last chunk, skip the trailers up to the empty line
+	while ( readBodyLine ( body->client, line, sizeof(line) ) > 0 ) {
+		if ( ++count > MAX_NUM_OF_HEADER_LINES )
+			return -1;
+	}
+	body->done = 1;
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : readBodyLine
+// Description  : Read one CRLF terminated line of chunk framing, without the
+//		  line ending
+//
+// Inputs       : client - socket file handle
+//		  buf - place to put the line
+//		  len - size of buf
+// Outputs      : length of the line, or -1 on error
+int readBodyLine ( int client, char *buf, int len ) {
+
+	int i = 0, rb;
+	char c;
+
+	while ( 1 ) {
+		if ( (rb = connRead ( client, &c, 1 )) < 0 && errno == EINTR )
+			continue;
+		if ( rb <= 0 )
+			return -1;
+		countTransfer ( client, 1, 0 );
+		if ( c == '\n' )
+			break;
+		if ( i >= len - 1 )
+			return -1;
+		buf[i++] = c;
+	}
+
+	if ( i > 0 && buf[i-1] == '\r' )
+		i--;
+	buf[i] = '\0';
+	return i;
+}
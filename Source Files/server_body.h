@@ -0,0 +1,45 @@
+#ifndef SERVER_BODY_INCLUDED
+#define SERVER_BODY_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_body.h
+//  Description   : Reading request bodies. A body is never buffered whole, it
+//                  is pulled from the socket in bounded chunks by whoever is
+//                  consuming it (a CGI stdin pipe or an in-process handler), so
+//                  a slow consumer slows the client down instead of using memory.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#include <stdint.h>
+#include <server.h>
+
+//
+// Constants
+
+#define MAX_BODY_SIZE ( 8 * 1024 * 1024 )	//largest request body accepted
+#define BODY_CHUNK_SIZE 16384			//most bytes moved per read
+
+//
+// Type Definitions
+
+typedef struct request_body {
+	int client;			//socket the body arrives on
+	int chunked;			//body uses chunked transfer coding
+	int64_t remaining;		//bytes left in the body, or in the current chunk
+	int64_t received;		//body bytes delivered so far
+	int64_t limit;			//most body bytes allowed
+	int done;			//the whole body, including any trailers, was read
+} REQUEST_BODY;
+
+//
+// Functional Prototypes
+
+int startRequestBody ( REQUEST_BODY *body, int client, HTTP_REQUEST *request );
+int hasRequestBody ( REQUEST_BODY *body );
+int readRequestBody ( REQUEST_BODY *body, char *buf, int len );
+int discardRequestBody ( REQUEST_BODY *body );
+
+#endif
@@ -0,0 +1,131 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_bufpool.c
+//  Description   : The buffer pool. Each buffer has a small header in front
+//                  of it saying which class it is, so it can be returned
+//                  without its size. Free buffers are chained through that
+//                  header on their class's list, under one lock, which is
+//                  only taken when a connection starts or finishes moving
+//                  data.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+
+// Project Include Files
+#include <cmpsc311_log.h>
+#include <server_bufpool.h>
+#include <server_shared.h>
+
+//
+// Type Definitions
+
+typedef struct pool_buffer {
+	union {
+		struct pool_buffer *next;	//free list, while it is in the pool
+		size_t size;			//bytes it holds, while it is lent
+	};
+	int poolClass;				//class it belongs to, -1 if it is outside the pool
+} __attribute__ ((aligned ( 16 ))) POOL_BUFFER;
+
+// Global Variables
+POOL_BUFFER *freeBuffers[BUFPOOL_CLASSES];	//free list of each class
+int freeCount[BUFPOOL_CLASSES];
+pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : borrowBuffer
+// Description  : Borrow a buffer of at least size bytes. Its contents are
+//		  whatever the last borrower left.
+//
+// Inputs       : size - bytes needed
+// Outputs      : the buffer, or NULL if memory ran out
+void * borrowBuffer ( size_t size ) {
+
+	POOL_BUFFER *buffer = NULL;
+	int poolClass = 0;
+	size_t classSize = BUFPOOL_MIN_SIZE;
+
+	while ( classSize < size && poolClass < BUFPOOL_CLASSES ) {
+		classSize <<= 1;
+		poolClass++;
+	}
+	if ( poolClass == BUFPOOL_CLASSES ) {
+		poolClass = -1;
+		classSize = size;
+	}
+	else {
+		pthread_mutex_lock ( &poolLock );
+		if ( (buffer = freeBuffers[poolClass]) != NULL ) {
+			freeBuffers[poolClass] = buffer->next;
+			freeCount[poolClass]--;
+		}
+		pthread_mutex_unlock ( &poolLock );
+		if ( buffer != NULL )
+			countStat ( STAT_BUFFERS_POOLED, -(uint64_t)classSize );
+	}
+
+	if ( buffer == NULL && (buffer = malloc ( sizeof(POOL_BUFFER) + classSize )) == NULL ) {
+		logMessage ( LOG_ERROR_LEVEL, "_borrowBuffer:Out of memory for a %lu byte buffer", (unsigned long)classSize );
+		return NULL;
+	}
+	buffer->size = classSize;
+	buffer->poolClass = poolClass;
+	countStat ( STAT_BUFFERS_LENT, classSize );
+	return buffer + 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : returnBuffer
+// Description  : Give a borrowed buffer back to the pool
+//
+// Inputs       : buffer - the buffer, or NULL
+// Outputs      : none
+void returnBuffer ( void *buffer ) {
+
+	POOL_BUFFER *header;
+	size_t size;
+	int kept = 0;
+
+	if ( buffer == NULL )
+		return;
+	header = (POOL_BUFFER *)buffer - 1;
+	size = header->size;
+	countStat ( STAT_BUFFERS_LENT, -(uint64_t)size );
+
+	if ( header->poolClass != -1 ) {
+		pthread_mutex_lock ( &poolLock );
+		if ( freeCount[header->poolClass] < (int)( BUFPOOL_KEEP_BYTES / size ) ) {
+			header->next = freeBuffers[header->poolClass];
+			freeBuffers[header->poolClass] = header;
+			freeCount[header->poolClass]++;
+			kept = 1;
+		}
+		pthread_mutex_unlock ( &poolLock );
+	}
+
+	if ( kept )
+		countStat ( STAT_BUFFERS_POOLED, size );
+	else
+		free ( header );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bufferSize
+// Description  : Get how many bytes a borrowed buffer holds, which may be
+//		  more than were asked for
+//
+// Inputs       : buffer - the buffer
+// Outputs      : its size
+size_t bufferSize ( void *buffer ) {
+
+	return ( (POOL_BUFFER *)buffer - 1 )->size;
+}
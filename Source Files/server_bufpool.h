@@ -0,0 +1,38 @@
+#ifndef SERVER_BUFPOOL_INCLUDED
+#define SERVER_BUFPOOL_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_bufpool.h
+//  Description   : A pool of buffers in power of two size classes, lent to
+//                  connections only while they have data in flight. An idle
+//                  keep-alive connection hands its buffers back, so it costs
+//                  no more than its own state while it waits in the event
+//                  loop.
+//
+//                  Returned buffers are kept on their class's free list for
+//                  the next connection, up to BUFPOOL_KEEP_BYTES a class.
+//                  Sizes above the largest class are allocated and freed
+//                  directly, but are still borrowed and returned the same way.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#include <stddef.h>
+
+//
+// Constants
+
+#define BUFPOOL_MIN_SIZE 1024			//smallest class
+#define BUFPOOL_CLASSES 7			//classes from 1KB to 64KB
+#define BUFPOOL_KEEP_BYTES ( 4 * 1024 * 1024 )	//free bytes a class keeps, the rest go back to malloc
+
+//
+// Functional Prototypes
+
+void * borrowBuffer ( size_t size );
+void returnBuffer ( void *buffer );
+size_t bufferSize ( void *buffer );
+
+#endif
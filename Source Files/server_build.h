@@ -0,0 +1,95 @@
+#ifndef SERVER_BUILD_INCLUDED
+#define SERVER_BUILD_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_build.h
+//  Description   : Features picked when the server is compiled. Each one is
+//                  a constant the compiler sees, so a disabled feature leaves
+//                  nothing behind, not even a branch, on the request path.
+//
+//                  The defaults build the server as it has always been, with
+//                  debug logging and counters. Two other builds are useful:
+//
+//                    -DSERVER_FAST        the minimal server, no debug
+//                                         logging, counters or tracing
+//                    -DSERVER_TRACE=1     everything, plus trace points
+//                                         through a connection's life
+//
+//                  Any single feature can also be set with -D on its own.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#include <stdint.h>
+#include <time.h>
+#include <cmpsc311_log.h>
+
+//
+// Constants
+
+#ifdef SERVER_FAST
+#ifndef SERVER_DEBUG
+#define SERVER_DEBUG 0
+#endif
+#ifndef SERVER_METRICS
+#define SERVER_METRICS 0
+#endif
+#ifndef SERVER_TRACE
+#define SERVER_TRACE 0
+#endif
+#endif
+
+#ifndef SERVER_DEBUG
+#define SERVER_DEBUG 1			//per read, write and request messages at the info level
+#endif
+#ifndef SERVER_METRICS
+#define SERVER_METRICS 1		//counters in the shared segment, for /server-status
+#endif
+#ifndef SERVER_TRACE
+#define SERVER_TRACE 0			//timestamped trace points at the TRACE log level
+#endif
+
+/* DEBUG */
+#define DEBUG SERVER_DEBUG
+
+#if SERVER_TRACE
+#define SERVER_BUILD "traced"
+#elif SERVER_DEBUG || SERVER_METRICS
+#define SERVER_BUILD "standard"
+#else
+#define SERVER_BUILD "fast"
+#endif
+
+//
+// Functional Prototypes
+
+#if SERVER_TRACE
+extern unsigned long traceLevel;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : traceEvent
+// Description  : Log a trace point, with the monotonic time in microseconds
+//		  so events on different threads can be put in order
+//
+// Inputs       : event - what happened
+//		  fd - the connection's socket
+// Outputs      : none
+static inline void traceEvent ( const char *event, int fd ) {
+
+	struct timespec now;
+
+	clock_gettime ( CLOCK_MONOTONIC, &now );
+	logMessage ( traceLevel, "%s fd=%d at %llu", event, fd,
+			(unsigned long long)now.tv_sec * 1000000 + now.tv_nsec / 1000 );
+}
+#else
+static inline void traceEvent ( const char *event, int fd ) {
+	(void)event;
+	(void)fd;
+}
+#endif
+
+#endif
@@ -0,0 +1,693 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_bundle.c
+//  Description   : Packing, mapping and serving asset bundles. A bundle up to
+//                  BUNDLE_POPULATE_LIMIT is faulted in whole when it is mapped,
+//                  so the first request for any file is as fast as the last.
+//                  A larger one only has its index and strings read ahead, and
+//                  bodies come in from the page cache as they are asked for.
+//
+//                  Entries are checked against the size of the file when they
+//                  are looked up rather than when the bundle is mapped, which
+//                  keeps startup independent of the number of files.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fts.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <zlib.h>
+
+// Project Include Files
+#include <cmpsc311_log.h>
+#include <server.h>
+#include <server_bundle.h>
+
+//
+// Type Definitions
+
+typedef struct pack_file {
+	BUNDLE_ENTRY entry;		//offsets into the file are final, strings are not
+	char *path;
+	char *type;
+	char etag[48];
+} PACK_FILE;
+
+typedef struct pack_state {
+	int fd;				//the bundle being written
+	dev_t dev;			//so it is never packed into itself
+	ino_t ino;
+	uint64_t offset;		//where the next body goes
+	PACK_FILE *files;
+	int count;
+	int capacity;
+	char *strings;
+	uint64_t stringsLength;
+	uint64_t stringsCapacity;
+} PACK_STATE;
+
+//Functional Prototypes
+int checkEntry ( BUNDLE *bundle, const BUNDLE_ENTRY *entry );
+uint64_t hashBundlePath ( const char *path );
+uint64_t hashBytes ( const void *data, uint64_t length );
+int packFile ( PACK_STATE *state, const char *filename, const char *path, struct stat *sbuf );
+int writeBody ( PACK_STATE *state, const void *data, uint64_t length, uint64_t *offset );
+int gzipBody ( const void *data, uint64_t length, unsigned char **out, uint64_t *outLength );
+int packStrings ( PACK_STATE *state, PACK_FILE *file );
+int64_t appendPackString ( PACK_STATE *state, const char *text, int length );
+int comparePackFiles ( const void *a, const void *b );
+void freePackState ( PACK_STATE *state );
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : attachBundle
+// Description  : Map a bundle and serve a host's files from it
+//
+// Inputs       : host - the virtual host
+//		  filename - the bundle
+// Outputs      : 0 if successful, -1 if failure
+int attachBundle ( VIRTUAL_HOST *host, const char *filename ) {
+
+	if ( (host->bundle = openBundle ( filename )) == NULL )
+		return -1;
+
+	logMessage ( LOG_INFO_LEVEL, "Host %s serves %u files from bundle %s", host->name,
+			host->bundle->header->count, filename );
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : openBundle
+// Description  : Map a bundle read only and check its header. The mapping is
+//		  shared, so every process serving the bundle uses the same
+//		  page cache pages.
+//
+// Inputs       : filename - the bundle
+// Outputs      : the bundle, or NULL on failure
+BUNDLE * openBundle ( const char *filename ) {
+
+	struct stat sbuf;
+	BUNDLE *bundle;
+	uint64_t meta;
+	void *map;
+
+	if ( (bundle = calloc ( 1, sizeof(BUNDLE) )) == NULL )
+		return NULL;
+	snprintf ( bundle->filename, sizeof(bundle->filename), "%s", filename );
+
+	if ( (bundle->fd = open ( filename, O_RDONLY | O_CLOEXEC )) == -1 || fstat ( bundle->fd, &sbuf ) ) {
+		logMessage ( LOG_ERROR_LEVEL, "_openBundle:Can't open %s [%s]", filename, strerror(errno) );
+		goto fail;
+	}
+	if ( (uint64_t)sbuf.st_size < sizeof(BUNDLE_HEADER) ) {
+		logMessage ( LOG_ERROR_LEVEL, "_openBundle:%s is too short to be a bundle", filename );
+		goto fail;
+	}
+
+	bundle->size = sbuf.st_size;
+	map = mmap ( NULL, bundle->size, PROT_READ,
+			MAP_SHARED | ( ( bundle->size <= BUNDLE_POPULATE_LIMIT ) ? MAP_POPULATE : 0 ), bundle->fd, 0 );
+	if ( map == MAP_FAILED ) {
+		logMessage ( LOG_ERROR_LEVEL, "_openBundle:Can't map %s [%s]", filename, strerror(errno) );
+		goto fail;
+	}
+	bundle->map = map;
+	bundle->header = map;
+
+	//The strings end with a NUL, so no string can run off the end
+	if ( memcmp ( bundle->header->magic, BUNDLE_MAGIC, 8 ) || bundle->header->version != BUNDLE_VERSION ||
+	     bundle->header->size != bundle->size || bundle->header->count > BUNDLE_MAX_FILES ||
+	     bundle->header->stringsLength == 0 || bundle->header->strings > bundle->size ||
+	     bundle->header->stringsLength > bundle->size - bundle->header->strings ||
+	     bundle->header->index > bundle->size ||
+	     (uint64_t)bundle->header->count * sizeof(BUNDLE_ENTRY) > bundle->size - bundle->header->index ||
+	     bundle->map[bundle->header->strings + bundle->header->stringsLength - 1] != '\0' ) {
+		logMessage ( LOG_ERROR_LEVEL, "_openBundle:%s is not a version %d bundle", filename, BUNDLE_VERSION );
+		goto fail;
+	}
+	bundle->strings = (const char *)bundle->map + bundle->header->strings;
+	bundle->index = (const BUNDLE_ENTRY *)( bundle->map + bundle->header->index );
+
+	//Too large to fault in, but lookups should never wait on the disk
+	if ( bundle->size > BUNDLE_POPULATE_LIMIT ) {
+		meta = bundle->header->strings & ~(uint64_t)( BUNDLE_ALIGN - 1 );
+		madvise ( (void *)( bundle->map + meta ), bundle->size - meta, MADV_WILLNEED );
+	}
+
+	logMessage ( LOG_INFO_LEVEL, "Mapped bundle %s, %u files in %llu bytes%s", filename, bundle->header->count,
+			(unsigned long long)bundle->size, ( bundle->size <= BUNDLE_POPULATE_LIMIT ) ? ", populated" : "" );
+	return bundle;
+
+fail:
+	closeBundle ( bundle );
+	return NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : closeBundle
+// Description  : Unmap a bundle and close it
+//
+// Inputs       : bundle - the bundle
+// Outputs      : none
+void closeBundle ( BUNDLE *bundle ) {
+
+	if ( bundle->map != NULL )
+		munmap ( (void *)bundle->map, bundle->size );
+	if ( bundle->fd != -1 )
+		close ( bundle->fd );
+	free ( bundle );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : findBundleEntry
+// Description  : Look a path up in the bundle's index
+//
+// Inputs       : bundle - the bundle
+//		  path - uri path under the host's docroot, like /pages/index.html
+// Outputs      : the entry, or NULL if the path isn't bundled
+const BUNDLE_ENTRY * findBundleEntry ( BUNDLE *bundle, const char *path ) {
+
+	uint64_t hash = hashBundlePath ( path );
+	uint32_t low = 0, high = bundle->header->count, mid;
+
+	//Lower bound of the hash, then the paths that share it
+	while ( low < high ) {
+		mid = low + ( high - low ) / 2;
+		if ( bundle->index[mid].hash < hash )
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	for ( ; low < bundle->header->count && bundle->index[low].hash == hash; low++ ) {
+		if ( bundle->index[low].path < bundle->header->stringsLength &&
+		     !strcmp ( bundleString ( bundle, bundle->index[low].path ), path ) )
+			return ( checkEntry ( bundle, &bundle->index[low] ) ) ? NULL : &bundle->index[low];
+	}
+	return NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bundleString
+// Description  : A string from the bundle's strings
+//
+// Inputs       : bundle - the bundle
+//		  offset - offset of the string
+// Outputs      : the string
+const char * bundleString ( BUNDLE *bundle, uint32_t offset ) {
+	return bundle->strings + offset;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bundleNotModified
+// Description  : Check whether the client's cached copy is still current
+//
+// Inputs       : bundle - the bundle
+//		  entry - the file
+//		  request - the request, with its If-None-Match
+// Outputs      : 1 if a 304 will do, 0 if not
+int bundleNotModified ( BUNDLE *bundle, const BUNDLE_ENTRY *entry, HTTP_REQUEST *request ) {
+
+	return request->ifNoneMatch[0] != '\0' && ( !strcmp ( request->ifNoneMatch, "*" ) ||
+			headerHasToken ( request->ifNoneMatch, bundleString ( bundle, entry->etag ) ) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : serveBundleEntry
+// Description  : Send a bundled file, gzipped when the client takes it and
+//		  the packer kept a variant. The head was built by the packer,
+//		  and the body goes out with sendfile from the bundle.
+//
+// Inputs       : client - socket file handle
+//		  bundle - the bundle
+//		  entry - the file
+//		  request - the request
+//		  headOnly - send only the headers, for a HEAD request
+// Outputs      : 0 if successful, -1 if failure
+int serveBundleEntry ( int client, BUNDLE *bundle, const BUNDLE_ENTRY *entry, HTTP_REQUEST *request, int headOnly ) {
+
+	char head[MAXLINE];
+	int gzip = request->acceptGzip && entry->gzipLength > 0;
+	off_t offset = ( gzip ) ? entry->gzip : entry->body;
+	off_t end = offset + ( ( gzip ) ? entry->gzipLength : entry->bodyLength );
+	ssize_t sent;
+
+	if ( bundleNotModified ( bundle, entry, request ) ) {
+		snprintf ( head, sizeof(head), "HTTP/1.0 304 Not Modified\r\n"
+				"Server: " SERVER_NAME "\r\n"
+				"ETag: %s\r\n\r\n", bundleString ( bundle, entry->etag ) );
+		return sendBytes ( client, strlen(head), head );
+	}
+
+	if ( sendBytes ( client, ( gzip ) ? entry->gzipHeadLength : entry->headLength,
+			(char *)bundleString ( bundle, ( gzip ) ? entry->gzipHead : entry->head ) ) )
+		return -1;
+	if ( headOnly )
+		return 0;
+
+	if ( !canSendDirect ( client ) )
+		return sendBytes ( client, end - offset, (char *)bundle->map + offset );
+	while ( offset < end ) {
+		if ( (sent = sendfile ( client, bundle->fd, &offset, end - offset )) <= 0 ) {
+			if ( sent == -1 && errno == EINTR )
+				continue;
+			logMessage ( LOG_ERROR_LEVEL, "_serveBundleEntry:sendfile failed [%s]", ( sent ) ? strerror(errno) : "bundle shrank" );
+			return -1;
+		}
+		countTransfer ( client, 0, sent );
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : packBundle
+// Description  : Pack every static file under a host's docroot into a bundle.
+//		  The bundle is written next to its final name and renamed into
+//		  place, so a server mapping the old one is never disturbed.
+//
+// Inputs       : host - the virtual host, for its docroot and cgi prefix
+//		  filename - the bundle to write
+// Outputs      : 0 if successful, -1 if failure
+int packBundle ( VIRTUAL_HOST *host, const char *filename ) {
+
+	char temp[VHOST_PATH_MAX + 8];
+	char *roots[2] = { host->docroot, NULL };
+	BUNDLE_HEADER header;
+	PACK_STATE state;
+	struct stat sbuf;
+	FTSENT *node;
+	FTS *walk;
+	int ret = -1;
+
+	memset ( &state, 0, sizeof(state) );
+	state.offset = BUNDLE_ALIGN;			//the header has the first page
+	snprintf ( temp, sizeof(temp), "%s.tmp", filename );
+	if ( (state.fd = open ( temp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 )) == -1 || fstat ( state.fd, &sbuf ) ) {
+		logMessage ( LOG_ERROR_LEVEL, "_packBundle:Can't create %s [%s]", temp, strerror(errno) );
+		return -1;
+	}
+	state.dev = sbuf.st_dev;
+	state.ino = sbuf.st_ino;
+
+	if ( (walk = fts_open ( roots, FTS_PHYSICAL | FTS_NOCHDIR, NULL )) == NULL ) {
+		logMessage ( LOG_ERROR_LEVEL, "_packBundle:Can't read %s [%s]", host->docroot, strerror(errno) );
+		goto done;
+	}
+	while ( (node = fts_read ( walk )) != NULL ) {
+		//CGI programs run, they are never sent
+		if ( node->fts_info != FTS_F || ( node->fts_statp->st_dev == state.dev && node->fts_statp->st_ino == state.ino ) ||
+		     !strncmp ( node->fts_path + strlen(host->docroot), host->cgiPrefix, strlen(host->cgiPrefix) ) ||
+		     !( node->fts_statp->st_mode & S_IRUSR ) || strlen ( node->fts_path ) >= MAXLINE )
+			continue;
+		if ( packFile ( &state, node->fts_path, node->fts_path + strlen(host->docroot), node->fts_statp ) ) {
+			fts_close ( walk );
+			goto done;
+		}
+	}
+	fts_close ( walk );
+
+	//Strings and index follow the last body
+	qsort ( state.files, state.count, sizeof(PACK_FILE), comparePackFiles );
+	for ( int i = 0; i < state.count; i++ ) {
+		if ( packStrings ( &state, &state.files[i] ) )
+			goto done;
+	}
+
+	memset ( &header, 0, sizeof(header) );
+	memcpy ( header.magic, BUNDLE_MAGIC, 8 );
+	header.version = BUNDLE_VERSION;
+	header.count = state.count;
+	header.strings = state.offset;
+	header.stringsLength = state.stringsLength;
+	header.index = state.offset + state.stringsLength;
+	header.index = ( header.index + 7 ) & ~(uint64_t)7;
+	header.size = header.index + (uint64_t)state.count * sizeof(BUNDLE_ENTRY);
+	header.packed = time ( NULL );
+
+	if ( pwrite ( state.fd, state.strings, state.stringsLength, header.strings ) != (ssize_t)state.stringsLength ) {
+		logMessage ( LOG_ERROR_LEVEL, "_packBundle:Can't write %s [%s]", temp, strerror(errno) );
+		goto done;
+	}
+	for ( int i = 0; i < state.count; i++ ) {
+		if ( pwrite ( state.fd, &state.files[i].entry, sizeof(BUNDLE_ENTRY),
+				header.index + (uint64_t)i * sizeof(BUNDLE_ENTRY) ) != sizeof(BUNDLE_ENTRY) ) {
+			logMessage ( LOG_ERROR_LEVEL, "_packBundle:Can't write %s [%s]", temp, strerror(errno) );
+			goto done;
+		}
+	}
+	if ( ftruncate ( state.fd, header.size ) || pwrite ( state.fd, &header, sizeof(header), 0 ) != sizeof(header) ||
+	     fsync ( state.fd ) || rename ( temp, filename ) ) {
+		logMessage ( LOG_ERROR_LEVEL, "_packBundle:Can't finish %s [%s]", filename, strerror(errno) );
+		goto done;
+	}
+
+	logMessage ( LOG_INFO_LEVEL, "Packed %d files from %s into %s, %llu bytes", state.count, host->docroot,
+			filename, (unsigned long long)header.size );
+	ret = 0;
+
+done:
+	close ( state.fd );
+	if ( ret )
+		unlink ( temp );
+	freePackState ( &state );
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : checkEntry
+// Description  : Check that an entry's strings and bodies are inside the
+//		  bundle, before anything is sent from it
+//
+// Inputs       : bundle - the bundle
+//		  entry - the entry
+// Outputs      : 0 if it is sound, -1 if not
+int checkEntry ( BUNDLE *bundle, const BUNDLE_ENTRY *entry ) {
+
+	uint64_t strings = bundle->header->stringsLength;
+
+	if ( entry->type >= strings || entry->etag >= strings ||
+	     entry->head >= strings || entry->headLength > strings - entry->head ||
+	     entry->gzipHead >= strings || entry->gzipHeadLength > strings - entry->gzipHead ||
+	     entry->body > bundle->size || entry->bodyLength > bundle->size - entry->body ||
+	     entry->gzip > bundle->size || entry->gzipLength > bundle->size - entry->gzip ) {
+		logMessage ( LOG_ERROR_LEVEL, "_checkEntry:Bundle %s has a damaged entry for %s", bundle->filename,
+				bundleString ( bundle, entry->path ) );
+		return -1;
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hashBundlePath
+// Description  : Hash of a path, the index's sort key
+//
+// Inputs       : path - the path
+// Outputs      : the hash
+uint64_t hashBundlePath ( const char *path ) {
+	return hashBytes ( path, strlen(path) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hashBytes
+// Description  : 64 bit FNV-1a hash
+//
+// Inputs       : data - the bytes
+//		  length - how many
+// Outputs      : the hash
+uint64_t hashBytes ( const void *data, uint64_t length ) {
+
+	const unsigned char *p = (const unsigned char *)data;
+	uint64_t hash = 14695981039346656037ULL;
+
+	for ( uint64_t i = 0; i < length; i++ ) {
+		hash ^= p[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : packFile
+// Description  : Write one file's body, and its gzip variant if that is
+//		  enough smaller, and note it for the index
+//
+// Inputs       : state - the bundle being packed
+//		  filename - the file
+//		  path - its uri path
+//		  sbuf - its stat
+// Outputs      : 0 if successful, -1 if failure
+int packFile ( PACK_STATE *state, const char *filename, const char *path, struct stat *sbuf ) {
+
+	char type[MAXLINE];
+	unsigned char *gzip = NULL;
+	uint64_t gzipLength = 0;
+	void *data = NULL;
+	PACK_FILE *file;
+	int fd, ret = -1;
+
+	if ( state->count == BUNDLE_MAX_FILES ) {
+		logMessage ( LOG_ERROR_LEVEL, "_packFile:More than %d files", BUNDLE_MAX_FILES );
+		return -1;
+	}
+	if ( state->count == state->capacity ) {
+		state->capacity = ( state->capacity ) ? state->capacity * 2 : 256;
+		if ( (file = realloc ( state->files, state->capacity * sizeof(PACK_FILE) )) == NULL )
+			return -1;
+		state->files = file;
+	}
+	file = &state->files[state->count];
+	memset ( file, 0, sizeof(PACK_FILE) );
+
+	if ( (fd = open ( filename, O_RDONLY | O_CLOEXEC )) == -1 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_packFile:Can't open %s [%s]", filename, strerror(errno) );
+		return -1;
+	}
+	if ( sbuf->st_size > 0 && (data = mmap ( NULL, sbuf->st_size, PROT_READ, MAP_PRIVATE, fd, 0 )) == MAP_FAILED ) {
+		logMessage ( LOG_ERROR_LEVEL, "_packFile:Can't map %s [%s]", filename, strerror(errno) );
+		close ( fd );
+		return -1;
+	}
+	close ( fd );
+
+	//The ETag changes with the content, not with the file's mtime
+	get_filetype ( (char *)filename, type );
+	file->path = strdup ( path );
+	file->type = strdup ( type );
+	snprintf ( file->etag, sizeof(file->etag), "\"%016llx-%llx\"",
+			(unsigned long long)hashBytes ( data, sbuf->st_size ), (unsigned long long)sbuf->st_size );
+	file->entry.hash = hashBundlePath ( path );
+	file->entry.bodyLength = sbuf->st_size;
+
+	if ( file->path == NULL || file->type == NULL ||
+	     writeBody ( state, data, sbuf->st_size, &file->entry.body ) ||
+	     gzipBody ( data, sbuf->st_size, &gzip, &gzipLength ) )
+		goto done;
+	if ( gzip != NULL && gzipLength * 100 < (uint64_t)sbuf->st_size * BUNDLE_GZIP_RATIO ) {
+		if ( writeBody ( state, gzip, gzipLength, &file->entry.gzip ) )
+			goto done;
+		file->entry.gzipLength = gzipLength;
+	}
+	state->count++;
+	ret = 0;
+
+done:
+	if ( ret ) {
+		free ( file->path );
+		free ( file->type );
+	}
+	free ( gzip );
+	if ( data != NULL )
+		munmap ( data, sbuf->st_size );
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : writeBody
+// Description  : Write a body at the next page boundary
+//
+// Inputs       : state - the bundle being packed
+//		  data - the body
+//		  length - its length
+//		  offset - where to put the offset it was written at
+// Outputs      : 0 if successful, -1 if failure
+int writeBody ( PACK_STATE *state, const void *data, uint64_t length, uint64_t *offset ) {
+
+	uint64_t done = 0;
+	ssize_t wrote;
+
+	*offset = state->offset;
+	while ( done < length ) {
+		if ( (wrote = pwrite ( state->fd, (const char *)data + done, length - done, state->offset + done )) <= 0 ) {
+			if ( wrote == -1 && errno == EINTR )
+				continue;
+			logMessage ( LOG_ERROR_LEVEL, "_writeBody:Can't write the bundle [%s]", strerror(errno) );
+			return -1;
+		}
+		done += wrote;
+	}
+	state->offset = ( state->offset + length + BUNDLE_ALIGN - 1 ) & ~(uint64_t)( BUNDLE_ALIGN - 1 );
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : gzipBody
+// Description  : Compress a body the way a Content-Encoding: gzip response
+//		  carries it
+//
+// Inputs       : data - the body
+//		  length - its length
+//		  out - where to put the malloc'd result, NULL for an empty body
+//		  outLength - where to put its length
+// Outputs      : 0 if successful, -1 if failure
+int gzipBody ( const void *data, uint64_t length, unsigned char **out, uint64_t *outLength ) {
+
+	z_stream zs;
+	int ret;
+
+	*out = NULL;
+	*outLength = 0;
+	if ( length == 0 || length > UINT32_MAX )
+		return 0;
+
+	memset ( &zs, 0, sizeof(zs) );
+	if ( deflateInit2 ( &zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY ) != Z_OK )
+		return -1;
+	if ( (*out = malloc ( deflateBound ( &zs, length ) )) == NULL ) {
+		deflateEnd ( &zs );
+		return -1;
+	}
+	zs.next_in = (unsigned char *)data;
+	zs.avail_in = length;
+	zs.next_out = *out;
+	zs.avail_out = deflateBound ( &zs, length );
+	ret = deflate ( &zs, Z_FINISH );
+	*outLength = zs.total_out;
+	deflateEnd ( &zs );
+
+	if ( ret != Z_STREAM_END ) {
+		logMessage ( LOG_ERROR_LEVEL, "_gzipBody:deflate failed [%d]", ret );
+		free ( *out );
+		*out = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : packStrings
+// Description  : Add a file's path, type, ETag and response heads to the
+//		  strings, and point its entry at them
+//
+// Inputs       : state - the bundle being packed
+//		  file - the file
+// Outputs      : 0 if successful, -1 if failure
+int packStrings ( PACK_STATE *state, PACK_FILE *file ) {
+
+	char head[MAXLINE * 2];
+	int64_t offsets[5];
+	int len;
+
+	//Heads look exactly like serve_static's, plus the validator
+	len = snprintf ( head, sizeof(head), "HTTP/1.0 200 OK\r\n"
+			"Server: " SERVER_NAME "\r\n"
+			"Content-length: %llu\r\n"
+			"Content-type: %s\r\n"
+			"ETag: %s\r\n%s\r\n",
+			(unsigned long long)file->entry.bodyLength, file->type, file->etag,
+			( file->entry.gzipLength ) ? "Vary: Accept-Encoding\r\n" : "" );
+	offsets[0] = appendPackString ( state, file->path, strlen(file->path) );
+	offsets[1] = appendPackString ( state, file->type, strlen(file->type) );
+	offsets[2] = appendPackString ( state, file->etag, strlen(file->etag) );
+	offsets[3] = appendPackString ( state, head, len );
+	file->entry.headLength = len;
+
+	len = snprintf ( head, sizeof(head), "HTTP/1.0 200 OK\r\n"
+			"Server: " SERVER_NAME "\r\n"
+			"Content-length: %llu\r\n"
+			"Content-type: %s\r\n"
+			"Content-encoding: gzip\r\n"
+			"ETag: %s\r\n"
+			"Vary: Accept-Encoding\r\n\r\n",
+			(unsigned long long)file->entry.gzipLength, file->type, file->etag );
+	offsets[4] = ( file->entry.gzipLength ) ? appendPackString ( state, head, len ) : 0;
+	file->entry.gzipHeadLength = ( file->entry.gzipLength ) ? len : 0;
+
+	for ( int i = 0; i < 5; i++ ) {
+		if ( offsets[i] == -1 )
+			return -1;
+	}
+	file->entry.path = offsets[0];
+	file->entry.type = offsets[1];
+	file->entry.etag = offsets[2];
+	file->entry.head = offsets[3];
+	file->entry.gzipHead = offsets[4];
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : appendPackString
+// Description  : Add a NUL terminated string to the strings
+//
+// Inputs       : state - the bundle being packed
+//		  text - the string
+//		  length - its length
+// Outputs      : its offset, or -1 if failure
+int64_t appendPackString ( PACK_STATE *state, const char *text, int length ) {
+
+	uint64_t offset = state->stringsLength;
+	char *grown;
+
+	if ( offset + length + 1 > UINT32_MAX ) {
+		logMessage ( LOG_ERROR_LEVEL, "_appendPackString:More than 4GB of strings" );
+		return -1;
+	}
+	if ( offset + length + 1 > state->stringsCapacity ) {
+		state->stringsCapacity = ( state->stringsCapacity + length + 1 ) * 2;
+		if ( (grown = realloc ( state->strings, state->stringsCapacity )) == NULL )
+			return -1;
+		state->strings = grown;
+	}
+	memcpy ( state->strings + offset, text, length );
+	state->strings[offset + length] = '\0';
+	state->stringsLength += length + 1;
+	return offset;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : comparePackFiles
+// Description  : qsort comparison, index order is by hash, then path
+//
+// Inputs       : a, b - the PACK_FILEs
+// Outputs      : <0, 0 or >0
+int comparePackFiles ( const void *a, const void *b ) {
+
+	const PACK_FILE *x = (const PACK_FILE *)a, *y = (const PACK_FILE *)b;
+
+	if ( x->entry.hash != y->entry.hash )
+		return ( x->entry.hash < y->entry.hash ) ? -1 : 1;
+	return strcmp ( x->path, y->path );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : freePackState
+// Description  : Free what packing allocated
+//
+// Inputs       : state - the bundle being packed
+// Outputs      : none
+void freePackState ( PACK_STATE *state ) {
+
+	for ( int i = 0; i < state->count; i++ ) {
+		free ( state->files[i].path );
+		free ( state->files[i].type );
+	}
+	free ( state->files );
+	free ( state->strings );
+}
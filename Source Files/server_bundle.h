@@ -0,0 +1,99 @@
+#ifndef SERVER_BUNDLE_INCLUDED
+#define SERVER_BUNDLE_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_bundle.h
+//  Description   : Asset bundles, a whole docroot packed offline into one
+//                  indexed file that the server maps at startup. A request
+//                  for a bundled file is a binary search over the mapped
+//                  index and a send of precomputed headers and a page aligned
+//                  body, with no stat, open or mmap per request. Every server
+//                  process that maps the same bundle shares its pages through
+//                  the page cache.
+//
+//                  The file is laid out as
+//
+//                      header | bodies, each page aligned | strings | index
+//
+//                  The index is sorted by path hash, then path. Strings hold
+//                  the paths, content types, ETags and the HTTP/1.0 response
+//                  heads, one for the plain body and one for the gzip variant
+//                  when the packer kept one.
+//
+//                  A bundle is attached to a host with bundle=<file> in the
+//                  hosts file, or to the default host with -b. Files that
+//                  aren't in the bundle are still served from the docroot.
+//                  Packing needs -lz.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#include <stdint.h>
+#include <server.h>
+
+//
+// Constants
+
+#define BUNDLE_MAGIC "GHWSBNDL"
+#define BUNDLE_VERSION 1
+#define BUNDLE_ALIGN 4096			//bodies start on a page boundary
+#define BUNDLE_POPULATE_LIMIT ( 1024L * 1024 * 1024 )	//bundles up to this size are faulted in at startup
+#define BUNDLE_GZIP_RATIO 90			//keep a gzip variant under this percent of the body
+#define BUNDLE_MAX_FILES 1000000		//files in one bundle
+
+//
+// Type Definitions
+
+typedef struct bundle_header {
+	char magic[8];			//BUNDLE_MAGIC, not NUL terminated
+	uint32_t version;		//BUNDLE_VERSION
+	uint32_t count;			//entries in the index
+	uint64_t strings;		//file offset of the strings
+	uint64_t stringsLength;
+	uint64_t index;			//file offset of the index
+	uint64_t size;			//length of the whole file
+	int64_t packed;			//time the bundle was packed
+} BUNDLE_HEADER;
+
+// String fields are offsets into the strings, data fields offsets into the file
+typedef struct bundle_entry {
+	uint64_t hash;			//hash of the path
+	uint32_t path;			//uri path, like /pages/index.html
+	uint32_t type;			//Content-Type
+	uint32_t etag;			//strong ETag, quoted
+	uint32_t head;			//response head for the plain body
+	uint32_t headLength;
+	uint32_t gzipHead;		//response head for the gzip variant
+	uint32_t gzipHeadLength;
+	uint32_t reserved;
+	uint64_t body;
+	uint64_t bodyLength;
+	uint64_t gzip;			//gzip variant, gzipLength is 0 if there is none
+	uint64_t gzipLength;
+} BUNDLE_ENTRY;
+
+typedef struct bundle {
+	char filename[VHOST_PATH_MAX];
+	int fd;				//kept open for sendfile
+	const unsigned char *map;	//the whole file, read only
+	uint64_t size;
+	const BUNDLE_HEADER *header;
+	const BUNDLE_ENTRY *index;
+	const char *strings;
+} BUNDLE;
+
+//
+// Functional Prototypes
+
+int attachBundle ( VIRTUAL_HOST *host, const char *filename );
+BUNDLE * openBundle ( const char *filename );
+void closeBundle ( BUNDLE *bundle );
+const BUNDLE_ENTRY * findBundleEntry ( BUNDLE *bundle, const char *path );
+const char * bundleString ( BUNDLE *bundle, uint32_t offset );
+int bundleNotModified ( BUNDLE *bundle, const BUNDLE_ENTRY *entry, HTTP_REQUEST *request );
+int serveBundleEntry ( int client, BUNDLE *bundle, const BUNDLE_ENTRY *entry, HTTP_REQUEST *request, int headOnly );
+int packBundle ( VIRTUAL_HOST *host, const char *filename );
+
+#endif
@@ -0,0 +1,123 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_busypoll.c
+//  Description   : Setting up busy polling, in the server and in the kernel.
+//                  The spinning itself is in the event loop and the workers'
+//                  wait for work.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+
+// Project Include Files
+#include <cmpsc311_log.h>
+#include <server_busypoll.h>
+
+// Not every libc has these yet
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL 46
+#endif
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69
+#endif
+#ifndef EPIOCSPARAMS
+struct epoll_params {
+	uint32_t busy_poll_usecs;
+	uint16_t busy_poll_budget;
+	uint8_t prefer_busy_poll;
+	uint8_t __pad;
+};
+#define EPIOCSPARAMS _IOW ( 0x8A, 0x01, struct epoll_params )
+#endif
+
+// Global Variables
+long busyPollUsecs = 0;			//spin budget, 0 when busy polling is off
+int busyPollWarned = 0;			//the kernel turned SO_BUSY_POLL down once already
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : setupBusyPoll
+// Description  : Turn busy polling on, before the event loop and workers start
+//
+// Inputs       : usecs - microseconds to spin for more work, 0 for none
+// Outputs      : none
+void setupBusyPoll ( long usecs ) {
+
+	busyPollUsecs = usecs;
+	if ( usecs )
+		logMessage ( LOG_INFO_LEVEL, "Busy polling for %ld us before sleeping", usecs );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : busyPollTime
+// Description  : Get how long a thread spins for more work
+//
+// Inputs       : none
+// Outputs      : the budget in ns, 0 when busy polling is off
+uint64_t busyPollTime ( void ) {
+
+	return (uint64_t)busyPollUsecs * 1000ULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : busyPollEpoll
+// Description  : Have the kernel busy poll the devices of an epoll
+//		  instance's sockets before epoll_wait sleeps
+//
+// Inputs       : fd - the epoll instance
+// Outputs      : none
+void busyPollEpoll ( int fd ) {
+
+	struct epoll_params params;
+
+	if ( busyPollUsecs == 0 )
+		return;
+
+	memset ( &params, 0, sizeof(params) );
+	params.busy_poll_usecs = busyPollUsecs;
+	params.busy_poll_budget = BUSY_POLL_PACKETS;
+	params.prefer_busy_poll = 1;
+	//An older kernel just doesn't busy poll in epoll_wait
+	if ( ioctl ( fd, EPIOCSPARAMS, &params ) == -1 )
+		logMessage ( LOG_WARNING_LEVEL, "Epoll won't busy poll, the server still spins [%s]", strerror(errno) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : busyPollSocket
+// Description  : Have blocking reads on a socket, and on the ones it accepts,
+//		  busy poll the device queue
+//
+// Inputs       : fd - the socket
+// Outputs      : 0 if successful or busy polling is off, -1 if failure
+int busyPollSocket ( int fd ) {
+
+	int usecs = busyPollUsecs, prefer = 1;
+
+	if ( busyPollUsecs == 0 )
+		return 0;
+
+	if ( setsockopt ( fd, SOL_SOCKET, SO_BUSY_POLL, &usecs, sizeof(usecs) ) == -1 ||
+	     setsockopt ( fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &prefer, sizeof(prefer) ) == -1 ) {
+		if ( errno != EPERM && errno != ENOPROTOOPT ) {
+			logMessage ( LOG_ERROR_LEVEL, "_busyPollSocket:Can't busy poll socket %d [%s]", fd, strerror(errno) );
+			return -1;
+		}
+		if ( !busyPollWarned ) {
+			busyPollWarned = 1;
+			logMessage ( LOG_WARNING_LEVEL, "Sockets won't busy poll in the kernel, the server still spins [%s]", strerror(errno) );
+		}
+	}
+	return 0;
+}
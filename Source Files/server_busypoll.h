@@ -0,0 +1,64 @@
+#ifndef SERVER_BUSYPOLL_INCLUDED
+#define SERVER_BUSYPOLL_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_busypoll.h
+//  Description   : The low-latency mode, for deployments that would rather
+//                  burn CPU than wait on a wakeup. With busy-poll set, a
+//                  thread that just had work looks for more for that many
+//                  microseconds before it goes to sleep. The event loop polls
+//                  epoll without a timeout, and an idle worker keeps checking
+//                  the rings instead of sleeping on its semaphore. A busy
+//                  server never sleeps at all, and a quiet one sleeps as it
+//                  always has once the budget runs out.
+//
+//                  The kernel is asked to busy poll as well. Listeners set
+//                  SO_BUSY_POLL and SO_PREFER_BUSY_POLL, which accepted
+//                  sockets inherit, so blocking reads on them spin on the
+//                  device queue. The event loop's epoll instance gets the same
+//                  budget where the kernel takes EPIOCSPARAMS. Raising
+//                  SO_BUSY_POLL over net.core.busy_read needs CAP_NET_ADMIN,
+//                  and without it only the server's own spinning is done.
+//
+//                  Spinning threads should each have a CPU of their own. With
+//                  a list of CPUs, cpus isolated for the kernel's isolcpus,
+//                  each worker thread is pinned to its own CPU next to the
+//                  event loop's.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#include <stdint.h>
+
+//
+// Constants
+
+#define BUSY_POLL_PACKETS 8			//packets the kernel takes from the device each poll
+
+//
+// Functional Prototypes
+
+void setupBusyPoll ( long usecs );
+uint64_t busyPollTime ( void );
+void busyPollEpoll ( int fd );
+int busyPollSocket ( int fd );
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : spinPause
+// Description  : Tell the CPU we are spinning, so it saves power and gives
+//		  its sibling hyperthread the pipeline
+//
+// Inputs       : none
+// Outputs      : none
+static inline void spinPause ( void ) {
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause ();
+#elif defined(__aarch64__)
+	__asm__ __volatile__ ( "yield" );
+#endif
+}
+
+#endif
@@ -0,0 +1,305 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_capture.c
+//  Description   : Capturing requests. Each worker builds the record of the
+//                  request it is reading in a buffer of its own, and copies
+//                  it into the ring once the headers are in. The writer
+//                  thread takes whatever is in the ring under the lock and
+//                  writes it out after letting go.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#include <sys/types.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+
+// Project Include Files
+#include <cmpsc311_log.h>
+#include <server_capture.h>
+#include <server_shared.h>
+#include <server_config.h>
+
+// Global Variables
+char captureFile[CONFIG_PATH_MAX];		//empty when nothing is captured
+long captureSample = 0;				//capture one request in this many
+uint64_t captureStart = 0;			//monotonic time the capture started
+uint64_t captureSeen = 0;			//requests sampling has looked at
+int captureFd = -1;
+int captureFailed = 0;				//the file couldn't be written, stop sampling
+char *captureRing = NULL;			//records waiting for the writer
+char *captureOut = NULL;			//the writer's copy of them
+size_t ringHead = 0, ringUsed = 0;
+int captureStopping = 0, captureRunning = 0;
+pthread_t captureThread;
+pthread_mutex_t captureLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t captureReady = PTHREAD_COND_INITIALIZER;
+
+__thread char captureHead[sizeof(CAPTURE_RECORD) + CAPTURE_HEAD_MAX];	//the record being built
+__thread int captureLength = -1;		//bytes of it so far, -1 when not capturing
+
+//
+// Functional Prototypes
+
+void * captureLoop ( void *arg );
+void appendCapture ( const char *data, int length );
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : setupCapture
+// Description  : Start a new capture file, before any worker process is
+//		  forked so they all share its start time
+//
+// Inputs       : filename - the capture file, NULL or empty for no capture
+//		  sample - capture one request in this many
+// Outputs      : 0 if successful, -1 if failure
+int setupCapture ( const char *filename, long sample ) {
+
+	int fd;
+
+	if ( filename == NULL || filename[0] == '\0' )
+		return 0;
+	if ( strlen ( filename ) >= sizeof(captureFile) || sample < 1 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_setupCapture:Bad capture file or sample rate" );
+		return -1;
+	}
+
+	if ( (fd = open ( filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 )) == -1 ||
+	     write ( fd, CAPTURE_MAGIC, CAPTURE_MAGIC_LENGTH ) != CAPTURE_MAGIC_LENGTH ) {
+		logMessage ( LOG_ERROR_LEVEL, "_setupCapture:Can't start capture file %s [%s]", filename, strerror(errno) );
+		if ( fd != -1 )
+			close ( fd );
+		return -1;
+	}
+	close ( fd );
+
+	strcpy ( captureFile, filename );
+	captureSample = sample;
+	captureStart = monotonicTime();
+	logMessage ( LOG_INFO_LEVEL, "Capturing one request in %ld to %s", sample, filename );
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : startCapture
+// Description  : Open this process's end of the capture file and start the
+//		  writer thread
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+int startCapture ( void ) {
+
+	sigset_t blocked, previous;
+	int ret;
+
+	if ( !captureFile[0] )
+		return 0;
+
+	//Whole records go out in each write, so processes appending at once
+	//never split one
+	if ( (captureFd = open ( captureFile, O_WRONLY | O_APPEND | O_CLOEXEC )) == -1 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_startCapture:Can't open %s [%s]", captureFile, strerror(errno) );
+		return -1;
+	}
+	if ( (captureRing = malloc ( CAPTURE_RING_BYTES )) == NULL || (captureOut = malloc ( CAPTURE_RING_BYTES )) == NULL ) {
+		logMessage ( LOG_ERROR_LEVEL, "_startCapture:Out of memory for the capture ring" );
+		return -1;
+	}
+	captureStopping = 0;
+
+	//Like the workers, the writer leaves SIGINT and SIGHUP to the event loop
+	sigemptyset ( &blocked );
+	sigaddset ( &blocked, SIGINT );
+	sigaddset ( &blocked, SIGHUP );
+	pthread_sigmask ( SIG_BLOCK, &blocked, &previous );
+	ret = pthread_create ( &captureThread, NULL, captureLoop, NULL );
+	pthread_sigmask ( SIG_SETMASK, &previous, NULL );
+
+	if ( ret ) {
+		logMessage ( LOG_ERROR_LEVEL, "_startCapture:Failed to create the capture writer" );
+		return -1;
+	}
+	captureRunning = 1;
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : stopCapture
+// Description  : Write out what is left in the ring and stop the writer.
+//		  The workers must already be stopped.
+//
+// Inputs       : none
+// Outputs      : none
+void stopCapture ( void ) {
+
+	pthread_mutex_lock ( &captureLock );
+	captureStopping = 1;
+	pthread_cond_signal ( &captureReady );
+	pthread_mutex_unlock ( &captureLock );
+
+	if ( captureRunning )
+		pthread_join ( captureThread, NULL );
+	captureRunning = 0;
+
+	if ( captureFd != -1 )
+		close ( captureFd );
+	captureFd = -1;
+	free ( captureRing );
+	free ( captureOut );
+	captureRing = captureOut = NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : captureRequestLine
+// Description  : Decide whether to capture the request, and start its record
+//		  with the request line if so
+//
+// Inputs       : conn - the connection the request came on
+//		  line - the request line as read, with its line ending
+// Outputs      : none
+void captureRequestLine ( CLIENT_CONN *conn, const char *line ) {
+
+	CAPTURE_RECORD *record = (CAPTURE_RECORD *)captureHead;
+
+	captureLength = -1;
+	if ( captureFd == -1 || __atomic_load_n ( &captureFailed, __ATOMIC_RELAXED ) ||
+	     __atomic_fetch_add ( &captureSeen, 1, __ATOMIC_RELAXED ) % captureSample )
+		return;
+
+	record->time = ( conn->acceptTime > captureStart ) ? conn->acceptTime - captureStart : 0;
+	captureLength = sizeof(CAPTURE_RECORD);
+	appendCapture ( line, strlen ( line ) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : captureHeaderLine
+// Description  : Add a header line to the record, if the request is being
+//		  captured
+//
+// Inputs       : line - the header line as read, before it is parsed
+// Outputs      : none
+void captureHeaderLine ( const char *line ) {
+
+	if ( captureLength != -1 )
+		appendCapture ( line, strlen ( line ) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : finishCapture
+// Description  : Hand the finished record to the writer, once the headers
+//		  are in, if the request can be replayed
+//
+// Inputs       : request - the parsed request
+// Outputs      : none
+void finishCapture ( HTTP_REQUEST *request ) {
+
+	CAPTURE_RECORD *record = (CAPTURE_RECORD *)captureHead;
+	size_t tail;
+
+	if ( captureLength == -1 )
+		return;
+	appendCapture ( "\r\n", ( request->version[0] ) ? 2 : 0 );
+	if ( captureLength == -1 || request->chunked || request->upgrade[0] )
+		return;
+	record->length = captureLength - sizeof(CAPTURE_RECORD);
+	record->body = ( request->contentLength > 0 && request->contentLength <= UINT32_MAX ) ? request->contentLength : 0;
+
+	pthread_mutex_lock ( &captureLock );
+	if ( ringUsed + captureLength > CAPTURE_RING_BYTES ) {
+		pthread_mutex_unlock ( &captureLock );
+		countStat ( STAT_CAPTURE_DROPPED, 1 );
+		captureLength = -1;
+		return;
+	}
+	tail = ( ringHead + ringUsed ) % CAPTURE_RING_BYTES;
+	if ( tail + captureLength <= CAPTURE_RING_BYTES )
+		memcpy ( &captureRing[tail], captureHead, captureLength );
+	else {
+		memcpy ( &captureRing[tail], captureHead, CAPTURE_RING_BYTES - tail );
+		memcpy ( captureRing, &captureHead[CAPTURE_RING_BYTES - tail], captureLength - ( CAPTURE_RING_BYTES - tail ) );
+	}
+	ringUsed += captureLength;
+	if ( ringUsed > CAPTURE_RING_BYTES / 2 )
+		pthread_cond_signal ( &captureReady );
+	pthread_mutex_unlock ( &captureLock );
+
+	countStat ( STAT_REQUESTS_CAPTURED, 1 );
+	captureLength = -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : appendCapture
+// Description  : Add bytes to the record being built, giving up on it if the
+//		  head is too long to capture
+//
+// Inputs       : data - the bytes
+//		  length - how many
+// Outputs      : none
+void appendCapture ( const char *data, int length ) {
+
+	if ( captureLength + length > (int)sizeof(captureHead) ) {
+		countStat ( STAT_CAPTURE_DROPPED, 1 );
+		captureLength = -1;
+		return;
+	}
+	memcpy ( &captureHead[captureLength], data, length );
+	captureLength += length;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : captureLoop
+// Description  : Body of the capture writer. Empties the ring into the file
+//		  every CAPTURE_FLUSH_MS, or sooner when it fills up.
+//
+// Inputs       : arg - unused
+// Outputs      : NULL
+void * captureLoop ( void *arg ) {
+
+	struct timespec deadline;
+	size_t length, first;
+	int stopping;
+
+	(void)arg;
+	do {
+		pthread_mutex_lock ( &captureLock );
+		if ( !captureStopping && ringUsed <= CAPTURE_RING_BYTES / 2 ) {
+			clock_gettime ( CLOCK_REALTIME, &deadline );
+			deadline.tv_nsec += CAPTURE_FLUSH_MS * 1000000L;
+			deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+			deadline.tv_nsec %= 1000000000L;
+			pthread_cond_timedwait ( &captureReady, &captureLock, &deadline );
+		}
+		stopping = captureStopping;
+		length = ringUsed;
+		first = ( ringHead + length <= CAPTURE_RING_BYTES ) ? length : CAPTURE_RING_BYTES - ringHead;
+		memcpy ( captureOut, &captureRing[ringHead], first );
+		memcpy ( &captureOut[first], captureRing, length - first );
+		ringHead = ( ringHead + length ) % CAPTURE_RING_BYTES;
+		ringUsed = 0;
+		pthread_mutex_unlock ( &captureLock );
+
+		//A full disk ends the capture, not the server
+		if ( length && write ( captureFd, captureOut, length ) != (ssize_t)length ) {
+			logMessage ( LOG_ERROR_LEVEL, "_captureLoop:Failed to write %s, capture stopped [%s]", captureFile, strerror(errno) );
+			__atomic_store_n ( &captureFailed, 1, __ATOMIC_RELAXED );
+			break;
+		}
+	} while ( !stopping );
+
+	return NULL;
+}
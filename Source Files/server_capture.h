@@ -0,0 +1,58 @@
+#ifndef SERVER_CAPTURE_INCLUDED
+#define SERVER_CAPTURE_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_capture.h
+//  Description   : Traffic capture, so real load can be replayed against a
+//                  test server with server_replay. With capture set, one
+//                  request in every capture-sample has its request line and
+//                  headers recorded as they arrived, along with when its
+//                  connection was accepted. Workers only copy the record
+//                  into a ring, and a background thread writes the ring out,
+//                  so a slow disk costs records, never request latency.
+//
+//                  The file starts with CAPTURE_MAGIC, and each record is a
+//                  CAPTURE_RECORD followed by the request head. Bodies aren't
+//                  kept, only their length, and replay sends that many filler
+//                  bytes. Chunked bodies, upgrades, HTTP/2 and requests the
+//                  rate limit turns away aren't captured. Every process
+//                  appends to the same file, so records are only roughly in
+//                  time order.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#include <stdint.h>
+#include <server.h>
+
+//
+// Constants
+
+#define CAPTURE_MAGIC "SRVCAP1\n"	//first bytes of a capture file
+#define CAPTURE_MAGIC_LENGTH 8
+#define CAPTURE_HEAD_MAX 16384		//longest request head captured
+#define CAPTURE_RING_BYTES 1048576	//records waiting for the writer
+#define CAPTURE_FLUSH_MS 200		//how often the writer wakes up without being asked
+
+//
+// Type Definitions
+
+typedef struct capture_record {
+	uint64_t time;			//ns from the start of the capture to the accept
+	uint32_t length;		//bytes of request head that follow
+	uint32_t body;			//bytes of body the request declared
+} __attribute__ ((packed)) CAPTURE_RECORD;
+
+//
+// Functional Prototypes
+
+int setupCapture ( const char *filename, long sample );
+int startCapture ( void );
+void stopCapture ( void );
+void captureRequestLine ( CLIENT_CONN *conn, const char *line );
+void captureHeaderLine ( const char *line );
+void finishCapture ( HTTP_REQUEST *request );
+
+#endif
@@ -0,0 +1,428 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_config.c
+//  Description   : Reads the config file into snapshots and publishes them.
+//                  Settings are described by a table, so the file and the
+//                  command line go through the same parser. A reload builds
+//                  the whole new snapshot, host table and bundles included,
+//                  before anything changes, and a config that fails to load
+//                  leaves the running one in place.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+// Project Include Files
+#include <cmpsc311_log.h>
+#include <server_config.h>
+#include <server_admission.h>
+#include <server_event.h>
+#include <server_body.h>
+#include <server_autoindex.h>
+#include <server_bundle.h>
+#include <server_microcache.h>
+#include <server_warmup.h>
+
+//
+// Type Definitions
+
+// How a setting's value is stored
+#define SETTING_NUMBER 0			//a long, at least the setting's minimum
+#define SETTING_TEXT 1				//a path or list, CONFIG_PATH_MAX at most
+#define SETTING_SWITCH 2			//on or off, kept as a long
+
+typedef struct config_setting {
+	const char *name;
+	int type;				//SETTING_ type
+	size_t offset;				//where the value goes in SERVER_CONFIG
+	long minimum;				//smallest number allowed
+	int startup;				//read once at startup, a reload can't change it
+} CONFIG_SETTING;
+
+// Global Variables
+CONFIG_SETTING configSettings[] = {
+	{ "hosts", SETTING_TEXT, offsetof(SERVER_CONFIG, hostsFile), 0, 0 },
+	{ "docroot", SETTING_TEXT, offsetof(SERVER_CONFIG, docroot), 0, 0 },
+	{ "bundle", SETTING_TEXT, offsetof(SERVER_CONFIG, bundleFile), 0, 0 },
+	{ "cache", SETTING_NUMBER, offsetof(SERVER_CONFIG, cacheBytes), 0, 0 },
+	{ "connections", SETTING_NUMBER, offsetof(SERVER_CONFIG, maxConnections), 1, 0 },
+	{ "connections-per-address", SETTING_NUMBER, offsetof(SERVER_CONFIG, maxConnectionsPerIp), 1, 0 },
+	{ "rate", SETTING_NUMBER, offsetof(SERVER_CONFIG, requestRate), 1, 0 },
+	{ "burst", SETTING_NUMBER, offsetof(SERVER_CONFIG, requestBurst), 1, 0 },
+	{ "shed", SETTING_NUMBER, offsetof(SERVER_CONFIG, queueShedDepth), 1, 0 },
+	{ "idle-timeout", SETTING_NUMBER, offsetof(SERVER_CONFIG, idleTimeout), 1, 0 },
+	{ "header-timeout", SETTING_NUMBER, offsetof(SERVER_CONFIG, headerTimeout), 1, 0 },
+	{ "keepalive-timeout", SETTING_NUMBER, offsetof(SERVER_CONFIG, keepaliveTimeout), 1, 0 },
+	{ "min-rate", SETTING_NUMBER, offsetof(SERVER_CONFIG, minTransferRate), 0, 0 },
+	{ "microcache", SETTING_NUMBER, offsetof(SERVER_CONFIG, microcacheTtl), 0, 0 },
+	{ "microcache-stale", SETTING_NUMBER, offsetof(SERVER_CONFIG, microcacheStale), 0, 0 },
+	{ "send-rate", SETTING_NUMBER, offsetof(SERVER_CONFIG, sendRate), 0, 0 },
+	{ "bulk-rate", SETTING_NUMBER, offsetof(SERVER_CONFIG, bulkRate), 0, 0 },
+	{ "listen", SETTING_NUMBER, offsetof(SERVER_CONFIG, port), 1, 1 },
+	{ "tls", SETTING_NUMBER, offsetof(SERVER_CONFIG, tlsPort), 0, 1 },
+	{ "certificate", SETTING_TEXT, offsetof(SERVER_CONFIG, certFile), 0, 1 },
+	{ "key", SETTING_TEXT, offsetof(SERVER_CONFIG, keyFile), 0, 1 },
+	{ "listeners", SETTING_TEXT, offsetof(SERVER_CONFIG, listenersFile), 0, 1 },
+	{ "workers", SETTING_NUMBER, offsetof(SERVER_CONFIG, workers), 0, 1 },
+	{ "cpus", SETTING_TEXT, offsetof(SERVER_CONFIG, cpus), 0, 1 },
+	{ "steer", SETTING_SWITCH, offsetof(SERVER_CONFIG, steer), 0, 1 },
+	{ "upstreams", SETTING_TEXT, offsetof(SERVER_CONFIG, upstreamsFile), 0, 1 },
+	{ "events-socket", SETTING_TEXT, offsetof(SERVER_CONFIG, eventsSocket), 0, 1 },
+	{ "busy-poll", SETTING_NUMBER, offsetof(SERVER_CONFIG, busyPoll), 0, 1 },
+	{ "capture", SETTING_TEXT, offsetof(SERVER_CONFIG, captureFile), 0, 1 },
+	{ "capture-sample", SETTING_NUMBER, offsetof(SERVER_CONFIG, captureSample), 1, 1 },
+	{ "warmup", SETTING_TEXT, offsetof(SERVER_CONFIG, warmupFile), 0, 1 },
+	{ "warmup-bytes", SETTING_NUMBER, offsetof(SERVER_CONFIG, warmupBytes), 0, 1 },
+	{ NULL, 0, 0, 0, 0 }
+};
+
+char configFile[CONFIG_PATH_MAX];		//the config file, empty if there is none
+char *overrides[CONFIG_MAX_OVERRIDES][2];	//command line settings and their values
+int overrideCount = 0;
+SERVER_CONFIG *publishedConfig = NULL;		//the snapshot new connections get
+uint64_t configGeneration = 0;
+
+//
+// Functional Prototypes
+
+SERVER_CONFIG * buildConfig ( void );
+int readConfigFile ( SERVER_CONFIG *config, const char *filename );
+int applySetting ( SERVER_CONFIG *config, const char *name, const char *value, const char *source, int lineNumber );
+const CONFIG_SETTING * findSetting ( const char *name );
+void freeConfig ( SERVER_CONFIG *config );
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : overrideConfig
+// Description  : Give a setting from the command line. It beats the config
+//		  file, on every reload too.
+//
+// Inputs       : setting - the setting's name
+//		  value - its value
+// Outputs      : 0 if successful, -1 if failure
+int overrideConfig ( const char *setting, const char *value ) {
+
+	if ( findSetting ( setting ) == NULL || overrideCount >= CONFIG_MAX_OVERRIDES ) {
+		logMessage ( LOG_ERROR_LEVEL, "_overrideConfig:Can't override %s", setting );
+		return -1;
+	}
+	overrides[overrideCount][0] = strdup ( setting );
+	overrides[overrideCount][1] = strdup ( value );
+	if ( overrides[overrideCount][0] == NULL || overrides[overrideCount][1] == NULL )
+		return -1;
+	overrideCount++;
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : loadConfig
+// Description  : Build and publish the startup config
+//
+// Inputs       : filename - the config file, NULL if there is none
+// Outputs      : 0 if successful, -1 if failure
+int loadConfig ( const char *filename ) {
+
+	if ( filename != NULL && snprintf ( configFile, sizeof(configFile), "%s", filename ) >= (int)sizeof(configFile) ) {
+		logMessage ( LOG_ERROR_LEVEL, "_loadConfig:Config file name %s is too long", filename );
+		return -1;
+	}
+
+	if ( (publishedConfig = buildConfig ()) == NULL )
+		return -1;
+	if ( publishedConfig->port == 0 && !publishedConfig->listenersFile[0] ) {
+		logMessage ( LOG_ERROR_LEVEL, "_loadConfig:No port to listen on" );
+		freeConfig ( publishedConfig );
+		publishedConfig = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : reloadConfig
+// Description  : Read the config again and publish it in place of the
+//		  running one. Only the event loop calls this.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if the running config was kept
+int reloadConfig ( void ) {
+
+	SERVER_CONFIG *config, *old = publishedConfig;
+	char *field, *oldField;
+
+	logMessage ( LOG_INFO_LEVEL, "Reloading the config%s%s", ( configFile[0] ) ? " from " : "", configFile );
+	if ( (config = buildConfig ()) == NULL ) {
+		logMessage ( LOG_ERROR_LEVEL, "_reloadConfig:Keeping the running config, generation %llu",
+				(unsigned long long)old->generation );
+		return -1;
+	}
+
+	//Listeners, processes and placement are already set up, so those stay
+	//as they are until a restart
+	for ( const CONFIG_SETTING *setting = configSettings; setting->name != NULL; setting++ ) {
+		if ( !setting->startup )
+			continue;
+		field = (char *)config + setting->offset;
+		oldField = (char *)old + setting->offset;
+		if ( ( setting->type == SETTING_TEXT ) ? strcmp ( field, oldField ) : *(long *)field != *(long *)oldField ) {
+			logMessage ( LOG_WARNING_LEVEL, "Changing %s needs a restart, keeping the running value", setting->name );
+			memcpy ( field, oldField, ( setting->type == SETTING_TEXT ) ? CONFIG_PATH_MAX : sizeof(long) );
+		}
+	}
+
+	//New connections get the new snapshot right away. The old one goes
+	//once the connections still using it are done
+	__atomic_store_n ( &publishedConfig, config, __ATOMIC_RELEASE );
+	logMessage ( LOG_INFO_LEVEL, "Published config generation %llu", (unsigned long long)config->generation );
+	releaseConfig ( old );
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : serverConfig
+// Description  : Get the published config, for startup and the event loop.
+//		  A worker uses its connection's snapshot instead.
+//
+// Inputs       : none
+// Outputs      : the config
+SERVER_CONFIG * serverConfig ( void ) {
+	return __atomic_load_n ( &publishedConfig, __ATOMIC_ACQUIRE );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : holdConfig
+// Description  : Take a reference to the published config. Only the event
+//		  loop, which publishes configs, may take one, so the config
+//		  can't be freed between finding it and holding it.
+//
+// Inputs       : none
+// Outputs      : the config
+SERVER_CONFIG * holdConfig ( void ) {
+
+	SERVER_CONFIG *config = publishedConfig;
+
+	__atomic_add_fetch ( &config->references, 1, __ATOMIC_RELAXED );
+	return config;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : releaseConfig
+// Description  : Drop a reference to a config, freeing it with the last one
+//
+// Inputs       : config - the config, may be NULL
+// Outputs      : none
+void releaseConfig ( SERVER_CONFIG *config ) {
+
+	if ( config != NULL && __atomic_sub_fetch ( &config->references, 1, __ATOMIC_ACQ_REL ) == 0 ) {
+		logMessage ( LOG_INFO_LEVEL, "Freeing config generation %llu", (unsigned long long)config->generation );
+		freeConfig ( config );
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : refreshConfig
+// Description  : Move a connection about to start a new request onto the
+//		  published config. An HTTP/2 session keeps the one it started
+//		  with, its streams may still point into it. Only the event
+//		  loop calls this.
+//
+// Inputs       : conn - the connection
+// Outputs      : none
+void refreshConfig ( CLIENT_CONN *conn ) {
+
+	if ( conn->config == publishedConfig || conn->http2 != NULL )
+		return;
+	releaseConfig ( conn->config );
+	conn->config = holdConfig ();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : buildConfig
+// Description  : Build a snapshot from the defaults, the config file and
+//		  the command line, in that order, and load its hosts
+//
+// Inputs       : none
+// Outputs      : the snapshot, with one reference, or NULL on failure
+SERVER_CONFIG * buildConfig ( void ) {
+
+	SERVER_CONFIG *config;
+	VIRTUAL_HOST defaults = { "*", "", DEFAULT_CGI_PREFIX, AUTOINDEX_ENABLED, MAX_BODY_SIZE, 0, 0, 0, NULL };
+
+	if ( (config = calloc ( 1, sizeof(SERVER_CONFIG) )) == NULL ) {
+		logMessage ( LOG_ERROR_LEVEL, "_buildConfig:Out of memory for the config" );
+		return NULL;
+	}
+
+	strcpy ( config->docroot, DEFAULT_DOCROOT );
+	config->cacheBytes = AUTOINDEX_CACHE_BYTES;
+	config->maxConnections = MAX_CONNECTIONS;
+	config->maxConnectionsPerIp = MAX_CONNECTIONS_PER_IP;
+	config->requestRate = REQUEST_RATE_PER_IP;
+	config->requestBurst = REQUEST_BURST_PER_IP;
+	config->queueShedDepth = QUEUE_SHED_DEPTH;
+	config->idleTimeout = IDLE_TIMEOUT_MS;
+	config->headerTimeout = HEADER_TIMEOUT_MS;
+	config->keepaliveTimeout = KEEPALIVE_TIMEOUT_MS;
+	config->minTransferRate = MIN_TRANSFER_RATE;
+	config->microcacheTtl = MICROCACHE_TTL;
+	config->microcacheStale = MICROCACHE_STALE;
+	config->captureSample = 1;
+	config->warmupBytes = WARMUP_BYTES;
+	config->references = 1;
+
+	if ( configFile[0] && readConfigFile ( config, configFile ) )
+		goto failed;
+	for ( int i = 0; i < overrideCount; i++ ) {
+		if ( applySetting ( config, overrides[i][0], overrides[i][1], "the command line", 0 ) )
+			goto failed;
+	}
+
+	//Hosts the hosts file doesn't configure fully fall back on the
+	//default host's settings
+	if ( snprintf ( defaults.docroot, sizeof(defaults.docroot), "%s", config->docroot ) >= (int)sizeof(defaults.docroot) ) {
+		logMessage ( LOG_ERROR_LEVEL, "_buildConfig:Docroot %s is too long", config->docroot );
+		goto failed;
+	}
+	defaults.cacheBytes = config->cacheBytes;
+	defaults.sendRate = config->sendRate;
+	if ( (config->hosts = loadVirtualHosts ( ( config->hostsFile[0] ) ? config->hostsFile : NULL, &defaults )) == NULL )
+		goto failed;
+	if ( config->bundleFile[0] && attachBundle ( config->hosts->defaultHost, config->bundleFile ) )
+		goto failed;
+
+	config->generation = ++configGeneration;
+	return config;
+
+failed:
+	freeConfig ( config );
+	return NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : readConfigFile
+// Description  : Apply every setting in a config file
+//
+// Inputs       : config - the snapshot to fill in
+//		  filename - the config file
+// Outputs      : 0 if successful, -1 if failure
+int readConfigFile ( SERVER_CONFIG *config, const char *filename ) {
+
+	char line[CONFIG_PATH_MAX * 2], *name, *value, *extra, *save;
+	int lineNumber = 0, ret = 0;
+	FILE *file;
+
+	if ( (file = fopen ( filename, "r" )) == NULL ) {
+		logMessage ( LOG_ERROR_LEVEL, "_readConfigFile:Can't open %s [%s]", filename, strerror(errno) );
+		return -1;
+	}
+
+	while ( ret == 0 && fgets ( line, sizeof(line), file ) != NULL ) {
+		lineNumber++;
+		if ( (name = strtok_r ( line, " \t\r\n", &save )) == NULL || name[0] == '#' )
+			continue;
+		value = strtok_r ( NULL, " \t\r\n", &save );
+		extra = strtok_r ( NULL, " \t\r\n", &save );
+		if ( value == NULL || extra != NULL ) {
+			logMessage ( LOG_ERROR_LEVEL, "_readConfigFile:%s:%d: expected \"%s <value>\"", filename, lineNumber, name );
+			ret = -1;
+		}
+		else
+			ret = applySetting ( config, name, value, filename, lineNumber );
+	}
+
+	fclose ( file );
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : applySetting
+// Description  : Check a setting's value and store it in a snapshot
+//
+// Inputs       : config - the snapshot
+//		  name - the setting
+//		  value - its value
+//		  source - where it came from, for errors
+//		  lineNumber - line it was on, for errors
+// Outputs      : 0 if successful, -1 if failure
+int applySetting ( SERVER_CONFIG *config, const char *name, const char *value, const char *source, int lineNumber ) {
+
+	const CONFIG_SETTING *setting;
+	char *field, *end;
+	long number;
+
+	if ( (setting = findSetting ( name )) == NULL ) {
+		logMessage ( LOG_ERROR_LEVEL, "_applySetting:%s:%d: unknown setting %s", source, lineNumber, name );
+		return -1;
+	}
+	field = (char *)config + setting->offset;
+
+	switch ( setting->type ) {
+	case SETTING_NUMBER:
+		errno = 0;
+		number = strtol ( value, &end, 10 );
+		if ( errno || end == value || *end || number < setting->minimum ) {
+			logMessage ( LOG_ERROR_LEVEL, "_applySetting:%s:%d: %s must be a number, at least %ld", source, lineNumber, name, setting->minimum );
+			return -1;
+		}
+		*(long *)field = number;
+		break;
+	case SETTING_SWITCH:
+		if ( strcmp ( value, "on" ) && strcmp ( value, "off" ) ) {
+			logMessage ( LOG_ERROR_LEVEL, "_applySetting:%s:%d: %s must be on or off", source, lineNumber, name );
+			return -1;
+		}
+		*(long *)field = !strcmp ( value, "on" );
+		break;
+	default:
+		if ( snprintf ( field, CONFIG_PATH_MAX, "%s", value ) >= CONFIG_PATH_MAX ) {
+			logMessage ( LOG_ERROR_LEVEL, "_applySetting:%s:%d: %s is too long", source, lineNumber, name );
+			return -1;
+		}
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : findSetting
+// Description  : Look a setting up by name
+//
+// Inputs       : name - the setting's name
+// Outputs      : the setting, or NULL if there is none
+const CONFIG_SETTING * findSetting ( const char *name ) {
+
+	for ( const CONFIG_SETTING *setting = configSettings; setting->name != NULL; setting++ ) {
+		if ( !strcmp ( setting->name, name ) )
+			return setting;
+	}
+	return NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : freeConfig
+// Description  : Free a snapshot and its host table
+//
+// Inputs       : config - the snapshot
+// Outputs      : none
+void freeConfig ( SERVER_CONFIG *config ) {
+
+	freeVirtualHosts ( config->hosts );
+	free ( config );
+}
@@ -0,0 +1,133 @@
+#ifndef SERVER_CONFIG_INCLUDED
+#define SERVER_CONFIG_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_config.h
+//  Description   : The server's runtime configuration. Settings come from a
+//                  config file, with command line flags overriding it, and
+//                  are parsed into an immutable snapshot. SIGHUP makes the
+//                  event loop read them again into a new snapshot and publish
+//                  it in place of the old one, without a restart.
+//
+//                  Every connection holds a reference to the snapshot it was
+//                  dispatched with, so a request in flight keeps the limits,
+//                  docroots and hosts it started with. The next request on
+//                  the connection picks up the new snapshot, except on an
+//                  HTTP/2 session, which keeps its own until it closes. A
+//                  snapshot is freed when the last connection holding it
+//                  lets go. Only the event loop publishes snapshots and takes
+//                  new references, so taking one never races with a reload.
+//
+//                  Config file lines look like
+//
+//                      <setting> <value>
+//
+//                  Blank lines and lines starting with # are ignored. These
+//                  settings take effect on reload:
+//
+//                      hosts <file>                virtual hosts, see server_vhost.h
+//                      docroot <dir>               docroot of the default host
+//                      bundle <file>               asset bundle of the default host
+//                      cache <bytes>               listing cache budget of each host
+//                      connections <n>             open connections across the server
+//                      connections-per-address <n>
+//                      rate <n>                    requests per second per address
+//                      burst <n>                   requests an address may save up
+//                      shed <n>                    queued connections before early 503s
+//                      idle-timeout <ms>           time allowed for the first request bytes
+//                      header-timeout <ms>         time allowed for the request headers
+//                      keepalive-timeout <ms>      time an idle HTTP/2 session waits
+//                      min-rate <bytes>            per second a body or response must move
+//                      microcache <seconds>        CGI responses are cached without a max-age,
+//                                                  0 for no CGI caching
+//                      microcache-stale <seconds>  an expired CGI response is sent while it refreshes
+//                      send-rate <bytes>           per second each download may use, 0 for no limit,
+//                                                  hosts may set their own
+//                      bulk-rate <bytes>           per second large downloads share in each process,
+//                                                  0 for no limit
+//
+//                  and these only at startup:
+//
+//                      listen <port>, tls <port>, certificate <file>, key <file>,
+//                      listeners <file>, workers <n>, cpus <list>|isolated, steer on|off,
+//                      upstreams <file>, events-socket <path>, busy-poll <us>,
+//                      capture <file>, capture-sample <n>, warmup <file>,
+//                      warmup-bytes <bytes>
+//
+//                  A listeners file, see server_listener.h, takes the place
+//                  of the listen and tls ports, and server_warmup.h covers
+//                  the warm-up list.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#include <stdint.h>
+#include <server_vhost.h>
+#include <server_conn.h>
+
+//
+// Constants
+
+#define CONFIG_PATH_MAX 512		//longest path or list setting
+#define CONFIG_MAX_OVERRIDES 32		//command line settings
+
+//
+// Type Definitions
+
+typedef struct server_config {
+	// Taking effect on reload
+	char hostsFile[CONFIG_PATH_MAX];	//empty for just the default host
+	char docroot[CONFIG_PATH_MAX];
+	char bundleFile[CONFIG_PATH_MAX];	//empty for no bundle
+	long cacheBytes;
+	long maxConnections;
+	long maxConnectionsPerIp;
+	long requestRate;
+	long requestBurst;
+	long queueShedDepth;
+	long idleTimeout;
+	long headerTimeout;
+	long keepaliveTimeout;
+	long minTransferRate;
+	long microcacheTtl;			//0 for no CGI response caching
+	long microcacheStale;
+	long sendRate;				//bytes per second a download may use, 0 for no limit
+	long bulkRate;				//bytes per second large downloads share, 0 for no limit
+
+	// Read once at startup
+	long port;
+	long tlsPort;				//0 for no TLS
+	char certFile[CONFIG_PATH_MAX];
+	char keyFile[CONFIG_PATH_MAX];
+	char listenersFile[CONFIG_PATH_MAX];	//empty to listen on the listen and tls ports
+	long workers;				//0 to serve in this process
+	char cpus[CONFIG_PATH_MAX];		//empty to leave placement to the kernel
+	long steer;
+	char upstreamsFile[CONFIG_PATH_MAX];	//empty for no upstreams
+	char eventsSocket[CONFIG_PATH_MAX];	//empty for no event publishing socket
+	long busyPoll;				//microseconds threads spin for more work, 0 to just sleep
+	char captureFile[CONFIG_PATH_MAX];	//empty for no traffic capture
+	long captureSample;			//capture one request in this many
+	char warmupFile[CONFIG_PATH_MAX];	//empty for no cache warm-up
+	long warmupBytes;			//most bytes the warm-up reads in
+
+	// Built from the settings
+	VHOST_TABLE *hosts;
+	uint64_t generation;			//1 for the startup config, counting up with reloads
+	int references;				//connections holding it, plus one while published
+} SERVER_CONFIG;
+
+//
+// Functional Prototypes
+
+int overrideConfig ( const char *setting, const char *value );
+int loadConfig ( const char *filename );
+int reloadConfig ( void );
+SERVER_CONFIG * serverConfig ( void );
+SERVER_CONFIG * holdConfig ( void );
+void releaseConfig ( SERVER_CONFIG *config );
+void refreshConfig ( CLIENT_CONN *conn );
+
+#endif
@@ -0,0 +1,253 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_conn.c
+//  Description   : Creation and teardown of the per-connection state. Closing
+//                  a connection also gives its slot back to admission control.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+// Project Include Files
+#include <cmpsc311_log.h>
+#include <server_conn.h>
+#include <server_admission.h>
+#include <server_event.h>
+#include <server_tls.h>
+#include <server_http2.h>
+#include <server_websocket.h>
+#include <server_shared.h>
+#include <server_build.h>
+#include <server_config.h>
+
+// Global Variables
+__thread CLIENT_CONN *currentConnection = NULL;	//connection the calling worker is serving
+#if SERVER_TRACE
+unsigned long traceLevel = LOG_INFO_LEVEL;		//log level of trace points, registered at startup
+#endif
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : allocateConnection
+// Description  : Create the connection state for a freshly accepted client
+//
+// Inputs       : fd - socket file handle returned by accept
+//		  address - peer address returned by accept
+//		  len - length of the peer address
+// Outputs      : the new connection, or NULL on failure
+CLIENT_CONN * allocateConnection ( int fd, struct sockaddr_storage *address, socklen_t len ) {
+
+	CLIENT_CONN *conn;
+
+	if ( (conn = calloc ( 1, sizeof(CLIENT_CONN) )) == NULL ) {
+		logMessage ( LOG_ERROR_LEVEL, "_allocateConnection:Out of memory for client %d", fd );
+		return NULL;
+	}
+
+	conn->fd = fd;
+	memcpy ( &conn->address, address, len );
+	conn->addressLen = len;
+	conn->acceptTime = monotonicTime();
+	conn->config = holdConfig();
+	countStat ( STAT_OPEN_CONNECTIONS, 1 );
+	countStat ( STAT_CONNECTION_BYTES, sizeof(CLIENT_CONN) );
+	return conn;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : closeConnection
+// Description  : Close the client socket, release its admission slot and
+//		  free the connection state
+//
+// Inputs       : conn - the connection to close
+// Outputs      : none
+void closeConnection ( CLIENT_CONN *conn ) {
+
+	if ( conn == NULL )
+		return;
+	traceEvent ( "closed", conn->fd );
+
+	//The deadline must be off the wheel before the memory goes away
+	clearDeadline ( conn );
+
+	if ( conn->http2 != NULL )
+		closeHttp2 ( conn );
+	if ( conn->websocket != NULL )
+		freeWebSocket ( conn );
+	free ( conn->pending );
+	if ( conn->tls != NULL )
+		closeTls ( conn );
+	if ( conn->fd != -1 )
+		close ( conn->fd );
+
+	releaseConnection ( conn );
+	releaseConfig ( conn->config );
+	countStat ( STAT_OPEN_CONNECTIONS, -(uint64_t)1 );
+	countStat ( STAT_CONNECTION_BYTES, -(uint64_t)sizeof(CLIENT_CONN) );
+	free ( conn );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : connectionAddress
+// Description  : Format the peer address of the connection for log messages
+//
+// Inputs       : conn - the connection
+//		  buf - place to write the address
+//		  len - size of buf
+// Outputs      : buf
+const char * connectionAddress ( CLIENT_CONN *conn, char *buf, int len ) {
+
+	if ( conn->address.ss_family == AF_INET6 ) {
+		struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)&conn->address;
+		inet_ntop ( AF_INET6, &in6->sin6_addr, buf, len );
+	}
+	else if ( conn->address.ss_family == AF_INET ) {
+		struct sockaddr_in *in = (struct sockaddr_in *)&conn->address;
+		inet_ntop ( AF_INET, &in->sin_addr, buf, len );
+	}
+	else
+		snprintf ( buf, len, "local" );
+
+	return buf;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : setCurrentConnection
+// Description  : Record the connection the calling worker is serving, so the
+//		  low level read and send functions can credit its transfer
+//		  counters for the minimum rate checks
+//
+// Inputs       : conn - the connection, or NULL when done
+// Outputs      : none
+void setCurrentConnection ( CLIENT_CONN *conn ) {
+	currentConnection = conn;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : countTransfer
+// Description  : Credit bytes moved on a socket to the current connection
+//
+// Inputs       : fd - socket the bytes moved on
+//		  in - bytes read
+//		  out - bytes sent
+// Outputs      : none
+void countTransfer ( int fd, int in, int out ) {
+
+	CLIENT_CONN *conn = currentConnection;
+
+	if ( conn == NULL || conn->fd != fd )
+		return;
+
+	__atomic_add_fetch ( &conn->bytesIn, in, __ATOMIC_RELAXED );
+	__atomic_add_fetch ( &conn->bytesOut, out, __ATOMIC_RELAXED );
+	countStat ( STAT_BYTES_IN, in );
+	countStat ( STAT_BYTES_OUT, out );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : connRead
+// Description  : Read from a client socket. The current connection's TLS
+//		  layer decrypts, unless the kernel already does.
+//
+// Inputs       : fd - socket file handle
+//		  buf - place to put the bytes
+//		  len - most bytes to read
+// Outputs      : bytes read, 0 at end of stream, -1 if failure
+ssize_t connRead ( int fd, void *buf, size_t len ) {
+
+	CLIENT_CONN *conn = currentConnection;
+
+	if ( conn != NULL && conn->fd == fd && conn->tls != NULL && !( conn->tlsOffload & TLS_OFFLOAD_RECV ) )
+		return tlsRead ( conn, buf, len );
+	return read ( fd, buf, len );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : connWrite
+// Description  : Write to a client socket. The current connection's TLS
+//		  layer encrypts, unless the kernel already does.
+//
+// Inputs       : fd - socket file handle
+//		  buf - the bytes
+//		  len - how many to write
+// Outputs      : bytes written, -1 if failure
+ssize_t connWrite ( int fd, const void *buf, size_t len ) {
+
+	CLIENT_CONN *conn = currentConnection;
+
+	if ( conn != NULL && conn->fd == fd && conn->tls != NULL && !( conn->tlsOffload & TLS_OFFLOAD_SEND ) )
+		return tlsWrite ( conn, buf, len );
+	return write ( fd, buf, len );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : canSendDirect
+// Description  : Check whether bytes put on the socket by sendfile, splice or
+//		  another process reach the client intact, which is true for a
+//		  plain connection or one whose sends kTLS encrypts
+//
+// Inputs       : fd - socket file handle
+// Outputs      : 1 if they do, 0 if they must go through connWrite
+int canSendDirect ( int fd ) {
+
+	CLIENT_CONN *conn = currentConnection;
+
+	return ( conn == NULL || conn->fd != fd || conn->tls == NULL || ( conn->tlsOffload & TLS_OFFLOAD_SEND ) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : connReadable
+// Description  : Check whether a read on a client socket would return at once,
+//		  counting bytes the current connection's TLS layer already
+//		  decrypted and holds
+//
+// Inputs       : fd - socket file handle
+//		  ms - milliseconds to wait, 0 to only check
+// Outputs      : 1 if readable, 0 if not
+int connReadable ( int fd, int ms ) {
+
+	CLIENT_CONN *conn = currentConnection;
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+	if ( conn != NULL && conn->fd == fd && conn->tls != NULL && !( conn->tlsOffload & TLS_OFFLOAD_RECV ) &&
+	     tlsPending ( conn ) )
+		return 1;
+	return ( poll ( &pfd, 1, ms ) > 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : monotonicTime
+// Description  : Current time on the monotonic clock, used for all deadline
+//		  and queue delay measurements
+//
+// Inputs       : none
+// Outputs      : time in nanoseconds
+uint64_t monotonicTime ( void ) {
+
+	struct timespec ts;
+
+	clock_gettime ( CLOCK_MONOTONIC, &ts );
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
@@ -0,0 +1,94 @@
+#ifndef SERVER_CONN_INCLUDED
+#define SERVER_CONN_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_conn.h
+//  Description   : The per-connection state that is created by the accept loop
+//                  and handed to a worker thread through the connection queue.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <server_timer.h>
+
+struct ssl_st;
+struct http2_session;
+struct websocket;
+struct pending_request;
+struct server_config;
+
+//
+// Constants
+
+// What the connection's deadline timer is currently guarding
+#define CONN_IDLE 0		//waiting in the event loop for request bytes
+#define CONN_HEADER 1		//a worker is reading the request line and headers
+#define CONN_BODY 2		//a worker is reading a request body
+#define CONN_SEND 3		//a worker is sending the response
+#define CONN_KEEPALIVE 4	//an HTTP/2 session is waiting in the event loop for frames
+#define CONN_WEBSOCKET 5	//a WebSocket is waiting in the event loop, and is pinged when this runs out
+
+// Protocol spoken on the connection, picked by ALPN for TLS
+#define PROTOCOL_HTTP1 0
+#define PROTOCOL_HTTP2 1
+
+// Handler result that hands the connection back to the event loop
+#define CONN_KEEP_OPEN 2
+
+// Handler result that hands the connection to the I/O pool, which queues it
+// for a worker again once its file has been looked up
+#define CONN_SUSPENDED 3
+
+// Handler result that gives the connection away for good, to a subsystem
+// that writes to it and closes it itself, like an event channel
+#define CONN_DETACHED 4
+
+//
+// Type Definitions
+
+typedef struct client_conn {
+	int fd;					//socket file handle for the client
+	struct sockaddr_storage address;	//peer address as returned by accept()
+	socklen_t addressLen;			//length of the peer address
+	uint64_t acceptTime;			//monotonic time (ns) the connection was accepted
+	uint64_t enqueueTime;			//monotonic time (ns) the connection entered the queue
+	int admitted;				//holds a slot in the admission control counters
+	int phase;				//CONN_ phase the deadline is guarding
+	int timedOut;				//a deadline expired and the socket was shut down
+	TIMER_NODE deadline;			//deadline for the current phase
+	uint64_t bytesIn;			//bytes read from the client so far
+	uint64_t bytesOut;			//bytes sent to the client so far
+	uint64_t progressMark;			//transfer count at the last rate check
+	uint64_t heldTime;			//ns the bandwidth shaper held its sends back, so far
+	uint64_t heldMark;			//held time at the last rate check
+	struct ssl_st *tls;			//TLS state, NULL for a plain connection
+	int tlsReady;				//the TLS handshake has finished
+	int tlsOffload;				//TLS_OFFLOAD_SEND and TLS_OFFLOAD_RECV, directions kTLS handles
+	int protocol;				//PROTOCOL_HTTP1 or PROTOCOL_HTTP2
+	struct http2_session *http2;		//HTTP/2 session state, NULL until one starts
+	struct websocket *websocket;		//WebSocket state, NULL unless the connection switched
+	struct pending_request *pending;	//request waiting on the I/O pool, NULL if none
+	struct server_config *config;		//config snapshot the connection holds
+	struct client_conn *next;		//link used by the I/O pool's queue
+} CLIENT_CONN;
+
+//
+// Functional Prototypes
+
+CLIENT_CONN * allocateConnection ( int fd, struct sockaddr_storage *address, socklen_t len );
+void closeConnection ( CLIENT_CONN *conn );
+const char * connectionAddress ( CLIENT_CONN *conn, char *buf, int len );
+void setCurrentConnection ( CLIENT_CONN *conn );
+void countTransfer ( int fd, int in, int out );
+ssize_t connRead ( int fd, void *buf, size_t len );
+ssize_t connWrite ( int fd, const void *buf, size_t len );
+int canSendDirect ( int fd );
+int connReadable ( int fd, int ms );
+uint64_t monotonicTime ( void );
+
+#endif
@@ -0,0 +1,383 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_event.c
+//  Description   : The epoll event loop. New connections are parked here, not
+//                  in a worker, until they have request bytes to read, so a
+//                  client that connects and says nothing never holds a thread.
+//
+//                  Every connection carries one deadline timer for whatever it
+//                  is currently doing. Idle and header deadlines are absolute.
+//                  Body and send deadlines are rolling rate checks, re-armed as
+//                  long as the transfer keeps up with the minimum rate. When a
+//                  deadline expires the socket is shut down, which wakes any
+//                  worker blocked on it with an error or end of file.
+//
+//                  TLS handshakes are also run here, non-blocking, so only
+//                  connections with a finished handshake reach a worker. The
+//                  idle deadline covers the handshake and the first request.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+// Project Include Files
+#include <cmpsc311_log.h>
+#include <server.h>
+#include <server_event.h>
+#include <server_threads.h>
+#include <server_admission.h>
+#include <server_tls.h>
+#include <server_config.h>
+#include <server_websocket.h>
+#include <server_busypoll.h>
+
+// Global Variables
+int epollFd = -1;			//the event loop's epoll instance
+int listenFds[MAX_LISTENERS];		//the listeners being watched, their epoll data is the index
+int listenFlags[MAX_LISTENERS];
+int listenerCount = 0;
+TIMER_WHEEL connectionTimers;		//deadlines for every open connection
+uint64_t lastEvents = 0;		//monotonic time epoll last returned events, for busy polling
+
+//Functional Prototypes
+int parkConnection ( CLIENT_CONN *conn, int events );
+int deadlineExpired ( void *arg );
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : setupEventLoop
+// Description  : Create the epoll instance. The listeners are added to it
+//		  as they are opened.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+int setupEventLoop ( void ) {
+
+	if ( setupTimerWheel ( &connectionTimers, monotonicTime() ) )
+		return -1;
+
+	if ( (epollFd = epoll_create1 ( EPOLL_CLOEXEC )) == -1 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_setupEventLoop:Failed to create epoll instance [%s]", strerror(errno) );
+		return -1;
+	}
+	busyPollEpoll ( epollFd );
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : addListener
+// Description  : Start watching another listening socket
+//
+// Inputs       : listener - the listening socket
+//		  flags - LISTEN_ flags, passed on to the accept handler
+// Outputs      : 0 if successful, -1 if failure
+int addListener ( int listener, int flags ) {
+
+	struct epoll_event event;
+
+	if ( listenerCount >= MAX_LISTENERS ) {
+		logMessage ( LOG_ERROR_LEVEL, "_addListener:Already watching %d listeners", MAX_LISTENERS );
+		return -1;
+	}
+
+	//The listener is drained until EAGAIN on every wakeup
+	fcntl ( listener, F_SETFL, fcntl ( listener, F_GETFL ) | O_NONBLOCK );
+
+	//Connections are heap pointers, so small integers are free to mark listeners
+	memset ( &event, 0, sizeof(event) );
+	event.events = EPOLLIN;
+	event.data.u64 = listenerCount;
+
+	//A socket every process watches only wakes one of them per connection
+	if ( flags & LISTEN_SHARED )
+		event.events |= EPOLLEXCLUSIVE;
+	if ( epoll_ctl ( epollFd, EPOLL_CTL_ADD, listener, &event ) == -1 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_addListener:Failed to watch the listener [%s]", strerror(errno) );
+		return -1;
+	}
+
+	listenFds[listenerCount] = listener;
+	listenFlags[listenerCount] = flags;
+	listenerCount++;
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : waitForEvents
+// Description  : Wait up to one timer tick for activity, accept new clients,
+//		  dispatch connections that became readable, and run any
+//		  deadlines that came due. When busy polling, it only looks
+//		  without waiting until the budget has gone by with no events.
+//
+// Inputs       : onAccept - called when the listener is readable
+// Outputs      : 0 if successful, 1 if failure
+int waitForEvents ( ACCEPT_HANDLER onAccept ) {
+
+	struct epoll_event events[MAX_EVENTS];
+	CLIENT_CONN *conn;
+	uint64_t spin = busyPollTime ();
+	int ready, want, timeout = TIMER_TICK_MS;
+
+	if ( spin && monotonicTime () - lastEvents < spin )
+		timeout = 0;
+	if ( (ready = epoll_wait ( epollFd, events, MAX_EVENTS, timeout )) == -1 ) {
+		if ( errno == EINTR )
+			return 0;
+		logMessage ( LOG_ERROR_LEVEL, "_waitForEvents:epoll_wait failed [%s]", strerror(errno) );
+		return 1;
+	}
+	if ( ready > 0 )
+		lastEvents = monotonicTime ();
+	else if ( timeout == 0 )
+		spinPause ();
+
+	for ( int i = 0; i < ready; i++ ) {
+
+		if ( events[i].data.u64 < MAX_LISTENERS ) {
+			onAccept ( listenFds[events[i].data.u64], listenFlags[events[i].data.u64] );
+			continue;
+		}
+		conn = events[i].data.ptr;
+
+		//The connection leaves the loop either way
+		epoll_ctl ( epollFd, EPOLL_CTL_DEL, conn->fd, NULL );
+		if ( conn->timedOut ) {
+			logMessage ( LOG_INFO_LEVEL, "Closing idle client connection" );
+			closeConnection ( conn );
+			continue;
+		}
+
+		//Handshakes go as far as the socket allows, then wait here again.
+		//A finished one still waits for the request, unless OpenSSL has
+		//already read it off the socket
+		if ( conn->tls != NULL && !conn->tlsReady ) {
+			if ( (want = handshakeTls ( conn )) == -1 ) {
+				closeConnection ( conn );
+				continue;
+			}
+			if ( want || !tlsPending ( conn ) ) {
+				if ( parkConnection ( conn, ( want == TLS_WANT_WRITE ) ? EPOLLOUT : EPOLLIN ) )
+					closeConnection ( conn );
+				continue;
+			}
+		}
+		dispatchConnection ( conn );
+	}
+
+	advanceTimers ( &connectionTimers, monotonicTime() );
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : watchConnection
+// Description  : Park a connection in the event loop until it is readable
+//
+// Inputs       : conn - the connection
+// Outputs      : 0 if successful, -1 if failure
+int watchConnection ( CLIENT_CONN *conn ) {
+
+	armDeadline ( conn, CONN_IDLE );
+
+	if ( parkConnection ( conn, EPOLLIN ) ) {
+		clearDeadline ( conn );
+		return -1;
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : keepConnection
+// Description  : Park a connection a worker is done with for now, an HTTP/2
+//		  session with nothing in flight or a WebSocket, until the
+//		  client sends more
+//
+// Inputs       : conn - the connection
+// Outputs      : 0 if successful, -1 if failure
+int keepConnection ( CLIENT_CONN *conn ) {
+
+	armDeadline ( conn, ( conn->websocket != NULL ) ? CONN_WEBSOCKET : CONN_KEEPALIVE );
+
+	if ( parkConnection ( conn, EPOLLIN ) ) {
+		clearDeadline ( conn );
+		return -1;
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : parkConnection
+// Description  : Wait in the event loop for one event on the connection,
+//		  leaving its deadline as it is
+//
+// Inputs       : conn - the connection
+//		  events - EPOLLIN or EPOLLOUT
+// Outputs      : 0 if successful, -1 if failure
+int parkConnection ( CLIENT_CONN *conn, int events ) {
+
+	struct epoll_event event;
+
+	memset ( &event, 0, sizeof(event) );
+	event.events = events | EPOLLRDHUP | EPOLLONESHOT;
+	event.data.ptr = conn;
+	if ( epoll_ctl ( epollFd, EPOLL_CTL_ADD, conn->fd, &event ) == -1 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_parkConnection:Failed to watch client [%s]", strerror(errno) );
+		return -1;
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : armDeadline
+// Description  : Start the deadline for the connection's next phase,
+//		  replacing whatever deadline was running
+//
+// Inputs       : conn - the connection
+//		  phase - CONN_ phase
+// Outputs      : none
+void armDeadline ( CLIENT_CONN *conn, int phase ) {
+
+	int ms;
+
+	conn->phase = phase;
+	switch ( phase ) {
+	case CONN_IDLE:
+		ms = conn->config->idleTimeout;
+		break;
+	case CONN_HEADER:
+		ms = conn->config->headerTimeout;
+		break;
+	case CONN_KEEPALIVE:
+		ms = conn->config->keepaliveTimeout;
+		break;
+	case CONN_WEBSOCKET:
+		ms = WEBSOCKET_PING_MS;
+		break;
+	default:
+		conn->progressMark = ( phase == CONN_BODY ) ?
+			__atomic_load_n ( &conn->bytesIn, __ATOMIC_RELAXED ) :
+			__atomic_load_n ( &conn->bytesOut, __ATOMIC_RELAXED );
+		conn->heldMark = __atomic_load_n ( &conn->heldTime, __ATOMIC_RELAXED );
+		ms = RATE_CHECK_MS;
+		break;
+	}
+
+	addTimer ( &connectionTimers, &conn->deadline, ms, deadlineExpired, conn );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : clearDeadline
+// Description  : Stop the connection's deadline
+//
+// Inputs       : conn - the connection
+// Outputs      : none
+void clearDeadline ( CLIENT_CONN *conn ) {
+	cancelTimer ( &connectionTimers, &conn->deadline );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : closeEventLoop
+// Description  : Release the epoll instance
+//
+// Inputs       : none
+// Outputs      : none
+void closeEventLoop ( void ) {
+
+	if ( epollFd != -1 )
+		close ( epollFd );
+	epollFd = -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : dispatchConnection
+// Description  : Hand a readable connection to the worker pool, or shed it if
+//		  the queue is already too deep
+//
+// Inputs       : conn - the connection
+// Outputs      : none
+void dispatchConnection ( CLIENT_CONN *conn ) {
+
+	//Each request starts on the newest config
+	refreshConfig ( conn );
+	armDeadline ( conn, CONN_HEADER );
+	traceEvent ( "dispatched", conn->fd );
+
+	if ( queueDepth() >= conn->config->queueShedDepth || enqueueConnection ( conn ) ) {
+		logMessage ( LOG_WARNING_LEVEL, "Rejecting client, connection queue is full" );
+		setCurrentConnection ( conn );		//so a TLS connection answers through its session
+		rejectConnection ( conn, 503, RETRY_AFTER_SECONDS );
+		setCurrentConnection ( NULL );
+		closeConnection ( conn );
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : deadlineExpired
+// Description  : Timer callback for connection deadlines. Rate checked phases
+//		  are re-armed while they keep moving enough bytes, a quiet
+//		  WebSocket is pinged, and everything else is shut down.
+//
+// Inputs       : arg - the connection
+// Outputs      : milliseconds to re-arm for, or 0
+int deadlineExpired ( void *arg ) {
+
+	CLIENT_CONN *conn = (CLIENT_CONN *)arg;
+	struct epoll_event event;
+	uint64_t moved, heldTime, held, window = RATE_CHECK_MS;
+
+	//The socket is parked here, so watching it for writing as well wakes
+	//it on the next round and a worker sends the ping. The worker closes
+	//it once too many pings go unanswered
+	if ( conn->phase == CONN_WEBSOCKET ) {
+		conn->websocket->pingDue = 1;
+		memset ( &event, 0, sizeof(event) );
+		event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLONESHOT;
+		event.data.ptr = conn;
+		if ( epoll_ctl ( epollFd, EPOLL_CTL_MOD, conn->fd, &event ) == 0 )
+			return 0;
+	}
+
+	//Time the bandwidth shaper held a response back is the server's doing,
+	//so the client only has to keep up for the rest of the window
+	if ( conn->phase == CONN_BODY || conn->phase == CONN_SEND ) {
+		moved = ( conn->phase == CONN_BODY ) ?
+			__atomic_load_n ( &conn->bytesIn, __ATOMIC_RELAXED ) :
+			__atomic_load_n ( &conn->bytesOut, __ATOMIC_RELAXED );
+		heldTime = __atomic_load_n ( &conn->heldTime, __ATOMIC_RELAXED );
+		held = ( heldTime - conn->heldMark ) / 1000000ULL;
+		window -= ( held < window ) ? held : window;
+		if ( moved - conn->progressMark >= (uint64_t)conn->config->minTransferRate * window / 1000 ) {
+			conn->progressMark = moved;
+			conn->heldMark = heldTime;
+			return RATE_CHECK_MS;
+		}
+	}
+
+	logMessage ( LOG_WARNING_LEVEL, "Client missed its %s deadline, closing",
+			( conn->phase == CONN_IDLE ) ? "idle" : ( conn->phase == CONN_HEADER ) ? "header" :
+			( conn->phase == CONN_KEEPALIVE ) ? "keep-alive" : ( conn->phase == CONN_WEBSOCKET ) ? "ping" :
+			( conn->phase == CONN_BODY ) ? "body rate" : "send rate" );
+	conn->timedOut = 1;
+	shutdown ( conn->fd, SHUT_RDWR );
+	return 0;
+}
@@ -0,0 +1,52 @@
+#ifndef SERVER_EVENT_INCLUDED
+#define SERVER_EVENT_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_event.h
+//  Description   : The epoll event loop run by the accept thread. It owns the
+//                  listener, parks new connections until their first request
+//                  bytes arrive, and drives the timing wheel that enforces the
+//                  per-connection deadlines.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#include <server_conn.h>
+
+//
+// Constants
+
+#define MAX_EVENTS 64			//events handled per epoll_wait
+#define IDLE_TIMEOUT_MS 5000		//time allowed for the first request bytes, by default
+#define HEADER_TIMEOUT_MS 10000		//time allowed to read the request line and headers, by default
+#define KEEPALIVE_TIMEOUT_MS 30000	//time an idle HTTP/2 session waits for its next frame, by default
+#define RATE_CHECK_MS 5000		//how often body and send progress is checked
+#define MIN_TRANSFER_RATE 1024		//bytes per second a body or response must move, by default
+#define MAX_LISTENERS 16			//listening sockets the loop can watch
+
+// Listener flags
+#define LISTEN_TLS 1			//connections start with a TLS handshake
+#define LISTEN_DEFERRED 2		//connections usually have their request waiting when accepted
+#define LISTEN_SHARED 4			//every process watches the same socket
+
+//
+// Type Definitions
+
+typedef int (*ACCEPT_HANDLER) ( int listener, int flags );
+
+//
+// Functional Prototypes
+
+int setupEventLoop ( void );
+int addListener ( int listener, int flags );
+int waitForEvents ( ACCEPT_HANDLER onAccept );
+int watchConnection ( CLIENT_CONN *conn );
+void dispatchConnection ( CLIENT_CONN *conn );
+int keepConnection ( CLIENT_CONN *conn );
+void armDeadline ( CLIENT_CONN *conn, int phase );
+void clearDeadline ( CLIENT_CONN *conn );
+void closeEventLoop ( void );
+
+#endif
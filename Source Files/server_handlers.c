@@ -0,0 +1,76 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_handlers.c
+//  Description   : The table of in-process request handlers. Handlers are
+//                  registered at startup, before the workers run, so lookups
+//                  need no locking.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#include <string.h>
+#include <stdlib.h>
+
+// Project Include Files
+#include <cmpsc311_log.h>
+#include <server_handlers.h>
+
+//
+// Type Definitions
+
+typedef struct handler_entry {
+	char prefix[MAXLINE];		//uri prefix the handler serves
+	int prefixLen;
+	REQUEST_HANDLER handler;
+} HANDLER_ENTRY;
+
+// Global Variables
+HANDLER_ENTRY handlers[MAX_HANDLERS];
+int handlerCount = 0;
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : registerHandler
+// Description  : Serve every uri starting with prefix from an in-process handler
+//
+// Inputs       : prefix - uri prefix, e.g. "/api/"
+//		  handler - function that answers the request
+// Outputs      : 0 if successful, -1 if failure
+int registerHandler ( const char *prefix, REQUEST_HANDLER handler ) {
+
+	if ( handlerCount >= MAX_HANDLERS || strlen(prefix) >= MAXLINE ) {
+		logMessage ( LOG_ERROR_LEVEL, "_registerHandler:Can't register a handler for %s", prefix );
+		return -1;
+	}
+
+	strcpy ( handlers[handlerCount].prefix, prefix );
+	handlers[handlerCount].prefixLen = strlen(prefix);
+	handlers[handlerCount].handler = handler;
+	handlerCount++;
+
+	logMessage ( LOG_INFO_LEVEL, "Registered handler for %s", prefix );
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : findHandler
+// Description  : Find the handler with the longest prefix matching the uri
+//
+// Inputs       : uri - the request uri
+// Outputs      : the handler, or NULL if none matches
+REQUEST_HANDLER findHandler ( const char *uri ) {
+
+	REQUEST_HANDLER found = NULL;
+	int longest = 0;
+
+	for ( int i = 0; i < handlerCount; i++ ) {
+		if ( handlers[i].prefixLen > longest && !strncmp ( uri, handlers[i].prefix, handlers[i].prefixLen ) ) {
+			found = handlers[i].handler;
+			longest = handlers[i].prefixLen;
+		}
+	}
+	return found;
+}
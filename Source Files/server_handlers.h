@@ -0,0 +1,35 @@
+#ifndef SERVER_HANDLERS_INCLUDED
+#define SERVER_HANDLERS_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_handlers.h
+//  Description   : In-process request handlers, matched on a uri prefix before
+//                  the static and CGI paths are tried. A handler owns the rest
+//                  of the request, including pulling its body.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#include <server.h>
+#include <server_body.h>
+
+//
+// Constants
+
+#define MAX_HANDLERS 16
+
+//
+// Type Definitions
+
+// Returns 0 if the request was answered, 1 if the connection should be dropped
+typedef int (*REQUEST_HANDLER) ( CLIENT_CONN *conn, HTTP_REQUEST *request, REQUEST_BODY *body );
+
+//
+// Functional Prototypes
+
+int registerHandler ( const char *prefix, REQUEST_HANDLER handler );
+REQUEST_HANDLER findHandler ( const char *uri );
+
+#endif
@@ -0,0 +1,656 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_hpack.c
+//  Description   : HPACK encoding and decoding. The dynamic table is a ring of
+//                  entries, so adding the newest and evicting the oldest are
+//                  both O(1). Huffman coded strings are decoded by walking a
+//                  tree built once from the RFC 7541 code table, and strings
+//                  we send are Huffman coded whenever that makes them shorter.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+// Project Include Files
+#include <cmpsc311_log.h>
+#include <server_hpack.h>
+
+//
+// Type Definitions
+
+typedef struct static_entry {
+	const char *name;
+	const char *value;
+} STATIC_ENTRY;
+
+typedef struct huffman_code {
+	unsigned int code;		//right aligned code
+	int bits;			//length of the code
+} HUFFMAN_CODE;
+
+// Global Variables
+const STATIC_ENTRY staticTable[HPACK_STATIC_ENTRIES] = {
+	{ ":authority", "" }, { ":method", "GET" }, { ":method", "POST" }, { ":path", "/" },
+	{ ":path", "/index.html" }, { ":scheme", "http" }, { ":scheme", "https" }, { ":status", "200" },
+	{ ":status", "204" }, { ":status", "206" }, { ":status", "304" }, { ":status", "400" },
+	{ ":status", "404" }, { ":status", "500" }, { "accept-charset", "" }, { "accept-encoding", "gzip, deflate" },
+	{ "accept-language", "" }, { "accept-ranges", "" }, { "accept", "" }, { "access-control-allow-origin", "" },
+	{ "age", "" }, { "allow", "" }, { "authorization", "" }, { "cache-control", "" },
+	{ "content-disposition", "" }, { "content-encoding", "" }, { "content-language", "" }, { "content-length", "" },
+	{ "content-location", "" }, { "content-range", "" }, { "content-type", "" }, { "cookie", "" },
+	{ "date", "" }, { "etag", "" }, { "expect", "" }, { "expires", "" },
+	{ "from", "" }, { "host", "" }, { "if-match", "" }, { "if-modified-since", "" },
+	{ "if-none-match", "" }, { "if-range", "" }, { "if-unmodified-since", "" }, { "last-modified", "" },
+	{ "link", "" }, { "location", "" }, { "max-forwards", "" }, { "proxy-authenticate", "" },
+	{ "proxy-authorization", "" }, { "range", "" }, { "referer", "" }, { "refresh", "" },
+	{ "retry-after", "" }, { "server", "" }, { "set-cookie", "" }, { "strict-transport-security", "" },
+	{ "transfer-encoding", "" }, { "user-agent", "" }, { "vary", "" }, { "via", "" },
+	{ "www-authenticate", "" }
+};
+
+// RFC 7541 Appendix B, indexed by symbol, 256 is end of string
+const HUFFMAN_CODE huffmanCodes[257] = {
+	{ 0x1ff8, 13 }, { 0x7fffd8, 23 }, { 0xfffffe2, 28 }, { 0xfffffe3, 28 },
+	{ 0xfffffe4, 28 }, { 0xfffffe5, 28 }, { 0xfffffe6, 28 }, { 0xfffffe7, 28 },
+	{ 0xfffffe8, 28 }, { 0xffffea, 24 }, { 0x3ffffffc, 30 }, { 0xfffffe9, 28 },
+	{ 0xfffffea, 28 }, { 0x3ffffffd, 30 }, { 0xfffffeb, 28 }, { 0xfffffec, 28 },
+	{ 0xfffffed, 28 }, { 0xfffffee, 28 }, { 0xfffffef, 28 }, { 0xffffff0, 28 },
+	{ 0xffffff1, 28 }, { 0xffffff2, 28 }, { 0x3ffffffe, 30 }, { 0xffffff3, 28 },
+	{ 0xffffff4, 28 }, { 0xffffff5, 28 }, { 0xffffff6, 28 }, { 0xffffff7, 28 },
+	{ 0xffffff8, 28 }, { 0xffffff9, 28 }, { 0xffffffa, 28 }, { 0xffffffb, 28 },
+	{ 0x14, 6 }, { 0x3f8, 10 }, { 0x3f9, 10 }, { 0xffa, 12 },
+	{ 0x1ff9, 13 }, { 0x15, 6 }, { 0xf8, 8 }, { 0x7fa, 11 },
+	{ 0x3fa, 10 }, { 0x3fb, 10 }, { 0xf9, 8 }, { 0x7fb, 11 },
+	{ 0xfa, 8 }, { 0x16, 6 }, { 0x17, 6 }, { 0x18, 6 },
+	{ 0x0, 5 }, { 0x1, 5 }, { 0x2, 5 }, { 0x19, 6 },
+	{ 0x1a, 6 }, { 0x1b, 6 }, { 0x1c, 6 }, { 0x1d, 6 },
+	{ 0x1e, 6 }, { 0x1f, 6 }, { 0x5c, 7 }, { 0xfb, 8 },
+	{ 0x7ffc, 15 }, { 0x20, 6 }, { 0xffb, 12 }, { 0x3fc, 10 },
+	{ 0x1ffa, 13 }, { 0x21, 6 }, { 0x5d, 7 }, { 0x5e, 7 },
+	{ 0x5f, 7 }, { 0x60, 7 }, { 0x61, 7 }, { 0x62, 7 },
+	{ 0x63, 7 }, { 0x64, 7 }, { 0x65, 7 }, { 0x66, 7 },
+	{ 0x67, 7 }, { 0x68, 7 }, { 0x69, 7 }, { 0x6a, 7 },
+	{ 0x6b, 7 }, { 0x6c, 7 }, { 0x6d, 7 }, { 0x6e, 7 },
+	{ 0x6f, 7 }, { 0x70, 7 }, { 0x71, 7 }, { 0x72, 7 },
+	{ 0xfc, 8 }, { 0x73, 7 }, { 0xfd, 8 }, { 0x1ffb, 13 },
+	{ 0x7fff0, 19 }, { 0x1ffc, 13 }, { 0x3ffc, 14 }, { 0x22, 6 },
+	{ 0x7ffd, 15 }, { 0x3, 5 }, { 0x23, 6 }, { 0x4, 5 },
+	{ 0x24, 6 }, { 0x5, 5 }, { 0x25, 6 }, { 0x26, 6 },
+	{ 0x27, 6 }, { 0x6, 5 }, { 0x74, 7 }, { 0x75, 7 },
+	{ 0x28, 6 }, { 0x29, 6 }, { 0x2a, 6 }, { 0x7, 5 },
+	{ 0x2b, 6 }, { 0x76, 7 }, { 0x2c, 6 }, { 0x8, 5 },
+	{ 0x9, 5 }, { 0x2d, 6 }, { 0x77, 7 }, { 0x78, 7 },
+	{ 0x79, 7 }, { 0x7a, 7 }, { 0x7b, 7 }, { 0x7ffe, 15 },
+	{ 0x7fc, 11 }, { 0x3ffd, 14 }, { 0x1ffd, 13 }, { 0xffffffc, 28 },
+	{ 0xfffe6, 20 }, { 0x3fffd2, 22 }, { 0xfffe7, 20 }, { 0xfffe8, 20 },
+	{ 0x3fffd3, 22 }, { 0x3fffd4, 22 }, { 0x3fffd5, 22 }, { 0x7fffd9, 23 },
+	{ 0x3fffd6, 22 }, { 0x7fffda, 23 }, { 0x7fffdb, 23 }, { 0x7fffdc, 23 },
+	{ 0x7fffdd, 23 }, { 0x7fffde, 23 }, { 0xffffeb, 24 }, { 0x7fffdf, 23 },
+	{ 0xffffec, 24 }, { 0xffffed, 24 }, { 0x3fffd7, 22 }, { 0x7fffe0, 23 },
+	{ 0xffffee, 24 }, { 0x7fffe1, 23 }, { 0x7fffe2, 23 }, { 0x7fffe3, 23 },
+	{ 0x7fffe4, 23 }, { 0x1fffdc, 21 }, { 0x3fffd8, 22 }, { 0x7fffe5, 23 },
+	{ 0x3fffd9, 22 }, { 0x7fffe6, 23 }, { 0x7fffe7, 23 }, { 0xffffef, 24 },
+	{ 0x3fffda, 22 }, { 0x1fffdd, 21 }, { 0xfffe9, 20 }, { 0x3fffdb, 22 },
+	{ 0x3fffdc, 22 }, { 0x7fffe8, 23 }, { 0x7fffe9, 23 }, { 0x1fffde, 21 },
+	{ 0x7fffea, 23 }, { 0x3fffdd, 22 }, { 0x3fffde, 22 }, { 0xfffff0, 24 },
+	{ 0x1fffdf, 21 }, { 0x3fffdf, 22 }, { 0x7fffeb, 23 }, { 0x7fffec, 23 },
+	{ 0x1fffe0, 21 }, { 0x1fffe1, 21 }, { 0x3fffe0, 22 }, { 0x1fffe2, 21 },
+	{ 0x7fffed, 23 }, { 0x3fffe1, 22 }, { 0x7fffee, 23 }, { 0x7fffef, 23 },
+	{ 0xfffea, 20 }, { 0x3fffe2, 22 }, { 0x3fffe3, 22 }, { 0x3fffe4, 22 },
+	{ 0x7ffff0, 23 }, { 0x3fffe5, 22 }, { 0x3fffe6, 22 }, { 0x7ffff1, 23 },
+	{ 0x3ffffe0, 26 }, { 0x3ffffe1, 26 }, { 0xfffeb, 20 }, { 0x7fff1, 19 },
+	{ 0x3fffe7, 22 }, { 0x7ffff2, 23 }, { 0x3fffe8, 22 }, { 0x1ffffec, 25 },
+	{ 0x3ffffe2, 26 }, { 0x3ffffe3, 26 }, { 0x3ffffe4, 26 }, { 0x7ffffde, 27 },
+	{ 0x7ffffdf, 27 }, { 0x3ffffe5, 26 }, { 0xfffff1, 24 }, { 0x1ffffed, 25 },
+	{ 0x7fff2, 19 }, { 0x1fffe3, 21 }, { 0x3ffffe6, 26 }, { 0x7ffffe0, 27 },
+	{ 0x7ffffe1, 27 }, { 0x3ffffe7, 26 }, { 0x7ffffe2, 27 }, { 0xfffff2, 24 },
+	{ 0x1fffe4, 21 }, { 0x1fffe5, 21 }, { 0x3ffffe8, 26 }, { 0x3ffffe9, 26 },
+	{ 0xffffffd, 28 }, { 0x7ffffe3, 27 }, { 0x7ffffe4, 27 }, { 0x7ffffe5, 27 },
+	{ 0xfffec, 20 }, { 0xfffff3, 24 }, { 0xfffed, 20 }, { 0x1fffe6, 21 },
+	{ 0x3fffe9, 22 }, { 0x1fffe7, 21 }, { 0x1fffe8, 21 }, { 0x7ffff3, 23 },
+	{ 0x3fffea, 22 }, { 0x3fffeb, 22 }, { 0x1ffffee, 25 }, { 0x1ffffef, 25 },
+	{ 0xfffff4, 24 }, { 0xfffff5, 24 }, { 0x3ffffea, 26 }, { 0x7ffff4, 23 },
+	{ 0x3ffffeb, 26 }, { 0x7ffffe6, 27 }, { 0x3ffffec, 26 }, { 0x3ffffed, 26 },
+	{ 0x7ffffe7, 27 }, { 0x7ffffe8, 27 }, { 0x7ffffe9, 27 }, { 0x7ffffea, 27 },
+	{ 0x7ffffeb, 27 }, { 0xffffffe, 28 }, { 0x7ffffec, 27 }, { 0x7ffffed, 27 },
+	{ 0x7ffffee, 27 }, { 0x7ffffef, 27 }, { 0x7fffff0, 27 }, { 0x3ffffee, 26 },
+	{ 0x3fffffff, 30 },
+};
+
+short huffmanTree[256][2];		//internal nodes, a negative child is -(symbol + 1)
+int huffmanNodes = 1;			//node 0 is the root
+pthread_once_t huffmanOnce = PTHREAD_ONCE_INIT;
+
+//Functional Prototypes
+void buildHuffmanTree ( void );
+int decodeInteger ( const unsigned char **pos, const unsigned char *end, int prefix, unsigned int *value );
+int decodeString ( const unsigned char **pos, const unsigned char *end, char *out, int *len );
+int huffmanDecode ( const unsigned char *in, int len, char *out, int *outLen );
+int decodeLiteral ( HPACK_TABLE *table, const unsigned char **pos, const unsigned char *end, int prefix,
+		int indexing, HPACK_CALLBACK onHeader, void *arg );
+int encodeInteger ( unsigned char *out, int space, int pos, int flags, int prefix, unsigned int value );
+int encodeString ( unsigned char *out, int space, int pos, const char *text, int len );
+int lookupEntry ( HPACK_TABLE *table, unsigned int index, const char **name, int *nameLen, const char **value, int *valueLen );
+void addEntry ( HPACK_TABLE *table, const char *name, int nameLen, const char *value, int valueLen );
+void resizeTable ( HPACK_TABLE *table, int maxSize );
+void evictEntries ( HPACK_TABLE *table, int size );
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : setupHpackTable
+// Description  : Start an empty dynamic table
+//
+// Inputs       : table - the table
+//		  settingSize - largest size the table may grow to
+// Outputs      : none
+void setupHpackTable ( HPACK_TABLE *table, int settingSize ) {
+
+	pthread_once ( &huffmanOnce, buildHuffmanTree );
+	memset ( table, 0, sizeof(HPACK_TABLE) );
+	table->maxSize = table->settingSize = settingSize;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : freeHpackTable
+// Description  : Release every entry in a dynamic table
+//
+// Inputs       : table - the table
+// Outputs      : none
+void freeHpackTable ( HPACK_TABLE *table ) {
+	resizeTable ( table, 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hpackDecode
+// Description  : Decode a complete header block. The table is updated as the
+//		  block is read, so every block on the connection must be
+//		  decoded, in order, even for a request that will be refused.
+//
+// Inputs       : table - the decoder's dynamic table
+//		  block - the header block
+//		  len - its length
+//		  onHeader - called with each header field
+//		  arg - passed to onHeader
+// Outputs      : 0 if successful, -1 on a compression error
+int hpackDecode ( HPACK_TABLE *table, const unsigned char *block, int len, HPACK_CALLBACK onHeader, void *arg ) {
+
+	const unsigned char *pos = block, *end = block + len;
+	const char *name, *value;
+	int nameLen, valueLen, fields = 0;
+	unsigned int index;
+
+	while ( pos < end ) {
+		if ( *pos & 0x80 ) {			//Indexed field
+			if ( decodeInteger ( &pos, end, 7, &index ) ||
+			     lookupEntry ( table, index, &name, &nameLen, &value, &valueLen ) ||
+			     onHeader ( arg, name, nameLen, value, valueLen ) )
+				return -1;
+		}
+		else if ( ( *pos & 0xc0 ) == 0x40 ) {	//Literal, added to the table
+			if ( decodeLiteral ( table, &pos, end, 6, 1, onHeader, arg ) )
+				return -1;
+		}
+		else if ( ( *pos & 0xe0 ) == 0x20 ) {	//Table size update, only ahead of the fields
+			if ( fields || decodeInteger ( &pos, end, 5, &index ) || index > (unsigned int)table->settingSize )
+				return -1;
+			resizeTable ( table, index );
+			continue;
+		}
+		else {					//Literal, without or never indexed
+			if ( decodeLiteral ( table, &pos, end, 4, 0, onHeader, arg ) )
+				return -1;
+		}
+		fields++;
+	}
+
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hpackEncoderLimit
+// Description  : Apply the peer's SETTINGS_HEADER_TABLE_SIZE to the encoder's
+//		  table. The new size is announced in the next header block.
+//
+// Inputs       : table - the encoder's dynamic table
+//		  settingSize - the peer's setting
+// Outputs      : none
+void hpackEncoderLimit ( HPACK_TABLE *table, int settingSize ) {
+
+	//We never use more than HPACK_TABLE_SIZE, however much the peer allows
+	table->settingSize = ( settingSize < HPACK_TABLE_SIZE ) ? settingSize : HPACK_TABLE_SIZE;
+	if ( table->settingSize != table->maxSize ) {
+		resizeTable ( table, table->settingSize );
+		table->pendingUpdate = 1;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hpackEncode
+// Description  : Encode one header field. A field already in a table is sent
+//		  as its index, otherwise as a literal that reuses an indexed
+//		  name when there is one. The table is only changed once the
+//		  whole field fits.
+//
+// Inputs       : table - the encoder's dynamic table
+//		  out - where to write
+//		  space - bytes left at out
+//		  name - lower case field name
+//		  value - field value
+//		  mode - HPACK_INDEX, HPACK_NO_INDEX or HPACK_NEVER_INDEX
+// Outputs      : bytes written, or -1 if they don't fit
+int hpackEncode ( HPACK_TABLE *table, unsigned char *out, int space, const char *name, const char *value, int mode ) {
+
+	int nameLen = strlen ( name ), valueLen = strlen ( value );
+	unsigned int match = 0, nameMatch = 0, index;
+	HPACK_ENTRY *entry;
+	int pos = 0;
+
+	if ( table->pendingUpdate && (pos = encodeInteger ( out, space, 0, 0x20, 5, table->maxSize )) == -1 )
+		return -1;
+
+	//Static entries, then dynamic ones from the newest
+	for ( index = 1; index <= HPACK_STATIC_ENTRIES && !match; index++ ) {
+		if ( strcmp ( staticTable[index-1].name, name ) )
+			continue;
+		if ( !strcmp ( staticTable[index-1].value, value ) )
+			match = index;
+		else if ( !nameMatch )
+			nameMatch = index;
+	}
+	for ( int i = 0; i < table->count && !match; i++ ) {
+		entry = &table->entries[(table->first + i) % HPACK_MAX_ENTRIES];
+		if ( entry->nameLen != nameLen || memcmp ( entry->name, name, nameLen ) )
+			continue;
+		if ( entry->valueLen == valueLen && !memcmp ( entry->value, value, valueLen ) )
+			match = HPACK_STATIC_ENTRIES + 1 + i;
+		else if ( !nameMatch )
+			nameMatch = HPACK_STATIC_ENTRIES + 1 + i;
+	}
+
+	if ( match )
+		pos = encodeInteger ( out, space, pos, 0x80, 7, match );
+	else {
+		if ( mode == HPACK_INDEX )
+			pos = encodeInteger ( out, space, pos, 0x40, 6, nameMatch );
+		else
+			pos = encodeInteger ( out, space, pos, ( mode == HPACK_NEVER_INDEX ) ? 0x10 : 0x00, 4, nameMatch );
+		if ( !nameMatch )
+			pos = encodeString ( out, space, pos, name, nameLen );
+		pos = encodeString ( out, space, pos, value, valueLen );
+	}
+	if ( pos == -1 )
+		return -1;
+
+	table->pendingUpdate = 0;
+	if ( !match && mode == HPACK_INDEX )
+		addEntry ( table, name, nameLen, value, valueLen );
+	return pos;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : buildHuffmanTree
+// Description  : Build the decoding tree from the code table, run once
+//
+// Inputs       : none
+// Outputs      : none
+void buildHuffmanTree ( void ) {
+
+	int node, bit;
+
+	for ( int symbol = 0; symbol < 257; symbol++ ) {
+		node = 0;
+		for ( int b = huffmanCodes[symbol].bits - 1; b > 0; b-- ) {
+			bit = ( huffmanCodes[symbol].code >> b ) & 1;
+			if ( huffmanTree[node][bit] == 0 )
+				huffmanTree[node][bit] = huffmanNodes++;
+			node = huffmanTree[node][bit];
+		}
+		huffmanTree[node][huffmanCodes[symbol].code & 1] = -(symbol + 1);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : decodeInteger
+// Description  : Decode an integer with an N bit prefix
+//
+// Inputs       : pos - read position, advanced past the integer
+//		  end - end of the block
+//		  prefix - bits of the first byte that hold the integer
+//		  value - the integer
+// Outputs      : 0 if successful, -1 if truncated or too large
+int decodeInteger ( const unsigned char **pos, const unsigned char *end, int prefix, unsigned int *value ) {
+
+	unsigned int mask = ( 1 << prefix ) - 1;
+	int shift = 0;
+	unsigned char b;
+
+	if ( *pos >= end )
+		return -1;
+	*value = *(*pos)++ & mask;
+	if ( *value < mask )
+		return 0;
+
+	do {
+		if ( *pos >= end || shift > 21 )	//nothing we accept needs more than 28 bits
+			return -1;
+		b = *(*pos)++;
+		*value += ( b & 0x7f ) << shift;
+		shift += 7;
+	} while ( b & 0x80 );
+
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : decodeString
+// Description  : Decode a string literal, Huffman coded or not
+//
+// Inputs       : pos - read position, advanced past the string
+//		  end - end of the block
+//		  out - HPACK_MAX_STRING bytes for the string, NUL terminated
+//		  len - length of the string
+// Outputs      : 0 if successful, -1 if it is malformed or too long
+int decodeString ( const unsigned char **pos, const unsigned char *end, char *out, int *len ) {
+
+	int huffman;
+	unsigned int length;
+
+	if ( *pos >= end )
+		return -1;
+	huffman = **pos & 0x80;
+	if ( decodeInteger ( pos, end, 7, &length ) || length > (unsigned int)( end - *pos ) )
+		return -1;
+
+	if ( huffman ) {
+		if ( huffmanDecode ( *pos, length, out, len ) )
+			return -1;
+	}
+	else {
+		if ( length >= HPACK_MAX_STRING )
+			return -1;
+		memcpy ( out, *pos, length );
+		*len = length;
+	}
+	out[*len] = '\0';
+	*pos += length;
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : huffmanDecode
+// Description  : Decode a Huffman coded string. The padding must be shorter
+//		  than a byte and all ones, the start of the end of string code.
+//
+// Inputs       : in - the coded bytes
+//		  len - number of coded bytes
+//		  out - HPACK_MAX_STRING bytes for the string
+//		  outLen - length of the string
+// Outputs      : 0 if successful, -1 if it is malformed or too long
+int huffmanDecode ( const unsigned char *in, int len, char *out, int *outLen ) {
+
+	int node = 0, padBits = 0, allOnes = 1, count = 0, bit, next;
+
+	for ( int i = 0; i < len; i++ ) {
+		for ( int b = 7; b >= 0; b-- ) {
+			bit = ( in[i] >> b ) & 1;
+			next = huffmanTree[node][bit];
+			padBits++;
+			allOnes &= bit;
+			if ( next >= 0 ) {
+				node = next;
+				continue;
+			}
+			if ( next == -257 || count >= HPACK_MAX_STRING - 1 )
+				return -1;		//end of string inside the string, or too long
+			out[count++] = -next - 1;
+			node = padBits = 0;
+			allOnes = 1;
+		}
+	}
+
+	*outLen = count;
+	return ( padBits > 7 || !allOnes ) ? -1 : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : decodeLiteral
+// Description  : Decode a literal field, whose name is either indexed or
+//		  given as a string, and pass it on
+//
+// Inputs       : table - the decoder's dynamic table
+//		  pos - read position, advanced past the field
+//		  end - end of the block
+//		  prefix - bits of the name index in the first byte
+//		  indexing - add the field to the table
+//		  onHeader - called with the field
+//		  arg - passed to onHeader
+// Outputs      : 0 if successful, -1 on error
+int decodeLiteral ( HPACK_TABLE *table, const unsigned char **pos, const unsigned char *end, int prefix,
+		int indexing, HPACK_CALLBACK onHeader, void *arg ) {
+
+	char name[HPACK_MAX_STRING], value[HPACK_MAX_STRING];
+	const char *indexedName, *unused;
+	int nameLen, valueLen, unusedLen;
+	unsigned int index;
+
+	if ( decodeInteger ( pos, end, prefix, &index ) )
+		return -1;
+
+	//The name is copied, adding the field may evict the entry it came from
+	if ( index ) {
+		if ( lookupEntry ( table, index, &indexedName, &nameLen, &unused, &unusedLen ) )
+			return -1;
+		memcpy ( name, indexedName, nameLen );
+		name[nameLen] = '\0';
+	}
+	else if ( decodeString ( pos, end, name, &nameLen ) )
+		return -1;
+
+	if ( decodeString ( pos, end, value, &valueLen ) )
+		return -1;
+
+	if ( indexing )
+		addEntry ( table, name, nameLen, value, valueLen );
+	return onHeader ( arg, name, nameLen, value, valueLen );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : encodeInteger
+// Description  : Encode an integer with an N bit prefix
+//
+// Inputs       : out - the output buffer
+//		  space - its size
+//		  pos - where to write, -1 if an earlier write didn't fit
+//		  flags - bits above the prefix in the first byte
+//		  prefix - bits of the first byte that hold the integer
+//		  value - the integer
+// Outputs      : the new position, or -1 if it doesn't fit
+int encodeInteger ( unsigned char *out, int space, int pos, int flags, int prefix, unsigned int value ) {
+
+	unsigned int mask = ( 1 << prefix ) - 1;
+
+	if ( pos == -1 || pos >= space )
+		return -1;
+	if ( value < mask ) {
+		out[pos++] = flags | value;
+		return pos;
+	}
+
+	out[pos++] = flags | mask;
+	for ( value -= mask; value >= 0x80; value >>= 7 ) {
+		if ( pos >= space )
+			return -1;
+		out[pos++] = ( value & 0x7f ) | 0x80;
+	}
+	if ( pos >= space )
+		return -1;
+	out[pos++] = value;
+	return pos;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : encodeString
+// Description  : Encode a string literal, Huffman coded if that is shorter
+//
+// Inputs       : out - the output buffer
+//		  space - its size
+//		  pos - where to write, -1 if an earlier write didn't fit
+//		  text - the string
+//		  len - its length
+// Outputs      : the new position, or -1 if it doesn't fit
+int encodeString ( unsigned char *out, int space, int pos, const char *text, int len ) {
+
+	uint64_t bits = 0;
+	int codedBits = 0, pending = 0;
+	const HUFFMAN_CODE *code;
+
+	for ( int i = 0; i < len; i++ )
+		codedBits += huffmanCodes[(unsigned char)text[i]].bits;
+
+	if ( ( codedBits + 7 ) / 8 >= len ) {
+		if ( (pos = encodeInteger ( out, space, pos, 0x00, 7, len )) == -1 || len > space - pos )
+			return -1;
+		memcpy ( out + pos, text, len );
+		return pos + len;
+	}
+
+	if ( (pos = encodeInteger ( out, space, pos, 0x80, 7, ( codedBits + 7 ) / 8 )) == -1 ||
+	     ( codedBits + 7 ) / 8 > space - pos )
+		return -1;
+	for ( int i = 0; i < len; i++ ) {
+		code = &huffmanCodes[(unsigned char)text[i]];
+		bits = ( bits << code->bits ) | code->code;
+		for ( pending += code->bits; pending >= 8; pending -= 8 )
+			out[pos++] = bits >> ( pending - 8 );
+		bits &= ( 1u << pending ) - 1;
+	}
+	if ( pending )				//pad with the start of end of string
+		out[pos++] = ( bits << ( 8 - pending ) ) | ( 0xff >> pending );
+	return pos;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lookupEntry
+// Description  : Find a field by index, static table first
+//
+// Inputs       : table - the dynamic table
+//		  index - the index, from 1
+//		  name, nameLen - the field's name
+//		  value, valueLen - the field's value
+// Outputs      : 0 if successful, -1 if there is no such entry
+int lookupEntry ( HPACK_TABLE *table, unsigned int index, const char **name, int *nameLen, const char **value, int *valueLen ) {
+
+	HPACK_ENTRY *entry;
+
+	if ( index == 0 )
+		return -1;
+	if ( index <= HPACK_STATIC_ENTRIES ) {
+		*name = staticTable[index-1].name;
+		*nameLen = strlen ( *name );
+		*value = staticTable[index-1].value;
+		*valueLen = strlen ( *value );
+		return 0;
+	}
+
+	index -= HPACK_STATIC_ENTRIES + 1;
+	if ( index >= (unsigned int)table->count )
+		return -1;
+	entry = &table->entries[(table->first + index) % HPACK_MAX_ENTRIES];
+	*name = entry->name;
+	*nameLen = entry->nameLen;
+	*value = entry->value;
+	*valueLen = entry->valueLen;
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : addEntry
+// Description  : Add a field to the front of the dynamic table, evicting the
+//		  oldest entries to make room. A field bigger than the whole
+//		  table just empties it.
+//
+// Inputs       : table - the dynamic table
+//		  name, nameLen - the field's name
+//		  value, valueLen - the field's value
+// Outputs      : none
+void addEntry ( HPACK_TABLE *table, const char *name, int nameLen, const char *value, int valueLen ) {
+
+	int size = nameLen + valueLen + HPACK_ENTRY_OVERHEAD;
+	HPACK_ENTRY *entry;
+	char *copy;
+
+	evictEntries ( table, ( size > table->maxSize ) ? 0 : table->maxSize - size );
+	if ( size > table->maxSize )
+		return;
+	if ( (copy = malloc ( nameLen + valueLen + 2 )) == NULL ) {
+		logMessage ( LOG_ERROR_LEVEL, "_addEntry:Out of memory for a header table entry" );
+		return;
+	}
+
+	table->first = ( table->first + HPACK_MAX_ENTRIES - 1 ) % HPACK_MAX_ENTRIES;
+	entry = &table->entries[table->first];
+	entry->name = copy;
+	entry->nameLen = nameLen;
+	memcpy ( entry->name, name, nameLen );
+	entry->name[nameLen] = '\0';
+	entry->value = copy + nameLen + 1;
+	entry->valueLen = valueLen;
+	memcpy ( entry->value, value, valueLen );
+	entry->value[valueLen] = '\0';
+	table->count++;
+	table->size += size;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : resizeTable
+// Description  : Set the table's limit, evicting whatever no longer fits
+//
+// Inputs       : table - the dynamic table
+//		  maxSize - the new limit
+// Outputs      : none
+void resizeTable ( HPACK_TABLE *table, int maxSize ) {
+
+	table->maxSize = maxSize;
+	evictEntries ( table, maxSize );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : evictEntries
+// Description  : Drop the oldest entries until the table uses no more than
+//		  the given number of bytes
+//
+// Inputs       : table - the dynamic table
+//		  size - bytes the remaining entries may use
+// Outputs      : none
+void evictEntries ( HPACK_TABLE *table, int size ) {
+
+	HPACK_ENTRY *oldest;
+
+	while ( table->count > 0 && table->size > size ) {
+		oldest = &table->entries[(table->first + table->count - 1) % HPACK_MAX_ENTRIES];
+		table->size -= oldest->nameLen + oldest->valueLen + HPACK_ENTRY_OVERHEAD;
+		free ( oldest->name );
+		table->count--;
+	}
+}
@@ -0,0 +1,64 @@
+#ifndef SERVER_HPACK_INCLUDED
+#define SERVER_HPACK_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_hpack.h
+//  Description   : HPACK (RFC 7541) header compression for HTTP/2. Each side
+//                  of a connection keeps a dynamic table that the other side
+//                  adds to as it sends, so an HTTP/2 session has one table for
+//                  decoding requests and one for encoding responses. Entries
+//                  are looked up by index, the static table first and then the
+//                  dynamic table, newest entry first.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+//
+// Constants
+
+#define HPACK_TABLE_SIZE 4096			//largest dynamic table, SETTINGS_HEADER_TABLE_SIZE default
+#define HPACK_ENTRY_OVERHEAD 32			//bytes RFC 7541 charges each entry beyond its strings
+#define HPACK_MAX_ENTRIES ( HPACK_TABLE_SIZE / HPACK_ENTRY_OVERHEAD )
+#define HPACK_MAX_STRING 8192			//longest name or value we decode
+#define HPACK_STATIC_ENTRIES 61
+
+// How an encoded header field is kept
+#define HPACK_INDEX 0				//add it to the dynamic table
+#define HPACK_NO_INDEX 1			//leave the tables alone
+#define HPACK_NEVER_INDEX 2			//and ask intermediaries to do the same
+
+//
+// Type Definitions
+
+typedef struct hpack_entry {
+	char *name;			//name and value share one allocation
+	char *value;
+	int nameLen;
+	int valueLen;
+} HPACK_ENTRY;
+
+typedef struct hpack_table {
+	HPACK_ENTRY entries[HPACK_MAX_ENTRIES];	//ring, the newest entry at first
+	int first;
+	int count;
+	int size;			//bytes used, counted the RFC 7541 way
+	int maxSize;			//current limit on size
+	int settingSize;		//largest maxSize the peer's setting allows
+	int pendingUpdate;		//encoder must signal a new maxSize in its next block
+} HPACK_TABLE;
+
+// Called for every decoded header field. Returns 0 to continue, -1 to stop.
+typedef int (*HPACK_CALLBACK) ( void *arg, const char *name, int nameLen, const char *value, int valueLen );
+
+//
+// Functional Prototypes
+
+void setupHpackTable ( HPACK_TABLE *table, int settingSize );
+void freeHpackTable ( HPACK_TABLE *table );
+int hpackDecode ( HPACK_TABLE *table, const unsigned char *block, int len, HPACK_CALLBACK onHeader, void *arg );
+void hpackEncoderLimit ( HPACK_TABLE *table, int settingSize );
+int hpackEncode ( HPACK_TABLE *table, unsigned char *out, int space, const char *name, const char *value, int mode );
+
+#endif
@@ -0,0 +1,1715 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_http2.c
+//  Description   : The HTTP/2 framing layer and stream scheduler. The worker
+//                  running a session alternates between reading whatever
+//                  frames have arrived and sending one DATA frame for the
+//                  stream that should go next, so every stream in flight makes
+//                  progress on the one connection.
+//
+//                  The next stream is chosen by RFC 9218 urgency when the
+//                  client sent a priority header, then through the RFC 7540
+//                  dependency tree, where a stream waits while any stream it
+//                  depends on has data to send, and finally by weighted fair
+//                  share among the streams that are left. File bodies go out
+//                  with sendfile behind a corked frame header, the same path
+//                  HTTP/1.0 responses take.
+//
+//                  Frames we send are gathered in the session's output buffer
+//                  and written together, before the worker blocks on a read or
+//                  when the buffer is full.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+// Project Include Files
+#include <cmpsc311_log.h>
+#include <server.h>
+#include <server_http2.h>
+#include <server_config.h>
+#include <server_hpack.h>
+#include <server_event.h>
+#include <server_admission.h>
+#include <server_handlers.h>
+#include <server_autoindex.h>
+#include <server_bundle.h>
+#include <server_shared.h>
+#include <server_bufpool.h>
+
+// Frame types
+#define FRAME_DATA 0x0
+#define FRAME_HEADERS 0x1
+#define FRAME_PRIORITY 0x2
+#define FRAME_RST_STREAM 0x3
+#define FRAME_SETTINGS 0x4
+#define FRAME_PUSH_PROMISE 0x5
+#define FRAME_PING 0x6
+#define FRAME_GOAWAY 0x7
+#define FRAME_WINDOW_UPDATE 0x8
+#define FRAME_CONTINUATION 0x9
+
+#define FRAME_HEADER_SIZE 9
+
+// Frame flags
+#define FLAG_END_STREAM 0x1
+#define FLAG_ACK 0x1
+#define FLAG_END_HEADERS 0x4
+#define FLAG_PADDED 0x8
+#define FLAG_PRIORITY 0x20
+
+// Settings
+#define SETTINGS_HEADER_TABLE_SIZE 0x1
+#define SETTINGS_ENABLE_PUSH 0x2
+#define SETTINGS_MAX_CONCURRENT_STREAMS 0x3
+#define SETTINGS_INITIAL_WINDOW_SIZE 0x4
+#define SETTINGS_MAX_FRAME_SIZE 0x5
+#define SETTINGS_MAX_HEADER_LIST_SIZE 0x6
+
+// Error codes
+#define H2_NO_ERROR 0x0
+#define H2_PROTOCOL_ERROR 0x1
+#define H2_INTERNAL_ERROR 0x2
+#define H2_FLOW_CONTROL_ERROR 0x3
+#define H2_STREAM_CLOSED 0x5
+#define H2_FRAME_SIZE_ERROR 0x6
+#define H2_REFUSED_STREAM 0x7
+#define H2_COMPRESSION_ERROR 0x9
+#define H2_ENHANCE_YOUR_CALM 0xb
+#define H2_HTTP_1_1_REQUIRED 0xd
+
+#define MAX_WINDOW 0x7fffffff
+#define MAX_FRAME_SIZE_SETTING 0xffffff
+
+// Stream states
+#define STREAM_FREE 0			//slot not in use
+#define STREAM_IDLE 1			//not opened, only a node in the priority tree
+#define STREAM_OPEN 2			//the client may still send on it
+#define STREAM_HALF_CLOSED 3		//the client is done, we are answering
+
+// Pseudo-headers seen in a request
+#define PSEUDO_METHOD 1
+#define PSEUDO_SCHEME 2
+#define PSEUDO_PATH 4
+#define PSEUDO_AUTHORITY 8
+
+//
+// Type Definitions
+
+typedef struct http2_stream {
+	uint32_t id;			//0 for a free slot
+	int state;			//STREAM_FREE, STREAM_IDLE, STREAM_OPEN or STREAM_HALF_CLOSED
+	int64_t sendWindow;		//flow control window for the DATA we send
+	struct http2_stream *parent;	//stream this one depends on, NULL for the root
+	int weight;			//1 to 256, its share among its siblings
+	int urgency;			//RFC 9218 urgency, 0 goes first
+	int incremental;		//shares bandwidth instead of waiting its turn
+	uint64_t pass;			//bytes sent scaled by weight, for the fair share
+	int fd;				//file the body comes from, -1 if none
+	const char *data;		//or bytes in memory
+	char *page;			//an error page data points into, freed with the stream
+	struct listing *listing;	//or the cached listing data points into
+	off_t offset;			//where the next DATA frame starts
+	off_t remaining;		//body bytes left to send
+} HTTP2_STREAM;
+
+typedef struct http2_session {
+	CLIENT_CONN *conn;
+	int fd;
+	HPACK_TABLE decoder;		//fields the client sends
+	HPACK_TABLE encoder;		//fields we send
+	HTTP2_STREAM *streams;		//HTTP2_STREAM_SLOTS slots, borrowed while any is in use
+	int active;			//streams open or half closed
+	int idle;			//streams only in the priority tree
+	uint32_t lastStreamId;		//highest stream the client has opened
+	int64_t sendWindow;		//connection flow control window for our DATA
+	int64_t initialWindow;		//client's SETTINGS_INITIAL_WINDOW_SIZE
+	int maxFrame;			//largest DATA frame we send
+	int gotSettings;		//the client's first SETTINGS arrived
+	int goingAway;			//the client sent GOAWAY, no new streams
+	uint64_t virtualTime;		//pass of the stream served last
+	unsigned char *headerBlock;	//header block gathered across CONTINUATION frames, borrowed until it ends
+	int headerLength;
+	uint32_t headerStream;		//stream the block is for, 0 when none is open
+	int headerEndStream;		//the HEADERS frame ended the stream
+	int headerPrioritized;		//the HEADERS frame carried a priority
+	uint32_t headerParent;
+	int headerWeight;
+	int headerExclusive;
+	unsigned char *out;		//frames waiting to be written, borrowed while the session runs
+	int outLength;
+} HTTP2_SESSION;
+
+typedef struct header_fields {
+	HTTP_REQUEST *request;		//NULL for trailers, which are checked but not kept
+	int pseudo;			//PSEUDO_* bits seen
+	int regular;			//a regular field was seen, no more pseudo-headers
+	int malformed;
+	int prioritized;		//a priority header was seen
+	int urgency;
+	int incremental;
+} HEADER_FIELDS;
+
+//Functional Prototypes
+int readFrame ( HTTP2_SESSION *session );
+int readFull ( HTTP2_SESSION *session, void *buf, int len );
+int processFrame ( HTTP2_SESSION *session, int type, int flags, uint32_t id, unsigned char *payload, int length );
+int handleData ( HTTP2_SESSION *session, int flags, uint32_t id, unsigned char *payload, int length );
+int handleHeaders ( HTTP2_SESSION *session, int flags, uint32_t id, unsigned char *payload, int length );
+int handleContinuation ( HTTP2_SESSION *session, int flags, uint32_t id, unsigned char *payload, int length );
+int handlePriority ( HTTP2_SESSION *session, uint32_t id, unsigned char *payload, int length );
+int handleRstStream ( HTTP2_SESSION *session, uint32_t id, unsigned char *payload, int length );
+int handleSettings ( HTTP2_SESSION *session, int flags, uint32_t id, unsigned char *payload, int length );
+int handlePing ( HTTP2_SESSION *session, int flags, uint32_t id, unsigned char *payload, int length );
+int handleGoaway ( HTTP2_SESSION *session, uint32_t id, unsigned char *payload, int length );
+int handleWindowUpdate ( HTTP2_SESSION *session, uint32_t id, unsigned char *payload, int length );
+int applySettings ( HTTP2_SESSION *session, unsigned char *payload, int length );
+int appendHeaderBlock ( HTTP2_SESSION *session, unsigned char *fragment, int length );
+int finishHeaderBlock ( HTTP2_SESSION *session, unsigned char *block, int length );
+int collectField ( void *arg, const char *name, int nameLen, const char *value, int valueLen );
+void parsePriority ( const char *value, HEADER_FIELDS *fields );
+int startResponse ( HTTP2_SESSION *session, HTTP2_STREAM *stream, HTTP_REQUEST *request );
+int respondBundle ( HTTP2_SESSION *session, HTTP2_STREAM *stream, HTTP_REQUEST *request,
+		const BUNDLE_ENTRY *entry, int headOnly );
+int respond ( HTTP2_SESSION *session, HTTP2_STREAM *stream, int status, const char *type, off_t length,
+		int headOnly, const char **extra );
+int respondError ( HTTP2_SESSION *session, HTTP2_STREAM *stream, int status, int headOnly, const char **extra );
+HTTP2_STREAM * pickStream ( HTTP2_SESSION *session );
+int isSending ( HTTP2_SESSION *session, HTTP2_STREAM *stream );
+int sendData ( HTTP2_SESSION *session, HTTP2_STREAM *stream );
+HTTP2_STREAM * findStream ( HTTP2_SESSION *session, uint32_t id );
+HTTP2_STREAM * openStream ( HTTP2_SESSION *session, uint32_t id, int state );
+int finishStream ( HTTP2_SESSION *session, HTTP2_STREAM *stream );
+int resetStream ( HTTP2_SESSION *session, HTTP2_STREAM *stream, int code );
+void releaseStream ( HTTP2_SESSION *session, HTTP2_STREAM *stream );
+void setPriority ( HTTP2_SESSION *session, HTTP2_STREAM *stream, uint32_t parentId, int weight, int exclusive );
+unsigned char * startFrame ( HTTP2_SESSION *session, int type, int flags, uint32_t id, int length, int room );
+int queueFrame ( HTTP2_SESSION *session, int type, int flags, uint32_t id, const void *payload, int length );
+int queueReset ( HTTP2_SESSION *session, uint32_t id, int code );
+int queueWindowUpdate ( HTTP2_SESSION *session, uint32_t id, uint32_t increment );
+int flushOutput ( HTTP2_SESSION *session, int more );
+int connectionError ( HTTP2_SESSION *session, int code, const char *why );
+void parkSession ( HTTP2_SESSION *session );
+uint32_t readUint32 ( const unsigned char *p );
+void writeUint32 ( unsigned char *p, uint32_t value );
+int decodeBase64Url ( const char *text, unsigned char *out, int space );
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : startHttp2
+// Description  : Start an HTTP/2 session on a connection. We send our SETTINGS
+//		  and read the rest of the client's preface. An upgraded request
+//		  is switched over first, and then answered as stream 1.
+//
+// Inputs       : conn - the connection
+//		  prefaceRead - the part of the client preface already read
+//		  upgrade - the HTTP/1.1 request asking for h2c, or NULL
+// Outputs      : 0 or 1 as processClient, or CONN_KEEP_OPEN
+int startHttp2 ( CLIENT_CONN *conn, const char *prefaceRead, HTTP_REQUEST *upgrade ) {
+
+	static const char switching[] = "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+	unsigned char settings[12] = { 0, SETTINGS_MAX_CONCURRENT_STREAMS, 0, 0, 0, 0,
+				       0, SETTINGS_MAX_HEADER_LIST_SIZE, 0, 0, 0, 0 };
+	unsigned char clientSettings[MAXLINE];
+	char preface[sizeof(HTTP2_PREFACE)];
+	int have = strlen ( prefaceRead ), length;
+	HTTP2_SESSION *session;
+	HTTP2_STREAM *stream;
+
+	if ( (session = calloc ( 1, sizeof(HTTP2_SESSION) )) == NULL ) {
+		logMessage ( LOG_ERROR_LEVEL, "_startHttp2:Out of memory for an HTTP/2 session" );
+		return 1;
+	}
+	conn->http2 = session;			//closeConnection frees it from here on
+	countStat ( STAT_CONNECTION_BYTES, sizeof(HTTP2_SESSION) );
+	session->conn = conn;
+	session->fd = conn->fd;
+	setupHpackTable ( &session->decoder, HPACK_TABLE_SIZE );
+	setupHpackTable ( &session->encoder, HPACK_TABLE_SIZE );
+	session->sendWindow = session->initialWindow = HTTP2_WINDOW;
+	session->maxFrame = HTTP2_FRAME_SIZE;
+
+	//An upgrade switches first, then each side sends its preface
+	if ( upgrade != NULL && sendBytes ( conn->fd, strlen(switching), (char *)switching ) )
+		return 1;
+	writeUint32 ( settings + 2, HTTP2_MAX_STREAMS );
+	writeUint32 ( settings + 8, HTTP2_MAX_HEADER_BLOCK );
+	if ( queueFrame ( session, FRAME_SETTINGS, 0, 0, settings, sizeof(settings) ) || flushOutput ( session, 0 ) )
+		return 1;
+
+	memcpy ( preface, prefaceRead, have );
+	if ( readFull ( session, preface + have, strlen(HTTP2_PREFACE) - have ) )
+		return 1;
+	if ( memcmp ( preface, HTTP2_PREFACE, strlen(HTTP2_PREFACE) ) ) {
+		connectionError ( session, H2_PROTOCOL_ERROR, "bad client preface" );
+		return 1;
+	}
+
+	//The upgrade request carried the client's settings in HTTP2-Settings
+	if ( upgrade != NULL ) {
+		if ( (length = decodeBase64Url ( upgrade->http2Settings, clientSettings, sizeof(clientSettings) )) == -1 ||
+		     length % 6 ) {
+			connectionError ( session, H2_PROTOCOL_ERROR, "bad HTTP2-Settings" );
+			return 1;
+		}
+		if ( applySettings ( session, clientSettings, length ) )
+			return 1;
+		session->lastStreamId = 1;
+		stream = openStream ( session, 1, STREAM_HALF_CLOSED );
+		strcpy ( upgrade->version, "HTTP/2.0" );
+		if ( startResponse ( session, stream, upgrade ) )
+			return 1;
+	}
+
+	logMessage ( LOG_INFO_LEVEL, "HTTP/2 session started, %s", ( upgrade != NULL ) ? "upgraded from HTTP/1.1" :
+			( conn->protocol == PROTOCOL_HTTP2 ) ? "negotiated with ALPN" : "with prior knowledge" );
+	return serveHttp2 ( conn );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : serveHttp2
+// Description  : Run a session until nothing is left to send and nothing has
+//		  arrived. Frames already waiting are always read before the
+//		  next DATA frame goes out, since they can reset streams, open
+//		  flow control windows and change priorities.
+//
+// Inputs       : conn - the connection, with its session
+// Outputs      : 0 when the session is over, 1 on error, CONN_KEEP_OPEN to
+//		  wait in the event loop for more frames
+int serveHttp2 ( CLIENT_CONN *conn ) {
+
+	HTTP2_SESSION *session = conn->http2;
+	HTTP2_STREAM *stream;
+
+	while ( 1 ) {
+		if ( (stream = pickStream ( session )) == NULL ) {
+			if ( flushOutput ( session, 0 ) )
+				return 1;
+			if ( session->goingAway && session->active == 0 ) {
+				logMessage ( LOG_INFO_LEVEL, "HTTP/2 session ended by the client" );
+				return 0;
+			}
+			//Blocked streams wait here for a WINDOW_UPDATE, an idle
+			//session waits in the event loop without a worker
+			if ( session->active == 0 && session->headerStream == 0 && !connReadable ( conn->fd, 0 ) ) {
+				parkSession ( session );
+				return CONN_KEEP_OPEN;
+			}
+		}
+		else if ( !connReadable ( conn->fd, 0 ) ) {
+			if ( sendData ( session, stream ) )
+				return 1;
+			continue;
+		}
+
+		if ( readFrame ( session ) )
+			return 1;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : canUpgradeHttp2
+// Description  : Check whether an HTTP/1.1 request asks for h2c and can be
+//		  answered as stream 1 of a session. Requests with bodies, or
+//		  for CGI programs and handlers, stay on HTTP/1.1.
+//
+// Inputs       : conn - the connection
+//		  request - the parsed request, with its virtual host
+// Outputs      : 1 if the connection should switch, 0 if not
+int canUpgradeHttp2 ( CLIENT_CONN *conn, HTTP_REQUEST *request ) {
+
+	return conn->tls == NULL && !strcmp ( request->version, "HTTP/1.1" ) &&
+	       headerHasToken ( request->upgrade, "h2c" ) && request->http2Settings[0] != '\0' &&
+	       request->contentLength <= 0 && !request->chunked &&
+	       ( !strcasecmp ( request->method, "GET" ) || !strcasecmp ( request->method, "HEAD" ) ) &&
+	       findHandler ( request->uri ) == NULL &&
+	       strncmp ( request->uri, request->vhost->cgiPrefix, strlen(request->vhost->cgiPrefix) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : refuseHttp2
+// Description  : Turn a session away under overload. GOAWAY names the last
+//		  stream we handled, so the client knows every later one is
+//		  safe to retry.
+//
+// Inputs       : conn - the connection, with its session
+// Outputs      : 0 if successful, -1 if failure
+int refuseHttp2 ( CLIENT_CONN *conn ) {
+
+	HTTP2_SESSION *session = conn->http2;
+	unsigned char payload[8];
+
+	writeUint32 ( payload, session->lastStreamId );
+	writeUint32 ( payload + 4, H2_NO_ERROR );
+	if ( queueFrame ( session, FRAME_GOAWAY, 0, 0, payload, sizeof(payload) ) )
+		return -1;
+	return flushOutput ( session, 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : closeHttp2
+// Description  : Free a connection's session and everything its streams hold
+//
+// Inputs       : conn - the connection
+// Outputs      : none
+void closeHttp2 ( CLIENT_CONN *conn ) {
+
+	HTTP2_SESSION *session = conn->http2;
+
+	for ( int i = 0; session->streams != NULL && i < HTTP2_STREAM_SLOTS; i++ ) {
+		if ( session->streams[i].state != STREAM_FREE )
+			releaseStream ( session, &session->streams[i] );
+	}
+	freeHpackTable ( &session->decoder );
+	freeHpackTable ( &session->encoder );
+	returnBuffer ( session->streams );
+	returnBuffer ( session->headerBlock );
+	returnBuffer ( session->out );
+	countStat ( STAT_CONNECTION_BYTES, -(uint64_t)sizeof(HTTP2_SESSION) );
+	free ( session );
+	conn->http2 = NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : parkSession
+// Description  : Give the pool back the buffers of a session about to wait
+//		  in the event loop. The output has been flushed and no
+//		  header block is open, and the stream slots go too once no
+//		  stream, not even an idle one in the priority tree, is left.
+//
+// Inputs       : session - the session
+// Outputs      : none
+void parkSession ( HTTP2_SESSION *session ) {
+
+	returnBuffer ( session->out );
+	session->out = NULL;
+	returnBuffer ( session->headerBlock );
+	session->headerBlock = NULL;
+	if ( session->active == 0 && session->idle == 0 ) {
+		returnBuffer ( session->streams );
+		session->streams = NULL;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : readFrame
+// Description  : Read one frame and act on it
+//
+// Inputs       : session - the session
+// Outputs      : 0 if successful, -1 if the session must end
+int readFrame ( HTTP2_SESSION *session ) {
+
+	unsigned char head[FRAME_HEADER_SIZE];
+	unsigned char payload[HTTP2_FRAME_SIZE];
+	int length;
+
+	if ( readFull ( session, head, FRAME_HEADER_SIZE ) )
+		return -1;
+	length = ( head[0] << 16 ) | ( head[1] << 8 ) | head[2];
+	if ( length > HTTP2_FRAME_SIZE )
+		return connectionError ( session, H2_FRAME_SIZE_ERROR, "frame larger than SETTINGS_MAX_FRAME_SIZE" );
+	if ( readFull ( session, payload, length ) )
+		return -1;
+
+	return processFrame ( session, head[3], head[4], readUint32 ( head + 5 ) & MAX_WINDOW, payload, length );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : readFull
+// Description  : Read exactly len bytes from the client
+//
+// Inputs       : session - the session
+//		  buf - place to put the bytes
+//		  len - how many to read
+// Outputs      : 0 if successful, -1 if the client went away
+int readFull ( HTTP2_SESSION *session, void *buf, int len ) {
+
+	ssize_t rb;
+	int got = 0;
+
+	while ( got < len ) {
+		if ( (rb = connRead ( session->fd, (char *)buf + got, len - got )) <= 0 ) {
+			if ( rb == -1 && errno == EINTR )
+				continue;
+			logMessage ( LOG_INFO_LEVEL, "HTTP/2 client went away [%s]", ( rb == 0 ) ? "end of stream" : strerror(errno) );
+			return -1;
+		}
+		countTransfer ( session->fd, rb, 0 );
+		got += rb;
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : processFrame
+// Description  : Check a frame against the connection's state and pass it to
+//		  its handler. Frames of unknown types are ignored.
+//
+// Inputs       : session - the session
+//		  type, flags, id - from the frame header
+//		  payload - the frame payload
+//		  length - its length
+// Outputs      : 0 if successful, -1 if the session must end
+int processFrame ( HTTP2_SESSION *session, int type, int flags, uint32_t id, unsigned char *payload, int length ) {
+
+	if ( !session->gotSettings && type != FRAME_SETTINGS )
+		return connectionError ( session, H2_PROTOCOL_ERROR, "first frame wasn't SETTINGS" );
+
+	//Nothing may come between the frames of a header block
+	if ( session->headerStream != 0 && type != FRAME_CONTINUATION )
+		return connectionError ( session, H2_PROTOCOL_ERROR, "header block interrupted" );
+
+	switch ( type ) {
+	case FRAME_DATA:
+		return handleData ( session, flags, id, payload, length );
+	case FRAME_HEADERS:
+		return handleHeaders ( session, flags, id, payload, length );
+	case FRAME_PRIORITY:
+		return handlePriority ( session, id, payload, length );
+	case FRAME_RST_STREAM:
+		return handleRstStream ( session, id, payload, length );
+	case FRAME_SETTINGS:
+		return handleSettings ( session, flags, id, payload, length );
+	case FRAME_PUSH_PROMISE:
+		return connectionError ( session, H2_PROTOCOL_ERROR, "client sent PUSH_PROMISE" );
+	case FRAME_PING:
+		return handlePing ( session, flags, id, payload, length );
+	case FRAME_GOAWAY:
+		return handleGoaway ( session, id, payload, length );
+	case FRAME_WINDOW_UPDATE:
+		return handleWindowUpdate ( session, id, payload, length );
+	case FRAME_CONTINUATION:
+		return handleContinuation ( session, flags, id, payload, length );
+	default:
+		return 0;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : handleData
+// Description  : Take a DATA frame. We don't serve request bodies over HTTP/2,
+//		  so the bytes are dropped, but the windows they used are given
+//		  back right away.
+//
+// Inputs       : session - the session
+//		  flags, id - from the frame header
+//		  payload - the frame payload
+//		  length - its length
+// Outputs      : 0 if successful, -1 if the session must end
+int handleData ( HTTP2_SESSION *session, int flags, uint32_t id, unsigned char *payload, int length ) {
+
+	HTTP2_STREAM *stream;
+
+	if ( id == 0 || id > session->lastStreamId )
+		return connectionError ( session, H2_PROTOCOL_ERROR, "DATA on an idle stream" );
+	if ( ( flags & FLAG_PADDED ) && ( length < 1 || payload[0] >= length ) )
+		return connectionError ( session, H2_PROTOCOL_ERROR, "DATA padding longer than the frame" );
+
+	if ( length > 0 && queueWindowUpdate ( session, 0, length ) )
+		return -1;
+
+	//DATA can still be in flight for a stream we reset or finished
+	if ( (stream = findStream ( session, id )) == NULL || stream->state != STREAM_OPEN )
+		return 0;
+	if ( flags & FLAG_END_STREAM ) {
+		stream->state = STREAM_HALF_CLOSED;
+		return 0;
+	}
+	return ( length > 0 ) ? queueWindowUpdate ( session, id, length ) : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : handleHeaders
+// Description  : Take a HEADERS frame, which opens a stream or carries its
+//		  trailers. The header block is decoded once it is complete,
+//		  here or after its CONTINUATION frames.
+//
+// Inputs       : session - the session
+//		  flags, id - from the frame header
+//		  payload - the frame payload
+//		  length - its length
+// Outputs      : 0 if successful, -1 if the session must end
+int handleHeaders ( HTTP2_SESSION *session, int flags, uint32_t id, unsigned char *payload, int length ) {
+
+	int padding = 0;
+
+	if ( id == 0 || ( id & 1 ) == 0 )
+		return connectionError ( session, H2_PROTOCOL_ERROR, "HEADERS on a server stream" );
+
+	if ( flags & FLAG_PADDED ) {
+		if ( length < 1 )
+			return connectionError ( session, H2_FRAME_SIZE_ERROR, "HEADERS too short" );
+		padding = payload[0];
+		payload++;
+		length--;
+	}
+	session->headerPrioritized = flags & FLAG_PRIORITY;
+	if ( flags & FLAG_PRIORITY ) {
+		if ( length < 5 )
+			return connectionError ( session, H2_FRAME_SIZE_ERROR, "HEADERS too short" );
+		session->headerExclusive = payload[0] >> 7;
+		session->headerParent = readUint32 ( payload ) & MAX_WINDOW;
+		session->headerWeight = payload[4] + 1;
+		payload += 5;
+		length -= 5;
+	}
+	if ( padding > length )
+		return connectionError ( session, H2_PROTOCOL_ERROR, "HEADERS padding longer than the frame" );
+
+	session->headerStream = id;
+	session->headerEndStream = flags & FLAG_END_STREAM;
+	session->headerLength = 0;
+	if ( flags & FLAG_END_HEADERS )
+		return finishHeaderBlock ( session, payload, length - padding );
+	return appendHeaderBlock ( session, payload, length - padding );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : handleContinuation
+// Description  : Take the next piece of a header block
+//
+// Inputs       : session - the session
+//		  flags, id - from the frame header
+//		  payload - the frame payload
+//		  length - its length
+// Outputs      : 0 if successful, -1 if the session must end
+int handleContinuation ( HTTP2_SESSION *session, int flags, uint32_t id, unsigned char *payload, int length ) {
+
+	if ( session->headerStream == 0 || id != session->headerStream )
+		return connectionError ( session, H2_PROTOCOL_ERROR, "CONTINUATION without a header block" );
+	if ( appendHeaderBlock ( session, payload, length ) )
+		return -1;
+	if ( flags & FLAG_END_HEADERS )
+		return finishHeaderBlock ( session, session->headerBlock, session->headerLength );
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : handlePriority
+// Description  : Move a stream in the dependency tree. A stream that hasn't
+//		  been opened yet gets an idle node, while there is room, since
+//		  clients use those to group the streams they open later.
+//
+// Inputs       : session - the session
+//		  id - from the frame header
+//		  payload - the frame payload
+//		  length - its length
+// Outputs      : 0 if successful, -1 if the session must end
+int handlePriority ( HTTP2_SESSION *session, uint32_t id, unsigned char *payload, int length ) {
+
+	HTTP2_STREAM *stream;
+	uint32_t parent;
+
+	if ( id == 0 )
+		return connectionError ( session, H2_PROTOCOL_ERROR, "PRIORITY on stream 0" );
+	if ( length != 5 )
+		return connectionError ( session, H2_FRAME_SIZE_ERROR, "PRIORITY of the wrong size" );
+
+	parent = readUint32 ( payload ) & MAX_WINDOW;
+	stream = findStream ( session, id );
+	if ( parent == id )
+		return ( stream != NULL && stream->state != STREAM_IDLE ) ?
+			resetStream ( session, stream, H2_PROTOCOL_ERROR ) : queueReset ( session, id, H2_PROTOCOL_ERROR );
+
+	if ( stream == NULL && id > session->lastStreamId && session->idle < HTTP2_STREAM_SLOTS - HTTP2_MAX_STREAMS )
+		stream = openStream ( session, id, STREAM_IDLE );
+	if ( stream != NULL )
+		setPriority ( session, stream, parent, payload[4] + 1, payload[0] >> 7 );
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : handleRstStream
+// Description  : The client cancelled a stream, stop sending it
+//
+// Inputs       : session - the session
+//		  id - from the frame header
+//		  payload - the frame payload
+//		  length - its length
+// Outputs      : 0 if successful, -1 if the session must end
+int handleRstStream ( HTTP2_SESSION *session, uint32_t id, unsigned char *payload, int length ) {
+
+	HTTP2_STREAM *stream;
+
+	if ( id == 0 || id > session->lastStreamId )
+		return connectionError ( session, H2_PROTOCOL_ERROR, "RST_STREAM on an idle stream" );
+	if ( length != 4 )
+		return connectionError ( session, H2_FRAME_SIZE_ERROR, "RST_STREAM of the wrong size" );
+
+	if ( (stream = findStream ( session, id )) != NULL && stream->state != STREAM_IDLE ) {
+		logMessage ( LOG_INFO_LEVEL, "HTTP/2 stream %u cancelled by the client, code %u", id, readUint32 ( payload ) );
+		releaseStream ( session, stream );
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : handleSettings
+// Description  : Apply the client's settings and acknowledge them
+//
+// Inputs       : session - the session
+//		  flags, id - from the frame header
+//		  payload - the frame payload
+//		  length - its length
+// Outputs      : 0 if successful, -1 if the session must end
+int handleSettings ( HTTP2_SESSION *session, int flags, uint32_t id, unsigned char *payload, int length ) {
+
+	if ( id != 0 )
+		return connectionError ( session, H2_PROTOCOL_ERROR, "SETTINGS on a stream" );
+	if ( flags & FLAG_ACK )
+		return ( length == 0 ) ? 0 : connectionError ( session, H2_FRAME_SIZE_ERROR, "SETTINGS ack with a payload" );
+	if ( length % 6 )
+		return connectionError ( session, H2_FRAME_SIZE_ERROR, "SETTINGS of the wrong size" );
+
+	if ( applySettings ( session, payload, length ) )
+		return -1;
+	session->gotSettings = 1;
+	return queueFrame ( session, FRAME_SETTINGS, FLAG_ACK, 0, NULL, 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : handlePing
+// Description  : Answer a PING with the same payload
+//
+// Inputs       : session - the session
+//		  flags, id - from the frame header
+//		  payload - the frame payload
+//		  length - its length
+// Outputs      : 0 if successful, -1 if the session must end
+int handlePing ( HTTP2_SESSION *session, int flags, uint32_t id, unsigned char *payload, int length ) {
+
+	if ( id != 0 )
+		return connectionError ( session, H2_PROTOCOL_ERROR, "PING on a stream" );
+	if ( length != 8 )
+		return connectionError ( session, H2_FRAME_SIZE_ERROR, "PING of the wrong size" );
+	if ( flags & FLAG_ACK )
+		return 0;
+	return queueFrame ( session, FRAME_PING, FLAG_ACK, 0, payload, 8 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : handleGoaway
+// Description  : The client is closing the session. Streams already open are
+//		  finished, and the session ends after the last one.
+//
+// Inputs       : session - the session
+//		  id - from the frame header
+//		  payload - the frame payload
+//		  length - its length
+// Outputs      : 0 if successful, -1 if the session must end
+int handleGoaway ( HTTP2_SESSION *session, uint32_t id, unsigned char *payload, int length ) {
+
+	if ( id != 0 )
+		return connectionError ( session, H2_PROTOCOL_ERROR, "GOAWAY on a stream" );
+	if ( length < 8 )
+		return connectionError ( session, H2_FRAME_SIZE_ERROR, "GOAWAY too short" );
+
+	if ( readUint32 ( payload + 4 ) != H2_NO_ERROR )
+		logMessage ( LOG_INFO_LEVEL, "HTTP/2 client is going away, code %u", readUint32 ( payload + 4 ) );
+	session->goingAway = 1;
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : handleWindowUpdate
+// Description  : Open up the connection's or a stream's send window
+//
+// Inputs       : session - the session
+//		  id - from the frame header
+//		  payload - the frame payload
+//		  length - its length
+// Outputs      : 0 if successful, -1 if the session must end
+int handleWindowUpdate ( HTTP2_SESSION *session, uint32_t id, unsigned char *payload, int length ) {
+
+	HTTP2_STREAM *stream;
+	uint32_t increment;
+
+	if ( length != 4 )
+		return connectionError ( session, H2_FRAME_SIZE_ERROR, "WINDOW_UPDATE of the wrong size" );
+	increment = readUint32 ( payload ) & MAX_WINDOW;
+
+	if ( id == 0 ) {
+		if ( increment == 0 )
+			return connectionError ( session, H2_PROTOCOL_ERROR, "WINDOW_UPDATE of 0" );
+		if ( (session->sendWindow += increment) > MAX_WINDOW )
+			return connectionError ( session, H2_FLOW_CONTROL_ERROR, "connection window overflow" );
+		return 0;
+	}
+
+	if ( id > session->lastStreamId )
+		return connectionError ( session, H2_PROTOCOL_ERROR, "WINDOW_UPDATE on an idle stream" );
+	if ( (stream = findStream ( session, id )) == NULL || stream->state == STREAM_IDLE )
+		return ( increment == 0 ) ? queueReset ( session, id, H2_PROTOCOL_ERROR ) : 0;
+	if ( increment == 0 )
+		return resetStream ( session, stream, H2_PROTOCOL_ERROR );
+	if ( (stream->sendWindow += increment) > MAX_WINDOW )
+		return resetStream ( session, stream, H2_FLOW_CONTROL_ERROR );
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : applySettings
+// Description  : Apply a list of the client's settings, from a SETTINGS frame
+//		  or an HTTP2-Settings header. A new initial window size moves
+//		  the window of every open stream by the difference.
+//
+// Inputs       : session - the session
+//		  payload - the settings, six bytes each
+//		  length - length of the list
+// Outputs      : 0 if successful, -1 if the session must end
+int applySettings ( HTTP2_SESSION *session, unsigned char *payload, int length ) {
+
+	uint32_t value;
+	int64_t delta;
+
+	for ( int i = 0; i + 6 <= length; i += 6 ) {
+		value = readUint32 ( payload + i + 2 );
+		switch ( ( payload[i] << 8 ) | payload[i+1] ) {
+		case SETTINGS_HEADER_TABLE_SIZE:
+			hpackEncoderLimit ( &session->encoder, ( value > HPACK_TABLE_SIZE ) ? HPACK_TABLE_SIZE : (int)value );
+			break;
+		case SETTINGS_ENABLE_PUSH:
+			if ( value > 1 )
+				return connectionError ( session, H2_PROTOCOL_ERROR, "bad SETTINGS_ENABLE_PUSH" );
+			break;
+		case SETTINGS_INITIAL_WINDOW_SIZE:
+			if ( value > MAX_WINDOW )
+				return connectionError ( session, H2_FLOW_CONTROL_ERROR, "bad SETTINGS_INITIAL_WINDOW_SIZE" );
+			delta = (int64_t)value - session->initialWindow;
+			session->initialWindow = value;
+			for ( int s = 0; session->streams != NULL && s < HTTP2_STREAM_SLOTS; s++ ) {
+				if ( session->streams[s].state >= STREAM_OPEN &&
+				     (session->streams[s].sendWindow += delta) > MAX_WINDOW )
+					return connectionError ( session, H2_FLOW_CONTROL_ERROR, "stream window overflow" );
+			}
+			break;
+		case SETTINGS_MAX_FRAME_SIZE:
+			if ( value < HTTP2_FRAME_SIZE || value > MAX_FRAME_SIZE_SETTING )
+				return connectionError ( session, H2_PROTOCOL_ERROR, "bad SETTINGS_MAX_FRAME_SIZE" );
+			break;				//we never send more than HTTP2_FRAME_SIZE anyway
+		default:
+			break;				//nothing else changes what we send
+		}
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : appendHeaderBlock
+// Description  : Add a fragment to the header block being gathered
+//
+// Inputs       : session - the session
+//		  fragment - the fragment
+//		  length - its length
+// Outputs      : 0 if successful, -1 if the session must end
+int appendHeaderBlock ( HTTP2_SESSION *session, unsigned char *fragment, int length ) {
+
+	if ( session->headerBlock == NULL && (session->headerBlock = borrowBuffer ( HTTP2_MAX_HEADER_BLOCK )) == NULL )
+		return connectionError ( session, H2_INTERNAL_ERROR, "out of memory for a header block" );
+	if ( length > HTTP2_MAX_HEADER_BLOCK - session->headerLength )
+		return connectionError ( session, H2_ENHANCE_YOUR_CALM, "header block too large" );
+
+	memcpy ( session->headerBlock + session->headerLength, fragment, length );
+	session->headerLength += length;
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : finishHeaderBlock
+// Description  : Decode a complete header block, then open its stream and
+//		  start the response, or refuse it. The block is decoded even
+//		  for a stream that is refused, to keep the table in step.
+//
+// Inputs       : session - the session
+//		  block - the header block
+//		  length - its length
+// Outputs      : 0 if successful, -1 if the session must end
+int finishHeaderBlock ( HTTP2_SESSION *session, unsigned char *block, int length ) {
+
+	uint32_t id = session->headerStream;
+	HTTP2_STREAM *stream = findStream ( session, id );
+	HTTP_REQUEST request;
+	HEADER_FIELDS fields;
+
+	session->headerStream = 0;
+	memset ( &fields, 0, sizeof(fields) );
+	fields.urgency = HTTP2_DEFAULT_URGENCY;
+	fields.incremental = 1;
+
+	//Trailers, which end a stream that is still open
+	if ( id <= session->lastStreamId ) {
+		if ( hpackDecode ( &session->decoder, block, length, collectField, &fields ) )
+			return connectionError ( session, H2_COMPRESSION_ERROR, "bad header block" );
+		if ( stream == NULL || stream->state == STREAM_IDLE )
+			return connectionError ( session, H2_STREAM_CLOSED, "HEADERS on a closed stream" );
+		if ( stream->state != STREAM_OPEN || !session->headerEndStream || fields.malformed )
+			return resetStream ( session, stream, ( stream->state != STREAM_OPEN ) ? H2_STREAM_CLOSED : H2_PROTOCOL_ERROR );
+		stream->state = STREAM_HALF_CLOSED;
+		return 0;
+	}
+
+	memset ( &request, 0, sizeof(request) );
+	request.contentLength = -1;
+	strcpy ( request.version, "HTTP/2.0" );
+	fields.request = &request;
+	if ( hpackDecode ( &session->decoder, block, length, collectField, &fields ) )
+		return connectionError ( session, H2_COMPRESSION_ERROR, "bad header block" );
+	session->lastStreamId = id;
+
+	if ( session->goingAway )
+		return 0;
+	if ( session->active >= HTTP2_MAX_STREAMS ||
+	     (stream = openStream ( session, id, ( session->headerEndStream ) ? STREAM_HALF_CLOSED : STREAM_OPEN )) == NULL )
+		return queueReset ( session, id, H2_REFUSED_STREAM );
+
+	if ( session->headerPrioritized ) {
+		if ( session->headerParent == id )
+			return resetStream ( session, stream, H2_PROTOCOL_ERROR );
+		setPriority ( session, stream, session->headerParent, session->headerWeight, session->headerExclusive );
+	}
+	if ( fields.prioritized ) {
+		stream->urgency = fields.urgency;
+		stream->incremental = fields.incremental;
+	}
+
+	if ( fields.malformed || ( fields.pseudo & ( PSEUDO_METHOD | PSEUDO_SCHEME | PSEUDO_PATH ) ) !=
+				 ( PSEUDO_METHOD | PSEUDO_SCHEME | PSEUDO_PATH ) || request.uri[0] == '\0' ) {
+		logMessage ( LOG_INFO_LEVEL, "HTTP/2 stream %u has a malformed request", id );
+		return resetStream ( session, stream, H2_PROTOCOL_ERROR );
+	}
+	return startResponse ( session, stream, &request );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : collectField
+// Description  : HPACK callback, checks each request field and keeps the ones
+//		  we act on. A malformed request is only flagged, decoding has
+//		  to carry on to the end of the block either way.
+//
+// Inputs       : arg - the HEADER_FIELDS being filled in
+//		  name, nameLen - the field name
+//		  value, valueLen - the field value
+// Outputs      : 0 to keep decoding
+int collectField ( void *arg, const char *name, int nameLen, const char *value, int valueLen ) {
+
+	HEADER_FIELDS *fields = (HEADER_FIELDS *)arg;
+	HTTP_REQUEST *request = fields->request;
+	char *end, *dest = NULL;
+	int bit;
+
+	for ( int i = 0; i < nameLen; i++ ) {
+		if ( isupper ( (unsigned char)name[i] ) )
+			fields->malformed = 1;
+	}
+
+	if ( name[0] == ':' ) {
+		if ( fields->regular || request == NULL ) {
+			fields->malformed = 1;
+			return 0;
+		}
+		if ( !strcmp ( name, ":method" ) ) {
+			bit = PSEUDO_METHOD;
+			dest = request->method;
+		}
+		else if ( !strcmp ( name, ":scheme" ) )
+			bit = PSEUDO_SCHEME;
+		else if ( !strcmp ( name, ":path" ) ) {
+			bit = PSEUDO_PATH;
+			dest = request->uri;
+		}
+		else if ( !strcmp ( name, ":authority" ) ) {
+			bit = PSEUDO_AUTHORITY;
+			dest = request->host;
+		}
+		else {
+			fields->malformed = 1;
+			return 0;
+		}
+		if ( ( fields->pseudo & bit ) || valueLen >= MAXLINE )
+			fields->malformed = 1;
+		else if ( dest != NULL )
+			memcpy ( dest, value, valueLen + 1 );
+		fields->pseudo |= bit;
+		return 0;
+	}
+
+	//Connection specific fields have no place in HTTP/2
+	fields->regular = 1;
+	if ( !strcmp ( name, "connection" ) || !strcmp ( name, "keep-alive" ) || !strcmp ( name, "proxy-connection" ) ||
+	     !strcmp ( name, "transfer-encoding" ) || !strcmp ( name, "upgrade" ) ||
+	     ( !strcmp ( name, "te" ) && strcmp ( value, "trailers" ) ) ) {
+		fields->malformed = 1;
+		return 0;
+	}
+	if ( request == NULL )
+		return 0;
+
+	if ( !strcmp ( name, "host" ) && !( fields->pseudo & PSEUDO_AUTHORITY ) && valueLen < MAXLINE )
+		memcpy ( request->host, value, valueLen + 1 );
+	else if ( !strcmp ( name, "content-length" ) ) {
+		request->contentLength = strtoll ( value, &end, 10 );
+		if ( end == value || *end != '\0' || request->contentLength < 0 )
+			fields->malformed = 1;
+	}
+	else if ( !strcmp ( name, "content-type" ) )
+		snprintf ( request->contentType, sizeof(request->contentType), "%s", value );
+	else if ( !strcmp ( name, "priority" ) )
+		parsePriority ( value, fields );
+	else if ( !strcmp ( name, "if-none-match" ) )
+		snprintf ( request->ifNoneMatch, sizeof(request->ifNoneMatch), "%s", value );
+	else if ( !strcmp ( name, "accept-encoding" ) )
+		request->acceptGzip |= headerHasToken ( value, "gzip" );
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : parsePriority
+// Description  : Read an RFC 9218 priority field, like "u=2, i". Without an
+//		  i parameter the stream is not incremental.
+//
+// Inputs       : value - the field value
+//		  fields - where to record the urgency and incremental flag
+// Outputs      : none
+void parsePriority ( const char *value, HEADER_FIELDS *fields ) {
+
+	int len;
+
+	fields->prioritized = 1;
+	fields->incremental = 0;
+	while ( *value ) {
+		value += strspn ( value, " \t," );
+		len = strcspn ( value, " \t," );
+		if ( len == 3 && value[0] == 'u' && value[1] == '=' && value[2] >= '0' && value[2] <= '7' )
+			fields->urgency = value[2] - '0';
+		else if ( ( len == 1 && value[0] == 'i' ) || ( len == 4 && !strncmp ( value, "i=?1", 4 ) ) )
+			fields->incremental = 1;
+		else if ( len == 4 && !strncmp ( value, "i=?0", 4 ) )
+			fields->incremental = 0;
+		value += len;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : startResponse
+// Description  : Work out the response to a stream's request and send its
+//		  HEADERS. This makes the same decisions processClient does
+//		  for HTTP/1.0, and the body is left for the scheduler.
+//
+// Inputs       : session - the session
+//		  stream - the new stream
+//		  request - its request
+// Outputs      : 0 if successful, -1 if the session must end
+int startResponse ( HTTP2_SESSION *session, HTTP2_STREAM *stream, HTTP_REQUEST *request ) {
+
+	char filename[MAXLINE], cgiargs[MAXLINE], location[MAXLINE + 8], filetype[MAXLINE];
+	int headOnly = !strcasecmp ( request->method, "HEAD" );
+	const char *extra[3] = { NULL, NULL, NULL };
+	int retryAfter, is_static, format, length, status;
+	const BUNDLE_ENTRY *entry;
+	struct stat sbuf;
+
+	logMessage ( LOG_INFO_LEVEL, "HTTP/2 stream %u: %s %s", stream->id, request->method, request->uri );
+	countStat ( STAT_REQUESTS, 1 );
+
+	//Every stream spends a token, just like a request on its own connection
+	if ( admitRequest ( session->conn, &retryAfter ) ) {
+		countStat ( STAT_REJECTED, 1 );
+		snprintf ( location, sizeof(location), "%d", retryAfter );
+		extra[0] = "retry-after";
+		extra[1] = location;
+		return respondError ( session, stream, 429, headOnly, extra );
+	}
+
+	//Bodies, CGI programs and handlers go back to HTTP/1.1
+	if ( strcasecmp ( request->method, "GET" ) && !headOnly ) {
+		if ( strcasecmp ( request->method, "POST" ) && strcasecmp ( request->method, "PUT" ) )
+			return respondError ( session, stream, 501, 0, NULL );
+		logMessage ( LOG_INFO_LEVEL, "HTTP/2 stream %u has a body, it needs HTTP/1.1", stream->id );
+		return resetStream ( session, stream, H2_HTTP_1_1_REQUIRED );
+	}
+	request->vhost = findVirtualHost ( session->conn->config->hosts, request->host );
+	if ( request->uri[0] != '/' || !uri_is_safe ( request->uri ) )
+		return respondError ( session, stream, 400, headOnly, NULL );
+	if ( findHandler ( request->uri ) != NULL ) {
+		logMessage ( LOG_INFO_LEVEL, "HTTP/2 stream %u is for a handler, it needs HTTP/1.1", stream->id );
+		return resetStream ( session, stream, H2_HTTP_1_1_REQUIRED );
+	}
+	if ( (is_static = parse_uri ( request->vhost, request->uri, filename, cgiargs )) == -1 )
+		return respondError ( session, stream, 414, headOnly, NULL );
+	if ( !is_static ) {
+		logMessage ( LOG_INFO_LEVEL, "HTTP/2 stream %u is for a CGI program, it needs HTTP/1.1", stream->id );
+		return resetStream ( session, stream, H2_HTTP_1_1_REQUIRED );
+	}
+	if ( request->vhost->bundle != NULL &&
+	     (entry = findBundleEntry ( request->vhost->bundle, filename + docrootLength ( request->vhost ) )) != NULL )
+		return respondBundle ( session, stream, request, entry, headOnly );
+
+	if ( stat ( filename, &sbuf ) < 0 ) {
+		//Listings are sent straight from the cache
+		if ( request->vhost->autoindex && request->uri[0] && request->uri[strlen(request->uri)-1] == '/' ) {
+			format = ( !strcmp ( cgiargs, "format=json" ) ) ? AUTOINDEX_JSON : AUTOINDEX_HTML;
+			if ( (status = openDirectoryListing ( request->vhost, request->uri, format, &stream->listing )) )
+				return respondError ( session, stream, status, headOnly, NULL );
+			stream->data = listingBody ( stream->listing, &length );
+			return respond ( session, stream, 200, AUTOINDEX_TYPE ( format ), length, headOnly, NULL );
+		}
+		return respondError ( session, stream, 404, headOnly, NULL );
+	}
+	if ( S_ISDIR ( sbuf.st_mode ) ) {
+		snprintf ( location, sizeof(location), "%s/", request->uri );
+		extra[0] = "location";
+		extra[1] = location;
+		return respondError ( session, stream, 301, headOnly, extra );
+	}
+	if ( !S_ISREG ( sbuf.st_mode ) || !( S_IRUSR & sbuf.st_mode ) ||
+	     ( !headOnly && (stream->fd = open ( filename, O_RDONLY | O_CLOEXEC )) == -1 ) )
+		return respondError ( session, stream, 403, headOnly, NULL );
+
+	get_filetype ( filename, filetype );
+	return respond ( session, stream, 200, filetype, sbuf.st_size, headOnly, NULL );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : respond
+// Description  : Send a stream's response HEADERS. The body, whose source the
+//		  caller already set, is left for the scheduler. A response
+//		  without one ends the stream here.
+//
+// Inputs       : session - the session
+//		  stream - the stream
+//		  status - HTTP status code
+//		  type - Content-Type (NULL to leave it out)
+//		  length - length of the body
+//		  headOnly - send only the headers, for a HEAD request
+//		  extra - more fields to send, name and value pairs ending in
+//			a NULL name (may be NULL)
+// Outputs      : 0 if successful, -1 if the session must end
+int respond ( HTTP2_SESSION *session, HTTP2_STREAM *stream, int status, const char *type, off_t length,
+		int headOnly, const char **extra ) {
+
+	unsigned char block[MAXLINE * 3];
+	char code[16], size[32];
+	const char *fields[][2] = { { ":status", code }, { "server", SERVER_NAME }, { "content-type", type },
+				    { "content-length", size } };
+	int modes[] = { HPACK_INDEX, HPACK_INDEX, HPACK_INDEX, HPACK_NO_INDEX };
+	int pos = 0, n;
+
+	snprintf ( code, sizeof(code), "%d", status );
+	snprintf ( size, sizeof(size), "%lld", (long long)length );
+	for ( int i = 0; i < 4; i++ ) {
+		if ( fields[i][1] == NULL )
+			continue;
+		if ( (n = hpackEncode ( &session->encoder, block + pos, sizeof(block) - pos, fields[i][0], fields[i][1], modes[i] )) == -1 )
+			return connectionError ( session, H2_INTERNAL_ERROR, "response headers too large" );
+		pos += n;
+	}
+	for ( int i = 0; extra != NULL && extra[i] != NULL; i += 2 ) {
+		if ( (n = hpackEncode ( &session->encoder, block + pos, sizeof(block) - pos, extra[i], extra[i+1], HPACK_NO_INDEX )) == -1 )
+			return connectionError ( session, H2_INTERNAL_ERROR, "response headers too large" );
+		pos += n;
+	}
+
+	stream->remaining = ( headOnly ) ? 0 : length;
+	if ( queueFrame ( session, FRAME_HEADERS, FLAG_END_HEADERS | ( ( stream->remaining ) ? 0 : FLAG_END_STREAM ),
+			stream->id, block, pos ) )
+		return -1;
+	return ( stream->remaining ) ? 0 : finishStream ( session, stream );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : respondError
+// Description  : Answer a stream with an error page
+//
+// Inputs       : session - the session
+//		  stream - the stream
+//		  status - HTTP status code
+//		  headOnly - send only the headers, for a HEAD request
+//		  extra - more fields to send, as for respond (may be NULL)
+// Outputs      : 0 if successful, -1 if the session must end
+int respondError ( HTTP2_SESSION *session, HTTP2_STREAM *stream, int status, int headOnly, const char **extra ) {
+
+	if ( (stream->page = malloc ( MAXLINE )) == NULL )
+		return connectionError ( session, H2_INTERNAL_ERROR, "out of memory for an error page" );
+	stream->data = stream->page;
+	return respond ( session, stream, status, "text/html", errorPage ( stream->page, MAXLINE, status, errorReason ( status ) ),
+			headOnly, extra );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : respondBundle
+// Description  : Answer a stream with a file from the host's asset bundle. The
+//		  body is sent straight out of the mapped bundle, the gzip
+//		  variant if the client takes it.
+//
+// Inputs       : session - the session
+//		  stream - the stream
+//		  request - its request
+//		  entry - the bundled file
+//		  headOnly - send only the headers, for a HEAD request
+// Outputs      : 0 if successful, -1 if the session must end
+int respondBundle ( HTTP2_SESSION *session, HTTP2_STREAM *stream, HTTP_REQUEST *request,
+		const BUNDLE_ENTRY *entry, int headOnly ) {
+
+	BUNDLE *bundle = request->vhost->bundle;
+	const char *extra[7] = { "etag", bundleString ( bundle, entry->etag ), NULL, NULL, NULL, NULL, NULL };
+	int gzip = ( request->acceptGzip && entry->gzipLength );
+
+	if ( bundleNotModified ( bundle, entry, request ) )
+		return respond ( session, stream, 304, NULL, entry->bodyLength, 1, extra );
+
+	if ( entry->gzipLength ) {
+		extra[2] = "vary";
+		extra[3] = "accept-encoding";
+	}
+	if ( gzip ) {
+		extra[4] = "content-encoding";
+		extra[5] = "gzip";
+	}
+	stream->data = (const char *)bundle->map + ( ( gzip ) ? entry->gzip : entry->body );
+	return respond ( session, stream, 200, bundleString ( bundle, entry->type ),
+			( gzip ) ? entry->gzipLength : entry->bodyLength, headOnly, extra );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : pickStream
+// Description  : Choose the stream that sends the next DATA frame. Lower
+//		  urgency goes first. A stream waits while anything it depends
+//		  on is sending. Streams that aren't incremental go one at a
+//		  time in the order they were opened, and incremental ones share
+//		  by weight, whoever has the least weighted bytes sent going next.
+//
+// Inputs       : session - the session
+// Outputs      : the stream, or NULL if nothing can be sent
+HTTP2_STREAM * pickStream ( HTTP2_SESSION *session ) {
+
+	HTTP2_STREAM *best = NULL, *stream, *ancestor;
+
+	if ( session->sendWindow <= 0 || session->streams == NULL )
+		return NULL;
+
+	for ( int i = 0; i < HTTP2_STREAM_SLOTS; i++ ) {
+		stream = &session->streams[i];
+		if ( !isSending ( session, stream ) )
+			continue;
+		for ( ancestor = stream->parent; ancestor != NULL && !isSending ( session, ancestor ); ancestor = ancestor->parent )
+			;
+		if ( ancestor != NULL )
+			continue;
+
+		if ( best == NULL || stream->urgency < best->urgency ||
+		     ( stream->urgency == best->urgency &&
+		       ( ( !stream->incremental && ( best->incremental || stream->id < best->id ) ) ||
+			 ( stream->incremental && best->incremental &&
+			   ( stream->pass < best->pass || ( stream->pass == best->pass && stream->id < best->id ) ) ) ) ) )
+			best = stream;
+	}
+	return best;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : isSending
+// Description  : Check whether a stream has body left and window to send it
+//
+// Inputs       : session - the session
+//		  stream - the stream
+// Outputs      : 1 if it can send, 0 if not
+int isSending ( HTTP2_SESSION *session, HTTP2_STREAM *stream ) {
+	return stream->state >= STREAM_OPEN && stream->remaining > 0 && stream->sendWindow > 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sendData
+// Description  : Send one DATA frame for a stream, as large as the windows
+//		  and frame size allow. File bytes are sent with sendfile right
+//		  behind the frame header when the socket allows it.
+//
+// Inputs       : session - the session
+//		  stream - the stream
+// Outputs      : 0 if successful, -1 if the session must end
+int sendData ( HTTP2_SESSION *session, HTTP2_STREAM *stream ) {
+
+	off_t n = stream->remaining, left;
+	unsigned char *payload;
+	ssize_t sent;
+	int flags;
+
+	if ( n > stream->sendWindow )
+		n = stream->sendWindow;
+	if ( n > session->sendWindow )
+		n = session->sendWindow;
+	if ( n > session->maxFrame )
+		n = session->maxFrame;
+	flags = ( n == stream->remaining ) ? FLAG_END_STREAM : 0;
+
+	if ( stream->fd != -1 && canSendDirect ( session->fd ) ) {
+		if ( startFrame ( session, FRAME_DATA, flags, stream->id, n, 0 ) == NULL || flushOutput ( session, 1 ) )
+			return -1;
+		for ( left = n; left > 0; left -= sent ) {
+			if ( (sent = sendfile ( session->fd, stream->fd, &stream->offset, left )) <= 0 ) {
+				if ( sent == -1 && errno == EINTR ) {
+					sent = 0;
+					continue;
+				}
+				logMessage ( LOG_ERROR_LEVEL, "_sendData:sendfile failed [%s]", ( sent ) ? strerror(errno) : "file shrank" );
+				return -1;
+			}
+			countTransfer ( session->fd, 0, sent );
+		}
+	}
+	else {
+		if ( (payload = startFrame ( session, FRAME_DATA, flags, stream->id, n, n )) == NULL )
+			return -1;
+		if ( stream->fd == -1 )
+			memcpy ( payload, stream->data + stream->offset, n );
+		else if ( pread ( stream->fd, payload, n, stream->offset ) != n ) {
+			logMessage ( LOG_ERROR_LEVEL, "_sendData:Failed to read the file [%s]", strerror(errno) );
+			return -1;
+		}
+		session->outLength += n;
+		stream->offset += n;
+	}
+
+	stream->remaining -= n;
+	stream->sendWindow -= n;
+	session->sendWindow -= n;
+	session->virtualTime = stream->pass;
+	stream->pass += (uint64_t)n * 256 / stream->weight;
+
+	return ( stream->remaining ) ? 0 : finishStream ( session, stream );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : findStream
+// Description  : Find a stream's slot
+//
+// Inputs       : session - the session
+//		  id - the stream
+// Outputs      : the stream, or NULL if it isn't open or idle in the tree
+HTTP2_STREAM * findStream ( HTTP2_SESSION *session, uint32_t id ) {
+
+	for ( int i = 0; session->streams != NULL && i < HTTP2_STREAM_SLOTS; i++ ) {
+		if ( session->streams[i].state != STREAM_FREE && session->streams[i].id == id )
+			return &session->streams[i];
+	}
+	return NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : openStream
+// Description  : Take a slot for a stream, or open the idle node that already
+//		  stands for it in the priority tree. The first open stream
+//		  starts the send rate deadline.
+//
+// Inputs       : session - the session
+//		  id - the stream
+//		  state - STREAM_IDLE, STREAM_OPEN or STREAM_HALF_CLOSED
+// Outputs      : the stream, or NULL if there is no free slot
+HTTP2_STREAM * openStream ( HTTP2_SESSION *session, uint32_t id, int state ) {
+
+	HTTP2_STREAM *stream = findStream ( session, id );
+
+	if ( stream != NULL )
+		session->idle--;		//only idle streams are found by a new id
+	else {
+		//The slots come back from the pool when the session goes idle
+		if ( session->streams == NULL ) {
+			if ( (session->streams = borrowBuffer ( HTTP2_STREAM_SLOTS * sizeof(HTTP2_STREAM) )) == NULL )
+				return NULL;
+			memset ( session->streams, 0, HTTP2_STREAM_SLOTS * sizeof(HTTP2_STREAM) );
+		}
+		for ( int i = 0; i < HTTP2_STREAM_SLOTS && stream == NULL; i++ ) {
+			if ( session->streams[i].state == STREAM_FREE )
+				stream = &session->streams[i];
+		}
+		if ( stream == NULL )
+			return NULL;
+		memset ( stream, 0, sizeof(HTTP2_STREAM) );
+		stream->id = id;
+		stream->weight = HTTP2_DEFAULT_WEIGHT;
+	}
+
+	stream->state = state;
+	stream->fd = -1;
+	stream->urgency = HTTP2_DEFAULT_URGENCY;
+	stream->incremental = 1;
+	stream->sendWindow = session->initialWindow;
+	stream->pass = session->virtualTime;
+
+	if ( state == STREAM_IDLE )
+		session->idle++;
+	else if ( session->active++ == 0 )
+		armDeadline ( session->conn, CONN_SEND );
+	return stream;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : finishStream
+// Description  : Close a stream whose response is complete. If the client
+//		  hasn't finished its side, it is told to stop sending.
+//
+// Inputs       : session - the session
+//		  stream - the stream
+// Outputs      : 0 if successful, -1 if the session must end
+int finishStream ( HTTP2_SESSION *session, HTTP2_STREAM *stream ) {
+
+	if ( stream->state == STREAM_OPEN )
+		return resetStream ( session, stream, H2_NO_ERROR );
+	releaseStream ( session, stream );
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : resetStream
+// Description  : Send RST_STREAM for a stream and close it
+//
+// Inputs       : session - the session
+//		  stream - the stream
+//		  code - the error code
+// Outputs      : 0 if successful, -1 if the session must end
+int resetStream ( HTTP2_SESSION *session, HTTP2_STREAM *stream, int code ) {
+
+	int ret = queueReset ( session, stream->id, code );
+
+	releaseStream ( session, stream );
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : releaseStream
+// Description  : Free a stream's slot and whatever its body came from. Its
+//		  children in the priority tree move up to its parent and split
+//		  its weight in proportion to their own.
+//
+// Inputs       : session - the session
+//		  stream - the stream
+// Outputs      : none
+void releaseStream ( HTTP2_SESSION *session, HTTP2_STREAM *stream ) {
+
+	HTTP2_STREAM *child;
+	int total = 0;
+
+	if ( stream->fd != -1 )
+		close ( stream->fd );
+	free ( stream->page );
+	if ( stream->listing != NULL )
+		releaseListing ( stream->listing );
+
+	for ( int i = 0; i < HTTP2_STREAM_SLOTS; i++ ) {
+		if ( session->streams[i].state != STREAM_FREE && session->streams[i].parent == stream )
+			total += session->streams[i].weight;
+	}
+	for ( int i = 0; i < HTTP2_STREAM_SLOTS && total > 0; i++ ) {
+		child = &session->streams[i];
+		if ( child->state == STREAM_FREE || child->parent != stream )
+			continue;
+		child->parent = stream->parent;
+		if ( (child->weight = stream->weight * child->weight / total) < 1 )
+			child->weight = 1;
+	}
+
+	if ( stream->state == STREAM_IDLE )
+		session->idle--;
+	else
+		session->active--;
+	memset ( stream, 0, sizeof(HTTP2_STREAM) );
+	stream->fd = -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : setPriority
+// Description  : Make a stream depend on another, following RFC 7540 5.3.3.
+//		  A parent that is not in the tree means the root with the
+//		  default weight. A parent that depends on the stream is first
+//		  moved up to the stream's old place, so the tree never loops.
+//		  An exclusive dependency adopts the parent's other children.
+//
+// Inputs       : session - the session
+//		  stream - the stream
+//		  parentId - the stream it depends on, 0 for the root
+//		  weight - 1 to 256
+//		  exclusive - take over the parent's other children
+// Outputs      : none
+void setPriority ( HTTP2_SESSION *session, HTTP2_STREAM *stream, uint32_t parentId, int weight, int exclusive ) {
+
+	HTTP2_STREAM *parent = NULL, *ancestor;
+
+	if ( parentId != 0 && (parent = findStream ( session, parentId )) == NULL ) {
+		weight = HTTP2_DEFAULT_WEIGHT;
+		exclusive = 0;
+	}
+
+	for ( ancestor = ( parent ) ? parent->parent : NULL; ancestor != NULL && ancestor != stream; ancestor = ancestor->parent )
+		;
+	if ( ancestor == stream )
+		parent->parent = stream->parent;
+
+	if ( exclusive ) {
+		for ( int i = 0; i < HTTP2_STREAM_SLOTS; i++ ) {
+			if ( session->streams[i].state != STREAM_FREE && session->streams[i].parent == parent &&
+			     &session->streams[i] != stream )
+				session->streams[i].parent = stream;
+		}
+	}
+	stream->parent = parent;
+	stream->weight = weight;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : startFrame
+// Description  : Write a frame header to the output buffer, making room for
+//		  it and for the part of the payload that will follow it there
+//
+// Inputs       : session - the session
+//		  type, flags, id - for the frame header
+//		  length - the payload length
+//		  room - payload bytes the caller will put in the buffer
+// Outputs      : where the payload goes, or NULL if the buffer couldn't be written
+unsigned char * startFrame ( HTTP2_SESSION *session, int type, int flags, uint32_t id, int length, int room ) {
+
+	unsigned char *head;
+
+	if ( session->out == NULL && (session->out = borrowBuffer ( HTTP2_OUTPUT_SIZE )) == NULL )
+		return NULL;
+	if ( session->outLength + FRAME_HEADER_SIZE + room > HTTP2_OUTPUT_SIZE && flushOutput ( session, 0 ) )
+		return NULL;
+
+	head = session->out + session->outLength;
+	head[0] = length >> 16;
+	head[1] = length >> 8;
+	head[2] = length;
+	head[3] = type;
+	head[4] = flags;
+	writeUint32 ( head + 5, id );
+	session->outLength += FRAME_HEADER_SIZE;
+	return head + FRAME_HEADER_SIZE;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : queueFrame
+// Description  : Add a whole frame to the output buffer
+//
+// Inputs       : session - the session
+//		  type, flags, id - for the frame header
+//		  payload - the payload (may be NULL when length is 0)
+//		  length - its length
+// Outputs      : 0 if successful, -1 if failure
+int queueFrame ( HTTP2_SESSION *session, int type, int flags, uint32_t id, const void *payload, int length ) {
+
+	unsigned char *dest;
+
+	if ( (dest = startFrame ( session, type, flags, id, length, length )) == NULL )
+		return -1;
+	if ( length > 0 )
+		memcpy ( dest, payload, length );
+	session->outLength += length;
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : queueReset
+// Description  : Add a RST_STREAM frame to the output buffer
+//
+// Inputs       : session - the session
+//		  id - the stream
+//		  code - the error code
+// Outputs      : 0 if successful, -1 if failure
+int queueReset ( HTTP2_SESSION *session, uint32_t id, int code ) {
+
+	unsigned char payload[4];
+
+	writeUint32 ( payload, code );
+	return queueFrame ( session, FRAME_RST_STREAM, 0, id, payload, sizeof(payload) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : queueWindowUpdate
+// Description  : Add a WINDOW_UPDATE frame to the output buffer
+//
+// Inputs       : session - the session
+//		  id - the stream, 0 for the connection
+//		  increment - bytes to add to the window
+// Outputs      : 0 if successful, -1 if failure
+int queueWindowUpdate ( HTTP2_SESSION *session, uint32_t id, uint32_t increment ) {
+
+	unsigned char payload[4];
+
+	writeUint32 ( payload, increment );
+	return queueFrame ( session, FRAME_WINDOW_UPDATE, 0, id, payload, sizeof(payload) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : flushOutput
+// Description  : Write out the output buffer. With more set the bytes are
+//		  corked, for a sendfile that follows straight after.
+//
+// Inputs       : session - the session
+//		  more - more bytes follow outside the buffer
+// Outputs      : 0 if successful, -1 if failure
+int flushOutput ( HTTP2_SESSION *session, int more ) {
+
+	ssize_t sent;
+	int done = 0;
+
+	if ( session->outLength == 0 )
+		return 0;
+
+	if ( more && canSendDirect ( session->fd ) ) {
+		while ( done < session->outLength ) {
+			if ( (sent = send ( session->fd, session->out + done, session->outLength - done, MSG_MORE )) <= 0 ) {
+				if ( sent == -1 && errno == EINTR )
+					continue;
+				logMessage ( LOG_ERROR_LEVEL, "_flushOutput:send failed [%s]", strerror(errno) );
+				return -1;
+			}
+			countTransfer ( session->fd, 0, sent );
+			done += sent;
+		}
+	}
+	else if ( sendBytes ( session->fd, session->outLength, (char *)session->out ) )
+		return -1;
+
+	session->outLength = 0;
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : connectionError
+// Description  : End the session with a GOAWAY carrying the error
+//
+// Inputs       : session - the session
+//		  code - the error code
+//		  why - what went wrong, for the log
+// Outputs      : -1, so callers can return it
+int connectionError ( HTTP2_SESSION *session, int code, const char *why ) {
+
+	unsigned char payload[8];
+
+	logMessage ( LOG_WARNING_LEVEL, "Ending HTTP/2 session, %s (code %d)", why, code );
+	writeUint32 ( payload, session->lastStreamId );
+	writeUint32 ( payload + 4, code );
+	if ( queueFrame ( session, FRAME_GOAWAY, 0, 0, payload, sizeof(payload) ) == 0 )
+		flushOutput ( session, 0 );
+	return -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : readUint32
+// Description  : Read a 32 bit big endian integer
+//
+// Inputs       : p - the bytes
+// Outputs      : the integer
+uint32_t readUint32 ( const unsigned char *p ) {
+	return ( (uint32_t)p[0] << 24 ) | ( (uint32_t)p[1] << 16 ) | ( (uint32_t)p[2] << 8 ) | p[3];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : writeUint32
+// Description  : Write a 32 bit big endian integer
+//
+// Inputs       : p - where to write
+//		  value - the integer
+// Outputs      : none
+void writeUint32 ( unsigned char *p, uint32_t value ) {
+
+	p[0] = value >> 24;
+	p[1] = value >> 16;
+	p[2] = value >> 8;
+	p[3] = value;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : decodeBase64Url
+// Description  : Decode the base64url text of an HTTP2-Settings header
+//
+// Inputs       : text - the text, padding optional
+//		  out - where to put the bytes
+//		  space - size of out
+// Outputs      : number of bytes, or -1 if the text is malformed or too long
+int decodeBase64Url ( const char *text, unsigned char *out, int space ) {
+
+	unsigned int bits = 0;
+	int pending = 0, len = 0, value;
+
+	for ( ; *text && *text != '='; text++ ) {
+		if ( *text >= 'A' && *text <= 'Z' )
+			value = *text - 'A';
+		else if ( *text >= 'a' && *text <= 'z' )
+			value = *text - 'a' + 26;
+		else if ( *text >= '0' && *text <= '9' )
+			value = *text - '0' + 52;
+		else if ( *text == '-' || *text == '+' )
+			value = 62;
+		else if ( *text == '_' || *text == '/' )
+			value = 63;
+		else
+			return -1;
+
+		bits = ( bits << 6 ) | value;
+		if ( (pending += 6) >= 8 ) {
+			if ( len >= space )
+				return -1;
+			pending -= 8;
+			out[len++] = bits >> pending;
+			bits &= ( 1u << pending ) - 1;
+		}
+	}
+	return len;
+}
@@ -0,0 +1,51 @@
+#ifndef SERVER_HTTP2_INCLUDED
+#define SERVER_HTTP2_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_http2.h
+//  Description   : HTTP/2 sessions. A session starts from ALPN "h2" on a TLS
+//                  connection, from the client preface sent with prior
+//                  knowledge, or from an HTTP/1.1 "Upgrade: h2c" request. One
+//                  worker runs a session for as long as it has streams to
+//                  answer or frames to read, interleaving DATA frames for every
+//                  stream it is sending, and then hands the connection back to
+//                  the event loop until the client sends more. While it waits
+//                  there its output buffer and stream slots are back in the
+//                  buffer pool, and only the HPACK tables are kept.
+//
+//                  Static files and directory listings are served over HTTP/2.
+//                  CGI programs, in-process handlers and request bodies still
+//                  need HTTP/1.1, and those streams are reset with
+//                  HTTP_1_1_REQUIRED so the client retries them that way.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#include <server.h>
+
+//
+// Constants
+
+#define HTTP2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define HTTP2_PREFACE_LINE "PRI * HTTP/2.0\r\n"	//what the preface looks like to readBytes
+#define HTTP2_MAX_STREAMS 100			//SETTINGS_MAX_CONCURRENT_STREAMS we advertise
+#define HTTP2_STREAM_SLOTS 128			//open streams plus idle ones only used for priority
+#define HTTP2_FRAME_SIZE 16384			//largest frame we receive or send
+#define HTTP2_MAX_HEADER_BLOCK 65536		//largest header block, across CONTINUATION frames
+#define HTTP2_OUTPUT_SIZE ( HTTP2_FRAME_SIZE * 2 )	//frames gathered before a write
+#define HTTP2_WINDOW 65535			//initial flow control window
+#define HTTP2_DEFAULT_WEIGHT 16
+#define HTTP2_DEFAULT_URGENCY 3			//RFC 9218 priority when the client doesn't say
+
+//
+// Functional Prototypes
+
+int startHttp2 ( CLIENT_CONN *conn, const char *prefaceRead, HTTP_REQUEST *upgrade );
+int serveHttp2 ( CLIENT_CONN *conn );
+int canUpgradeHttp2 ( CLIENT_CONN *conn, HTTP_REQUEST *request );
+int refuseHttp2 ( CLIENT_CONN *conn );
+void closeHttp2 ( CLIENT_CONN *conn );
+
+#endif
@@ -0,0 +1,328 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_iopool.c
+//  Description   : The I/O pool. Workers queue suspended requests here, in a
+//                  plain locked FIFO since this is already the slow path. Each
+//                  pool thread registers a work ring and pushes the
+//                  connections it is done with there, where the workers take
+//                  them like any other ready connection.
+//
+//                  Paging a file in starts readahead over the whole file and
+//                  waits for the first IO_READAHEAD_BYTES of it, so the worker
+//                  that sends it finds the start resident and the rest on its
+//                  way. On a kernel without RESOLVE_CACHED or RWF_NOWAIT,
+//                  lookups and reads just block in the worker as they always
+//                  did.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/openat2.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+
+// Project Include Files
+#include <cmpsc311_log.h>
+#include <server.h>
+#include <server_iopool.h>
+#include <server_threads.h>
+#include <server_affinity.h>
+
+// Global Variables
+pthread_t ioThreads[IO_THREADS];
+WORK_RING ioRings[IO_THREADS];		//finished lookups, one pushed onto by each thread
+CLIENT_CONN *ioHead = NULL;			//lookups waiting, linked through CLIENT_CONN.next
+CLIENT_CONN *ioTail = NULL;
+int ioLength = 0;
+int ioRunning = 0;				//threads in the pool
+int ioStopping = 0;
+int cachedLookups = 1;				//the kernel knows RESOLVE_CACHED
+int nowaitReads = 1;				//the kernel knows RWF_NOWAIT
+pthread_mutex_t ioLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t ioReady = PTHREAD_COND_INITIALIZER;
+
+//
+// Functional Prototypes
+
+void * ioLoop ( void *arg );
+CLIENT_CONN * takeLookup ( void );
+void pageIn ( const char *filename );
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : startIoPool
+// Description  : Start the I/O threads. The workers must already be running,
+//		  since finished lookups go back to them.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+int startIoPool ( void ) {
+
+	sigset_t blocked, previous;
+	pthread_attr_t attr;
+
+	ioStopping = 0;
+
+	//Like the workers, the pool leaves SIGINT and SIGHUP to the event loop, and runs
+	//on the process's node
+	sigemptyset ( &blocked );
+	sigaddset ( &blocked, SIGINT );
+	sigaddset ( &blocked, SIGHUP );
+	pthread_sigmask ( SIG_BLOCK, &blocked, &previous );
+	pthread_attr_init ( &attr );
+	workerThreadAffinity ( &attr, -1 );
+
+	for ( ioRunning = 0; ioRunning < IO_THREADS; ioRunning++ ) {
+		memset ( &ioRings[ioRunning], 0, sizeof(WORK_RING) );
+		if ( registerRing ( &ioRings[ioRunning] ) ||
+		     pthread_create ( &ioThreads[ioRunning], &attr, ioLoop, (void *)(intptr_t)ioRunning ) ) {
+			logMessage ( LOG_ERROR_LEVEL, "_startIoPool:Failed to create I/O thread %d", ioRunning + 1 );
+			break;
+		}
+	}
+
+	pthread_attr_destroy ( &attr );
+	pthread_sigmask ( SIG_SETMASK, &previous, NULL );
+	if ( ioRunning < IO_THREADS ) {
+		stopIoPool ();
+		return -1;
+	}
+
+	logMessage ( LOG_INFO_LEVEL, "Started %d I/O threads", IO_THREADS );
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : stopIoPool
+// Description  : Stop the I/O threads, closing the connections still waiting
+//		  for one. Lookups already running finish and go back to the
+//		  workers, so this runs before the workers are stopped.
+//
+// Inputs       : none
+// Outputs      : none
+void stopIoPool ( void ) {
+
+	CLIENT_CONN *conn;
+
+	pthread_mutex_lock ( &ioLock );
+	ioStopping = 1;
+	pthread_cond_broadcast ( &ioReady );
+	pthread_mutex_unlock ( &ioLock );
+
+	for ( int i = 0; i < ioRunning; i++ )
+		pthread_join ( ioThreads[i], NULL );
+	ioRunning = 0;
+
+	while ( (conn = ioHead) != NULL ) {
+		ioHead = conn->next;
+		closeConnection ( conn );
+	}
+	ioTail = NULL;
+	ioLength = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lookupFile
+// Description  : stat a file, but only if the kernel can answer from its
+//		  dentry and inode caches
+//
+// Inputs       : filename - the file
+//		  sbuf - place to put what stat says
+// Outputs      : 0 if found, -1 if not, IO_WOULD_BLOCK if it needs the disk
+int lookupFile ( const char *filename, struct stat *sbuf ) {
+
+	struct open_how how;
+	int fd, ret;
+
+	if ( !__atomic_load_n ( &cachedLookups, __ATOMIC_RELAXED ) )
+		return ( stat ( filename, sbuf ) ) ? -1 : 0;
+
+	//An O_PATH descriptor only resolves the path, the file isn't opened
+	memset ( &how, 0, sizeof(how) );
+	how.flags = O_PATH | O_CLOEXEC;
+	how.resolve = RESOLVE_CACHED;
+	if ( (fd = syscall ( SYS_openat2, AT_FDCWD, filename, &how, sizeof(how) )) == -1 ) {
+		if ( errno == EAGAIN )
+			return IO_WOULD_BLOCK;
+		if ( errno == ENOSYS || errno == EINVAL ) {
+			logMessage ( LOG_WARNING_LEVEL, "The kernel can't do cached lookups, file lookups will block workers" );
+			__atomic_store_n ( &cachedLookups, 0, __ATOMIC_RELAXED );
+			return ( stat ( filename, sbuf ) ) ? -1 : 0;
+		}
+		return -1;
+	}
+
+	ret = fstat ( fd, sbuf );
+	close ( fd );
+	return ( ret ) ? -1 : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : probeFile
+// Description  : Check that the start of a file is in the page cache, so
+//		  sending it won't wait on the disk. RWF_NOWAIT reads fail
+//		  instead of blocking, and the first and last byte of the
+//		  start are enough to tell, since readahead brings it in whole.
+//
+// Inputs       : filename - the file
+//		  length - its size
+// Outputs      : 0 if resident or unknown, IO_WOULD_BLOCK if it needs the disk
+int probeFile ( const char *filename, off_t length ) {
+
+	off_t ends[2] = { 0, ( ( length < IO_READAHEAD_BYTES ) ? length : IO_READAHEAD_BYTES ) - 1 };
+	struct iovec iov;
+	char byte;
+	int fd, ret = 0;
+
+	if ( length == 0 || !__atomic_load_n ( &nowaitReads, __ATOMIC_RELAXED ) ||
+	     (fd = open ( filename, O_RDONLY | O_CLOEXEC )) == -1 )
+		return 0;
+
+	iov.iov_base = &byte;
+	iov.iov_len = 1;
+	for ( int i = 0; i < 2 && ret == 0; i++ ) {
+		if ( preadv2 ( fd, &iov, 1, ends[i], RWF_NOWAIT ) != -1 )
+			continue;
+		if ( errno == EAGAIN )
+			ret = IO_WOULD_BLOCK;
+		else if ( errno == EOPNOTSUPP || errno == ENOSYS || errno == EINVAL ) {
+			logMessage ( LOG_WARNING_LEVEL, "The kernel can't do non-blocking reads, cold files will block workers" );
+			__atomic_store_n ( &nowaitReads, 0, __ATOMIC_RELAXED );
+			break;
+		}
+	}
+
+	close ( fd );
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : submitLookup
+// Description  : Queue a suspended request for the I/O pool. The connection's
+//		  pending request says what to look up.
+//
+// Inputs       : conn - the connection
+// Outputs      : 0 if successful, -1 if the pool can't take it
+int submitLookup ( CLIENT_CONN *conn ) {
+
+	pthread_mutex_lock ( &ioLock );
+	if ( ioRunning == 0 || ioStopping || ioLength >= IO_QUEUE_SIZE ) {
+		pthread_mutex_unlock ( &ioLock );
+		return -1;
+	}
+
+	conn->next = NULL;
+	if ( ioTail )
+		ioTail->next = conn;
+	else
+		ioHead = conn;
+	ioTail = conn;
+	ioLength++;
+
+	pthread_cond_signal ( &ioReady );
+	pthread_mutex_unlock ( &ioLock );
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ioLoop
+// Description  : Body of each I/O thread. Does the blocking lookup for each
+//		  suspended request, then gives the connection back to the
+//		  workers through the thread's own ring.
+//
+// Inputs       : arg - the thread's number
+// Outputs      : NULL
+void * ioLoop ( void *arg ) {
+
+	WORK_RING *ring = &ioRings[(intptr_t)arg];
+	PENDING_REQUEST *pending;
+	CLIENT_CONN *conn;
+
+	while ( (conn = takeLookup ()) != NULL ) {
+		pending = conn->pending;
+		if ( pending->job == IO_LOOKUP )
+			pending->found = ( stat ( pending->filename, &pending->sbuf ) ) ? -1 : 0;
+		if ( pending->found == 0 && pending->isStatic && S_ISREG ( pending->sbuf.st_mode ) &&
+		     strcasecmp ( pending->request.method, "HEAD" ) )
+			pageIn ( pending->filename );
+
+		//Workers empty the ring, so a full one only has to wait for them
+		while ( pushConnection ( ring, conn ) ) {
+			if ( __atomic_load_n ( &ioStopping, __ATOMIC_RELAXED ) ) {
+				closeConnection ( conn );
+				break;
+			}
+			usleep ( 1000 );
+		}
+	}
+
+	return NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : takeLookup
+// Description  : Wait for a suspended request
+//
+// Inputs       : none
+// Outputs      : the connection, or NULL when the pool is stopping
+CLIENT_CONN * takeLookup ( void ) {
+
+	CLIENT_CONN *conn = NULL;
+
+	pthread_mutex_lock ( &ioLock );
+	while ( ioHead == NULL && !ioStopping )
+		pthread_cond_wait ( &ioReady, &ioLock );
+	if ( !ioStopping ) {
+		conn = ioHead;
+		if ( (ioHead = conn->next) == NULL )
+			ioTail = NULL;
+		ioLength--;
+		conn->next = NULL;
+	}
+	pthread_mutex_unlock ( &ioLock );
+	return conn;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : pageIn
+// Description  : Read a file into the page cache. Readahead over the whole
+//		  file is started, and the start of it waited for, so the
+//		  worker that sends it doesn't wait on the disk for the first
+//		  bytes and the rest arrives ahead of it.
+//
+// Inputs       : filename - the file
+// Outputs      : none
+void pageIn ( const char *filename ) {
+
+	int fd;
+
+	if ( (fd = open ( filename, O_RDONLY | O_CLOEXEC )) == -1 )
+		return;
+	posix_fadvise ( fd, 0, 0, POSIX_FADV_WILLNEED );
+	readahead ( fd, 0, IO_READAHEAD_BYTES );
+	close ( fd );
+}
@@ -0,0 +1,59 @@
+#ifndef SERVER_IOPOOL_INCLUDED
+#define SERVER_IOPOOL_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_iopool.h
+//  Description   : A small pool of threads for filesystem work that has to
+//                  go to the disk. Workers look files up with RESOLVE_CACHED,
+//                  which fails instead of blocking when the kernel's caches
+//                  can't answer, and probe a file's first pages with
+//                  RWF_NOWAIT reads before sending it. Either way the request
+//                  is then suspended and handed to the pool, which does the
+//                  blocking stat or reads the file into the page cache, and
+//                  queues the connection for a worker again. Requests for
+//                  cached files never wait behind a cold one.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#include <sys/stat.h>
+#include <server.h>
+
+//
+// Constants
+
+#define IO_THREADS 4				//threads in the pool
+#define IO_QUEUE_SIZE 256			//lookups waiting for a thread
+#define IO_READAHEAD_BYTES ( 256 * 1024 )	//start of a cold file read in before a worker sends it
+#define IO_WOULD_BLOCK 1			//lookupFile or probeFile needs the disk
+
+// What the pool does for a suspended request
+#define IO_LOOKUP 0				//stat the file, then page it in
+#define IO_PAGE_IN 1				//the file was found, only page it in
+
+//
+// Type Definitions
+
+// A request suspended while its file is looked up
+typedef struct pending_request {
+	HTTP_REQUEST request;
+	char filename[MAXLINE];
+	char cgiargs[MAXLINE];
+	int isStatic;			//parse_uri's verdict
+	int job;			//IO_ job for the pool
+	int found;			//what stat returned, 0 or -1
+	struct stat sbuf;
+} PENDING_REQUEST;
+
+//
+// Functional Prototypes
+
+int startIoPool ( void );
+void stopIoPool ( void );
+int lookupFile ( const char *filename, struct stat *sbuf );
+int probeFile ( const char *filename, off_t length );
+int submitLookup ( CLIENT_CONN *conn );
+
+#endif
@@ -0,0 +1,438 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_listener.c
+//  Description   : Reading the listeners file and opening the listening
+//                  sockets with their options. The event loop watches them
+//                  once they are open.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+// Project Include Files
+#include <smsa_network.h>
+#include <cmpsc311_log.h>
+#include <server_listener.h>
+#include <server_event.h>
+#include <server_master.h>
+#include <server_affinity.h>
+#include <server_busypoll.h>
+
+// Global Variables
+LISTENER listeners[MAX_LISTENERS];	//every configured listener
+int listenersLoaded = 0;
+
+//
+// Functional Prototypes
+
+int parseListenerLine ( char *line, LISTENER *listener, const char *filename, int lineNumber );
+int parseListenAddress ( const char *text, LISTENER *listener );
+void defaultListener ( LISTENER *listener, int port, int flags );
+int openListener ( LISTENER *listener );
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : loadListeners
+// Description  : Read the listeners file, or make the listeners for the
+//		  listen and tls ports when there is none. Nothing is opened yet.
+//
+// Inputs       : filename - the listeners file, NULL if there is none
+//		  port - port to listen on without a file
+//		  tlsPort - port to serve TLS on without a file, 0 for none
+// Outputs      : 0 if successful, -1 if failure
+int loadListeners ( const char *filename, int port, int tlsPort ) {
+
+	char line[LISTENER_NAME_MAX * 4];
+	FILE *config;
+	int lineNumber = 0;
+
+	if ( filename == NULL ) {
+		defaultListener ( &listeners[listenersLoaded++], port, 0 );
+		if ( tlsPort )
+			defaultListener ( &listeners[listenersLoaded++], tlsPort, LISTEN_TLS );
+		return 0;
+	}
+
+	if ( (config = fopen ( filename, "r" )) == NULL ) {
+		logMessage ( LOG_ERROR_LEVEL, "_loadListeners:Can't open %s [%s]", filename, strerror(errno) );
+		return -1;
+	}
+
+	while ( fgets ( line, sizeof(line), config ) != NULL ) {
+		lineNumber++;
+		if ( listenersLoaded >= MAX_LISTENERS ) {
+			logMessage ( LOG_ERROR_LEVEL, "_loadListeners:%s has more than %d listeners", filename, MAX_LISTENERS );
+			fclose ( config );
+			return -1;
+		}
+		switch ( parseListenerLine ( line, &listeners[listenersLoaded], filename, lineNumber ) ) {
+		case 0:
+			listenersLoaded++;
+			break;
+		case 1:
+			break;			//blank or comment
+		default:
+			fclose ( config );
+			return -1;
+		}
+	}
+	fclose ( config );
+
+	if ( listenersLoaded == 0 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_loadListeners:%s doesn't define any listeners", filename );
+		return -1;
+	}
+	logMessage ( LOG_INFO_LEVEL, "Loaded %d listeners from %s", listenersLoaded, filename );
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : countListeners
+// Description  : Count the listeners that have all of some flags
+//
+// Inputs       : flags - LISTEN_ flags
+// Outputs      : the number of listeners
+int countListeners ( int flags ) {
+
+	int count = 0;
+
+	for ( int i = 0; i < listenersLoaded; i++ ) {
+		if ( ( listeners[i].flags & flags ) == flags )
+			count++;
+	}
+	return count;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : openSharedListeners
+// Description  : Open the Unix sockets, before any worker is forked, so every
+//		  process accepts from the same socket
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+int openSharedListeners ( void ) {
+
+	for ( int i = 0; i < listenersLoaded; i++ ) {
+		if ( listeners[i].address.ss_family == AF_UNIX && openListener ( &listeners[i] ) )
+			return -1;
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : openListeners
+// Description  : Open this process's listeners and have the event loop
+//		  watch them, along with the shared ones
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+int openListeners ( void ) {
+
+	for ( int i = 0; i < listenersLoaded; i++ ) {
+		if ( listeners[i].fd == -1 && openListener ( &listeners[i] ) )
+			return -1;
+		if ( addListener ( listeners[i].fd, listeners[i].flags ) )
+			return -1;
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : closeListeners
+// Description  : Close the listeners this process has open. The process
+//		  that made a Unix socket also removes it.
+//
+// Inputs       : none
+// Outputs      : none
+void closeListeners ( void ) {
+
+	LISTENER *listener;
+
+	for ( int i = 0; i < listenersLoaded; i++ ) {
+		listener = &listeners[i];
+		if ( listener->fd == -1 )
+			continue;
+		close ( listener->fd );
+		listener->fd = -1;
+		if ( listener->address.ss_family == AF_UNIX && !isWorkerProcess() )
+			unlink ( ((struct sockaddr_un *)&listener->address)->sun_path );
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : parseListenerLine
+// Description  : Parse one line of the listeners file
+//
+// Inputs       : line - the line
+//		  listener - listener to fill in
+//		  filename - listeners file name, for errors
+//		  lineNumber - line number, for errors
+// Outputs      : 0 for a listener, 1 for a blank or comment line, -1 on error
+int parseListenerLine ( char *line, LISTENER *listener, const char *filename, int lineNumber ) {
+
+	char *word, *value, *save;
+
+	if ( (word = strtok_r ( line, " \t\r\n", &save )) == NULL || word[0] == '#' )
+		return 1;
+
+	if ( strcmp ( word, "listen" ) ) {
+		logMessage ( LOG_ERROR_LEVEL, "_parseListenerLine:%s:%d: expected \"listen\", found \"%s\"", filename, lineNumber, word );
+		return -1;
+	}
+
+	defaultListener ( listener, 0, 0 );
+	if ( (word = strtok_r ( NULL, " \t\r\n", &save )) == NULL || parseListenAddress ( word, listener ) ) {
+		logMessage ( LOG_ERROR_LEVEL, "_parseListenerLine:%s:%d: missing or bad address", filename, lineNumber );
+		return -1;
+	}
+
+	while ( (word = strtok_r ( NULL, " \t\r\n", &save )) != NULL ) {
+		if ( (value = strchr ( word, '=' )) == NULL ) {
+			logMessage ( LOG_ERROR_LEVEL, "_parseListenerLine:%s:%d: expected key=value, found \"%s\"", filename, lineNumber, word );
+			return -1;
+		}
+		*value++ = '\0';
+
+		if ( !strcmp ( word, "tls" ) && ( !strcmp ( value, "on" ) || !strcmp ( value, "off" ) ) )
+			listener->flags = ( !strcmp ( value, "on" ) ) ? listener->flags | LISTEN_TLS : listener->flags & ~LISTEN_TLS;
+		else if ( !strcmp ( word, "backlog" ) && atoi ( value ) > 0 )
+			listener->backlog = atoi ( value );
+		else if ( !strcmp ( word, "fastopen" ) && atoi ( value ) >= 0 )
+			listener->fastOpen = atoi ( value );
+		else if ( !strcmp ( word, "defer" ) && atoi ( value ) >= 0 )
+			listener->deferAccept = atoi ( value );
+		else if ( !strcmp ( word, "rcvbuf" ) && atoi ( value ) >= 0 )
+			listener->receiveBuffer = atoi ( value );
+		else if ( !strcmp ( word, "sndbuf" ) && atoi ( value ) >= 0 )
+			listener->sendBuffer = atoi ( value );
+		else if ( !strcmp ( word, "v6only" ) && ( !strcmp ( value, "on" ) || !strcmp ( value, "off" ) ) )
+			listener->v6only = !strcmp ( value, "on" );
+		else if ( !strcmp ( word, "mode" ) && strtol ( value, NULL, 8 ) > 0 )
+			listener->mode = strtol ( value, NULL, 8 );
+		else {
+			logMessage ( LOG_ERROR_LEVEL, "_parseListenerLine:%s:%d: bad setting %s=%s", filename, lineNumber, word, value );
+			return -1;
+		}
+	}
+
+	//Unix sockets have no TCP options to set
+	if ( listener->address.ss_family == AF_UNIX && ( listener->fastOpen || listener->deferAccept ) ) {
+		logMessage ( LOG_ERROR_LEVEL, "_parseListenerLine:%s:%d: fastopen and defer are TCP only", filename, lineNumber );
+		return -1;
+	}
+
+	//The request is usually waiting by the time the connection is accepted
+	if ( listener->fastOpen || listener->deferAccept )
+		listener->flags |= LISTEN_DEFERRED;
+	if ( listener->address.ss_family == AF_UNIX )
+		listener->flags |= LISTEN_SHARED;
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : parseListenAddress
+// Description  : Parse a listen address, a port, <IPv4 address>:<port>,
+//		  [<IPv6 address>]:<port> or unix:<path>
+//
+// Inputs       : text - the address
+//		  listener - listener to set the address of
+// Outputs      : 0 if successful, -1 if the address is bad
+int parseListenAddress ( const char *text, LISTENER *listener ) {
+
+	struct sockaddr_in *in = (struct sockaddr_in *)&listener->address;
+	struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)&listener->address;
+	struct sockaddr_un *un = (struct sockaddr_un *)&listener->address;
+	char host[LISTENER_NAME_MAX];
+	const char *colon;
+	char *end;
+	long port;
+
+	if ( strlen ( text ) >= LISTENER_NAME_MAX )
+		return -1;
+	strcpy ( listener->name, text );
+	memset ( &listener->address, 0, sizeof(listener->address) );
+
+	if ( !strncmp ( text, "unix:", 5 ) ) {
+		if ( text[5] == '\0' || strlen ( &text[5] ) >= sizeof(un->sun_path) )
+			return -1;
+		un->sun_family = AF_UNIX;
+		strcpy ( un->sun_path, &text[5] );
+		listener->addressLength = sizeof(struct sockaddr_un);
+		return 0;
+	}
+
+	//Everything else ends in the port
+	if ( (colon = strrchr ( text, ':' )) == NULL )
+		colon = text - 1;
+	port = strtol ( colon + 1, &end, 10 );
+	if ( *end != '\0' || port < 1 || port > 65535 || colon - text >= LISTENER_NAME_MAX )
+		return -1;
+
+	if ( text[0] == '[' ) {
+		if ( colon - text < 3 || colon[-1] != ']' )
+			return -1;
+		memcpy ( host, &text[1], colon - text - 2 );
+		host[colon - text - 2] = '\0';
+		in6->sin6_family = AF_INET6;
+		in6->sin6_port = htons ( (unsigned short)port );
+		listener->addressLength = sizeof(struct sockaddr_in6);
+		return ( inet_pton ( AF_INET6, host, &in6->sin6_addr ) == 1 ) ? 0 : -1;
+	}
+
+	in->sin_family = AF_INET;
+	in->sin_port = htons ( (unsigned short)port );
+	in->sin_addr.s_addr = htonl ( INADDR_ANY );
+	listener->addressLength = sizeof(struct sockaddr_in);
+	if ( colon < text )
+		return 0;
+	memcpy ( host, text, colon - text );
+	host[colon - text] = '\0';
+	return ( inet_pton ( AF_INET, host, &in->sin_addr ) == 1 ) ? 0 : -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : defaultListener
+// Description  : Set up a listener on any IPv4 address, with default options
+//
+// Inputs       : listener - the listener
+//		  port - its port
+//		  flags - LISTEN_ flags
+// Outputs      : none
+void defaultListener ( LISTENER *listener, int port, int flags ) {
+
+	struct sockaddr_in *in = (struct sockaddr_in *)&listener->address;
+
+	memset ( listener, 0, sizeof(LISTENER) );
+	snprintf ( listener->name, sizeof(listener->name), "%d", port );
+	in->sin_family = AF_INET;
+	in->sin_port = htons ( (unsigned short)port );
+	in->sin_addr.s_addr = htonl ( INADDR_ANY );
+	listener->addressLength = sizeof(struct sockaddr_in);
+	listener->flags = flags;
+	listener->backlog = SMSA_MAX_BACKLOG;
+	listener->mode = LISTENER_UNIX_MODE;
+	listener->fd = -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : openListener
+// Description  : Create a listening socket, set its options, bind it and
+//		  start it listening
+//
+// Inputs       : listener - the listener
+// Outputs      : 0 if successful, -1 if failure
+int openListener ( LISTENER *listener ) {
+
+	int family = listener->address.ss_family;
+	int optionValue = 1;		   //holds the value for setsocketopt function call
+	const char *path = ((struct sockaddr_un *)&listener->address)->sun_path;
+	struct stat sbuf;
+
+	//Create the socket
+	//Set up a socket using TCP protocol ( SOCK_STREAM ), or a stream Unix
+	//socket, while setting the listener's file handle
+	if ( ( listener->fd = socket ( family, SOCK_STREAM | SOCK_CLOEXEC, 0 ) ) == -1 ) {
+		logMessage( LOG_ERROR_LEVEL, "_openListener:Failed to set up the socket for %s [%s]", listener->name, strerror(errno) );
+		return -1;
+	}
+
+	logMessage( LOG_INFO_LEVEL, "Socket Successfully Initialized. Socket File Handle = %d", listener->fd );
+
+	if ( family == AF_UNIX ) {
+		//A socket left behind by a server that didn't shut down cleanly
+		//would fail the bind
+		if ( lstat ( path, &sbuf ) == 0 && S_ISSOCK ( sbuf.st_mode ) )
+			unlink ( path );
+	}
+	else {
+		//Set the socket to be reusable.
+		if ( setsockopt ( listener->fd, SOL_SOCKET, SO_REUSEADDR, &optionValue, sizeof(optionValue) ) != 0 ) {
+			logMessage ( LOG_ERROR_LEVEL, "_openListener:setsockopt failed to make the local address reusable [%s]", strerror(errno) );
+			goto failed;
+		}
+
+		//Worker processes each bind their own listener to the port, and the
+		//kernel spreads new connections across them
+		if ( isWorkerProcess() && setsockopt ( listener->fd, SOL_SOCKET, SO_REUSEPORT, &optionValue, sizeof(optionValue) ) != 0 ) {
+			logMessage ( LOG_ERROR_LEVEL, "_openListener:setsockopt failed to share the port [%s]", strerror(errno) );
+			goto failed;
+		}
+		if ( steerListener ( listener->fd ) || busyPollSocket ( listener->fd ) )
+			goto failed;
+
+		//[::] also takes IPv4 clients, as mapped addresses, unless told not to
+		if ( family == AF_INET6 && setsockopt ( listener->fd, IPPROTO_IPV6, IPV6_V6ONLY, &listener->v6only, sizeof(int) ) != 0 ) {
+			logMessage ( LOG_ERROR_LEVEL, "_openListener:Can't set IPV6_V6ONLY on %s [%s]", listener->name, strerror(errno) );
+			goto failed;
+		}
+
+		//Only wake us once the client has sent something, and let clients
+		//that have connected before send their request in the SYN
+		if ( listener->deferAccept && setsockopt ( listener->fd, IPPROTO_TCP, TCP_DEFER_ACCEPT,
+				&listener->deferAccept, sizeof(int) ) != 0 ) {
+			logMessage ( LOG_ERROR_LEVEL, "_openListener:Can't defer accepts on %s [%s]", listener->name, strerror(errno) );
+			goto failed;
+		}
+		if ( listener->fastOpen && setsockopt ( listener->fd, IPPROTO_TCP, TCP_FASTOPEN,
+				&listener->fastOpen, sizeof(int) ) != 0 )
+			logMessage ( LOG_WARNING_LEVEL, "TCP Fast Open is off on %s [%s]", listener->name, strerror(errno) );
+	}
+
+	//Accepted sockets start out with the listener's buffer sizes
+	if ( listener->receiveBuffer && setsockopt ( listener->fd, SOL_SOCKET, SO_RCVBUF, &listener->receiveBuffer, sizeof(int) ) != 0 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_openListener:Can't set the receive buffer of %s [%s]", listener->name, strerror(errno) );
+		goto failed;
+	}
+	if ( listener->sendBuffer && setsockopt ( listener->fd, SOL_SOCKET, SO_SNDBUF, &listener->sendBuffer, sizeof(int) ) != 0 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_openListener:Can't set the send buffer of %s [%s]", listener->name, strerror(errno) );
+		goto failed;
+	}
+
+	//bind the server to the socket. bind the server file handle to
+	//the address we have initialized
+	if ( bind ( listener->fd, (struct sockaddr*)&listener->address, listener->addressLength ) == -1 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_openListener:Failure to bind %s [%s]", listener->name, strerror(errno) );
+		goto failed;
+	}
+	if ( family == AF_UNIX && chmod ( path, listener->mode ) == -1 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_openListener:Can't set the permissions of %s [%s]", path, strerror(errno) );
+		goto failed;
+	}
+
+	//listen for connections
+	if ( listen ( listener->fd, listener->backlog ) == -1 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_openListener:Failure to properly listen on %s [%s]", listener->name, strerror(errno) );
+		goto failed;
+	}
+
+	logMessage ( LOG_INFO_LEVEL, "Listening on %s%s, Queueing %d Connections", listener->name,
+			( listener->flags & LISTEN_TLS ) ? " with TLS" : "", listener->backlog );
+	return 0;
+
+failed:
+	close ( listener->fd );
+	listener->fd = -1;
+	return -1;
+}
@@ -0,0 +1,74 @@
+#ifndef SERVER_LISTENER_INCLUDED
+#define SERVER_LISTENER_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_listener.h
+//  Description   : The sockets the server listens on. Without a listeners
+//                  file there is an IPv4 listener on the listen port, and
+//                  another for TLS on the tls port. A listeners file replaces
+//                  both with lines like
+//
+//                      listen <address> [key=value ...]
+//
+//                  where <address> is a port or <IPv4 address>:<port>,
+//                  [<IPv6 address>]:<port>, or unix:<path> for a Unix-domain
+//                  socket. [::] takes IPv4 clients too, unless v6only=on.
+//                  Keys are tls=on|off, backlog=<queued connections>,
+//                  fastopen=<queued TCP Fast Open requests, 0 for none>,
+//                  defer=<seconds the kernel holds a connection until its
+//                  request arrives, 0 for none>, rcvbuf=<bytes>,
+//                  sndbuf=<bytes>, v6only=on|off and mode=<octal permissions
+//                  of a Unix socket>. Blank lines and lines starting with #
+//                  are ignored.
+//
+//                  With defer or fastopen, a connection usually has its
+//                  request waiting when it is accepted, and goes straight to
+//                  a worker instead of being parked in the event loop first.
+//
+//                  TCP listeners are opened by every process, sharing their
+//                  port with SO_REUSEPORT. A Unix socket can't be shared that
+//                  way, so it is opened once before the workers are forked,
+//                  and they all accept from it.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+//
+// Constants
+
+#define LISTENER_NAME_MAX 128		//longest address in the listeners file
+#define LISTENER_UNIX_MODE 0660		//permissions of a Unix socket, by default
+
+//
+// Type Definitions
+
+typedef struct listener {
+	char name[LISTENER_NAME_MAX];		//the address as it was given, for logs
+	struct sockaddr_storage address;
+	socklen_t addressLength;
+	int flags;				//LISTEN_ flags handed to the accept handler
+	int backlog;
+	int fastOpen;				//TCP Fast Open queue, 0 for none
+	int deferAccept;			//TCP_DEFER_ACCEPT seconds, 0 for none
+	int receiveBuffer;			//SO_RCVBUF, 0 for the kernel's
+	int sendBuffer;				//SO_SNDBUF, 0 for the kernel's
+	int v6only;
+	int mode;				//permissions of a Unix socket
+	int fd;					//-1 until it is open
+} LISTENER;
+
+//
+// Functional Prototypes
+
+int loadListeners ( const char *filename, int port, int tlsPort );
+int countListeners ( int flags );
+int openSharedListeners ( void );
+int openListeners ( void );
+void closeListeners ( void );
+
+#endif
@@ -0,0 +1,245 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_master.c
+//  Description   : The master process of multi-process mode. Everything that
+//                  is loaded from the command line, hosts, bundles, upstreams
+//                  and the TLS context, is loaded before the workers are
+//                  forked and so is shared copy on write. Each worker then
+//                  sets up its own listeners, event loop and threads by
+//                  running server(), exactly as a single process server would.
+//
+//                  A worker that dies from a signal, or fails after it has
+//                  been up for a while, is restarted in the same slot. One
+//                  that fails right away is taken to be misconfigured, since
+//                  restarting it would only fail again, and the master stops
+//                  the server. Workers are killed with SIGINT when the master
+//                  goes away, so none outlives it.
+//
+//                  SIGHUP reloads the master's config, so restarted workers
+//                  start with the new one, and is passed on to every worker
+//                  to reload its own.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+// Project Include Files
+#include <cmpsc311_log.h>
+#include <server.h>
+#include <server_master.h>
+#include <server_shared.h>
+#include <server_affinity.h>
+#include <server_config.h>
+
+// Global Variables
+int workerProcess = 0;				//set in every forked worker
+volatile sig_atomic_t masterShutdown = 0;
+volatile sig_atomic_t masterReload = 0;		//SIGHUP, pass it on to the workers
+int workersFailed = 0;				//a worker couldn't start, so the server stopped
+pid_t masterPid = 0;
+pid_t workerPids[SHARED_MAX_WORKERS];		//0 for a slot with no worker running
+time_t workerStarted[SHARED_MAX_WORKERS];
+
+//
+// Functional Prototypes
+
+int startWorker ( int slot, int restarted );
+int workerCrashed ( int slot, pid_t pid, int status );
+void masterSignalHandler ( int signal );
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : runWorkers
+// Description  : Fork the worker processes and watch them until the server
+//		  is shut down
+//
+// Inputs       : workers - number of worker processes
+// Outputs      : 0 if successful, -1 if the workers couldn't be started
+int runWorkers ( int workers ) {
+
+	struct sigaction action;
+	int running = 0, signalled = 0, status, slot;
+	pid_t pid;
+
+	if ( workers < 1 || workers > SHARED_MAX_WORKERS ) {
+		logMessage ( LOG_ERROR_LEVEL, "_runWorkers:Can't run %d workers, the most is %d", workers, SHARED_MAX_WORKERS );
+		return -1;
+	}
+
+	//No SA_RESTART, so a shutdown signal wakes the master out of waitpid
+	memset ( &action, 0, sizeof(action) );
+	action.sa_handler = masterSignalHandler;
+	sigemptyset ( &action.sa_mask );
+	sigaction ( SIGINT, &action, NULL );
+	sigaction ( SIGTERM, &action, NULL );
+	sigaction ( SIGHUP, &action, NULL );
+
+	masterPid = getpid();
+	for ( slot = 0; slot < workers && !masterShutdown; slot++ ) {
+		if ( startWorker ( slot, 0 ) )
+			masterShutdown = workersFailed = 1;
+		else
+			running++;
+	}
+
+	while ( running > 0 ) {
+		if ( masterShutdown && !signalled ) {
+			logMessage ( LOG_INFO_LEVEL, "Stopping %d worker processes", running );
+			for ( slot = 0; slot < workers; slot++ ) {
+				if ( workerPids[slot] )
+					kill ( workerPids[slot], SIGINT );
+			}
+			signalled = 1;
+		}
+		if ( masterReload && !masterShutdown ) {
+			masterReload = 0;
+			reloadConfig();
+			for ( slot = 0; slot < workers; slot++ ) {
+				if ( workerPids[slot] )
+					kill ( workerPids[slot], SIGHUP );
+			}
+		}
+
+		if ( (pid = waitpid ( -1, &status, 0 )) == -1 ) {
+			if ( errno == EINTR )
+				continue;
+			logMessage ( LOG_ERROR_LEVEL, "_runWorkers:Failed to wait for the workers [%s]", strerror(errno) );
+			return -1;
+		}
+		for ( slot = 0; slot < workers && workerPids[slot] != pid; slot++ );
+		if ( slot == workers )
+			continue;
+
+		running--;
+		workerPids[slot] = 0;
+		releaseSharedLocks ( pid );
+		if ( workerCrashed ( slot, pid, status ) && !masterShutdown && !startWorker ( slot, 1 ) )
+			running++;
+	}
+
+	logMessage ( LOG_INFO_LEVEL, "All worker processes have stopped" );
+	return ( workersFailed ) ? -1 : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : isWorkerProcess
+// Description  : Check whether this process is a worker forked by the master,
+//		  which shares its listening port with the other workers
+//
+// Inputs       : none
+// Outputs      : 1 if it is, 0 if not
+int isWorkerProcess ( void ) {
+
+	return workerProcess;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : startWorker
+// Description  : Fork a worker process into a slot. The child runs the server
+//		  and never returns.
+//
+// Inputs       : slot - the worker's slot
+//		  restarted - 1 if it replaces a worker that crashed
+// Outputs      : 0 if successful, -1 if failure
+int startWorker ( int slot, int restarted ) {
+
+	pid_t pid;
+
+	//Or every child writes out the master's buffered output again
+	fflush ( NULL );
+
+	if ( (pid = fork ()) == -1 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_startWorker:Can't fork worker %d [%s]", slot, strerror(errno) );
+		return -1;
+	}
+
+	if ( pid == 0 ) {
+		//Die with the master, and leave signals to the server's own handler
+		signal ( SIGINT, SIG_DFL );
+		signal ( SIGTERM, SIG_DFL );
+		signal ( SIGHUP, SIG_IGN );		//until the server's handler is in place
+		prctl ( PR_SET_PDEATHSIG, SIGINT );
+		if ( getppid () != masterPid )
+			exit ( 0 );
+
+		workerProcess = 1;
+		setSharedSlot ( slot, restarted );
+		chooseHomeCpu ( slot );
+		exit ( server () ? 1 : 0 );
+	}
+
+	workerPids[slot] = pid;
+	workerStarted[slot] = time ( NULL );
+	logMessage ( LOG_INFO_LEVEL, "Started worker %d, pid %d", slot, (int)pid );
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : workerCrashed
+// Description  : Decide what a worker's exit means. A clean exit is left
+//		  alone, a crash is restarted, and a worker that fails as soon
+//		  as it starts stops the server.
+//
+// Inputs       : slot - the worker's slot
+//		  pid - its process id
+//		  status - its status from waitpid
+// Outputs      : 1 if the worker should be restarted, 0 if not
+int workerCrashed ( int slot, pid_t pid, int status ) {
+
+	int young = ( time ( NULL ) - workerStarted[slot] < MASTER_MIN_UPTIME );
+
+	if ( WIFEXITED ( status ) && WEXITSTATUS ( status ) == 0 ) {
+		logMessage ( LOG_INFO_LEVEL, "Worker %d, pid %d, has exited", slot, (int)pid );
+		return 0;
+	}
+
+	if ( WIFEXITED ( status ) && young ) {
+		logMessage ( LOG_ERROR_LEVEL, "_workerCrashed:Worker %d failed to start, status %d. Stopping the server",
+				slot, WEXITSTATUS ( status ) );
+		masterShutdown = workersFailed = 1;
+		return 0;
+	}
+
+	if ( WIFSIGNALED ( status ) )
+		logMessage ( LOG_WARNING_LEVEL, "Worker %d, pid %d, was killed by signal %d. Restarting it",
+				slot, (int)pid, WTERMSIG ( status ) );
+	else
+		logMessage ( LOG_WARNING_LEVEL, "Worker %d, pid %d, failed with status %d. Restarting it",
+				slot, (int)pid, WEXITSTATUS ( status ) );
+
+	//A worker that keeps crashing as it starts is not restarted in a tight loop
+	if ( young )
+		sleep ( MASTER_RESTART_DELAY );
+	return 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : masterSignalHandler
+// Description  : Handles SIGINT and SIGTERM in the master by asking it to stop
+//		  the workers, and SIGHUP by asking it to reload
+//
+// Inputs       : signal - the signal received
+// Outputs      : none
+void masterSignalHandler ( int signal ) {
+
+	if ( signal == SIGHUP )
+		masterReload = 1;
+	else
+		masterShutdown = 1;
+}
@@ -0,0 +1,30 @@
+#ifndef SERVER_MASTER_INCLUDED
+#define SERVER_MASTER_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_master.h
+//  Description   : Multi-process mode. A master process forks a number of
+//                  worker processes, each running the whole server with its
+//                  own event loop, thread pool and SO_REUSEPORT listener, so
+//                  the kernel spreads connections across them. The master
+//                  only watches its workers and restarts the ones that crash.
+//                  What the workers share lives in server_shared.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+//
+// Constants
+
+#define MASTER_MIN_UPTIME 1		//seconds a worker must run before a failed exit counts as a crash
+#define MASTER_RESTART_DELAY 1		//seconds to wait before restarting a worker that crashed young
+
+//
+// Functional Prototypes
+
+int runWorkers ( int workers );
+int isWorkerProcess ( void );
+
+#endif
@@ -0,0 +1,712 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_microcache.c
+//  Description   : The CGI response cache. A miss links a placeholder for its
+//                  key before running the program, and requests that find the
+//                  placeholder wait on a condition variable for the output
+//                  instead of forking their own copy. A program whose response
+//                  can't be cached leaves a pass entry for the default TTL, so
+//                  its requests run straight through without waiting on each
+//                  other.
+//
+//                  Cached responses are never changed once published, since
+//                  other workers may be sending them. A refresh builds a new
+//                  entry and swaps it in, and the old one is freed when its
+//                  last sender is done, as with directory listings.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+
+// Project Include Files
+#include <cmpsc311_log.h>
+#include <server.h>
+#include <server_microcache.h>
+#include <server_config.h>
+#include <server_shared.h>
+#include <server_body.h>
+
+// Where a cache entry is in its life
+#define RESPONSE_FETCHING 0		//the program is running, requests wait for it
+#define RESPONSE_READY 1		//the program's output, fresh or stale
+#define RESPONSE_PASS 2			//the output can't be cached, run the program
+
+// Results of runProgram besides 0 and -1
+#define PROGRAM_TOO_LARGE 1		//the output was over MICROCACHE_ENTRY_MAX
+
+//
+// Type Definitions
+
+typedef struct cached_response {
+	char key[2 * MAXLINE + 2];	//program and query string
+	char filename[MAXLINE];
+	char cgiargs[MAXLINE];
+	char *data;			//the program's output, headers included
+	int length;
+	int state;			//RESPONSE_ state
+	int defaultTtl;			//seconds, from the config of the request that added it
+	int defaultStale;
+	uint64_t storedAt;		//monotonic time the output was read, in ns
+	uint64_t freshUntil;		//sent as is until then, or passed until then
+	uint64_t staleUntil;		//sent while it refreshes until then
+	int refreshing;			//queued for, or in, the refresh thread
+	int refs;			//workers sending it, plus one while cached
+	int cached;			//still reachable from the cache
+	struct cached_response *next;	//hash chain
+	struct cached_response *newer;	//LRU list, most recently used at the head
+	struct cached_response *older;
+} CACHED_RESPONSE;
+
+// Global Variables
+CACHED_RESPONSE *responseBuckets[MICROCACHE_BUCKETS];
+CACHED_RESPONSE *responseNewest = NULL;
+CACHED_RESPONSE *responseOldest = NULL;
+long responseBytes = 0;
+CACHED_RESPONSE *refreshQueue[MICROCACHE_REFRESHES];	//stale entries, each holding a reference
+int refreshHead = 0;
+int refreshCount = 0;
+int refreshStopping = 0;
+int refreshRunning = 0;
+pthread_t refreshThread;
+pthread_mutex_t responseLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t responseDone = PTHREAD_COND_INITIALIZER;	//a program run finished
+pthread_cond_t refreshReady = PTHREAD_COND_INITIALIZER;
+
+//
+// Functional Prototypes
+
+void * refreshLoop ( void *arg );
+int runProgram ( const char *filename, const char *cgiargs, int client, char **data, int *length );
+int sendCachedResponse ( int client, const char *data, int length, int age );
+int responseLifetime ( const char *data, int length, int defaultTtl, int defaultStale, int *ttl, int *stale );
+CACHED_RESPONSE * newResponse ( const char *key, const char *filename, const char *cgiargs, int defaultTtl, int defaultStale );
+void fillResponse ( CACHED_RESPONSE *response, char *data, int length );
+unsigned int hashResponse ( const char *key );
+CACHED_RESPONSE * findResponse ( const char *key );
+void linkResponse ( CACHED_RESPONSE *response );
+void unlinkResponse ( CACHED_RESPONSE *response );
+void releaseResponse ( CACHED_RESPONSE *response );
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : startMicrocache
+// Description  : Start the thread that refreshes stale responses. It runs
+//		  whether or not the cache is on, since a reload can turn it on.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+int startMicrocache ( void ) {
+
+	sigset_t blocked, previous;
+	int ret;
+
+	refreshStopping = 0;
+
+	//Like the workers, the refresh thread leaves SIGINT and SIGHUP to the event loop
+	sigemptyset ( &blocked );
+	sigaddset ( &blocked, SIGINT );
+	sigaddset ( &blocked, SIGHUP );
+	pthread_sigmask ( SIG_BLOCK, &blocked, &previous );
+	ret = pthread_create ( &refreshThread, NULL, refreshLoop, NULL );
+	pthread_sigmask ( SIG_SETMASK, &previous, NULL );
+
+	if ( ret ) {
+		logMessage ( LOG_ERROR_LEVEL, "_startMicrocache:Failed to create the refresh thread" );
+		return -1;
+	}
+	refreshRunning = 1;
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : stopMicrocache
+// Description  : Stop the refresh thread, dropping the refreshes still queued
+//
+// Inputs       : none
+// Outputs      : none
+void stopMicrocache ( void ) {
+
+	pthread_mutex_lock ( &responseLock );
+	refreshStopping = 1;
+	pthread_cond_broadcast ( &refreshReady );
+	pthread_mutex_unlock ( &responseLock );
+
+	if ( refreshRunning )
+		pthread_join ( refreshThread, NULL );
+	refreshRunning = 0;
+
+	while ( refreshCount > 0 ) {
+		refreshQueue[refreshHead]->refreshing = 0;
+		releaseResponse ( refreshQueue[refreshHead] );
+		refreshHead = ( refreshHead + 1 ) % MICROCACHE_REFRESHES;
+		refreshCount--;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : serveCachedResponse
+// Description  : Answer a CGI request from the cache. On a miss the program
+//		  is run here, its output sent and, if the program allows it,
+//		  kept for the requests after this one.
+//
+// Inputs       : conn - the connection
+//		  request - the parsed request
+//		  filename - the program, with its docroot
+//		  cgiargs - its query string
+// Outputs      : 0 if the response was sent, 1 if sending it failed, -1 if
+//		  the caller has to run the program itself
+int serveCachedResponse ( CLIENT_CONN *conn, HTTP_REQUEST *request, char *filename, char *cgiargs ) {
+
+	SERVER_CONFIG *config = conn->config;
+	CACHED_RESPONSE *response;
+	struct timespec deadline;
+	char key[2 * MAXLINE + 2];
+	char *data;
+	uint64_t now;
+	int length, ret, kept;
+
+	//Only a GET with no body is the same request every time
+	if ( config->microcacheTtl == 0 || strcasecmp ( request->method, "GET" ) ||
+	     request->contentLength > 0 || request->chunked )
+		return -1;
+	snprintf ( key, sizeof(key), "%s?%s", filename, cgiargs );
+
+	clock_gettime ( CLOCK_REALTIME, &deadline );
+	deadline.tv_sec += MICROCACHE_WAIT_MS / 1000;
+	deadline.tv_nsec += ( MICROCACHE_WAIT_MS % 1000 ) * 1000000L;
+	if ( deadline.tv_nsec >= 1000000000L ) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	pthread_mutex_lock ( &responseLock );
+	while ( 1 ) {
+		now = monotonicTime ();
+		response = findResponse ( key );
+
+		//Nothing usable, this request runs the program
+		if ( response == NULL || ( response->state == RESPONSE_READY && now >= response->staleUntil ) ||
+		     ( response->state == RESPONSE_PASS && now >= response->freshUntil ) )
+			break;
+
+		if ( response->state == RESPONSE_PASS ) {
+			pthread_mutex_unlock ( &responseLock );
+			return -1;
+		}
+
+		if ( response->state == RESPONSE_READY ) {
+			//Past its freshness it is still sent, while one refresh
+			//brings it up to date
+			if ( now >= response->freshUntil && !response->refreshing &&
+			     refreshCount < MICROCACHE_REFRESHES && !refreshStopping ) {
+				response->refreshing = 1;
+				response->refs++;
+				refreshQueue[( refreshHead + refreshCount ) % MICROCACHE_REFRESHES] = response;
+				refreshCount++;
+				pthread_cond_signal ( &refreshReady );
+			}
+			response->refs++;
+			pthread_mutex_unlock ( &responseLock );
+
+			countStat ( STAT_MICROCACHE_HITS, 1 );
+			if ( DEBUG )
+				logMessage ( LOG_INFO_LEVEL, "Sending the %s response for %s from the cache",
+						( now >= response->freshUntil ) ? "stale" : "fresh", key );
+			ret = sendCachedResponse ( conn->fd, response->data, response->length,
+					(int)( ( now - response->storedAt ) / 1000000000ULL ) );
+			releaseResponse ( response );
+			return ( ret ) ? 1 : 0;
+		}
+
+		//Another request is running the program, its output will do for this one too
+		if ( pthread_cond_timedwait ( &responseDone, &responseLock, &deadline ) == ETIMEDOUT ) {
+			pthread_mutex_unlock ( &responseLock );
+			logMessage ( LOG_WARNING_LEVEL, "Gave up waiting on another request for %s", key );
+			return -1;
+		}
+	}
+
+	if ( response != NULL )
+		unlinkResponse ( response );
+	if ( (response = newResponse ( key, filename, cgiargs, config->microcacheTtl, config->microcacheStale )) == NULL ) {
+		pthread_mutex_unlock ( &responseLock );
+		return -1;
+	}
+	linkResponse ( response );
+	response->refs++;
+	pthread_mutex_unlock ( &responseLock );
+
+	countStat ( STAT_MICROCACHE_MISSES, 1 );
+	ret = runProgram ( filename, cgiargs, conn->fd, &data, &length );
+
+	//Publish before sending, so the waiting requests aren't held up by this
+	//client. Output that can't be cached leaves a pass entry, and a program
+	//that didn't run leaves nothing, so the next request tries again
+	pthread_mutex_lock ( &responseLock );
+	if ( ret == 0 && response->cached )
+		fillResponse ( response, data, length );
+	kept = ( data != NULL && response->data == data );
+	if ( response->cached && response->state == RESPONSE_FETCHING ) {
+		if ( ret == -1 )
+			unlinkResponse ( response );
+		else {
+			response->state = RESPONSE_PASS;
+			response->freshUntil = monotonicTime () + (uint64_t)response->defaultTtl * 1000000000ULL;
+		}
+	}
+	pthread_cond_broadcast ( &responseDone );
+	pthread_mutex_unlock ( &responseLock );
+
+	if ( ret == -1 )
+		sendErrorResponse ( conn->fd, 500, "Internal Server Error", NULL );
+	else if ( ret == 0 )
+		ret = sendCachedResponse ( conn->fd, data, length, -1 );
+	if ( !kept )
+		free ( data );
+	releaseResponse ( response );
+	return ( ret == -1 ) ? 1 : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : refreshLoop
+// Description  : Body of the refresh thread. Runs the program for each stale
+//		  response and swaps the new output in.
+//
+// Inputs       : arg - unused
+// Outputs      : NULL
+void * refreshLoop ( void *arg ) {
+
+	CACHED_RESPONSE *stale, *fresh;
+	char *data;
+	int length, ret;
+
+	(void)arg;
+	pthread_mutex_lock ( &responseLock );
+	while ( 1 ) {
+		while ( refreshCount == 0 && !refreshStopping )
+			pthread_cond_wait ( &refreshReady, &responseLock );
+		if ( refreshStopping )
+			break;
+		stale = refreshQueue[refreshHead];
+		fresh = NULL;
+		refreshHead = ( refreshHead + 1 ) % MICROCACHE_REFRESHES;
+		refreshCount--;
+		pthread_mutex_unlock ( &responseLock );
+
+		ret = runProgram ( stale->filename, stale->cgiargs, -1, &data, &length );
+
+		pthread_mutex_lock ( &responseLock );
+		stale->refreshing = 0;
+		if ( stale->cached && ret != -1 ) {
+			//The new output replaces it, or a pass entry if it can't be cached now
+			if ( (fresh = newResponse ( stale->key, stale->filename, stale->cgiargs,
+					stale->defaultTtl, stale->defaultStale )) != NULL ) {
+				unlinkResponse ( stale );
+				linkResponse ( fresh );
+				if ( ret == 0 )
+					fillResponse ( fresh, data, length );
+				if ( fresh->state != RESPONSE_READY ) {
+					fresh->state = RESPONSE_PASS;
+					fresh->freshUntil = monotonicTime () + (uint64_t)fresh->defaultTtl * 1000000000ULL;
+				}
+				if ( DEBUG )
+					logMessage ( LOG_INFO_LEVEL, "Refreshed the cached response for %s", fresh->key );
+			}
+		}
+		if ( ret == 0 && ( fresh == NULL || fresh->data != data ) )
+			free ( data );
+
+		//Drop the queue's reference without the lock held by releaseResponse
+		if ( --stale->refs == 0 ) {
+			free ( stale->data );
+			free ( stale );
+		}
+	}
+	pthread_mutex_unlock ( &responseLock );
+
+	return NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : runProgram
+// Description  : Run a CGI program for a GET and read all of its output.
+//		  Output too big to cache is sent to the client as it comes,
+//		  behind the same status line serve_dynamic sends.
+//
+// Inputs       : filename - the program
+//		  cgiargs - its query string
+//		  client - socket file handle, -1 to only read the output
+//		  data - place to put the output, malloced
+//		  length - place to put its length
+// Outputs      : 0 if the output was read, PROGRAM_TOO_LARGE if it was
+//		  sent or dropped instead, -1 if the program couldn't run
+int runProgram ( const char *filename, const char *cgiargs, int client, char **data, int *length ) {
+
+	char query[MAXLINE + 16];
+	char *envp[] = { query, "REQUEST_METHOD=GET", "CONTENT_LENGTH=", "CONTENT_TYPE=",
+			 "SERVER_SOFTWARE=" SERVER_NAME, "GATEWAY_INTERFACE=CGI/1.1", NULL };
+	char *argv[] = { (char *)filename, NULL };
+	char buf[BODY_CHUNK_SIZE], *grown;
+	int output[2], capacity = 0, ret = 0, n, fd;
+	pid_t pid;
+
+	*data = NULL;
+	*length = 0;
+	snprintf ( query, sizeof(query), "QUERY_STRING=%s", cgiargs );
+
+	//Close on exec, so programs other workers start don't hold the pipe open
+	if ( pipe2 ( output, O_CLOEXEC ) == -1 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_runProgram:Failed to create the program's pipe [%s]", strerror(errno) );
+		return -1;
+	}
+	if ( (pid = fork ()) == 0 ) {
+		if ( (fd = open ( "/dev/null", O_RDONLY )) != -1 )
+			dup2 ( fd, STDIN_FILENO );
+		dup2 ( output[1], STDOUT_FILENO );
+		execve ( filename, argv, envp );
+		_exit ( 1 );
+	}
+	close ( output[1] );
+	if ( pid == -1 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_runProgram:Failed to fork [%s]", strerror(errno) );
+		close ( output[0] );
+		return -1;
+	}
+
+	while ( (n = read ( output[0], buf, sizeof(buf) )) != 0 ) {
+		if ( n == -1 ) {
+			if ( errno == EINTR )
+				continue;
+			break;
+		}
+		if ( ret == PROGRAM_TOO_LARGE ) {
+			if ( client != -1 && sendBytes ( client, n, buf ) )
+				client = -1;
+			continue;
+		}
+
+		//Past the limit, what was read so far goes out and the rest follows it
+		if ( *length + n > MICROCACHE_ENTRY_MAX ) {
+			ret = PROGRAM_TOO_LARGE;
+			if ( client != -1 && ( sendCachedResponse ( client, *data, *length, -1 ) || sendBytes ( client, n, buf ) ) )
+				client = -1;
+			free ( *data );
+			*data = NULL;
+			continue;
+		}
+		if ( *length + n > capacity ) {
+			capacity = ( capacity ) ? capacity * 2 : (int)sizeof(buf);
+			if ( capacity < *length + n )
+				capacity = *length + n;
+			if ( (grown = realloc ( *data, capacity )) == NULL ) {
+				ret = -1;
+				break;
+			}
+			*data = grown;
+		}
+		memcpy ( *data + *length, buf, n );
+		*length += n;
+	}
+
+	close ( output[0] );
+	waitpid ( pid, NULL, 0 );
+	if ( ret == -1 || ( ret == 0 && *data == NULL ) ) {
+		free ( *data );
+		*data = NULL;
+		*length = 0;
+		return ( ret == -1 ) ? -1 : PROGRAM_TOO_LARGE;
+	}
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sendCachedResponse
+// Description  : Send a program's output behind the status line, with the
+//		  age of a cached copy
+//
+// Inputs       : client - socket file handle
+//		  data - the program's output
+//		  length - its length
+//		  age - seconds since it was read, -1 if it was just read
+// Outputs      : 0 if successful, -1 if failure
+int sendCachedResponse ( int client, const char *data, int length, int age ) {
+
+	char buf[MAXLINE];
+
+	if ( age >= 0 )
+		snprintf ( buf, sizeof(buf), "HTTP/1.0 200 OK\r\nServer: " SERVER_NAME "\r\nAge: %d\r\n", age );
+	else
+		snprintf ( buf, sizeof(buf), "HTTP/1.0 200 OK\r\nServer: " SERVER_NAME "\r\n" );
+	if ( sendBytes ( client, strlen(buf), buf ) )
+		return -1;
+	return ( length > 0 ) ? sendBytes ( client, length, (char *)data ) : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : responseLifetime
+// Description  : Work out how long a program's output may be cached from
+//		  its Cache-Control header. Output without one gets the
+//		  configured lifetime, and output that sets a cookie is never
+//		  shared.
+//
+// Inputs       : data - the program's output
+//		  length - its length
+//		  defaultTtl - seconds fresh without a max-age
+//		  defaultStale - seconds stale without a stale-while-revalidate
+//		  ttl - place to put the seconds it is fresh for
+//		  stale - place to put the seconds it may be sent stale for
+// Outputs      : 0 if it can be cached, -1 if not
+int responseLifetime ( const char *data, int length, int defaultTtl, int defaultStale, int *ttl, int *stale ) {
+
+	const char *line = data, *end = data + length, *eol, *value;
+	char field[MAXLINE];
+	int len;
+
+	*ttl = defaultTtl;
+	*stale = defaultStale;
+
+	while ( line < end ) {
+		if ( (eol = memchr ( line, '\n', end - line )) == NULL )
+			return -1;			//The headers never ended
+		len = eol - line;
+		if ( len > 0 && line[len-1] == '\r' )
+			len--;
+		if ( len == 0 )
+			return ( *ttl > 0 ) ? 0 : -1;	//The end of the headers
+		if ( len < (int)sizeof(field) ) {
+			memcpy ( field, line, len );
+			field[len] = '\0';
+			if ( !strncasecmp ( field, "Set-Cookie:", 11 ) )
+				return -1;
+			if ( !strncasecmp ( field, "Cache-Control:", 14 ) ) {
+				value = field + 14;
+				if ( headerHasToken ( value, "no-store" ) || headerHasToken ( value, "no-cache" ) ||
+				     headerHasToken ( value, "private" ) )
+					return -1;
+				if ( (value = strcasestr ( field, "s-maxage=" )) != NULL )
+					*ttl = atoi ( value + 9 );
+				else if ( (value = strcasestr ( field, "max-age=" )) != NULL )
+					*ttl = atoi ( value + 8 );
+				if ( (value = strcasestr ( field, "stale-while-revalidate=" )) != NULL )
+					*stale = atoi ( value + 23 );
+			}
+		}
+		line = eol + 1;
+	}
+	return -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : newResponse
+// Description  : Make a cache entry that is waiting on its program
+//
+// Inputs       : key - program and query string
+//		  filename - the program
+//		  cgiargs - its query string
+//		  defaultTtl - seconds fresh without a max-age
+//		  defaultStale - seconds stale without a stale-while-revalidate
+// Outputs      : the entry, or NULL if out of memory
+CACHED_RESPONSE * newResponse ( const char *key, const char *filename, const char *cgiargs, int defaultTtl, int defaultStale ) {
+
+	CACHED_RESPONSE *response;
+
+	if ( (response = calloc ( 1, sizeof(CACHED_RESPONSE) )) == NULL ) {
+		logMessage ( LOG_ERROR_LEVEL, "_newResponse:Out of memory for a cached response" );
+		return NULL;
+	}
+	snprintf ( response->key, sizeof(response->key), "%s", key );
+	snprintf ( response->filename, sizeof(response->filename), "%s", filename );
+	snprintf ( response->cgiargs, sizeof(response->cgiargs), "%s", cgiargs );
+	response->state = RESPONSE_FETCHING;
+	response->defaultTtl = defaultTtl;
+	response->defaultStale = defaultStale;
+	return response;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fillResponse
+// Description  : Give a linked entry its program's output, if the output
+//		  can be cached. The entry then takes the data. The response
+//		  lock must be held.
+//
+// Inputs       : response - the entry, RESPONSE_FETCHING
+//		  data - the program's output
+//		  length - its length
+// Outputs      : none
+void fillResponse ( CACHED_RESPONSE *response, char *data, int length ) {
+
+	CACHED_RESPONSE *old, *newer;
+	int ttl, stale;
+
+	if ( responseLifetime ( data, length, response->defaultTtl, response->defaultStale, &ttl, &stale ) )
+		return;
+
+	response->data = data;
+	response->length = length;
+	response->storedAt = monotonicTime ();
+	response->freshUntil = response->storedAt + (uint64_t)ttl * 1000000000ULL;
+	response->staleUntil = response->freshUntil + (uint64_t)stale * 1000000000ULL;
+	response->state = RESPONSE_READY;
+	responseBytes += length;
+
+	//Make room from the least recently used end, leaving programs still running
+	for ( old = responseOldest; old != NULL && responseBytes > MICROCACHE_BYTES; old = newer ) {
+		newer = old->newer;
+		if ( old != response && old->state != RESPONSE_FETCHING )
+			unlinkResponse ( old );
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hashResponse
+// Description  : FNV-1a hash of a cache key
+//
+// Inputs       : key - program and query string
+// Outputs      : the hash
+unsigned int hashResponse ( const char *key ) {
+
+	unsigned int hash = 2166136261u;
+
+	for ( ; *key; key++ ) {
+		hash ^= (unsigned char)*key;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : findResponse
+// Description  : Look up a key, moving its entry to the head of the LRU
+//		  list. The response lock must be held.
+//
+// Inputs       : key - program and query string
+// Outputs      : the entry, or NULL if there is none
+CACHED_RESPONSE * findResponse ( const char *key ) {
+
+	CACHED_RESPONSE *response = responseBuckets[hashResponse ( key ) % MICROCACHE_BUCKETS];
+
+	while ( response != NULL && strcmp ( response->key, key ) )
+		response = response->next;
+
+	if ( response != NULL && responseNewest != response ) {
+		response->newer->older = response->older;
+		if ( response->older )
+			response->older->newer = response->newer;
+		else
+			responseOldest = response->newer;
+		response->newer = NULL;
+		response->older = responseNewest;
+		responseNewest->newer = response;
+		responseNewest = response;
+	}
+	return response;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : linkResponse
+// Description  : Add an entry to the cache, which holds a reference to it.
+//		  The response lock must be held.
+//
+// Inputs       : response - the entry
+// Outputs      : none
+void linkResponse ( CACHED_RESPONSE *response ) {
+
+	unsigned int bucket = hashResponse ( response->key ) % MICROCACHE_BUCKETS;
+
+	response->cached = 1;
+	response->refs++;
+	response->next = responseBuckets[bucket];
+	responseBuckets[bucket] = response;
+	response->newer = NULL;
+	response->older = responseNewest;
+	if ( responseNewest )
+		responseNewest->newer = response;
+	else
+		responseOldest = response;
+	responseNewest = response;
+	responseBytes += response->length;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : unlinkResponse
+// Description  : Take an entry out of the cache and drop the cache's
+//		  reference. The response lock must be held.
+//
+// Inputs       : response - the entry
+// Outputs      : none
+void unlinkResponse ( CACHED_RESPONSE *response ) {
+
+	CACHED_RESPONSE **link = &responseBuckets[hashResponse ( response->key ) % MICROCACHE_BUCKETS];
+
+	while ( *link != response )
+		link = &(*link)->next;
+	*link = response->next;
+
+	if ( response->newer )
+		response->newer->older = response->older;
+	else
+		responseNewest = response->older;
+	if ( response->older )
+		response->older->newer = response->newer;
+	else
+		responseOldest = response->newer;
+
+	responseBytes -= response->length;
+	response->cached = 0;
+	if ( --response->refs == 0 ) {
+		free ( response->data );
+		free ( response );
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : releaseResponse
+// Description  : Drop a reference, freeing the entry once it is out of the
+//		  cache and nobody is sending it
+//
+// Inputs       : response - the entry
+// Outputs      : none
+void releaseResponse ( CACHED_RESPONSE *response ) {
+
+	int last;
+
+	pthread_mutex_lock ( &responseLock );
+	last = ( --response->refs == 0 );
+	pthread_mutex_unlock ( &responseLock );
+
+	if ( last ) {
+		free ( response->data );
+		free ( response );
+	}
+}
@@ -0,0 +1,43 @@
+#ifndef SERVER_MICROCACHE_INCLUDED
+#define SERVER_MICROCACHE_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_microcache.h
+//  Description   : A short lived cache of CGI responses, for programs asked
+//                  the same thing many times a second. Responses to GETs
+//                  without a body are kept by program and query string, the
+//                  only request input a program sees, for as long as the
+//                  program's Cache-Control allows, or the configured number
+//                  of seconds when it says nothing.
+//
+//                  Concurrent misses for the same key run the program once.
+//                  The first request runs it, the others wait for its output.
+//                  An expired response is still sent for the stale window
+//                  while one refresh runs in the background.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#include <server.h>
+
+//
+// Constants
+
+#define MICROCACHE_TTL 0			//seconds a response is fresh by default, 0 turns the cache off
+#define MICROCACHE_STALE 5			//seconds an expired response is still sent while it refreshes
+#define MICROCACHE_BYTES ( 32 * 1024 * 1024 )	//responses kept in each process
+#define MICROCACHE_ENTRY_MAX ( 1024 * 1024 )	//largest response kept
+#define MICROCACHE_BUCKETS 256			//hash chains in the cache
+#define MICROCACHE_WAIT_MS 10000		//longest a coalesced miss waits before running the program itself
+#define MICROCACHE_REFRESHES 64			//refreshes waiting for the refresh thread
+
+//
+// Functional Prototypes
+
+int startMicrocache ( void );
+void stopMicrocache ( void );
+int serveCachedResponse ( CLIENT_CONN *conn, HTTP_REQUEST *request, char *filename, char *cgiargs );
+
+#endif
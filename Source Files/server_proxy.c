@@ -0,0 +1,953 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_proxy.c
+//  Description   : Forwards requests for the configured routes to upstream
+//                  servers. A request goes out as HTTP/1.1 on a pooled or new
+//                  upstream connection, the response head is rewritten for the
+//                  client, and the body is spliced through a per-worker pipe
+//                  without being copied into the server, unless the client's
+//                  TLS is done in user space. Chunked responses are
+//                  decoded on the way, since the client connection is closed
+//                  after the response anyway.
+//
+//                  A pooled connection the upstream closed while it sat idle
+//                  is retried once on a fresh connection, as long as none of
+//                  the request body has been consumed yet.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+// Project Include Files
+#include <cmpsc311_log.h>
+#include <server_proxy.h>
+#include <server_event.h>
+
+//
+// Type Definitions
+
+typedef struct upstream_server {
+	char name[MAXLINE];			//host:port, for the log
+	struct sockaddr_storage address;
+	socklen_t addressLen;
+	int healthy;				//in rotation, written by the health checks
+	int active;				//requests in flight, for leastconn
+} UPSTREAM_SERVER;
+
+typedef struct upstream_route {
+	char prefix[MAXLINE];			//uri prefix the route serves
+	int balance;				//BALANCE_ROUND_ROBIN or BALANCE_LEAST_CONN
+	char health[MAXLINE];			//health check uri, empty to only connect
+	int first;				//the route's servers in upstreamServers
+	int count;
+	unsigned int nextServer;		//round robin position
+} UPSTREAM_ROUTE;
+
+typedef struct upstream_reader {
+	int fd;					//upstream socket
+	char buf[UPSTREAM_HEAD_SIZE + 1];	//bytes received but not yet used, NUL terminated
+	int start;
+	int end;
+} UPSTREAM_READER;
+
+// Global Variables
+UPSTREAM_ROUTE upstreamRoutes[MAX_UPSTREAM_ROUTES];
+int upstreamRouteCount = 0;
+UPSTREAM_SERVER upstreamServers[MAX_UPSTREAM_SERVERS];
+int upstreamServerCount = 0;
+
+pthread_t healthThread;
+int healthRunning = 0;
+pthread_mutex_t healthLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t healthWake = PTHREAD_COND_INITIALIZER;
+
+// Per worker state, so pooled connections and the splice pipe need no locks
+__thread int idleUpstreams[MAX_UPSTREAM_SERVERS][UPSTREAM_IDLE_PER_WORKER];
+__thread int idleCount[MAX_UPSTREAM_SERVERS];
+__thread int splicePipe[2] = { -1, -1 };
+
+//Functional Prototypes
+int parseUpstreamLine ( char *line, const char *filename, int lineNumber );
+int resolveUpstream ( const char *spec, UPSTREAM_SERVER *server );
+UPSTREAM_ROUTE * findRoute ( const char *uri );
+int pickServer ( UPSTREAM_ROUTE *route, uint64_t *tried );
+int connectUpstream ( UPSTREAM_SERVER *server, int timeout );
+int takeIdle ( int index );
+void keepIdle ( int index, int fd );
+int exchange ( CLIENT_CONN *conn, HTTP_REQUEST *request, REQUEST_BODY *body, UPSTREAM_READER *reader,
+		int *committed, int *reusable );
+int sendRequest ( CLIENT_CONN *conn, HTTP_REQUEST *request, REQUEST_BODY *body, int fd, int *committed );
+int relayResponseHead ( int client, UPSTREAM_READER *reader, int *status, int64_t *length, int *chunked, int *reusable );
+int relayChunkedBody ( int client, UPSTREAM_READER *reader );
+int relayBytes ( int client, UPSTREAM_READER *reader, int64_t count );
+int spliceBytes ( int from, int to, int64_t count );
+int copyBytes ( int from, int to, int64_t count );
+int readerFill ( UPSTREAM_READER *reader );
+int readerLine ( UPSTREAM_READER *reader, char *line, int len );
+void * checkUpstreams ( void *arg );
+int checkServer ( UPSTREAM_ROUTE *route, UPSTREAM_SERVER *server );
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : loadUpstreams
+// Description  : Read the upstream file and register a handler for each route.
+//		  Must be called before the server starts its workers.
+//
+// Inputs       : filename - path of the upstream file
+// Outputs      : 0 if successful, -1 if failure
+int loadUpstreams ( const char *filename ) {
+
+	char line[MAXLINE * 4];
+	FILE *config;
+	int lineNumber = 0;
+
+	if ( (config = fopen ( filename, "r" )) == NULL ) {
+		logMessage ( LOG_ERROR_LEVEL, "_loadUpstreams:Can't open %s [%s]", filename, strerror(errno) );
+		return -1;
+	}
+
+	while ( fgets ( line, sizeof(line), config ) != NULL ) {
+		if ( parseUpstreamLine ( line, filename, ++lineNumber ) == -1 ) {
+			fclose ( config );
+			return -1;
+		}
+	}
+	fclose ( config );
+
+	for ( int i = 0; i < upstreamRouteCount; i++ ) {
+		if ( registerHandler ( upstreamRoutes[i].prefix, proxyRequest ) )
+			return -1;
+	}
+
+	logMessage ( LOG_INFO_LEVEL, "Loaded %d upstream routes to %d servers from %s",
+			upstreamRouteCount, upstreamServerCount, filename );
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : startUpstreamChecks
+// Description  : Start the thread that takes servers in and out of rotation
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+int startUpstreamChecks ( void ) {
+
+	sigset_t blocked, previous;
+	int ret = 0;
+
+	if ( upstreamRouteCount == 0 )
+		return 0;
+
+	//Like the workers, the checker leaves SIGINT and SIGHUP to the accept loop
+	sigemptyset ( &blocked );
+	sigaddset ( &blocked, SIGINT );
+	sigaddset ( &blocked, SIGHUP );
+	pthread_sigmask ( SIG_BLOCK, &blocked, &previous );
+
+	healthRunning = 1;
+	if ( pthread_create ( &healthThread, NULL, checkUpstreams, NULL ) ) {
+		logMessage ( LOG_ERROR_LEVEL, "_startUpstreamChecks:Failed to create the health thread" );
+		healthRunning = 0;
+		ret = -1;
+	}
+
+	pthread_sigmask ( SIG_SETMASK, &previous, NULL );
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : stopUpstreamChecks
+// Description  : Stop the health check thread and wait for it to exit
+//
+// Inputs       : none
+// Outputs      : none
+void stopUpstreamChecks ( void ) {
+
+	if ( !healthRunning )
+		return;
+
+	pthread_mutex_lock ( &healthLock );
+	healthRunning = 0;
+	pthread_cond_signal ( &healthWake );
+	pthread_mutex_unlock ( &healthLock );
+	pthread_join ( healthThread, NULL );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : proxyRequest
+// Description  : The handler for every upstream route. Picks a server, sends
+//		  the request and relays the response.
+//
+// Inputs       : conn - the client connection
+//		  request - the parsed request
+//		  body - the request body, not yet read
+// Outputs      : 0 if the request was answered, 1 if the connection should be dropped
+int proxyRequest ( CLIENT_CONN *conn, HTTP_REQUEST *request, REQUEST_BODY *body ) {
+
+	UPSTREAM_ROUTE *route = findRoute ( request->uri );
+	UPSTREAM_SERVER *server;
+	UPSTREAM_READER *reader;
+	uint64_t tried = 0;
+	int index = -1, fd, reused, status, committed = 0, reusable;
+
+	if ( route == NULL || (reader = malloc ( sizeof(UPSTREAM_READER) )) == NULL ) {
+		sendErrorResponse ( conn->fd, 500, "Internal Server Error", NULL );
+		return 1;
+	}
+
+	for ( ;; ) {
+		//A stale pooled connection is retried on the same server, anything
+		//else moves on to the next server in the route
+		if ( index == -1 && (index = pickServer ( route, &tried )) == -1 ) {
+			logMessage ( LOG_WARNING_LEVEL, "No upstream server for %s is up. 503 error", route->prefix );
+			free ( reader );
+			sendErrorResponse ( conn->fd, 503, "Service Unavailable", "Retry-After: 1\r\n" );
+			return 1;
+		}
+		server = &upstreamServers[index];
+
+		reused = 1;
+		if ( (fd = takeIdle ( index )) == -1 ) {
+			reused = 0;
+			if ( (fd = connectUpstream ( server, UPSTREAM_TIMEOUT_MS )) == -1 ) {
+				__atomic_store_n ( &server->healthy, 0, __ATOMIC_RELAXED );
+				index = -1;
+				continue;
+			}
+		}
+
+		reader->fd = fd;
+		reader->start = reader->end = 0;
+		reader->buf[0] = '\0';
+		reusable = 0;
+		__atomic_add_fetch ( &server->active, 1, __ATOMIC_RELAXED );
+		status = exchange ( conn, request, body, reader, &committed, &reusable );
+		__atomic_sub_fetch ( &server->active, 1, __ATOMIC_RELAXED );
+
+		if ( status == 0 && reusable )
+			keepIdle ( index, fd );
+		else
+			close ( fd );
+
+		if ( status != 502 || committed )
+			break;
+		if ( reused ) {
+			logMessage ( LOG_INFO_LEVEL, "Pooled connection to %s went stale, retrying", server->name );
+			continue;
+		}
+		logMessage ( LOG_WARNING_LEVEL, "Upstream %s failed, taking it out of rotation", server->name );
+		__atomic_store_n ( &server->healthy, 0, __ATOMIC_RELAXED );
+		index = -1;
+	}
+	free ( reader );
+
+	//Nothing reached the client yet, so it can still get a proper error
+	if ( status > 0 ) {
+		logMessage ( LOG_WARNING_LEVEL, "Proxying %s to %s failed. %d error", request->uri, server->name, status );
+		sendErrorResponse ( conn->fd, status, errorReason ( status ), NULL );
+		return 1;
+	}
+	return ( status == 0 ) ? 0 : 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : exchange
+// Description  : Send one request on an upstream connection and relay the
+//		  response to the client
+//
+// Inputs       : conn - the client connection
+//		  request - the parsed request
+//		  body - the request body
+//		  reader - buffered reads from the upstream connection
+//		  committed - set once the request body starts being consumed
+//		  reusable - set if the upstream connection can be pooled
+// Outputs      : 0 if relayed, -1 if the relay broke off part way, or the
+//		  HTTP status to answer with if nothing was sent to the client
+int exchange ( CLIENT_CONN *conn, HTTP_REQUEST *request, REQUEST_BODY *body, UPSTREAM_READER *reader,
+		int *committed, int *reusable ) {
+
+	int64_t length;
+	int status, chunked, ret;
+
+	if ( (ret = sendRequest ( conn, request, body, reader->fd, committed )) )
+		return ret;
+
+	//The upstream's own timeout covers the wait for its answer
+	clearDeadline ( conn );
+	if ( (ret = relayResponseHead ( conn->fd, reader, &status, &length, &chunked, reusable )) )
+		return ret;
+
+	//From here on the client has to keep up with the send rate
+	armDeadline ( conn, CONN_SEND );
+	if ( !strcasecmp ( request->method, "HEAD" ) || status == 204 || status == 304 )
+		return 0;
+	if ( chunked )
+		ret = relayChunkedBody ( conn->fd, reader );
+	else
+		ret = relayBytes ( conn->fd, reader, length );
+	if ( ret ) {
+		*reusable = 0;
+		return -1;
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sendRequest
+// Description  : Send the request head and stream the body to the upstream
+//
+// Inputs       : conn - the client connection
+//		  request - the parsed request
+//		  body - the request body
+//		  fd - upstream socket
+//		  committed - set once the request body starts being consumed
+// Outputs      : 0 if successful, or the HTTP status to answer with
+int sendRequest ( CLIENT_CONN *conn, HTTP_REQUEST *request, REQUEST_BODY *body, int fd, int *committed ) {
+
+	char head[MAXLINE * 6 + MAX_PASSED_HEADERS];
+	char address[INET6_ADDRSTRLEN];
+	char data[BODY_CHUNK_SIZE];
+	char size[32];
+	int len, n;
+
+	//The client's own headers go first, so our X-Forwarded-For entry comes last
+	len = snprintf ( head, sizeof(head), "%s %s HTTP/1.1\r\nHost: %s\r\n%s%s%s%sX-Forwarded-For: %s\r\n",
+			request->method, request->uri, ( request->host[0] ) ? request->host : SERVER_NAME,
+			( request->contentType[0] ) ? "Content-Type: " : "", request->contentType,
+			( request->contentType[0] ) ? "\r\n" : "", request->passed,
+			connectionAddress ( conn, address, sizeof(address) ) );
+	if ( request->chunked )
+		len += snprintf ( head + len, sizeof(head) - len, "Transfer-Encoding: chunked\r\n\r\n" );
+	else if ( request->contentLength >= 0 )
+		len += snprintf ( head + len, sizeof(head) - len, "Content-Length: %lld\r\n\r\n", (long long)request->contentLength );
+	else
+		len += snprintf ( head + len, sizeof(head) - len, "\r\n" );
+
+	if ( sendBytes ( fd, len, head ) )
+		return 502;
+	if ( !hasRequestBody ( body ) )
+		return 0;
+
+	//The body is pulled from the client as the upstream takes it. Chunked
+	//bodies are chunked again, since readRequestBody hands back plain data
+	*committed = 1;
+	while ( (n = readRequestBody ( body, data, sizeof(data) )) > 0 ) {
+		len = snprintf ( size, sizeof(size), "%x\r\n", n );
+		if ( ( request->chunked && sendBytes ( fd, len, size ) ) || sendBytes ( fd, n, data ) ||
+		     ( request->chunked && sendBytes ( fd, 2, "\r\n" ) ) )
+			return 502;
+	}
+	if ( n < 0 )
+		return ( n == -2 ) ? 413 : 400;
+	if ( request->chunked && sendBytes ( fd, 5, "0\r\n\r\n" ) )
+		return 502;
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : relayResponseHead
+// Description  : Read the upstream response head, skipping interim 1xx
+//		  responses, and send it on to the client without its
+//		  hop-by-hop headers
+//
+// Inputs       : client - client socket file handle
+//		  reader - buffered reads from the upstream connection
+//		  status - set to the response status
+//		  length - set to the Content-Length, -1 for a body that ends at close
+//		  chunked - set if the body is chunked
+//		  reusable - set if the upstream keeps the connection open
+// Outputs      : 0 if successful, or the HTTP status to answer with
+int relayResponseHead ( int client, UPSTREAM_READER *reader, int *status, int64_t *length, int *chunked, int *reusable ) {
+
+	char out[UPSTREAM_HEAD_SIZE + MAXLINE];
+	char *head, *end, *line, *next, *value;
+	int major, minor, len, n, closing = 0;
+
+	for ( ;; ) {
+		while ( (end = memmem ( reader->buf + reader->start, reader->end - reader->start, "\r\n\r\n", 4 )) == NULL ) {
+			if ( (n = readerFill ( reader )) == -1 && ( errno == EAGAIN || errno == EWOULDBLOCK ) )
+				return 504;
+			if ( n <= 0 )
+				return 502;
+		}
+		head = reader->buf + reader->start;
+		reader->start = end + 4 - reader->buf;
+		if ( sscanf ( head, "HTTP/%d.%d %d", &major, &minor, status ) != 3 )
+			return 502;
+		if ( *status >= 200 || *status == 101 )
+			break;
+	}
+	if ( *status == 101 )
+		return 502;				//Upgrade was never offered upstream
+
+	//Keep the reason phrase, but answer in the version we speak
+	*length = -1;
+	*chunked = 0;
+	line = strstr ( head, "\r\n" ) + 2;
+	value = strchr ( head, ' ' );
+	len = snprintf ( out, sizeof(out), "HTTP/1.0%.*s\r\n", (int)( line - 2 - value ), value );
+
+	for ( ; line < end + 2; line = next ) {
+		next = strstr ( line, "\r\n" ) + 2;
+		if ( (value = memchr ( line, ':', next - line )) == NULL )
+			return 502;
+		*value = '\0';
+		if ( !strcasecmp ( line, "Content-Length" ) )
+			*length = strtoll ( value + 1, NULL, 10 );
+		else if ( !strcasecmp ( line, "Transfer-Encoding" ) )
+			*chunked = ( memmem ( value + 1, next - value - 1, "chunked", 7 ) != NULL );
+		else if ( !strcasecmp ( line, "Connection" ) )
+			closing = ( memmem ( value + 1, next - value - 1, "close", 5 ) != NULL );
+		*value = ':';
+
+		if ( !strncasecmp ( line, "Transfer-Encoding:", 18 ) || !strncasecmp ( line, "Connection:", 11 ) ||
+		     !strncasecmp ( line, "Keep-Alive:", 11 ) || !strncasecmp ( line, "Proxy-Connection:", 17 ) ||
+		     !strncasecmp ( line, "Trailer:", 8 ) || !strncasecmp ( line, "Upgrade:", 8 ) )
+			continue;
+		memcpy ( out + len, line, next - line );
+		len += next - line;
+	}
+	memcpy ( out + len, "\r\n", 2 );
+	len += 2;
+
+	//A body that ends when the upstream closes can't leave the connection reusable
+	*reusable = ( major == 1 && minor >= 1 && !closing && ( *chunked || *length >= 0 ) );
+	if ( sendBytes ( client, len, out ) )
+		return -1;
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : relayChunkedBody
+// Description  : Decode a chunked upstream body onto the client socket
+//
+// Inputs       : client - client socket file handle
+//		  reader - buffered reads from the upstream connection
+// Outputs      : 0 if successful, -1 if failure
+int relayChunkedBody ( int client, UPSTREAM_READER *reader ) {
+
+	char line[MAXLINE];
+	char *end;
+	int64_t size;
+
+	for ( ;; ) {
+		if ( readerLine ( reader, line, sizeof(line) ) == -1 )
+			return -1;
+		size = strtoll ( line, &end, 16 );
+		if ( end == line || size < 0 )
+			return -1;
+		if ( size == 0 )
+			break;
+		if ( relayBytes ( client, reader, size ) || readerLine ( reader, line, sizeof(line) ) == -1 ||
+		     strcmp ( line, "\r\n" ) )
+			return -1;
+	}
+
+	//Trailers are dropped, the client got no chunked framing to carry them
+	do {
+		if ( readerLine ( reader, line, sizeof(line) ) == -1 )
+			return -1;
+	} while ( strcmp ( line, "\r\n" ) );
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : relayBytes
+// Description  : Send body bytes to the client, first what is buffered and
+//		  then the rest straight from the upstream socket
+//
+// Inputs       : client - client socket file handle
+//		  reader - buffered reads from the upstream connection
+//		  count - bytes to relay, -1 for everything until the upstream closes
+// Outputs      : 0 if successful, -1 if failure
+int relayBytes ( int client, UPSTREAM_READER *reader, int64_t count ) {
+
+	int64_t buffered = reader->end - reader->start;
+
+	if ( count >= 0 && buffered > count )
+		buffered = count;
+	if ( buffered > 0 && sendBytes ( client, buffered, reader->buf + reader->start ) )
+		return -1;
+	reader->start += buffered;
+
+	if ( !canSendDirect ( client ) )
+		return copyBytes ( reader->fd, client, ( count < 0 ) ? -1 : count - buffered );
+	return spliceBytes ( reader->fd, client, ( count < 0 ) ? -1 : count - buffered );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : spliceBytes
+// Description  : Move bytes between sockets through the worker's pipe, so
+//		  they never pass through user space
+//
+// Inputs       : from - socket to read
+//		  to - socket to write
+//		  count - bytes to move, -1 for everything until from closes
+// Outputs      : 0 if successful, -1 if failure
+int spliceBytes ( int from, int to, int64_t count ) {
+
+	ssize_t got, sent;
+	size_t want;
+
+	if ( splicePipe[0] == -1 && pipe2 ( splicePipe, O_CLOEXEC ) ) {
+		logMessage ( LOG_ERROR_LEVEL, "_spliceBytes:Can't create a pipe [%s]", strerror(errno) );
+		return -1;
+	}
+
+	while ( count != 0 ) {
+		want = ( count < 0 || count > UPSTREAM_SPLICE_SIZE ) ? UPSTREAM_SPLICE_SIZE : count;
+		if ( (got = splice ( from, NULL, splicePipe[1], NULL, want, SPLICE_F_MOVE )) <= 0 ) {
+			if ( got == -1 && errno == EINTR )
+				continue;
+			if ( got == 0 && count < 0 )
+				return 0;			//The upstream closed, ending the body
+			logMessage ( LOG_ERROR_LEVEL, "_spliceBytes:Upstream read failed [%s]", ( got ) ? strerror(errno) : "closed" );
+			return -1;
+		}
+		if ( count > 0 )
+			count -= got;
+
+		while ( got > 0 ) {
+			if ( (sent = splice ( splicePipe[0], NULL, to, NULL, got,
+					SPLICE_F_MOVE | ( ( count != 0 ) ? SPLICE_F_MORE : 0 ) )) <= 0 ) {
+				if ( sent == -1 && errno == EINTR )
+					continue;
+				//The pipe still holds bytes, the next request starts on a fresh one
+				logMessage ( LOG_ERROR_LEVEL, "_spliceBytes:Client write failed [%s]", strerror(errno) );
+				close ( splicePipe[0] );
+				close ( splicePipe[1] );
+				splicePipe[0] = splicePipe[1] = -1;
+				return -1;
+			}
+			countTransfer ( to, 0, sent );
+			got -= sent;
+		}
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : copyBytes
+// Description  : Move bytes between sockets through a buffer, for a client
+//		  whose TLS has to be applied by sendBytes
+//
+// Inputs       : from - socket to read
+//		  to - socket to write
+//		  count - bytes to move, -1 for everything until from closes
+// Outputs      : 0 if successful, -1 if failure
+int copyBytes ( int from, int to, int64_t count ) {
+
+	char buf[UPSTREAM_SPLICE_SIZE / 4];
+	ssize_t got;
+
+	while ( count != 0 ) {
+		got = recv ( from, buf, ( count < 0 || count > (int64_t)sizeof(buf) ) ? sizeof(buf) : (size_t)count, 0 );
+		if ( got <= 0 ) {
+			if ( got == -1 && errno == EINTR )
+				continue;
+			if ( got == 0 && count < 0 )
+				return 0;			//The upstream closed, ending the body
+			logMessage ( LOG_ERROR_LEVEL, "_copyBytes:Upstream read failed [%s]", ( got ) ? strerror(errno) : "closed" );
+			return -1;
+		}
+		if ( sendBytes ( to, got, buf ) )
+			return -1;
+		if ( count > 0 )
+			count -= got;
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : readerFill
+// Description  : Receive more upstream bytes after whatever is buffered
+//
+// Inputs       : reader - buffered reads from the upstream connection
+// Outputs      : bytes received, 0 if the upstream closed, -1 if failure
+int readerFill ( UPSTREAM_READER *reader ) {
+
+	int n;
+
+	if ( reader->start > 0 ) {
+		memmove ( reader->buf, reader->buf + reader->start, reader->end - reader->start );
+		reader->end -= reader->start;
+		reader->start = 0;
+	}
+	if ( reader->end == UPSTREAM_HEAD_SIZE ) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+
+	while ( (n = recv ( reader->fd, reader->buf + reader->end, UPSTREAM_HEAD_SIZE - reader->end, 0 )) == -1 && errno == EINTR )
+		;
+	if ( n > 0 )
+		reader->end += n;
+	reader->buf[reader->end] = '\0';
+	return n;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : readerLine
+// Description  : Take one line, with its line ending, from the upstream
+//
+// Inputs       : reader - buffered reads from the upstream connection
+//		  line - where to put the line
+//		  len - size of line
+// Outputs      : the line's length, -1 if failure
+int readerLine ( UPSTREAM_READER *reader, char *line, int len ) {
+
+	char *eol;
+	int n;
+
+	while ( (eol = memchr ( reader->buf + reader->start, '\n', reader->end - reader->start )) == NULL ) {
+		if ( readerFill ( reader ) <= 0 )
+			return -1;
+	}
+	if ( (n = eol + 1 - ( reader->buf + reader->start )) >= len )
+		return -1;
+	memcpy ( line, reader->buf + reader->start, n );
+	line[n] = '\0';
+	reader->start += n;
+	return n;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : findRoute
+// Description  : Find the route with the longest prefix matching the uri
+//
+// Inputs       : uri - the request uri
+// Outputs      : the route, or NULL if none matches
+UPSTREAM_ROUTE * findRoute ( const char *uri ) {
+
+	UPSTREAM_ROUTE *found = NULL;
+	size_t longest = 0;
+
+	for ( int i = 0; i < upstreamRouteCount; i++ ) {
+		size_t len = strlen ( upstreamRoutes[i].prefix );
+		if ( len > longest && !strncmp ( uri, upstreamRoutes[i].prefix, len ) ) {
+			found = &upstreamRoutes[i];
+			longest = len;
+		}
+	}
+	return found;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : pickServer
+// Description  : Choose a healthy server of the route that wasn't tried yet
+//
+// Inputs       : route - the route
+//		  tried - servers of the route already tried, by position
+// Outputs      : index into upstreamServers, or -1 if none is left
+int pickServer ( UPSTREAM_ROUTE *route, uint64_t *tried ) {
+
+	unsigned int start = 0;
+	int best = -1, n;
+	UPSTREAM_SERVER *server;
+
+	if ( route->balance == BALANCE_ROUND_ROBIN )
+		start = __atomic_fetch_add ( &route->nextServer, 1, __ATOMIC_RELAXED );
+
+	for ( int i = 0; i < route->count; i++ ) {
+		n = ( start + i ) % route->count;
+		server = &upstreamServers[route->first + n];
+		if ( ( *tried & ( 1ULL << n ) ) || !__atomic_load_n ( &server->healthy, __ATOMIC_RELAXED ) )
+			continue;
+		if ( route->balance == BALANCE_ROUND_ROBIN ) {
+			best = n;
+			break;
+		}
+		if ( best == -1 || __atomic_load_n ( &server->active, __ATOMIC_RELAXED ) <
+				   __atomic_load_n ( &upstreamServers[route->first + best].active, __ATOMIC_RELAXED ) )
+			best = n;
+	}
+
+	if ( best == -1 )
+		return -1;
+	*tried |= 1ULL << best;
+	return route->first + best;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : connectUpstream
+// Description  : Open a new connection to an upstream server
+//
+// Inputs       : server - the server
+//		  timeout - connect, send and receive timeout in milliseconds
+// Outputs      : the socket, or -1 if failure
+int connectUpstream ( UPSTREAM_SERVER *server, int timeout ) {
+
+	struct timeval tv = { timeout / 1000, ( timeout % 1000 ) * 1000 };
+	int fd, on = 1;
+
+	if ( (fd = socket ( server->address.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0 )) == -1 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_connectUpstream:Can't create a socket [%s]", strerror(errno) );
+		return -1;
+	}
+
+	//A blocking connect honours the send timeout
+	setsockopt ( fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv) );
+	setsockopt ( fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv) );
+	setsockopt ( fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on) );
+
+	if ( connect ( fd, (struct sockaddr *)&server->address, server->addressLen ) ) {
+		logMessage ( LOG_WARNING_LEVEL, "_connectUpstream:Can't connect to %s [%s]", server->name, strerror(errno) );
+		close ( fd );
+		return -1;
+	}
+	return fd;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : takeIdle
+// Description  : Take the most recently pooled connection to a server,
+//		  skipping any the server has closed since
+//
+// Inputs       : index - index into upstreamServers
+// Outputs      : the socket, or -1 if the pool is empty
+int takeIdle ( int index ) {
+
+	char c;
+	int fd;
+
+	while ( idleCount[index] > 0 ) {
+		fd = idleUpstreams[index][--idleCount[index]];
+		if ( recv ( fd, &c, 1, MSG_PEEK | MSG_DONTWAIT ) == -1 && ( errno == EAGAIN || errno == EWOULDBLOCK ) )
+			return fd;
+		close ( fd );			//Closed, or sent bytes nobody asked for
+	}
+	return -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : keepIdle
+// Description  : Return a connection to the worker's pool
+//
+// Inputs       : index - index into upstreamServers
+//		  fd - the socket
+// Outputs      : none
+void keepIdle ( int index, int fd ) {
+
+	if ( idleCount[index] < UPSTREAM_IDLE_PER_WORKER )
+		idleUpstreams[index][idleCount[index]++] = fd;
+	else
+		close ( fd );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : checkUpstreams
+// Description  : Health check thread, checks every server on each interval
+//
+// Inputs       : arg - unused
+// Outputs      : NULL
+void * checkUpstreams ( void *arg ) {
+
+	UPSTREAM_ROUTE *route;
+	UPSTREAM_SERVER *server;
+	struct timespec wake;
+	int healthy;
+
+	pthread_mutex_lock ( &healthLock );
+	while ( healthRunning ) {
+		pthread_mutex_unlock ( &healthLock );
+
+		for ( int r = 0; r < upstreamRouteCount; r++ ) {
+			route = &upstreamRoutes[r];
+			for ( int i = 0; i < route->count; i++ ) {
+				server = &upstreamServers[route->first + i];
+				healthy = checkServer ( route, server );
+				if ( healthy != __atomic_exchange_n ( &server->healthy, healthy, __ATOMIC_RELAXED ) )
+					logMessage ( LOG_WARNING_LEVEL, "Upstream %s is %s", server->name,
+							( healthy ) ? "back up" : "down" );
+			}
+		}
+
+		clock_gettime ( CLOCK_REALTIME, &wake );
+		wake.tv_sec += UPSTREAM_HEALTH_MS / 1000;
+		pthread_mutex_lock ( &healthLock );
+		while ( healthRunning && pthread_cond_timedwait ( &healthWake, &healthLock, &wake ) != ETIMEDOUT )
+			;
+	}
+	pthread_mutex_unlock ( &healthLock );
+
+	return NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : checkServer
+// Description  : Check one server, by connecting or by fetching the route's
+//		  health uri
+//
+// Inputs       : route - the route the server belongs to
+//		  server - the server
+// Outputs      : 1 if healthy, 0 if not
+int checkServer ( UPSTREAM_ROUTE *route, UPSTREAM_SERVER *server ) {
+
+	char buf[MAXLINE * 2];
+	int fd, n, status = 0;
+
+	if ( (fd = connectUpstream ( server, UPSTREAM_HEALTH_MS )) == -1 )
+		return 0;
+	if ( route->health[0] == '\0' ) {
+		close ( fd );
+		return 1;
+	}
+
+	n = snprintf ( buf, sizeof(buf), "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n",
+			route->health, server->name );
+	if ( send ( fd, buf, n, MSG_NOSIGNAL ) == n && (n = recv ( fd, buf, sizeof(buf) - 1, 0 )) > 0 ) {
+		buf[n] = '\0';
+		sscanf ( buf, "HTTP/%*d.%*d %d", &status );
+	}
+	close ( fd );
+
+	return ( status >= 200 && status < 400 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : parseUpstreamLine
+// Description  : Parse one line of the upstream file into a route
+//
+// Inputs       : line - the line
+//		  filename - upstream file name, for errors
+//		  lineNumber - line number, for errors
+// Outputs      : 0 if successful, -1 if failure
+int parseUpstreamLine ( char *line, const char *filename, int lineNumber ) {
+
+	UPSTREAM_ROUTE *route = &upstreamRoutes[upstreamRouteCount];
+	char *word, *value, *save;
+
+	if ( (word = strtok_r ( line, " \t\r\n", &save )) == NULL || word[0] == '#' )
+		return 0;
+	if ( strcmp ( word, "upstream" ) ) {
+		logMessage ( LOG_ERROR_LEVEL, "_parseUpstreamLine:%s:%d: expected \"upstream\", found \"%s\"", filename, lineNumber, word );
+		return -1;
+	}
+	if ( upstreamRouteCount >= MAX_UPSTREAM_ROUTES ) {
+		logMessage ( LOG_ERROR_LEVEL, "_parseUpstreamLine:%s:%d: more than %d routes", filename, lineNumber, MAX_UPSTREAM_ROUTES );
+		return -1;
+	}
+
+	memset ( route, 0, sizeof(UPSTREAM_ROUTE) );
+	if ( (word = strtok_r ( NULL, " \t\r\n", &save )) == NULL || word[0] != '/' || strlen(word) >= MAXLINE ) {
+		logMessage ( LOG_ERROR_LEVEL, "_parseUpstreamLine:%s:%d: missing or bad uri prefix", filename, lineNumber );
+		return -1;
+	}
+	strcpy ( route->prefix, word );
+	route->first = upstreamServerCount;
+
+	while ( (word = strtok_r ( NULL, " \t\r\n", &save )) != NULL ) {
+		if ( (value = strchr ( word, '=' )) != NULL ) {
+			*value++ = '\0';
+			if ( !strcmp ( word, "balance" ) && !strcmp ( value, "roundrobin" ) )
+				route->balance = BALANCE_ROUND_ROBIN;
+			else if ( !strcmp ( word, "balance" ) && !strcmp ( value, "leastconn" ) )
+				route->balance = BALANCE_LEAST_CONN;
+			else if ( !strcmp ( word, "health" ) && value[0] == '/' && strlen(value) < MAXLINE )
+				strcpy ( route->health, value );
+			else {
+				logMessage ( LOG_ERROR_LEVEL, "_parseUpstreamLine:%s:%d: bad setting %s=%s", filename, lineNumber, word, value );
+				return -1;
+			}
+			continue;
+		}
+
+		if ( upstreamServerCount >= MAX_UPSTREAM_SERVERS ) {
+			logMessage ( LOG_ERROR_LEVEL, "_parseUpstreamLine:%s:%d: more than %d servers", filename, lineNumber, MAX_UPSTREAM_SERVERS );
+			return -1;
+		}
+		if ( resolveUpstream ( word, &upstreamServers[upstreamServerCount] ) ) {
+			logMessage ( LOG_ERROR_LEVEL, "_parseUpstreamLine:%s:%d: can't resolve %s", filename, lineNumber, word );
+			return -1;
+		}
+		upstreamServerCount++;
+		route->count++;
+	}
+
+	if ( route->count == 0 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_parseUpstreamLine:%s:%d: route %s has no servers", filename, lineNumber, route->prefix );
+		return -1;
+	}
+	upstreamRouteCount++;
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : resolveUpstream
+// Description  : Resolve a host:port, or [v6 address]:port, once at startup
+//
+// Inputs       : spec - the server as written in the upstream file
+//		  server - the server to fill in
+// Outputs      : 0 if successful, -1 if failure
+int resolveUpstream ( const char *spec, UPSTREAM_SERVER *server ) {
+
+	struct addrinfo hints, *result;
+	char host[MAXLINE];
+	char *port;
+
+	if ( strlen(spec) >= MAXLINE )
+		return -1;
+	strcpy ( host, spec );
+	if ( (port = strrchr ( host, ':' )) == NULL )
+		return -1;
+	*port++ = '\0';
+	if ( host[0] == '[' && port[-2] == ']' ) {
+		port[-2] = '\0';
+		memmove ( host, host + 1, strlen(host) );
+	}
+
+	memset ( &hints, 0, sizeof(hints) );
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if ( getaddrinfo ( host, port, &hints, &result ) )
+		return -1;
+
+	memset ( server, 0, sizeof(UPSTREAM_SERVER) );
+	snprintf ( server->name, sizeof(server->name), "%s", spec );
+	memcpy ( &server->address, result->ai_addr, result->ai_addrlen );
+	server->addressLen = result->ai_addrlen;
+	server->healthy = 1;
+	freeaddrinfo ( result );
+	return 0;
+}
@@ -0,0 +1,51 @@
+#ifndef SERVER_PROXY_INCLUDED
+#define SERVER_PROXY_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_proxy.h
+//  Description   : Reverse proxy to upstream HTTP servers. Each route is an
+//                  in-process handler for a uri prefix that forwards requests
+//                  to one of the route's servers. Every worker keeps its own
+//                  pool of idle keep-alive upstream connections, so reusing one
+//                  takes no locks, and response bodies are moved from the
+//                  upstream socket to the client with splice.
+//
+//                  Upstream file lines look like
+//
+//                      upstream <uri prefix> <host:port> [<host:port> ...] [key=value ...]
+//
+//                  Keys are balance=roundrobin|leastconn and health=<uri>, a
+//                  path that must answer 2xx or 3xx for a server to stay in
+//                  rotation. Without health= a server only has to accept a
+//                  connection. Blank lines and lines starting with # are ignored.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#include <server_handlers.h>
+
+//
+// Constants
+
+#define MAX_UPSTREAM_ROUTES 16			//routes in one upstream file
+#define MAX_UPSTREAM_SERVERS 64			//servers across all routes
+#define UPSTREAM_IDLE_PER_WORKER 4		//idle connections each worker keeps per server
+#define UPSTREAM_TIMEOUT_MS 30000		//connect, send and receive timeout
+#define UPSTREAM_HEALTH_MS 5000			//how often servers are checked
+#define UPSTREAM_HEAD_SIZE 16384		//largest upstream response head
+#define UPSTREAM_SPLICE_SIZE 65536		//most bytes moved per splice
+
+#define BALANCE_ROUND_ROBIN 0
+#define BALANCE_LEAST_CONN 1
+
+//
+// Functional Prototypes
+
+int loadUpstreams ( const char *filename );
+int startUpstreamChecks ( void );
+void stopUpstreamChecks ( void );
+int proxyRequest ( CLIENT_CONN *conn, HTTP_REQUEST *request, REQUEST_BODY *body );
+
+#endif
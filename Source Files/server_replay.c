@@ -0,0 +1,419 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_replay.c
+//  Description   : The replay client. The whole capture is read in and put in
+//                  time order, then one thread drives every connection
+//                  non-blocking through epoll, opening each when its request
+//                  is due and timing it until the server closes it.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+// Project Include Files
+#include <cmpsc311_log.h>
+#include <server_replay.h>
+#include <server_capture.h>
+
+//
+// Type Definitions
+
+typedef struct replay_request {
+	uint64_t time;			//ns into the capture
+	const char *head;		//request line and headers, in the capture
+	uint32_t length;
+	uint32_t body;			//filler bytes sent after the head
+} REPLAY_REQUEST;
+
+typedef struct replay_session {
+	int fd;				//-1 while the session is free
+	REPLAY_REQUEST *request;
+	uint64_t due;			//monotonic time the request was due
+	uint64_t sent;			//bytes of head and body sent
+	char status[16];		//start of the response, for its status code
+	int statusLength;
+} REPLAY_SESSION;
+
+typedef struct replay_results {
+	uint64_t *latency;		//ns each finished request took
+	int finished;
+	int failed;
+	int classes[6];			//responses by their status code's first digit
+} REPLAY_RESULTS;
+
+//
+// Functional Prototypes
+
+int readCapture ( const char *filename, char **data, REPLAY_REQUEST **requests, int *count );
+int compareRequests ( const void *a, const void *b );
+int openSession ( REPLAY_SESSION *session, REPLAY_REQUEST *request, uint64_t due, int port, int epollFd );
+int advanceSession ( REPLAY_SESSION *session, int events, int epollFd, REPLAY_RESULTS *results );
+void endSession ( REPLAY_SESSION *session, int failed, REPLAY_RESULTS *results );
+int compareLatency ( const void *a, const void *b );
+void reportReplay ( const char *filename, REPLAY_RESULTS *results, uint64_t elapsed );
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replayCapture
+// Description  : Replay a capture against a server on the loopback address
+//		  and print the latency distribution
+//
+// Inputs       : filename - the capture file
+//		  port - port the server listens on
+//		  speed - how many times faster than captured, 0 for as fast
+//			as possible
+// Outputs      : 0 if successful, -1 if failure
+int replayCapture ( const char *filename, int port, double speed ) {
+
+	struct epoll_event events[REPLAY_CONCURRENCY];
+	REPLAY_REQUEST *requests = NULL;
+	REPLAY_SESSION *sessions = NULL;
+	REPLAY_RESULTS results;
+	char *data = NULL;
+	int count, next = 0, active = 0, limit, ready, timeout, ret = -1;
+	uint64_t start, now, due;
+	int epollFd = -1;
+
+	memset ( &results, 0, sizeof(results) );
+	limit = ( speed > 0 ) ? REPLAY_MAX_INFLIGHT : REPLAY_CONCURRENCY;
+	if ( readCapture ( filename, &data, &requests, &count ) )
+		goto done;
+	if ( (sessions = calloc ( limit, sizeof(REPLAY_SESSION) )) == NULL ||
+	     (results.latency = calloc ( count + 1, sizeof(uint64_t) )) == NULL ) {
+		logMessage ( LOG_ERROR_LEVEL, "_replayCapture:Out of memory for %d requests", count );
+		goto done;
+	}
+	for ( int i = 0; i < limit; i++ )
+		sessions[i].fd = -1;
+	if ( (epollFd = epoll_create1 ( EPOLL_CLOEXEC )) == -1 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_replayCapture:Failed to create epoll instance [%s]", strerror(errno) );
+		goto done;
+	}
+
+	logMessage ( LOG_INFO_LEVEL, "Replaying %d requests from %s against port %d", count, filename, port );
+	start = monotonicTime();
+	while ( next < count || active > 0 ) {
+
+		//Open every connection that is due, as far as the limit allows
+		now = monotonicTime();
+		timeout = 100;
+		for ( int i = 0; i < limit && next < count; i++ ) {
+			if ( sessions[i].fd != -1 )
+				continue;
+			due = ( speed > 0 ) ? start + (uint64_t)( ( requests[next].time - requests[0].time ) / speed ) : now;
+			if ( due > now ) {
+				timeout = ( due - now + 999999 ) / 1000000;
+				break;
+			}
+			if ( openSession ( &sessions[i], &requests[next], due, port, epollFd ) )
+				endSession ( &sessions[i], 1, &results );
+			else
+				active++;
+			next++;
+		}
+
+		if ( (ready = epoll_wait ( epollFd, events, REPLAY_CONCURRENCY, ( timeout < 100 ) ? timeout : 100 )) == -1 ) {
+			if ( errno == EINTR )
+				continue;
+			logMessage ( LOG_ERROR_LEVEL, "_replayCapture:epoll_wait failed [%s]", strerror(errno) );
+			goto done;
+		}
+		for ( int i = 0; i < ready; i++ ) {
+			if ( advanceSession ( events[i].data.ptr, events[i].events, epollFd, &results ) )
+				active--;
+		}
+
+		//A request the server never answers fails instead of stalling the replay
+		now = monotonicTime();
+		for ( int i = 0; i < limit; i++ ) {
+			if ( sessions[i].fd != -1 && now > sessions[i].due + REPLAY_TIMEOUT_MS * 1000000ULL ) {
+				endSession ( &sessions[i], 1, &results );
+				active--;
+			}
+		}
+	}
+
+	reportReplay ( filename, &results, monotonicTime() - start );
+	ret = 0;
+
+done:
+	if ( epollFd != -1 )
+		close ( epollFd );
+	free ( results.latency );
+	free ( sessions );
+	free ( requests );
+	free ( data );
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : readCapture
+// Description  : Read a capture file into memory and list its requests in
+//		  time order
+//
+// Inputs       : filename - the capture file
+//		  data - set to the file's contents
+//		  requests - set to the requests, pointing into data
+//		  count - set to the number of requests
+// Outputs      : 0 if successful, -1 if failure
+int readCapture ( const char *filename, char **data, REPLAY_REQUEST **requests, int *count ) {
+
+	CAPTURE_RECORD record;
+	struct stat sbuf;
+	size_t offset;
+	ssize_t rb;
+	int fd, slots = 0;
+
+	*data = NULL;
+	*requests = NULL;
+	*count = 0;
+	if ( (fd = open ( filename, O_RDONLY | O_CLOEXEC )) == -1 || fstat ( fd, &sbuf ) == -1 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_readCapture:Can't open %s [%s]", filename, strerror(errno) );
+		if ( fd != -1 )
+			close ( fd );
+		return -1;
+	}
+	if ( (*data = malloc ( sbuf.st_size + 1 )) == NULL ) {
+		logMessage ( LOG_ERROR_LEVEL, "_readCapture:Out of memory for %s", filename );
+		close ( fd );
+		return -1;
+	}
+	for ( offset = 0; offset < (size_t)sbuf.st_size; offset += rb ) {
+		if ( (rb = read ( fd, *data + offset, sbuf.st_size - offset )) <= 0 )
+			break;
+	}
+	close ( fd );
+	if ( offset < CAPTURE_MAGIC_LENGTH || memcmp ( *data, CAPTURE_MAGIC, CAPTURE_MAGIC_LENGTH ) ) {
+		logMessage ( LOG_ERROR_LEVEL, "_readCapture:%s isn't a capture file", filename );
+		return -1;
+	}
+
+	//A capture cut short by a crash still replays up to its last whole record
+	for ( size_t at = CAPTURE_MAGIC_LENGTH; at + sizeof(record) <= offset; at += sizeof(record) + record.length ) {
+		memcpy ( &record, *data + at, sizeof(record) );
+		if ( at + sizeof(record) + record.length > offset )
+			break;
+		if ( *count == slots ) {
+			slots = ( slots ) ? slots * 2 : 1024;
+			REPLAY_REQUEST *grown = realloc ( *requests, slots * sizeof(REPLAY_REQUEST) );
+			if ( grown == NULL ) {
+				logMessage ( LOG_ERROR_LEVEL, "_readCapture:Out of memory for the requests in %s", filename );
+				return -1;
+			}
+			*requests = grown;
+		}
+		(*requests)[*count].time = record.time;
+		(*requests)[*count].head = *data + at + sizeof(record);
+		(*requests)[*count].length = record.length;
+		(*requests)[*count].body = record.body;
+		(*count)++;
+	}
+	if ( *count == 0 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_readCapture:%s has no requests in it", filename );
+		return -1;
+	}
+
+	//Every process appended to the file, so records are only roughly in order
+	qsort ( *requests, *count, sizeof(REPLAY_REQUEST), compareRequests );
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : compareRequests
+// Description  : Order requests by when they arrived, then by where they
+//		  are in the file, so every replay sends them in the same order
+//
+// Inputs       : a, b - the requests
+// Outputs      : less than, equal to or greater than 0
+int compareRequests ( const void *a, const void *b ) {
+
+	const REPLAY_REQUEST *first = a, *second = b;
+
+	if ( first->time != second->time )
+		return ( first->time < second->time ) ? -1 : 1;
+	return ( first->head < second->head ) ? -1 : ( first->head > second->head );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : openSession
+// Description  : Start connecting for a request
+//
+// Inputs       : session - a free session
+//		  request - the request to send
+//		  due - when it was due
+//		  port - the server's port
+//		  epollFd - the replay's epoll instance
+// Outputs      : 0 if successful, -1 if failure
+int openSession ( REPLAY_SESSION *session, REPLAY_REQUEST *request, uint64_t due, int port, int epollFd ) {
+
+	struct sockaddr_in address;
+	struct epoll_event event;
+	int on = 1;
+
+	memset ( session, 0, sizeof(REPLAY_SESSION) );
+	session->request = request;
+	session->due = due;
+	if ( (session->fd = socket ( AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 )) == -1 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_openSession:Can't create a socket [%s]", strerror(errno) );
+		return -1;
+	}
+	setsockopt ( session->fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on) );
+
+	memset ( &address, 0, sizeof(address) );
+	address.sin_family = AF_INET;
+	address.sin_port = htons ( (unsigned short)port );
+	address.sin_addr.s_addr = htonl ( INADDR_LOOPBACK );
+	if ( connect ( session->fd, (struct sockaddr *)&address, sizeof(address) ) == -1 && errno != EINPROGRESS ) {
+		logMessage ( LOG_INFO_LEVEL, "Replay can't connect to port %d [%s]", port, strerror(errno) );
+		return -1;
+	}
+
+	memset ( &event, 0, sizeof(event) );
+	event.events = EPOLLOUT;
+	event.data.ptr = session;
+	if ( epoll_ctl ( epollFd, EPOLL_CTL_ADD, session->fd, &event ) == -1 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_openSession:Failed to watch the socket [%s]", strerror(errno) );
+		return -1;
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : advanceSession
+// Description  : Send as much of the request, or read as much of the
+//		  response, as the socket allows
+//
+// Inputs       : session - the session
+//		  events - what epoll said about its socket
+//		  epollFd - the replay's epoll instance
+//		  results - where a finished request is counted
+// Outputs      : 1 if the session ended, 0 if it goes on
+int advanceSession ( REPLAY_SESSION *session, int events, int epollFd, REPLAY_RESULTS *results ) {
+
+	static char filler[REPLAY_READ_SIZE], response[REPLAY_READ_SIZE];
+	REPLAY_REQUEST *request = session->request;
+	uint64_t total = (uint64_t)request->length + request->body;
+	struct epoll_event event;
+	ssize_t rb;
+
+	//Send the head, then the body's filler
+	while ( session->sent < total ) {
+		if ( session->sent < request->length )
+			rb = send ( session->fd, request->head + session->sent, request->length - session->sent, MSG_NOSIGNAL );
+		else
+			rb = send ( session->fd, filler, ( total - session->sent < sizeof(filler) ) ? total - session->sent : sizeof(filler), MSG_NOSIGNAL );
+		if ( rb == -1 && ( errno == EAGAIN || errno == EWOULDBLOCK ) )
+			return 0;
+		if ( rb == -1 ) {
+			endSession ( session, 1, results );
+			return 1;
+		}
+		session->sent += rb;
+		if ( session->sent == total ) {
+			memset ( &event, 0, sizeof(event) );
+			event.events = EPOLLIN;
+			event.data.ptr = session;
+			epoll_ctl ( epollFd, EPOLL_CTL_MOD, session->fd, &event );
+			return 0;
+		}
+	}
+
+	//The server closes the connection once it has answered
+	while ( (rb = recv ( session->fd, response, sizeof(response), 0 )) > 0 ) {
+		if ( session->statusLength < (int)sizeof(session->status) - 1 ) {
+			int keep = sizeof(session->status) - 1 - session->statusLength;
+			memcpy ( &session->status[session->statusLength], response, ( rb < keep ) ? rb : keep );
+			session->statusLength += ( rb < keep ) ? rb : keep;
+		}
+	}
+	if ( rb == -1 && ( errno == EAGAIN || errno == EWOULDBLOCK ) && !( events & ( EPOLLERR | EPOLLHUP ) ) )
+		return 0;
+	endSession ( session, session->statusLength < 12, results );
+	return 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : endSession
+// Description  : Close a session and count how its request went
+//
+// Inputs       : session - the session
+//		  failed - 1 if the request got no response
+//		  results - where the request is counted
+// Outputs      : none
+void endSession ( REPLAY_SESSION *session, int failed, REPLAY_RESULTS *results ) {
+
+	if ( session->fd != -1 )
+		close ( session->fd );
+	session->fd = -1;
+
+	if ( failed ) {
+		results->failed++;
+		return;
+	}
+	results->latency[results->finished++] = monotonicTime() - session->due;
+	if ( session->status[9] >= '1' && session->status[9] <= '5' )
+		results->classes[session->status[9] - '0']++;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : compareLatency
+// Description  : Order latencies, shortest first
+//
+// Inputs       : a, b - the latencies
+// Outputs      : less than, equal to or greater than 0
+int compareLatency ( const void *a, const void *b ) {
+
+	uint64_t first = *(const uint64_t *)a, second = *(const uint64_t *)b;
+
+	return ( first < second ) ? -1 : ( first > second );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : reportReplay
+// Description  : Print what the replay found
+//
+// Inputs       : filename - the capture file
+//		  results - how the requests went
+//		  elapsed - ns the replay took
+// Outputs      : none
+void reportReplay ( const char *filename, REPLAY_RESULTS *results, uint64_t elapsed ) {
+
+	const double points[] = { 0.50, 0.90, 0.99, 0.999 };
+	uint64_t *latency = results->latency;
+	int n = results->finished;
+
+	printf ( "Replayed %d requests from %s in %.3fs, %.1f requests/s\n", n + results->failed, filename,
+			elapsed / 1e9, ( n + results->failed ) / ( elapsed / 1e9 ) );
+	printf ( "  1xx %d, 2xx %d, 3xx %d, 4xx %d, 5xx %d, failed %d\n", results->classes[1], results->classes[2],
+			results->classes[3], results->classes[4], results->classes[5], results->failed );
+	if ( n == 0 )
+		return;
+
+	qsort ( latency, n, sizeof(uint64_t), compareLatency );
+	printf ( "  latency us:" );
+	for ( int i = 0; i < (int)( sizeof(points) / sizeof(points[0]) ); i++ )
+		printf ( " p%g %.1f", points[i] * 100, latency[(int)( points[i] * ( n - 1 ) )] / 1e3 );
+	printf ( " max %.1f\n", latency[n - 1] / 1e3 );
+}
@@ -0,0 +1,37 @@
+#ifndef SERVER_REPLAY_INCLUDED
+#define SERVER_REPLAY_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_replay.h
+//  Description   : Replaying a capture, see server_capture.h, against a
+//                  server on this host, then reporting how long the requests
+//                  took. At speed 1 each request is sent when it arrived in
+//                  the capture, relative to the first, and at speed 2 twice
+//                  as fast. Latency is measured from when a request was due,
+//                  not from when it went out, so a server that falls behind
+//                  can't hide it by slowing the replay down. Speed 0 sends the
+//                  requests as fast as REPLAY_CONCURRENCY connections allow.
+//
+//                  Requests go out in capture order, each on a connection of
+//                  its own, with filler for the body it declared, so replays
+//                  of the same capture send the same bytes.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+//
+// Constants
+
+#define REPLAY_CONCURRENCY 32		//connections at a time when replaying as fast as possible
+#define REPLAY_MAX_INFLIGHT 1024	//connections at a time when replaying on schedule
+#define REPLAY_TIMEOUT_MS 30000		//time a request has to be answered
+#define REPLAY_READ_SIZE 65536		//bytes of response read at a time
+
+//
+// Functional Prototypes
+
+int replayCapture ( const char *filename, int port, double speed );
+
+#endif
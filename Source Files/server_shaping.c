@@ -0,0 +1,306 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_shaping.c
+//  Description   : The download pacer and the bulk scheduler. Pacing is
+//                  per sender and needs no lock. The bulk downloads of a
+//                  process sit in one ring under shapeLock, with a token
+//                  bucket filled at the bulk-rate. When there are tokens, the
+//                  next download round the ring that is waiting is credited
+//                  a quantum and may send up to its deficit. Its tokens are
+//                  set aside until the slice is sent, and what it didn't use
+//                  goes back.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+
+// Project Include Files
+#include <cmpsc311_log.h>
+#include <server_shaping.h>
+#include <server_config.h>
+
+// Global Variables
+SHAPED_TRANSFER *bulkTurn = NULL;		//ring of bulk downloads, at the next one to visit
+int64_t bulkTokens = 0;				//bytes the bulk downloads may still send
+uint64_t bulkRefilled = 0;			//monotonic time the tokens were last topped up, 0 before the first
+pthread_mutex_t shapeLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t shapeTurn = PTHREAD_COND_INITIALIZER;	//tokens came back, or a turn was given
+
+//
+// Functional Prototypes
+
+void paceTransfer ( SHAPED_TRANSFER *transfer, size_t slice );
+void refillBulkTokens ( long rate );
+int grantBulkTurn ( void );
+void setPacingRate ( int fd, unsigned int rate );
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : startTransfer
+// Description  : Start shaping a response body. A rate below the min-rate is
+//		  raised to it, or the shaping would fail the rate check.
+//
+// Inputs       : transfer - the transfer's state
+//		  conn - the connection it is sent on
+//		  rate - bytes per second, 0 for no limit
+//		  length - bytes in the body
+// Outputs      : none
+void startTransfer ( SHAPED_TRANSFER *transfer, CLIENT_CONN *conn, long rate, off_t length ) {
+
+	memset ( transfer, 0, sizeof(SHAPED_TRANSFER) );
+	transfer->conn = conn;
+	transfer->slice = SHAPE_SLICE;
+	transfer->started = monotonicTime ();
+
+	if ( rate > 0 ) {
+		transfer->rate = ( rate < conn->config->minTransferRate ) ? conn->config->minTransferRate : rate;
+		transfer->slice = transfer->rate * SHAPE_BURST_MS / 1000;
+		if ( transfer->slice < SHAPE_MIN_SLICE )
+			transfer->slice = SHAPE_MIN_SLICE;
+		if ( transfer->slice > SHAPE_SLICE )
+			transfer->slice = SHAPE_SLICE;
+		setPacingRate ( conn->fd, ( transfer->rate > UINT_MAX / 2 ) ? UINT_MAX : transfer->rate * SHAPE_PACING_HEADROOM );
+	}
+
+	if ( length >= SHAPE_BULK_SIZE && conn->config->bulkRate > 0 ) {
+		transfer->bulkRate = conn->config->bulkRate;
+		pthread_mutex_lock ( &shapeLock );
+		if ( bulkTurn == NULL ) {
+			transfer->next = transfer->prev = transfer;
+			bulkTurn = transfer;
+		}
+		else {
+			//Joining just behind the turn puts it last in this round
+			transfer->next = bulkTurn;
+			transfer->prev = bulkTurn->prev;
+			bulkTurn->prev->next = transfer;
+			bulkTurn->prev = transfer;
+		}
+		pthread_mutex_unlock ( &shapeLock );
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : nextSlice
+// Description  : Wait until the transfer may send again, and say how much
+//
+// Inputs       : transfer - the transfer
+//		  remaining - bytes of the body left to send
+// Outputs      : bytes to send now, at most remaining
+size_t nextSlice ( SHAPED_TRANSFER *transfer, size_t remaining ) {
+
+	uint64_t begin = monotonicTime (), wait;
+	size_t slice = ( remaining < (size_t)transfer->slice ) ? remaining : (size_t)transfer->slice;
+	struct timespec until;
+
+	if ( !transfer->rate && !transfer->bulkRate )
+		return remaining;
+
+	if ( transfer->rate )
+		paceTransfer ( transfer, slice );
+
+	if ( transfer->bulkRate ) {
+		pthread_mutex_lock ( &shapeLock );
+		transfer->waiting = 1;
+		transfer->granted = 0;
+		while ( 1 ) {
+			refillBulkTokens ( transfer->bulkRate );
+			while ( bulkTokens > 0 && !transfer->granted && grantBulkTurn () );
+			if ( transfer->granted )
+				break;
+
+			//Sleep until the bucket is back in credit, or until a
+			//finished slice gives tokens back
+			wait = (uint64_t)( 1 - bulkTokens ) * 1000000000ULL / transfer->bulkRate;
+			if ( wait > SHAPE_BURST_MS * 1000000ULL )
+				wait = SHAPE_BURST_MS * 1000000ULL;
+			clock_gettime ( CLOCK_REALTIME, &until );
+			until.tv_nsec += wait % 1000000000ULL;
+			until.tv_sec += wait / 1000000000ULL + until.tv_nsec / 1000000000L;
+			until.tv_nsec %= 1000000000L;
+			pthread_cond_timedwait ( &shapeTurn, &shapeLock, &until );
+		}
+		if ( slice > (size_t)transfer->deficit )
+			slice = transfer->deficit;
+		pthread_mutex_unlock ( &shapeLock );
+	}
+
+	__atomic_add_fetch ( &transfer->conn->heldTime, monotonicTime () - begin, __ATOMIC_RELAXED );
+	return slice;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sliceSent
+// Description  : Charge the transfer for what it sent of its slice
+//
+// Inputs       : transfer - the transfer
+//		  sent - bytes sent, 0 if the send failed
+// Outputs      : none
+void sliceSent ( SHAPED_TRANSFER *transfer, size_t sent ) {
+
+	transfer->sent += sent;
+	if ( !transfer->bulkRate || !transfer->granted )
+		return;
+
+	//The tokens set aside for the turn that weren't used go back, and the
+	//deficit left carries over to its next turn
+	pthread_mutex_lock ( &shapeLock );
+	bulkTokens += transfer->deficit - (int64_t)sent;
+	transfer->deficit -= sent;
+	transfer->granted = 0;
+	pthread_cond_broadcast ( &shapeTurn );
+	pthread_mutex_unlock ( &shapeLock );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : finishTransfer
+// Description  : Stop shaping a body, taking it out of the bulk ring and the
+//		  pacing off its socket
+//
+// Inputs       : transfer - the transfer
+// Outputs      : none
+void finishTransfer ( SHAPED_TRANSFER *transfer ) {
+
+	if ( transfer->rate )
+		setPacingRate ( transfer->conn->fd, UINT_MAX );
+	if ( !transfer->bulkRate )
+		return;
+
+	pthread_mutex_lock ( &shapeLock );
+	if ( transfer->granted )
+		bulkTokens += transfer->deficit;
+	if ( transfer->next == transfer )
+		bulkTurn = NULL;
+	else {
+		transfer->prev->next = transfer->next;
+		transfer->next->prev = transfer->prev;
+		if ( bulkTurn == transfer )
+			bulkTurn = transfer->next;
+	}
+	pthread_cond_broadcast ( &shapeTurn );
+	pthread_mutex_unlock ( &shapeLock );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : paceTransfer
+// Description  : Sleep until the transfer's rate allows its next slice. It
+//		  may run SHAPE_BURST_MS ahead of the rate.
+//
+// Inputs       : transfer - the transfer
+//		  slice - bytes it is about to send
+// Outputs      : none
+void paceTransfer ( SHAPED_TRANSFER *transfer, size_t slice ) {
+
+	uint64_t elapsed = monotonicTime () - transfer->started, allowed, ahead;
+	struct timespec pause;
+
+	allowed = (uint64_t)transfer->rate * ( elapsed / 1000000ULL + SHAPE_BURST_MS ) / 1000;
+	if ( transfer->sent + slice <= allowed )
+		return;
+
+	ahead = ( transfer->sent + slice - allowed ) * 1000000000ULL / transfer->rate;
+	pause.tv_sec = ahead / 1000000000ULL;
+	pause.tv_nsec = ahead % 1000000000ULL;
+	while ( nanosleep ( &pause, &pause ) == -1 && errno == EINTR );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : refillBulkTokens
+// Description  : Top up the bulk token bucket for the time gone by. The
+//		  clock only moves on by the time the whole tokens added were
+//		  worth, so frequent calls don't lose the fractions. Called
+//		  with shapeLock held.
+//
+// Inputs       : rate - bulk-rate, bytes per second
+// Outputs      : none
+void refillBulkTokens ( long rate ) {
+
+	uint64_t now = monotonicTime (), added;
+	int64_t burst = (int64_t)rate * SHAPE_BURST_MS / 1000;
+
+	if ( burst < SHAPE_QUANTUM )
+		burst = SHAPE_QUANTUM;
+	if ( bulkRefilled == 0 ) {
+		bulkTokens = burst;
+		bulkRefilled = now;
+		return;
+	}
+
+	added = ( now - bulkRefilled ) * rate / 1000000000ULL;
+	if ( added == 0 )
+		return;
+	bulkRefilled += added * 1000000000ULL / rate;
+	bulkTokens += added;
+	if ( bulkTokens > burst ) {
+		bulkTokens = burst;
+		bulkRefilled = now;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : grantBulkTurn
+// Description  : Give the next waiting download round the ring its turn. It
+//		  is credited a quantum, up to one of its slices, and its
+//		  deficit is set aside from the tokens. Downloads that aren't
+//		  waiting are passed over without credit, as an empty queue is.
+//		  Called with shapeLock held.
+//
+// Inputs       : none
+// Outputs      : 1 if a download got its turn, 0 if none is waiting
+int grantBulkTurn ( void ) {
+
+	SHAPED_TRANSFER *visit = bulkTurn;
+
+	if ( visit == NULL )
+		return 0;
+	do {
+		if ( visit->waiting ) {
+			visit->deficit += SHAPE_QUANTUM;
+			if ( visit->deficit > visit->slice )
+				visit->deficit = visit->slice;
+			visit->waiting = 0;
+			visit->granted = 1;
+			bulkTokens -= visit->deficit;
+			bulkTurn = visit->next;
+			pthread_cond_broadcast ( &shapeTurn );
+			return 1;
+		}
+		visit = visit->next;
+	} while ( visit != bulkTurn );
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : setPacingRate
+// Description  : Have the kernel pace the socket, where it can
+//
+// Inputs       : fd - the socket
+//		  rate - bytes per second, UINT_MAX for no pacing
+// Outputs      : none
+void setPacingRate ( int fd, unsigned int rate ) {
+
+#ifdef SO_MAX_PACING_RATE
+	if ( setsockopt ( fd, SOL_SOCKET, SO_MAX_PACING_RATE, &rate, sizeof(rate) ) == -1 && rate != UINT_MAX )
+		logMessage ( LOG_INFO_LEVEL, "Can't pace socket %d, only the token bucket will [%s]", fd, strerror(errno) );
+#else
+	(void)fd;
+	(void)rate;
+#endif
+}
@@ -0,0 +1,69 @@
+#ifndef SERVER_SHAPING_INCLUDED
+#define SERVER_SHAPING_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_shaping.h
+//  Description   : Bandwidth shaping of response bodies. A shaped body is
+//                  sent in slices, and before each one the sender asks for
+//                  the next slice and may be held back.
+//
+//                  Each download may be limited to the send-rate, or to its
+//                  host's rate. A token bucket in the sender paces it, and
+//                  where the kernel has SO_MAX_PACING_RATE the socket is
+//                  paced as well, so a slice doesn't leave as one burst.
+//
+//                  Bodies of SHAPE_BULK_SIZE and up also share the bulk-rate
+//                  of their process. Deficit round robin gives it out a
+//                  quantum at a time across the large downloads waiting for
+//                  it, so each gets an even share and the rest of the link
+//                  is left to small responses.
+//
+//                  Time a download is held back doesn't count against the
+//                  client in the min-rate check.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <server_conn.h>
+
+//
+// Constants
+
+#define SHAPE_BULK_SIZE ( 1024 * 1024 )		//bodies this large share the bulk-rate
+#define SHAPE_SLICE ( 256 * 1024 )		//most bytes sent between scheduling decisions
+#define SHAPE_MIN_SLICE 16384			//least bytes in a paced slice
+#define SHAPE_QUANTUM SHAPE_SLICE		//bytes a bulk download is credited each round
+#define SHAPE_BURST_MS 100			//time worth of bytes a rate may save up
+#define SHAPE_PACING_HEADROOM 5 / 4		//kernel pacing runs this much faster than the rate,
+						//so the token bucket decides and the kernel smooths
+
+//
+// Type Definitions
+
+typedef struct shaped_transfer {
+	CLIENT_CONN *conn;
+	long rate;				//bytes per second, 0 for no limit
+	long bulkRate;				//bulk-rate of the config it started with, 0 if not bulk
+	int slice;				//largest slice it sends
+	uint64_t started;			//monotonic time pacing started from, in ns
+	uint64_t sent;				//bytes sent since then
+	int64_t deficit;			//bytes it may send on its turn
+	int waiting;				//waiting for its turn
+	int granted;				//its turn came
+	struct shaped_transfer *next;		//ring of bulk downloads
+	struct shaped_transfer *prev;
+} SHAPED_TRANSFER;
+
+//
+// Functional Prototypes
+
+void startTransfer ( SHAPED_TRANSFER *transfer, CLIENT_CONN *conn, long rate, off_t length );
+size_t nextSlice ( SHAPED_TRANSFER *transfer, size_t remaining );
+void sliceSent ( SHAPED_TRANSFER *transfer, size_t sent );
+void finishTransfer ( SHAPED_TRANSFER *transfer );
+
+#endif
@@ -0,0 +1,534 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_shared.c
+//  Description   : The shared memory segment. It is an anonymous shared
+//                  mapping made before any worker process is forked, so every
+//                  process sees the same pages at the same address.
+//
+//                  Counters are only ever added to by the process that owns
+//                  the slot, with relaxed atomics since its worker threads
+//                  share it. The file cache is direct mapped, a file's path
+//                  hash picks its one slot. Readers copy the file out between
+//                  two reads of the slot's sequence number. Writers take the
+//                  slot's writer word with the pid of their process, and a
+//                  writer that finds it taken just doesn't cache the file. If
+//                  a process dies mid write, the master clears what it held.
+//
+//                  Hit counts are an open addressing table. A path takes an
+//                  empty slot by moving it from empty to claimed, and marks
+//                  it ready once its path is written. From then on the slot
+//                  is never written again, only its count added to.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+// Project Include Files
+#include <cmpsc311_log.h>
+#include <server.h>
+#include <server_shared.h>
+#include <server_handlers.h>
+#include <server_websocket.h>
+#include <server_affinity.h>
+
+//
+// Type Definitions
+
+typedef struct shared_stats {
+	uint64_t counters[STAT_COUNTERS];
+	pid_t pid;			//process counting into the slot, 0 if unused
+	uint32_t restarts;		//times the master restarted the slot's process
+	int64_t started;		//time the process started
+} __attribute__ ((aligned ( 64 ))) SHARED_STATS;
+
+typedef struct shared_cache_slot {
+	uint32_t sequence;		//odd while the slot is being written
+	pid_t writer;			//process writing the slot, 0 if none
+	uint64_t hash;			//hash of the path, 0 if the slot is empty
+	char path[MAXLINE];
+	dev_t device;			//what stat said about the cached file
+	ino_t inode;
+	struct timespec modified;
+	off_t length;
+	char data[SHARED_CACHE_FILE_MAX];
+} SHARED_CACHE_SLOT;
+
+// States of a hit slot
+#define HIT_EMPTY 0
+#define HIT_CLAIMED 1				//its path is being written
+#define HIT_READY 2
+
+typedef struct shared_hit_slot {
+	uint32_t state;			//HIT_ state
+	uint64_t hash;			//hash of the path
+	FILE_HITS file;
+} SHARED_HIT_SLOT;
+
+typedef struct shared_segment {
+	int64_t started;		//time the server started
+	SHARED_STATS stats[SHARED_MAX_WORKERS];
+	SHARED_CACHE_SLOT cache[SHARED_CACHE_SLOTS];
+	SHARED_HIT_SLOT hits[SHARED_HIT_SLOTS];
+} SHARED_SEGMENT;
+
+// Global Variables
+SHARED_SEGMENT *segment = NULL;
+int sharedSlot = 0;			//the stats slot this process counts into
+
+// Statistics names, in STAT_ order, for the status page
+const char *statNames[STAT_COUNTERS] = { "connections", "rejected", "requests", "bytesIn", "bytesOut",
+					 "cacheHits", "cacheMisses", "microcacheHits", "microcacheMisses",
+					 "websockets", "websocketMessages", "eventSubscribers", "eventsPublished",
+					 "eventsDropped", "requestsCaptured", "captureDropped", "openConnections",
+					 "connectionBytes", "buffersLent", "buffersPooled" };
+
+//
+// Functional Prototypes
+
+uint64_t hashSharedPath ( const char *path );
+int statusJson ( char *buf, int size );
+int openStatusSocket ( WEBSOCKET *ws, HTTP_REQUEST *request );
+int statusSocketMessage ( WEBSOCKET *ws, int opcode, const unsigned char *data, uint64_t length );
+
+// Dashboards keep a WebSocket open on the status uri and get the counters
+// back for every message they send
+const WEBSOCKET_ROUTE statusSocket = { openStatusSocket, statusSocketMessage, NULL };
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : setupSharedMemory
+// Description  : Map the shared segment, and serve its counters at
+//		  SHARED_STATUS_URI, over HTTP or a WebSocket. Must run before
+//		  the worker processes are forked.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+int setupSharedMemory ( void ) {
+
+	void *map;
+
+	//Pages are only backed once they are touched, so the empty cache
+	//slots cost nothing
+	if ( (map = mmap ( NULL, sizeof(SHARED_SEGMENT), PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0 )) == MAP_FAILED ) {
+		logMessage ( LOG_ERROR_LEVEL, "_setupSharedMemory:Can't map the shared segment [%s]", strerror(errno) );
+		return -1;
+	}
+	segment = map;
+	interleaveMemory ( map, sizeof(SHARED_SEGMENT) );
+	segment->started = time ( NULL );
+	setSharedSlot ( 0, 0 );
+
+	if ( registerHandler ( SHARED_STATUS_URI, serveStatus ) || registerWebSocket ( SHARED_STATUS_URI, &statusSocket ) )
+		return -1;
+	logMessage ( LOG_INFO_LEVEL, "Mapped %zu bytes of shared memory", sizeof(SHARED_SEGMENT) );
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : setSharedSlot
+// Description  : Claim the stats slot this process counts into. A worker
+//		  process calls it as soon as it is forked.
+//
+// Inputs       : slot - the slot, the worker's number
+//		  restarted - 1 if the worker replaces one that crashed
+// Outputs      : none
+void setSharedSlot ( int slot, int restarted ) {
+
+	if ( segment == NULL || slot < 0 || slot >= SHARED_MAX_WORKERS )
+		return;
+
+	//Whatever a crashed process held died with it
+	sharedSlot = slot;
+	for ( int c = STAT_FIRST_GAUGE; c < STAT_COUNTERS; c++ )
+		segment->stats[slot].counters[c] = 0;
+	segment->stats[slot].pid = getpid();
+	segment->stats[slot].started = time ( NULL );
+	segment->stats[slot].restarts += restarted;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : currentSharedSlot
+// Description  : Get the slot this process counts into
+//
+// Inputs       : none
+// Outputs      : the slot, 0 outside multi-process mode
+int currentSharedSlot ( void ) {
+
+	return sharedSlot;
+}
+
+#if SERVER_METRICS
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : countStat
+// Description  : Add to one of this process's counters
+//
+// Inputs       : counter - STAT_ value
+//		  amount - how much to add
+// Outputs      : none
+void countStat ( int counter, uint64_t amount ) {
+
+	if ( segment != NULL && amount )
+		__atomic_add_fetch ( &segment->stats[sharedSlot].counters[counter], amount, __ATOMIC_RELAXED );
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sharedCacheFetch
+// Description  : Copy a file out of the shared cache, if the cached copy is
+//		  the one stat describes
+//
+// Inputs       : filename - path of the file
+//		  sbuf - what stat just said about it
+//		  data - place to copy it to, at least st_size bytes
+// Outputs      : 0 on a hit, -1 on a miss
+int sharedCacheFetch ( const char *filename, struct stat *sbuf, char *data ) {
+
+	SHARED_CACHE_SLOT *slot;
+	uint64_t hash;
+	uint32_t begin;
+
+	if ( segment == NULL || sbuf->st_size > SHARED_CACHE_FILE_MAX )
+		return -1;
+
+	hash = hashSharedPath ( filename );
+	slot = &segment->cache[hash % SHARED_CACHE_SLOTS];
+
+	//The copy only counts if no writer started or finished while we took it
+	begin = __atomic_load_n ( &slot->sequence, __ATOMIC_ACQUIRE );
+	if ( ( begin & 1 ) || slot->hash != hash || slot->length != sbuf->st_size ||
+	     slot->inode != sbuf->st_ino || slot->device != sbuf->st_dev ||
+	     slot->modified.tv_sec != sbuf->st_mtim.tv_sec || slot->modified.tv_nsec != sbuf->st_mtim.tv_nsec ||
+	     strncmp ( slot->path, filename, sizeof(slot->path) ) ) {
+		countStat ( STAT_CACHE_MISSES, 1 );
+		return -1;
+	}
+	memcpy ( data, slot->data, sbuf->st_size );
+	__atomic_thread_fence ( __ATOMIC_ACQUIRE );
+	if ( __atomic_load_n ( &slot->sequence, __ATOMIC_RELAXED ) != begin ) {
+		countStat ( STAT_CACHE_MISSES, 1 );
+		return -1;
+	}
+
+	countStat ( STAT_CACHE_HITS, 1 );
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sharedCacheStore
+// Description  : Put a file in the shared cache, replacing whatever had its
+//		  slot. Skipped if another thread or process is writing the
+//		  slot right now.
+//
+// Inputs       : filename - path of the file
+//		  sbuf - what fstat said about the file that was read
+//		  data - the file's contents
+//		  length - its length
+// Outputs      : none
+void sharedCacheStore ( const char *filename, struct stat *sbuf, const char *data, int length ) {
+
+	SHARED_CACHE_SLOT *slot;
+	uint64_t hash;
+	pid_t expected = 0;
+	uint32_t sequence;
+
+	if ( segment == NULL || length > SHARED_CACHE_FILE_MAX || length != sbuf->st_size ||
+	     strlen ( filename ) >= sizeof(slot->path) )
+		return;
+
+	hash = hashSharedPath ( filename );
+	slot = &segment->cache[hash % SHARED_CACHE_SLOTS];
+	if ( !__atomic_compare_exchange_n ( &slot->writer, &expected, getpid(), 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED ) )
+		return;
+
+	//Odd sequence first, so no reader trusts the slot while it changes
+	sequence = slot->sequence;
+	__atomic_store_n ( &slot->sequence, sequence + 1, __ATOMIC_RELAXED );
+	__atomic_thread_fence ( __ATOMIC_RELEASE );
+
+	slot->hash = hash;
+	strcpy ( slot->path, filename );
+	slot->device = sbuf->st_dev;
+	slot->inode = sbuf->st_ino;
+	slot->modified = sbuf->st_mtim;
+	slot->length = length;
+	memcpy ( slot->data, data, length );
+
+	__atomic_store_n ( &slot->sequence, sequence + 2, __ATOMIC_RELEASE );
+	__atomic_store_n ( &slot->writer, 0, __ATOMIC_RELEASE );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : countFileHit
+// Description  : Add to a file's hit count. A file that finds no slot of its
+//		  own, or one still being claimed, just isn't counted.
+//
+// Inputs       : filename - path of the file
+//		  hits - how many to add
+// Outputs      : none
+void countFileHit ( const char *filename, uint64_t hits ) {
+
+	SHARED_HIT_SLOT *slot;
+	uint64_t hash;
+	uint32_t state;
+
+	if ( segment == NULL || strlen ( filename ) >= SHARED_HIT_PATH_MAX )
+		return;
+
+	hash = hashSharedPath ( filename );
+	for ( int probe = 0; probe < SHARED_HIT_PROBES; probe++ ) {
+		slot = &segment->hits[( hash + probe ) % SHARED_HIT_SLOTS];
+		state = __atomic_load_n ( &slot->state, __ATOMIC_ACQUIRE );
+		if ( state == HIT_EMPTY ) {
+			if ( !__atomic_compare_exchange_n ( &slot->state, &state, HIT_CLAIMED, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED ) )
+				return;
+			slot->hash = hash;
+			strcpy ( slot->file.path, filename );
+			slot->file.hits = hits;
+			__atomic_store_n ( &slot->state, HIT_READY, __ATOMIC_RELEASE );
+			return;
+		}
+		if ( state == HIT_CLAIMED )
+			return;
+		if ( slot->hash == hash && !strcmp ( slot->file.path, filename ) ) {
+			__atomic_add_fetch ( &slot->file.hits, hits, __ATOMIC_RELAXED );
+			return;
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : copyFileHits
+// Description  : Copy out the files that have hit counts
+//
+// Inputs       : list - place to copy them to
+//		  max - most files to copy
+// Outputs      : the number of files copied
+int copyFileHits ( FILE_HITS *list, int max ) {
+
+	SHARED_HIT_SLOT *slot;
+	int count = 0;
+
+	for ( int i = 0; segment != NULL && i < SHARED_HIT_SLOTS && count < max; i++ ) {
+		slot = &segment->hits[i];
+		if ( __atomic_load_n ( &slot->state, __ATOMIC_ACQUIRE ) != HIT_READY )
+			continue;
+		strcpy ( list[count].path, slot->file.path );
+		list[count].hits = __atomic_load_n ( &slot->file.hits, __ATOMIC_RELAXED );
+		count++;
+	}
+	return count;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : releaseSharedLocks
+// Description  : Clear the cache slots a dead process was writing. A slot left
+//		  half written is emptied, or every reader would miss on it
+//		  forever and no writer could take it.
+//
+// Inputs       : pid - the process that died
+// Outputs      : none
+void releaseSharedLocks ( pid_t pid ) {
+
+	SHARED_CACHE_SLOT *slot;
+	int released = 0;
+
+	if ( segment == NULL )
+		return;
+
+	for ( int i = 0; i < SHARED_CACHE_SLOTS; i++ ) {
+		slot = &segment->cache[i];
+		if ( __atomic_load_n ( &slot->writer, __ATOMIC_ACQUIRE ) != pid )
+			continue;
+		if ( slot->sequence & 1 ) {
+			slot->hash = 0;
+			slot->path[0] = '\0';
+			__atomic_store_n ( &slot->sequence, slot->sequence + 1, __ATOMIC_RELEASE );
+		}
+		__atomic_store_n ( &slot->writer, 0, __ATOMIC_RELEASE );
+		released++;
+	}
+
+	if ( released )
+		logMessage ( LOG_WARNING_LEVEL, "Cleared %d cache slots process %d was writing", released, (int)pid );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : serveStatus
+// Description  : The handler for SHARED_STATUS_URI. Answers with every
+//		  process's counters and their totals, as json. Only clients on
+//		  the loopback interface may ask.
+//
+// Inputs       : conn - the client connection
+//		  request - the parsed request
+//		  body - the request body, ignored
+// Outputs      : 0 if the request was answered, 1 if the connection should be dropped
+int serveStatus ( CLIENT_CONN *conn, HTTP_REQUEST *request, REQUEST_BODY *body ) {
+
+	char json[MAXBUF], head[MAXLINE];
+	int length, headOnly = !strcasecmp ( request->method, "HEAD" );
+
+	if ( !isLoopback ( conn ) ) {
+		logMessage ( LOG_WARNING_LEVEL, "Status asked for from outside the host. 403 error" );
+		sendErrorResponse ( conn->fd, 403, "Forbidden", NULL );
+		return 1;
+	}
+	if ( strcasecmp ( request->method, "GET" ) && !headOnly ) {
+		sendErrorResponse ( conn->fd, 405, "Method Not Allowed", "Allow: GET, HEAD\r\n" );
+		return 1;
+	}
+
+	length = statusJson ( json, sizeof(json) );
+	snprintf ( head, sizeof(head), "HTTP/1.0 200 OK\r\n"
+			"Server: " SERVER_NAME "\r\n"
+			"Content-length: %d\r\n"
+			"Content-type: application/json\r\n"
+			"Cache-Control: no-store\r\n\r\n", length );
+	if ( sendBytes ( conn->fd, strlen(head), head ) || ( !headOnly && sendBytes ( conn->fd, length, json ) ) )
+		return 1;
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : openStatusSocket
+// Description  : Keep the counters to loopback clients, as serveStatus does
+//
+// Inputs       : ws - the WebSocket
+//		  request - the upgrade request
+// Outputs      : 0 to keep the WebSocket, -1 to close it
+int openStatusSocket ( WEBSOCKET *ws, HTTP_REQUEST *request ) {
+
+	if ( !isLoopback ( ws->conn ) ) {
+		logMessage ( LOG_WARNING_LEVEL, "Status WebSocket opened from outside the host, closing" );
+		return -1;
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : statusSocketMessage
+// Description  : Answer any message with the counters, as json text
+//
+// Inputs       : ws - the WebSocket
+//		  opcode - WS_TEXT or WS_BINARY
+//		  data - the message, unused
+//		  length - its length
+// Outputs      : 0 if successful, -1 to close the WebSocket
+int statusSocketMessage ( WEBSOCKET *ws, int opcode, const unsigned char *data, uint64_t length ) {
+
+	char json[MAXBUF];
+
+	return sendWebSocket ( ws, WS_TEXT, json, statusJson ( json, sizeof(json) ) ) ? -1 : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : statusJson
+// Description  : Write the counters of every process that has a slot, and
+//		  their totals
+//
+// Inputs       : buf - place to write the json
+//		  size - size of buf
+// Outputs      : length of the json
+int statusJson ( char *buf, int size ) {
+
+	uint64_t totals[STAT_COUNTERS] = { 0 }, value;
+	int64_t now = time ( NULL );
+	SHARED_STATS *stats;
+	int len, processes = 0;
+
+	len = snprintf ( buf, size, "{\"uptime\":%lld,\"processes\":[", (long long)( now - segment->started ) );
+	for ( int i = 0; i < SHARED_MAX_WORKERS && len < size; i++ ) {
+		stats = &segment->stats[i];
+		if ( stats->pid == 0 )
+			continue;
+		len += snprintf ( buf + len, size - len, "%s{\"slot\":%d,\"pid\":%d,\"restarts\":%u,\"uptime\":%lld",
+				( processes++ ) ? "," : "", i, (int)stats->pid, stats->restarts,
+				(long long)( now - stats->started ) );
+		for ( int c = 0; c < STAT_COUNTERS && len < size; c++ ) {
+			value = __atomic_load_n ( &stats->counters[c], __ATOMIC_RELAXED );
+			totals[c] += value;
+			len += snprintf ( buf + len, size - len, ",\"%s\":%llu", statNames[c], (unsigned long long)value );
+		}
+		if ( len < size )
+			len += snprintf ( buf + len, size - len, "}" );
+	}
+	if ( len < size )
+		len += snprintf ( buf + len, size - len, "],\"totals\":{" );
+	for ( int c = 0; c < STAT_COUNTERS && len < size; c++ )
+		len += snprintf ( buf + len, size - len, "%s\"%s\":%llu", ( c ) ? "," : "", statNames[c],
+				(unsigned long long)totals[c] );
+
+	//What an open connection costs on average, its buffers included
+	if ( len < size )
+		len += snprintf ( buf + len, size - len, ",\"bytesPerConnection\":%llu", ( totals[STAT_OPEN_CONNECTIONS] ) ?
+				(unsigned long long)( ( totals[STAT_CONNECTION_BYTES] + totals[STAT_BUFFERS_LENT] ) /
+						      totals[STAT_OPEN_CONNECTIONS] ) : 0ULL );
+	if ( len < size )
+		len += snprintf ( buf + len, size - len, "}}\n" );
+
+	return ( len < size ) ? len : size - 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : isLoopback
+// Description  : Check whether a client connected over the loopback interface,
+//		  or a Unix socket, which is just as local
+//
+// Inputs       : conn - the connection
+// Outputs      : 1 if it did, 0 if not
+int isLoopback ( CLIENT_CONN *conn ) {
+
+	struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)&conn->address;
+	struct sockaddr_in *in = (struct sockaddr_in *)&conn->address;
+
+	if ( conn->address.ss_family == AF_INET )
+		return ( ntohl ( in->sin_addr.s_addr ) >> 24 ) == 127;
+	if ( conn->address.ss_family == AF_INET6 )
+		return IN6_IS_ADDR_LOOPBACK ( &in6->sin6_addr ) ||
+		       ( IN6_IS_ADDR_V4MAPPED ( &in6->sin6_addr ) && in6->sin6_addr.s6_addr[12] == 127 );
+	return conn->address.ss_family == AF_UNIX;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hashSharedPath
+// Description  : FNV-1a hash of a path, which picks its cache slot
+//
+// Inputs       : path - the path
+// Outputs      : the hash, never 0
+uint64_t hashSharedPath ( const char *path ) {
+
+	uint64_t hash = 14695981039346656037ULL;
+
+	while ( *path ) {
+		hash ^= (unsigned char)*path++;
+		hash *= 1099511628211ULL;
+	}
+	return ( hash ) ? hash : 1;
+}
@@ -0,0 +1,93 @@
+#ifndef SERVER_SHARED_INCLUDED
+#define SERVER_SHARED_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_shared.h
+//  Description   : The segment of memory every server process shares. It is
+//                  mapped before the worker processes are forked and holds
+//                  the server's counters, a cache of small static files and
+//                  the hit counts of static files, for the warm-up list.
+//
+//                  Each process counts into its own slot, so counters never
+//                  bounce between processes. Cache readers take no lock at
+//                  all. Every cache slot is guarded by a sequence number that
+//                  is odd while the slot is being written, and a reader that
+//                  sees it change simply treats the lookup as a miss.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <server.h>
+#include <server_body.h>
+
+//
+// Constants
+
+#define SHARED_MAX_WORKERS 64			//worker processes with a slot of counters
+#define SHARED_CACHE_SLOTS 1024			//files the cache holds, one per slot
+#define SHARED_CACHE_FILE_MAX 65536		//largest file the cache takes
+#define SHARED_HIT_SLOTS 4096			//files whose hits are counted
+#define SHARED_HIT_PATH_MAX 256			//longest path whose hits are counted
+#define SHARED_HIT_PROBES 8			//slots a path may look at before it isn't counted
+#define SHARED_STATUS_URI "/server-status"	//counters as json, for loopback clients only
+
+// Counters each process keeps
+#define STAT_CONNECTIONS 0			//connections accepted
+#define STAT_REJECTED 1				//connections and requests turned away
+#define STAT_REQUESTS 2				//requests read, HTTP/2 streams included
+#define STAT_BYTES_IN 3
+#define STAT_BYTES_OUT 4
+#define STAT_CACHE_HITS 5
+#define STAT_CACHE_MISSES 6
+#define STAT_MICROCACHE_HITS 7			//CGI responses sent from the cache, stale ones included
+#define STAT_MICROCACHE_MISSES 8
+#define STAT_WEBSOCKETS 9			//connections switched to a WebSocket
+#define STAT_WEBSOCKET_MESSAGES 10		//whole messages received on them
+#define STAT_EVENT_SUBSCRIBERS 11		//connections subscribed to an event channel
+#define STAT_EVENTS_PUBLISHED 12
+#define STAT_EVENTS_DROPPED 13			//events a slow subscriber never got
+#define STAT_REQUESTS_CAPTURED 14		//requests written to the capture file
+#define STAT_CAPTURE_DROPPED 15			//sampled requests the capture writer had no room for
+#define STAT_OPEN_CONNECTIONS 16		//connections open now
+#define STAT_CONNECTION_BYTES 17		//bytes of state they hold, not counting pooled buffers
+#define STAT_BUFFERS_LENT 18			//bytes of pooled buffers lent to connections now
+#define STAT_BUFFERS_POOLED 19			//bytes of free buffers the pool keeps
+#define STAT_COUNTERS 20
+#define STAT_FIRST_GAUGE STAT_OPEN_CONNECTIONS	//counters from here on go up and down
+
+//
+// Type Definitions
+
+typedef struct file_hits {
+	uint64_t hits;
+	char path[SHARED_HIT_PATH_MAX];
+} FILE_HITS;
+
+//
+// Functional Prototypes
+
+int setupSharedMemory ( void );
+void setSharedSlot ( int slot, int restarted );
+int currentSharedSlot ( void );
+#if SERVER_METRICS
+void countStat ( int counter, uint64_t amount );
+#else
+static inline void countStat ( int counter, uint64_t amount ) {
+	(void)counter;
+	(void)amount;
+}
+#endif
+int sharedCacheFetch ( const char *filename, struct stat *sbuf, char *data );
+void sharedCacheStore ( const char *filename, struct stat *sbuf, const char *data, int length );
+void countFileHit ( const char *filename, uint64_t hits );
+int copyFileHits ( FILE_HITS *list, int max );
+void releaseSharedLocks ( pid_t pid );
+int isLoopback ( CLIENT_CONN *conn );
+int serveStatus ( CLIENT_CONN *conn, HTTP_REQUEST *request, REQUEST_BODY *body );
+
+#endif
@@ -0,0 +1,963 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_sse.c
+//  Description   : The event channels and their fan-out thread. Workers only
+//                  answer the subscribe request and publishers only format
+//                  the event. Both hand their work to the fan-out thread
+//                  through a locked queue and an eventfd, and the thread owns
+//                  every channel and subscriber from there on, so the
+//                  channel table and the event reference counts need no lock.
+//
+//                  Subscriber sockets are non-blocking and sit in the thread's
+//                  own epoll set, edge triggered. A subscriber is written
+//                  until its socket is full, then left alone until epoll says
+//                  it drained. Plain and kTLS connections get their queued
+//                  events in one writev. Other TLS connections go through
+//                  the TLS layer an event at a time.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <pthread.h>
+
+// Project Include Files
+#include <cmpsc311_log.h>
+#include <server.h>
+#include <server_sse.h>
+#include <server_event.h>
+#include <server_handlers.h>
+#include <server_config.h>
+#include <server_shared.h>
+#include <server_master.h>
+
+//
+// Type Definitions
+
+typedef struct sse_event {
+	int refs;				//queues holding it, plus one while it waits to fan out
+	int length;
+	char channel[SSE_CHANNEL_MAX + 1];	//where it goes
+	struct sse_event *next;			//publish queue
+	char data[];				//the event as it goes on the wire
+} SSE_EVENT;
+
+typedef struct sse_subscriber {
+	CLIENT_CONN *conn;
+	char channelName[SSE_CHANNEL_MAX + 1];
+	struct sse_channel *channel;		//NULL until the fan-out thread takes it
+	SSE_EVENT *queue[SSE_QUEUE_DEPTH];	//events waiting to be sent, oldest at head
+	int head;
+	int count;
+	int offset;				//bytes of the oldest event already sent
+	int blocked;				//the socket is full, wait for epoll to say it drained
+	int missed;				//events it never got
+	int closing;				//close it at the next flush
+	int dirty;				//on the flush list
+	uint64_t lastWrite;			//monotonic time of the last bytes sent, in ns
+	struct sse_subscriber *prev;		//channel's subscriber list
+	struct sse_subscriber *next;
+	struct sse_subscriber *nextDirty;	//flush list, or the queue of subscribers joining
+} SSE_SUBSCRIBER;
+
+typedef struct sse_channel {
+	char name[SSE_CHANNEL_MAX + 1];
+	SSE_SUBSCRIBER *subscribers;
+	int count;
+	struct sse_channel *next;		//hash chain
+} SSE_CHANNEL;
+
+// Global Variables
+SSE_CHANNEL *channelBuckets[SSE_CHANNEL_BUCKETS];	//owned by the fan-out thread
+SSE_SUBSCRIBER *dirtySubscribers = NULL;		//subscribers to flush, fan-out thread only
+SSE_EVENT *publishHead = NULL;				//events waiting to fan out
+SSE_EVENT *publishTail = NULL;
+SSE_SUBSCRIBER *joiningSubscribers = NULL;		//subscribers waiting to join a channel
+int eventsRunning = 0;
+int eventsStopping = 0;
+int fanoutEpoll = -1;
+int fanoutWake = -1;					//eventfd the queues ring
+int publishSocket = -1;					//the events-socket, -1 if there is none
+char publishPath[sizeof(((struct sockaddr_un *)0)->sun_path)];
+uint64_t eventSequence = 0;				//last event id handed out
+pthread_t fanoutThread;
+pthread_mutex_t eventLock = PTHREAD_MUTEX_INITIALIZER;
+
+//
+// Functional Prototypes
+
+void * fanoutLoop ( void *arg );
+int openPublishSocket ( const char *path );
+void receiveEvents ( void );
+int subscribeEvents ( CLIENT_CONN *conn, const char *channel );
+int postEvent ( CLIENT_CONN *conn, HTTP_REQUEST *request, REQUEST_BODY *body, const char *channel );
+void wakeFanout ( void );
+void joinChannel ( SSE_SUBSCRIBER *sub );
+void fanOut ( SSE_EVENT *event );
+void sendKeepalives ( uint64_t quietSince );
+void queueEvent ( SSE_SUBSCRIBER *sub, SSE_EVENT *event );
+void flushSubscriber ( SSE_SUBSCRIBER *sub );
+void closeSubscriber ( SSE_SUBSCRIBER *sub );
+SSE_EVENT * formatEvent ( const char *channel, const char *name, const char *data, int length );
+void releaseEvent ( SSE_EVENT *event );
+int channelFromUri ( const char *uri, char *channel );
+int validChannel ( const char *channel, int length );
+unsigned int hashChannel ( const char *name );
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : setupEvents
+// Description  : Serve the channels at SSE_URI. Runs before the workers do.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+int setupEvents ( void ) {
+
+	return registerHandler ( SSE_URI, serveEvents );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : startEvents
+// Description  : Start the fan-out thread, and open the events-socket if the
+//		  config names one
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+int startEvents ( void ) {
+
+	struct epoll_event ev;
+	sigset_t blocked, previous;
+	int ret;
+
+	eventsStopping = 0;
+	if ( (fanoutEpoll = epoll_create1 ( EPOLL_CLOEXEC )) == -1 ||
+	     (fanoutWake = eventfd ( 0, EFD_NONBLOCK | EFD_CLOEXEC )) == -1 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_startEvents:Can't set up the fan-out thread [%s]", strerror(errno) );
+		return -1;
+	}
+	memset ( &ev, 0, sizeof(ev) );
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	if ( epoll_ctl ( fanoutEpoll, EPOLL_CTL_ADD, fanoutWake, &ev ) == -1 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_startEvents:Can't watch the wake event [%s]", strerror(errno) );
+		return -1;
+	}
+	if ( serverConfig()->eventsSocket[0] && openPublishSocket ( serverConfig()->eventsSocket ) )
+		return -1;
+
+	//Like the workers, the fan-out thread leaves SIGINT and SIGHUP to the event loop
+	sigemptyset ( &blocked );
+	sigaddset ( &blocked, SIGINT );
+	sigaddset ( &blocked, SIGHUP );
+	pthread_sigmask ( SIG_BLOCK, &blocked, &previous );
+	ret = pthread_create ( &fanoutThread, NULL, fanoutLoop, NULL );
+	pthread_sigmask ( SIG_SETMASK, &previous, NULL );
+
+	if ( ret ) {
+		logMessage ( LOG_ERROR_LEVEL, "_startEvents:Failed to create the fan-out thread" );
+		return -1;
+	}
+	__atomic_store_n ( &eventsRunning, 1, __ATOMIC_RELEASE );
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : stopEvents
+// Description  : Stop the fan-out thread and disconnect every subscriber
+//
+// Inputs       : none
+// Outputs      : none
+void stopEvents ( void ) {
+
+	SSE_SUBSCRIBER *sub;
+	SSE_EVENT *event;
+	int wasRunning;
+
+	pthread_mutex_lock ( &eventLock );
+	wasRunning = eventsRunning;
+	__atomic_store_n ( &eventsRunning, 0, __ATOMIC_RELEASE );
+	eventsStopping = 1;
+	pthread_mutex_unlock ( &eventLock );
+
+	if ( wasRunning ) {
+		wakeFanout ();
+		pthread_join ( fanoutThread, NULL );
+	}
+
+	//Nothing else touches the channels now
+	while ( (sub = joiningSubscribers) != NULL ) {
+		joiningSubscribers = sub->nextDirty;
+		closeConnection ( sub->conn );
+		countStat ( STAT_CONNECTION_BYTES, -(uint64_t)sizeof(SSE_SUBSCRIBER) );
+		free ( sub );
+	}
+	while ( (event = publishHead) != NULL ) {
+		publishHead = event->next;
+		releaseEvent ( event );
+	}
+	publishTail = NULL;
+	for ( int i = 0; i < SSE_CHANNEL_BUCKETS; i++ ) {
+		while ( channelBuckets[i] != NULL )
+			closeSubscriber ( channelBuckets[i]->subscribers );
+	}
+
+	if ( publishSocket != -1 ) {
+		close ( publishSocket );
+		unlink ( publishPath );
+		publishSocket = -1;
+	}
+	if ( fanoutWake != -1 )
+		close ( fanoutWake );
+	if ( fanoutEpoll != -1 )
+		close ( fanoutEpoll );
+	fanoutWake = fanoutEpoll = -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : publishEvent
+// Description  : Send an event to every subscriber of a channel. It is
+//		  formatted here, on the caller's thread, and fanned out by the
+//		  fan-out thread. Safe to call from any thread.
+//
+// Inputs       : channel - the channel's name
+//		  name - the event name, NULL or empty for a plain message
+//		  data - the event data, lines separated by \n
+//		  length - length of data
+// Outputs      : 0 if successful, -1 if failure
+int publishEvent ( const char *channel, const char *name, const char *data, int length ) {
+
+	SSE_EVENT *event;
+
+	if ( !validChannel ( channel, strlen(channel) ) || length < 0 || length > SSE_EVENT_MAX ||
+	     ( name != NULL && ( strlen(name) > SSE_EVENT_NAME_MAX || strpbrk ( name, "\r\n" ) != NULL ) ) ) {
+		logMessage ( LOG_ERROR_LEVEL, "_publishEvent:Can't publish that event to %s", channel );
+		return -1;
+	}
+	if ( !__atomic_load_n ( &eventsRunning, __ATOMIC_ACQUIRE ) || (event = formatEvent ( channel, name, data, length )) == NULL )
+		return -1;
+
+	pthread_mutex_lock ( &eventLock );
+	if ( !eventsRunning ) {
+		pthread_mutex_unlock ( &eventLock );
+		releaseEvent ( event );
+		return -1;
+	}
+	if ( publishTail != NULL )
+		publishTail->next = event;
+	else
+		publishHead = event;
+	publishTail = event;
+	pthread_mutex_unlock ( &eventLock );
+
+	wakeFanout ();
+	countStat ( STAT_EVENTS_PUBLISHED, 1 );
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : serveEvents
+// Description  : The handler for SSE_URI. A GET subscribes to the channel and
+//		  a POST from the loopback interface publishes its body to it.
+//
+// Inputs       : conn - the client connection
+//		  request - the parsed request
+//		  body - the request body
+// Outputs      : 0 if the request was answered, 1 if the connection should
+//		  be dropped, CONN_DETACHED once it is subscribed
+int serveEvents ( CLIENT_CONN *conn, HTTP_REQUEST *request, REQUEST_BODY *body ) {
+
+	char channel[SSE_CHANNEL_MAX + 1];
+
+	if ( channelFromUri ( request->uri, channel ) ) {
+		sendErrorResponse ( conn->fd, 404, "Not Found", NULL );
+		return 1;
+	}
+	if ( !strcasecmp ( request->method, "GET" ) )
+		return subscribeEvents ( conn, channel );
+	if ( !strcasecmp ( request->method, "POST" ) )
+		return postEvent ( conn, request, body, channel );
+
+	sendErrorResponse ( conn->fd, 405, "Method Not Allowed", "Allow: GET, POST\r\n" );
+	return 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : subscribeEvents
+// Description  : Start the event stream and hand the connection to the
+//		  fan-out thread
+//
+// Inputs       : conn - the client connection
+//		  channel - the channel it subscribes to
+// Outputs      : CONN_DETACHED if successful, 1 if the connection should be dropped
+int subscribeEvents ( CLIENT_CONN *conn, const char *channel ) {
+
+	SSE_SUBSCRIBER *sub;
+	char head[MAXLINE];
+
+	if ( !__atomic_load_n ( &eventsRunning, __ATOMIC_ACQUIRE ) ) {
+		sendErrorResponse ( conn->fd, 503, "Service Unavailable", NULL );
+		return 1;
+	}
+
+	//The stream has no length, it ends when the connection does
+	snprintf ( head, sizeof(head), "HTTP/1.0 200 OK\r\n"
+			"Server: " SERVER_NAME "\r\n"
+			"Content-type: text/event-stream\r\n"
+			"Cache-Control: no-store\r\n"
+			"X-Accel-Buffering: no\r\n\r\n"
+			"retry: %d\n\n", SSE_RETRY_MS );
+	if ( sendBytes ( conn->fd, strlen(head), head ) )
+		return 1;
+
+	if ( (sub = calloc ( 1, sizeof(SSE_SUBSCRIBER) )) == NULL ) {
+		logMessage ( LOG_ERROR_LEVEL, "_subscribeEvents:Can't allocate a subscriber for %s", channel );
+		return 1;
+	}
+	countStat ( STAT_CONNECTION_BYTES, sizeof(SSE_SUBSCRIBER) );
+	sub->conn = conn;
+	strcpy ( sub->channelName, channel );
+
+	//Its deadline belongs to request handling, the fan-out thread finds
+	//dead subscribers through epoll instead
+	clearDeadline ( conn );
+	fcntl ( conn->fd, F_SETFL, fcntl ( conn->fd, F_GETFL ) | O_NONBLOCK );
+
+	pthread_mutex_lock ( &eventLock );
+	if ( !eventsRunning ) {
+		pthread_mutex_unlock ( &eventLock );
+		countStat ( STAT_CONNECTION_BYTES, -(uint64_t)sizeof(SSE_SUBSCRIBER) );
+		free ( sub );
+		return 1;
+	}
+	sub->nextDirty = joiningSubscribers;
+	joiningSubscribers = sub;
+	pthread_mutex_unlock ( &eventLock );
+
+	wakeFanout ();
+	countStat ( STAT_EVENT_SUBSCRIBERS, 1 );
+	logMessage ( LOG_INFO_LEVEL, "Subscribed connection %d to channel %s", conn->fd, channel );
+	return CONN_DETACHED;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : postEvent
+// Description  : Publish a request body to a channel. The event name comes
+//		  from an event=<name> query parameter, if there is one.
+//
+// Inputs       : conn - the client connection
+//		  request - the parsed request
+//		  body - the request body, the event data
+//		  channel - the channel to publish to
+// Outputs      : 0 if the request was answered, 1 if the connection should be dropped
+int postEvent ( CLIENT_CONN *conn, HTTP_REQUEST *request, REQUEST_BODY *body, const char *channel ) {
+
+	char name[SSE_EVENT_NAME_MAX + 1], head[MAXLINE];
+	char *data, *query, *param, *save;
+	int length = 0, n = 0, status = 0;
+
+	if ( !isLoopback ( conn ) ) {
+		logMessage ( LOG_WARNING_LEVEL, "Event posted from outside the host. 403 error" );
+		sendErrorResponse ( conn->fd, 403, "Forbidden", NULL );
+		return 1;
+	}
+	if ( (data = malloc ( SSE_EVENT_MAX + 1 )) == NULL ) {
+		sendErrorResponse ( conn->fd, 500, "Internal Server Error", NULL );
+		return 1;
+	}
+
+	//Read one byte past the limit, to tell a full event from an oversized one
+	while ( length <= SSE_EVENT_MAX && (n = readRequestBody ( body, data + length, SSE_EVENT_MAX + 1 - length )) > 0 )
+		length += n;
+	if ( n == -1 )
+		status = 400;
+	else if ( n == -2 || length > SSE_EVENT_MAX )
+		status = 413;
+
+	name[0] = '\0';
+	if ( (query = strchr ( request->uri, '?' )) != NULL ) {
+		for ( param = strtok_r ( query + 1, "&", &save ); param != NULL; param = strtok_r ( NULL, "&", &save ) ) {
+			if ( !strncmp ( param, "event=", 6 ) && strlen(param + 6) <= SSE_EVENT_NAME_MAX )
+				strcpy ( name, param + 6 );
+		}
+	}
+	if ( !status && publishEvent ( channel, name, data, length ) )
+		status = 503;
+	free ( data );
+
+	if ( status ) {
+		sendErrorResponse ( conn->fd, status, errorReason ( status ), NULL );
+		return 1;
+	}
+	snprintf ( head, sizeof(head), "HTTP/1.0 204 No Content\r\nServer: " SERVER_NAME "\r\n\r\n" );
+	return sendBytes ( conn->fd, strlen(head), head ) ? 1 : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fanoutLoop
+// Description  : The fan-out thread. Takes in new subscribers and published
+//		  events, and writes to every subscriber that has events queued
+//		  and room in its socket.
+//
+// Inputs       : arg - unused
+// Outputs      : NULL
+void * fanoutLoop ( void *arg ) {
+
+	struct epoll_event events[MAX_EVENTS];
+	SSE_SUBSCRIBER *joining, *sub;
+	SSE_EVENT *published, *event;
+	uint64_t now, lastKeepalive = monotonicTime(), drained;
+	int n, wait;
+
+	while ( 1 ) {
+		now = monotonicTime();
+		wait = SSE_KEEPALIVE_MS - (int)( ( now - lastKeepalive ) / 1000000ULL );
+		n = epoll_wait ( fanoutEpoll, events, MAX_EVENTS, ( wait > 0 ) ? wait : 0 );
+		if ( n == -1 && errno != EINTR ) {
+			logMessage ( LOG_ERROR_LEVEL, "_fanoutLoop:Failed to wait for subscribers [%s]", strerror(errno) );
+			break;
+		}
+
+		for ( int i = 0; i < n; i++ ) {
+			if ( events[i].data.ptr == NULL ) {
+				while ( read ( fanoutWake, &drained, sizeof(drained) ) > 0 );
+				continue;
+			}
+			if ( events[i].data.ptr == &publishSocket ) {
+				receiveEvents ();
+				continue;
+			}
+
+			//Hang ups close the subscriber, and room in its socket
+			//lets it write again, both at the next flush
+			sub = events[i].data.ptr;
+			if ( events[i].events & ( EPOLLRDHUP | EPOLLHUP | EPOLLERR ) )
+				sub->closing = 1;
+			sub->blocked = 0;
+			if ( !sub->dirty ) {
+				sub->dirty = 1;
+				sub->nextDirty = dirtySubscribers;
+				dirtySubscribers = sub;
+			}
+		}
+
+		pthread_mutex_lock ( &eventLock );
+		if ( eventsStopping ) {
+			pthread_mutex_unlock ( &eventLock );
+			break;
+		}
+		joining = joiningSubscribers;
+		published = publishHead;
+		joiningSubscribers = NULL;
+		publishHead = publishTail = NULL;
+		pthread_mutex_unlock ( &eventLock );
+
+		while ( (sub = joining) != NULL ) {
+			joining = sub->nextDirty;
+			joinChannel ( sub );
+		}
+		while ( (event = published) != NULL ) {
+			published = event->next;
+			fanOut ( event );
+			releaseEvent ( event );
+		}
+		if ( (now = monotonicTime()) - lastKeepalive >= SSE_KEEPALIVE_MS * 1000000ULL ) {
+			sendKeepalives ( lastKeepalive );
+			lastKeepalive = now;
+		}
+
+		//Every subscriber with new events or new room gets one flush,
+		//however many events arrived for it
+		while ( (sub = dirtySubscribers) != NULL ) {
+			dirtySubscribers = sub->nextDirty;
+			sub->dirty = 0;
+			flushSubscriber ( sub );
+		}
+	}
+
+	return NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : openPublishSocket
+// Description  : Bind the Unix datagram socket events are published on. A
+//		  worker process binds <path>.<slot>, since each has its own
+//		  subscribers.
+//
+// Inputs       : path - the configured path
+// Outputs      : 0 if successful, -1 if failure
+int openPublishSocket ( const char *path ) {
+
+	struct sockaddr_un address;
+	struct epoll_event ev;
+	int len;
+
+	if ( isWorkerProcess () )
+		len = snprintf ( publishPath, sizeof(publishPath), "%s.%d", path, currentSharedSlot () );
+	else
+		len = snprintf ( publishPath, sizeof(publishPath), "%s", path );
+	if ( len >= (int)sizeof(publishPath) ) {
+		logMessage ( LOG_ERROR_LEVEL, "_openPublishSocket:The events-socket path %s is too long", path );
+		return -1;
+	}
+
+	//A socket left behind by an earlier run would make bind fail
+	unlink ( publishPath );
+	memset ( &address, 0, sizeof(address) );
+	address.sun_family = AF_UNIX;
+	strcpy ( address.sun_path, publishPath );
+	if ( (publishSocket = socket ( AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 )) == -1 ||
+	     bind ( publishSocket, (struct sockaddr *)&address, sizeof(address) ) == -1 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_openPublishSocket:Can't bind %s [%s]", publishPath, strerror(errno) );
+		return -1;
+	}
+
+	memset ( &ev, 0, sizeof(ev) );
+	ev.events = EPOLLIN;
+	ev.data.ptr = &publishSocket;
+	if ( epoll_ctl ( fanoutEpoll, EPOLL_CTL_ADD, publishSocket, &ev ) == -1 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_openPublishSocket:Can't watch %s [%s]", publishPath, strerror(errno) );
+		return -1;
+	}
+	logMessage ( LOG_INFO_LEVEL, "Taking events to publish on %s", publishPath );
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : receiveEvents
+// Description  : Publish every datagram waiting on the events-socket
+//
+// Inputs       : none
+// Outputs      : none
+void receiveEvents ( void ) {
+
+	static char buf[SSE_CHANNEL_MAX + SSE_EVENT_NAME_MAX + SSE_EVENT_MAX + 3];
+	char *line, *name, *data, *save;
+	ssize_t n;
+
+	while ( (n = recv ( publishSocket, buf, sizeof(buf) - 1, MSG_TRUNC )) >= 0 ) {
+		if ( n > (ssize_t)sizeof(buf) - 1 ) {
+			logMessage ( LOG_WARNING_LEVEL, "Dropping a %zd byte event datagram, it is too large", n );
+			continue;
+		}
+		buf[n] = '\0';
+
+		//<channel> [<event name>]\n<data>
+		if ( (data = memchr ( buf, '\n', n )) == NULL ) {
+			logMessage ( LOG_WARNING_LEVEL, "Dropping an event datagram without a channel line" );
+			continue;
+		}
+		*data++ = '\0';
+		line = strtok_r ( buf, " \r", &save );
+		name = strtok_r ( NULL, " \r", &save );
+		if ( line == NULL || publishEvent ( line, name, data, n - ( data - buf ) ) )
+			logMessage ( LOG_WARNING_LEVEL, "Dropping an event datagram for %s", ( line ) ? line : "no channel" );
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : wakeFanout
+// Description  : Ring the fan-out thread, so it takes what was queued for it
+//
+// Inputs       : none
+// Outputs      : none
+void wakeFanout ( void ) {
+
+	uint64_t one = 1;
+
+	if ( write ( fanoutWake, &one, sizeof(one) ) != sizeof(one) && errno != EAGAIN )
+		logMessage ( LOG_ERROR_LEVEL, "_wakeFanout:Can't wake the fan-out thread [%s]", strerror(errno) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : joinChannel
+// Description  : Add a new subscriber to its channel, creating the channel if
+//		  it is the first, and start watching its socket
+//
+// Inputs       : sub - the subscriber
+// Outputs      : none
+void joinChannel ( SSE_SUBSCRIBER *sub ) {
+
+	unsigned int bucket = hashChannel ( sub->channelName );
+	struct epoll_event ev;
+	SSE_CHANNEL *channel;
+
+	for ( channel = channelBuckets[bucket]; channel != NULL; channel = channel->next ) {
+		if ( !strcmp ( channel->name, sub->channelName ) )
+			break;
+	}
+	if ( channel == NULL ) {
+		if ( (channel = calloc ( 1, sizeof(SSE_CHANNEL) )) == NULL ) {
+			logMessage ( LOG_ERROR_LEVEL, "_joinChannel:Can't allocate channel %s", sub->channelName );
+			closeConnection ( sub->conn );
+			countStat ( STAT_CONNECTION_BYTES, -(uint64_t)sizeof(SSE_SUBSCRIBER) );
+			free ( sub );
+			return;
+		}
+		strcpy ( channel->name, sub->channelName );
+		channel->next = channelBuckets[bucket];
+		channelBuckets[bucket] = channel;
+	}
+	sub->channel = channel;
+	sub->next = channel->subscribers;
+	if ( channel->subscribers != NULL )
+		channel->subscribers->prev = sub;
+	channel->subscribers = sub;
+	channel->count++;
+	sub->lastWrite = monotonicTime();
+
+	//Edge triggered, so a subscriber with a full socket costs nothing until
+	//it drains
+	memset ( &ev, 0, sizeof(ev) );
+	ev.events = EPOLLOUT | EPOLLRDHUP | EPOLLET;
+	ev.data.ptr = sub;
+	if ( epoll_ctl ( fanoutEpoll, EPOLL_CTL_ADD, sub->conn->fd, &ev ) == -1 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_joinChannel:Can't watch subscriber %d [%s]", sub->conn->fd, strerror(errno) );
+		closeSubscriber ( sub );
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fanOut
+// Description  : Queue an event for every subscriber of its channel. An
+//		  event for a channel nobody is subscribed to goes nowhere.
+//
+// Inputs       : event - the event
+// Outputs      : none
+void fanOut ( SSE_EVENT *event ) {
+
+	SSE_CHANNEL *channel;
+
+	for ( channel = channelBuckets[hashChannel ( event->channel )]; channel != NULL; channel = channel->next ) {
+		if ( !strcmp ( channel->name, event->channel ) )
+			break;
+	}
+	if ( channel == NULL )
+		return;
+
+	for ( SSE_SUBSCRIBER *sub = channel->subscribers; sub != NULL; sub = sub->next )
+		queueEvent ( sub, event );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sendKeepalives
+// Description  : Send a comment line to every subscriber nothing was written
+//		  to lately, so proxies and clients keep the stream open
+//
+// Inputs       : quietSince - monotonic time, subscribers last written to
+//		  before it count as quiet
+// Outputs      : none
+void sendKeepalives ( uint64_t quietSince ) {
+
+	SSE_EVENT *keepalive;
+
+	if ( (keepalive = malloc ( sizeof(SSE_EVENT) + 3 )) == NULL )
+		return;
+	keepalive->refs = 1;
+	keepalive->length = 3;
+	memcpy ( keepalive->data, ":\n\n", 3 );
+
+	for ( int i = 0; i < SSE_CHANNEL_BUCKETS; i++ ) {
+		for ( SSE_CHANNEL *channel = channelBuckets[i]; channel != NULL; channel = channel->next ) {
+			for ( SSE_SUBSCRIBER *sub = channel->subscribers; sub != NULL; sub = sub->next ) {
+				if ( sub->count == 0 && sub->lastWrite < quietSince )
+					queueEvent ( sub, keepalive );
+			}
+		}
+	}
+	releaseEvent ( keepalive );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : queueEvent
+// Description  : Queue an event for a subscriber and mark it for the next
+//		  flush. A subscriber with a full queue misses the event, and is
+//		  closed once it has missed too many.
+//
+// Inputs       : sub - the subscriber
+//		  event - the event
+// Outputs      : none
+void queueEvent ( SSE_SUBSCRIBER *sub, SSE_EVENT *event ) {
+
+	if ( sub->closing )
+		return;
+
+	if ( sub->count == SSE_QUEUE_DEPTH ) {
+		countStat ( STAT_EVENTS_DROPPED, 1 );
+		if ( ++sub->missed >= SSE_MAX_MISSED ) {
+			logMessage ( LOG_WARNING_LEVEL, "Disconnecting subscriber %d on %s, it missed %d events",
+					sub->conn->fd, sub->channel->name, sub->missed );
+			sub->closing = 1;
+		}
+		else
+			return;
+	}
+	else {
+		sub->queue[( sub->head + sub->count ) % SSE_QUEUE_DEPTH] = event;
+		sub->count++;
+		event->refs++;
+	}
+
+	if ( !sub->dirty ) {
+		sub->dirty = 1;
+		sub->nextDirty = dirtySubscribers;
+		dirtySubscribers = sub;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : flushSubscriber
+// Description  : Write a subscriber's queued events until they are all sent
+//		  or its socket is full
+//
+// Inputs       : sub - the subscriber
+// Outputs      : none
+void flushSubscriber ( SSE_SUBSCRIBER *sub ) {
+
+	struct iovec iov[SSE_WRITE_BATCH];
+	SSE_EVENT *event;
+	int fd = sub->conn->fd, cnt, direct;
+	ssize_t n;
+
+	setCurrentConnection ( sub->conn );
+	direct = canSendDirect ( fd );
+
+	while ( !sub->closing && !sub->blocked && sub->count > 0 ) {
+
+		//The TLS layer takes one event at a time, and must be offered the
+		//same bytes again after a full socket
+		cnt = ( direct ) ? sub->count : 1;
+		if ( cnt > SSE_WRITE_BATCH )
+			cnt = SSE_WRITE_BATCH;
+		for ( int i = 0; i < cnt; i++ ) {
+			event = sub->queue[( sub->head + i ) % SSE_QUEUE_DEPTH];
+			iov[i].iov_base = event->data + ( ( i == 0 ) ? sub->offset : 0 );
+			iov[i].iov_len = event->length - ( ( i == 0 ) ? sub->offset : 0 );
+		}
+		n = ( direct ) ? writev ( fd, iov, cnt ) : connWrite ( fd, iov[0].iov_base, iov[0].iov_len );
+
+		if ( n < 0 ) {
+			if ( errno == EAGAIN || errno == EWOULDBLOCK )
+				sub->blocked = 1;
+			else if ( errno != EINTR )
+				sub->closing = 1;
+			continue;
+		}
+		countTransfer ( fd, 0, n );
+		sub->lastWrite = monotonicTime();
+
+		//Retire every event the write finished
+		while ( n > 0 ) {
+			event = sub->queue[sub->head];
+			if ( n < event->length - sub->offset ) {
+				sub->offset += n;
+				break;
+			}
+			n -= event->length - sub->offset;
+			sub->offset = 0;
+			sub->head = ( sub->head + 1 ) % SSE_QUEUE_DEPTH;
+			sub->count--;
+			releaseEvent ( event );
+		}
+	}
+
+	//A subscriber that caught up starts its allowance over
+	if ( sub->count == 0 )
+		sub->missed = 0;
+	setCurrentConnection ( NULL );
+	if ( sub->closing )
+		closeSubscriber ( sub );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : closeSubscriber
+// Description  : Take a subscriber off its channel, freeing the channel if it
+//		  was the last, and close its connection
+//
+// Inputs       : sub - the subscriber
+// Outputs      : none
+void closeSubscriber ( SSE_SUBSCRIBER *sub ) {
+
+	SSE_CHANNEL *channel = sub->channel, **link;
+
+	if ( sub->prev != NULL )
+		sub->prev->next = sub->next;
+	else
+		channel->subscribers = sub->next;
+	if ( sub->next != NULL )
+		sub->next->prev = sub->prev;
+
+	if ( --channel->count == 0 ) {
+		for ( link = &channelBuckets[hashChannel ( channel->name )]; *link != channel; link = &(*link)->next );
+		*link = channel->next;
+		free ( channel );
+	}
+
+	while ( sub->count > 0 ) {
+		releaseEvent ( sub->queue[sub->head] );
+		sub->head = ( sub->head + 1 ) % SSE_QUEUE_DEPTH;
+		sub->count--;
+	}
+	epoll_ctl ( fanoutEpoll, EPOLL_CTL_DEL, sub->conn->fd, NULL );
+	closeConnection ( sub->conn );
+	countStat ( STAT_CONNECTION_BYTES, -(uint64_t)sizeof(SSE_SUBSCRIBER) );
+	free ( sub );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : formatEvent
+// Description  : Build an event as it goes on the wire. Every line of data
+//		  becomes a data field, and a final newline is dropped.
+//
+// Inputs       : channel - the channel it goes to
+//		  name - the event name, NULL or empty for none
+//		  data - the event data
+//		  length - length of data
+// Outputs      : the event, holding one reference, or NULL if failure
+SSE_EVENT * formatEvent ( const char *channel, const char *name, const char *data, int length ) {
+
+	SSE_EVENT *event;
+	const char *line, *end;
+	int lines = 1, size, len;
+
+	if ( length > 0 && data[length-1] == '\n' )
+		length--;
+	if ( length > 0 && data[length-1] == '\r' )
+		length--;
+	for ( int i = 0; i < length; i++ )
+		lines += ( data[i] == '\n' );
+
+	size = 32 + ( ( name != NULL ) ? strlen(name) + 8 : 0 ) + lines * 7 + length + 1;
+	if ( (event = malloc ( sizeof(SSE_EVENT) + size )) == NULL ) {
+		logMessage ( LOG_ERROR_LEVEL, "_formatEvent:Can't allocate a %d byte event", size );
+		return NULL;
+	}
+	event->refs = 1;
+	event->next = NULL;
+	strcpy ( event->channel, channel );
+
+	len = snprintf ( event->data, size, "id: %llu\n",
+			(unsigned long long)__atomic_add_fetch ( &eventSequence, 1, __ATOMIC_RELAXED ) );
+	if ( name != NULL && name[0] != '\0' )
+		len += snprintf ( event->data + len, size - len, "event: %s\n", name );
+	for ( line = data; line <= data + length; line = end + 1 ) {
+		if ( (end = memchr ( line, '\n', data + length - line )) == NULL )
+			end = data + length;
+		memcpy ( event->data + len, "data: ", 6 );
+		len += 6;
+		memcpy ( event->data + len, line, end - line - ( end > line && end[-1] == '\r' ) );
+		len += end - line - ( end > line && end[-1] == '\r' );
+		event->data[len++] = '\n';
+	}
+	event->data[len++] = '\n';
+	event->length = len;
+	return event;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : releaseEvent
+// Description  : Drop a reference to an event, freeing it with the last one.
+//		  Only the fan-out thread shares events, so no atomics.
+//
+// Inputs       : event - the event
+// Outputs      : none
+void releaseEvent ( SSE_EVENT *event ) {
+
+	if ( --event->refs == 0 )
+		free ( event );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : channelFromUri
+// Description  : Take the channel name out of a uri under SSE_URI
+//
+// Inputs       : uri - the request uri
+//		  channel - place for the name, SSE_CHANNEL_MAX + 1 bytes
+// Outputs      : 0 if successful, -1 if the uri names no valid channel
+int channelFromUri ( const char *uri, char *channel ) {
+
+	const char *name = uri + strlen(SSE_URI);
+	int length = strcspn ( name, "?" );
+
+	if ( !validChannel ( name, length ) )
+		return -1;
+	memcpy ( channel, name, length );
+	channel[length] = '\0';
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : validChannel
+// Description  : Check a channel name, which is letters, digits, '-', '_'
+//		  and '.'
+//
+// Inputs       : channel - the name
+//		  length - its length
+// Outputs      : 1 if it is valid, 0 if not
+int validChannel ( const char *channel, int length ) {
+
+	if ( length < 1 || length > SSE_CHANNEL_MAX )
+		return 0;
+	for ( int i = 0; i < length; i++ ) {
+		if ( !isalnum ( (unsigned char)channel[i] ) && channel[i] != '-' && channel[i] != '_' && channel[i] != '.' )
+			return 0;
+	}
+	return 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hashChannel
+// Description  : FNV-1a hash of a channel name, which picks its bucket
+//
+// Inputs       : name - the name
+// Outputs      : the bucket
+unsigned int hashChannel ( const char *name ) {
+
+	uint32_t hash = 2166136261u;
+
+	while ( *name ) {
+		hash ^= (unsigned char)*name++;
+		hash *= 16777619u;
+	}
+	return hash % SSE_CHANNEL_BUCKETS;
+}
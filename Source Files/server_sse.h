@@ -0,0 +1,61 @@
+#ifndef SERVER_SSE_INCLUDED
+#define SERVER_SSE_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_sse.h
+//  Description   : Server-Sent Events channels. A GET on SSE_URI<channel>
+//                  subscribes the connection to the channel, and it stays
+//                  open as a text/event-stream from then on. Events are
+//                  published with publishEvent from inside the server, by a
+//                  POST of the data to the same uri from the loopback
+//                  interface, or by a datagram on the events-socket, which
+//                  looks like
+//
+//                      <channel> [<event name>]\n<data>
+//
+//                  Each process has its own subscribers, so in multi-process
+//                  mode worker N binds <path>.N and a publisher sends to
+//                  every one of them.
+//
+//                  Subscribers are written by one fan-out thread, never by
+//                  the workers. Every event is formatted once and shared by
+//                  all of its subscribers, each of which queues at most
+//                  SSE_QUEUE_DEPTH of them. A subscriber whose queue is full
+//                  misses events, and is disconnected once it has missed
+//                  SSE_MAX_MISSED, so it can reconnect and catch up. Every
+//                  subscriber counts as an open connection, so the
+//                  connections setting and the descriptor limit must allow
+//                  for them.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#include <server.h>
+#include <server_body.h>
+
+//
+// Constants
+
+#define SSE_URI "/events/"		//prefix of the channel uris
+#define SSE_CHANNEL_MAX 64		//longest channel name
+#define SSE_EVENT_NAME_MAX 64		//longest event name
+#define SSE_EVENT_MAX 65536		//most data bytes in an event
+#define SSE_CHANNEL_BUCKETS 1024	//hash chains in the channel table
+#define SSE_QUEUE_DEPTH 32		//events waiting for each subscriber
+#define SSE_MAX_MISSED 64		//events a subscriber may miss before it is disconnected
+#define SSE_KEEPALIVE_MS 15000		//quiet time before subscribers get a comment line
+#define SSE_RETRY_MS 3000		//how long clients wait before reconnecting
+#define SSE_WRITE_BATCH 16		//events handed to one writev
+
+//
+// Functional Prototypes
+
+int setupEvents ( void );
+int startEvents ( void );
+void stopEvents ( void );
+int publishEvent ( const char *channel, const char *name, const char *data, int length );
+int serveEvents ( CLIENT_CONN *conn, HTTP_REQUEST *request, REQUEST_BODY *body );
+
+#endif
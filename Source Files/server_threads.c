@@ -2,9 +2,28 @@
 //
 //  File          : server_threads.c
 //  Description   : The methods here handle all of the thread management and manipulation.
+//		    A fixed pool of worker threads serves the connections the event
+//		    loop finds ready. Each worker has a ring the event loop pushes
+//		    its connections onto, preferring a worker that is idle and
+//		    otherwise the one with the least waiting. A worker takes from its
+//		    own ring first and from everyone else's when that runs dry, so a
+//		    worker stuck on a slow request doesn't hold up the ones behind
+//		    it. Other threads that hand connections to the workers, like the
+//		    I/O pool, register rings of their own.
+//
+//		    The rings are first in, first out. Only the thread that
+//		    registered a ring pushes onto it, and any worker, its own
+//		    included, may take from it. There is no owner end that takes
+//		    the newest connection, since the thread that pushes a
+//		    connection is never the one that serves it.
+//
+//		    Idle workers sleep on a semaphore and set their bit in the idle
+//		    mask. A push wakes one of them, the ring's worker if it is
+//		    asleep. When busy polling, a worker spins before it sleeps, and
+//		    pushes go to spinning workers first, which need no waking.
 //
 //   Author        : Gabe Harms
-//   Last Modified : Mon Oct 28 06:58:31 EDT 2013
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
 //
 
 #include <signal.h>
@@ -22,62 +41,452 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <pthread.h>
+#include <semaphore.h>
+#include <time.h>
 
 // Project Include Files
 #include <smsa.h>
 #include <smsa_network.h>
 #include <cmpsc311_log.h>
+#include <server_threads.h>
+#include <server_admission.h>
+#include <server_event.h>
+#include <server_affinity.h>
+#include <server_busypoll.h>
 
 // Global Variables
 char *colors[] = { RED, PURPLE, ORANGE, GREEN };
-int threadCount = 0;
 
+WORK_RING workerRings[MAX_SCHEDULED_WORKERS];	//filled by the event loop, one per worker
+WORK_RING *rings[MAX_WORK_RINGS];		//every ring workers take from
+int ringCount = 0;
+int workerCount = 0;
+int nextWorker = 0;				//where the event loop starts looking for the shortest ring
+uint64_t idleWorkers = 0;			//a bit for every worker asleep
+uint64_t spinningWorkers = 0;			//a bit for every worker busy polling for work
+sem_t workerWake[MAX_SCHEDULED_WORKERS];
+int workersStopping = 0;
+CONN_HANDLER connectionHandler = NULL;
+MY_THREAD *workerTable = NULL;
+
+//Functional Prototypes
+void * workerLoop ( void * arg );
+int pushTask ( WORK_RING *ring, CLIENT_CONN *conn, int preferred );
+CLIENT_CONN * takeConnection ( WORK_RING *ring );
+CLIENT_CONN * findWork ( int self );
+CLIENT_CONN * waitForWork ( int self );
+void wakeWorker ( int preferred );
+int ringDepth ( WORK_RING *ring );
 
 
 int setupThreads ( MY_THREAD * backlog, int max ) {
-	
+
 	for (int i =0; i < max; i++) {
                 backlog[i].available = 1;
-                backlog[i].color = colors[i];
+                backlog[i].color = colors[i % (sizeof(colors) / sizeof(colors[0]))];
         }
-	
-	return 0;	
+
+	return 0;
 }
 
-int findFreeThread ( MY_THREAD * backlog, int max ) {
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : startWorkers
+// Description  : Start the worker threads that serve queued connections
+//
+// Inputs       : backlog - the thread table
+//		  max - number of workers to start
+//		  handler - function run for every connection served
+// Outputs      : 0 if successful, -1 if failure
+int startWorkers ( MY_THREAD * backlog, int max, CONN_HANDLER handler ) {
+
+	sigset_t blocked, previous;
+	pthread_attr_t attr;
+
+	if ( max > MAX_SCHEDULED_WORKERS ) {
+		logMessage ( LOG_ERROR_LEVEL, "_startWorkers:Can't schedule %d workers, the most is %d", max, MAX_SCHEDULED_WORKERS );
+		return -1;
+	}
+
+	connectionHandler = handler;
+	workerTable = backlog;
+	workersStopping = 0;
+	workerCount = max;
+	for ( int i = 0; i < max; i++ ) {
+		memset ( &workerRings[i], 0, sizeof(WORK_RING) );
+		sem_init ( &workerWake[i], 0, 0 );
+		if ( registerRing ( &workerRings[i] ) )
+			return -1;
+	}
+
+	//Workers inherit a mask with SIGINT and SIGHUP blocked, so signals are
+	//always delivered to the event loop's thread and interrupt its epoll_wait
+	sigemptyset ( &blocked );
+	sigaddset ( &blocked, SIGINT );
+	sigaddset ( &blocked, SIGHUP );
+	pthread_sigmask ( SIG_BLOCK, &blocked, &previous );
 
-	int usable_index = 0;
+	//Workers start on the CPUs they are placed on, so their stacks are
+	//allocated on that node
+	pthread_attr_init ( &attr );
+	for ( int i = 0; i < max; i++ ) {
+		if ( workerThreadAffinity ( &attr, i ) ) {
+			pthread_attr_destroy ( &attr );
+			pthread_sigmask ( SIG_SETMASK, &previous, NULL );
+			return -1;
+		}
+		if ( pthread_create ( &backlog[i].thread, &attr, workerLoop, &backlog[i] ) ) {
+			logMessage ( LOG_ERROR_LEVEL, "_startWorkers:Failed to create worker %d [%s]", i+1, strerror(errno) );
+			pthread_attr_destroy ( &attr );
+			pthread_sigmask ( SIG_SETMASK, &previous, NULL );
+			return -1;
+		}
+		backlog[i].available = 0;
+	}
 
-	while ( !backlog[usable_index].available ) { usable_index++; }
+	pthread_attr_destroy ( &attr );
+	pthread_sigmask ( SIG_SETMASK, &previous, NULL );
 
-        backlog[usable_index].available = 0;
+	logMessage ( LOG_INFO_LEVEL, "Started %d worker threads", max );
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : stopWorkers
+// Description  : Wake every worker, wait for them to finish their current
+//		  connection, and close anything still left in the rings
+//
+// Inputs       : backlog - the thread table
+//		  max - number of workers
+// Outputs      : 0 if successful, -1 if failure
+int stopWorkers ( MY_THREAD * backlog, int max ) {
+
+	CLIENT_CONN *conn;
 
-        logMessage ( LOG_INFO_LEVEL, "Request will be handled by the number %d thread", usable_index+1 );
+	__atomic_store_n ( &workersStopping, 1, __ATOMIC_SEQ_CST );
+	for ( int i = 0; i < max; i++ )
+		sem_post ( &workerWake[i] );
 
-        threadCount++;
+	for ( int i = 0; i < max; i++ ) {
+		if ( !backlog[i].available ) {
+			pthread_join ( backlog[i].thread, NULL );
+			backlog[i].available = 1;
+		}
+	}
 
-	return usable_index;
+	for ( int i = 0; i < ringCount; i++ ) {
+		while ( (conn = takeConnection ( rings[i] )) != NULL )
+			closeConnection ( conn );
+	}
+	for ( int i = 0; i < max; i++ )
+		sem_destroy ( &workerWake[i] );
+	ringCount = 0;
 
+	return 0;
 }
 
-int waitForThreads ( MY_THREAD *backlog, int max ) {
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : enqueueConnection
+// Description  : Hand a ready connection to the worker pool. Only the event
+//		  loop calls this, it pushes onto the workers' rings.
+//
+// Inputs       : conn - the connection to queue
+// Outputs      : 0 if successful, 1 if the ring is full
+int enqueueConnection ( CLIENT_CONN *conn ) {
+
+	uint64_t idle = __atomic_load_n ( &idleWorkers, __ATOMIC_RELAXED );
+	uint64_t spinning = __atomic_load_n ( &spinningWorkers, __ATOMIC_RELAXED );
+	int target, depth, best;
 
-	
-	logMessage ( LOG_INFO_LEVEL, "Thread Backlog full. Releasing all threads now" );
-        for ( int i =0; i < max; i++ ) {
-        	if ( !backlog[i].available ) {
-                	pthread_join ( backlog[i].thread, NULL );
-                        backlog[i].available = 1;
-                }
-        }
-        threadCount = 0;
+	//A spinning or idle worker takes it right away. Otherwise the shortest
+	//ring, and a worker that frees up first will take it anyway
+	if ( spinning )
+		target = __builtin_ctzll ( spinning );
+	else if ( idle )
+		target = __builtin_ctzll ( idle );
+	else {
+		target = nextWorker;
+		best = ringDepth ( &workerRings[target] );
+		for ( int i = 1; i < workerCount && best > 0; i++ ) {
+			if ( (depth = ringDepth ( &workerRings[(nextWorker + i) % workerCount] )) < best ) {
+				best = depth;
+				target = ( nextWorker + i ) % workerCount;
+			}
+		}
+		nextWorker = ( target + 1 ) % workerCount;
+	}
 
+	return pushTask ( &workerRings[target], conn, target );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : registerRing
+// Description  : Add a ring for the workers to take from. The calling
+//		  thread, or one it starts, is the only one that pushes onto it.
+//
+// Inputs       : ring - the ring, zeroed
+// Outputs      : 0 if successful, -1 if failure
+int registerRing ( WORK_RING *ring ) {
+
+	if ( ringCount >= MAX_WORK_RINGS ) {
+		logMessage ( LOG_ERROR_LEVEL, "_registerRing:No room for more than %d rings", MAX_WORK_RINGS );
+		return -1;
+	}
+
+	rings[ringCount] = ring;
+	__atomic_store_n ( &ringCount, ringCount + 1, __ATOMIC_RELEASE );
 	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : pushConnection
+// Description  : Hand a connection to the workers from a registered ring.
+//		  Only the thread that registered it may call this.
+//
+// Inputs       : ring - the caller's ring
+//		  conn - the connection
+// Outputs      : 0 if successful, 1 if the ring is full
+int pushConnection ( WORK_RING *ring, CLIENT_CONN *conn ) {
+
+	return pushTask ( ring, conn, -1 );
+}
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : queueDepth
+// Description  : Number of connections waiting for a worker
+//
+// Inputs       : none
+// Outputs      : the connections in every ring
+int queueDepth ( void ) {
+
+	int depth = 0, count = __atomic_load_n ( &ringCount, __ATOMIC_ACQUIRE );
+
+	for ( int i = 0; i < count; i++ )
+		depth += ringDepth ( rings[i] );
+	return depth;
 }
 
-int areThreadsMaxedOut ( int max ) {
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : pushTask
+// Description  : Push a connection at the tail of a ring and wake a worker
+//		  for it
+//
+// Inputs       : ring - the ring, registered by the caller
+//		  conn - the connection
+//		  preferred - worker to wake if it is idle, -1 for any
+// Outputs      : 0 if successful, 1 if the ring is full
+int pushTask ( WORK_RING *ring, CLIENT_CONN *conn, int preferred ) {
+
+	int64_t tail = __atomic_load_n ( &ring->tail, __ATOMIC_RELAXED );
+	int64_t head = __atomic_load_n ( &ring->head, __ATOMIC_ACQUIRE );
+
+	if ( tail - head >= WORK_RING_SIZE )
+		return 1;
+
+	conn->enqueueTime = monotonicTime();
+	__atomic_store_n ( &ring->tasks[tail & ( WORK_RING_SIZE - 1 )], conn, __ATOMIC_RELAXED );
+	__atomic_store_n ( &ring->tail, tail + 1, __ATOMIC_RELEASE );
+
+	wakeWorker ( preferred );
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : takeConnection
+// Description  : Take the connection at the head of a ring, the one that has
+//		  waited longest. Workers race each other for it with a compare
+//		  and swap on head.
+//
+// Inputs       : ring - the ring
+// Outputs      : the connection, or NULL if the ring is empty
+CLIENT_CONN * takeConnection ( WORK_RING *ring ) {
+
+	CLIENT_CONN *conn;
+	int64_t head, tail;
+
+	for ( ;; ) {
+		head = __atomic_load_n ( &ring->head, __ATOMIC_ACQUIRE );
+		__atomic_thread_fence ( __ATOMIC_SEQ_CST );
+		tail = __atomic_load_n ( &ring->tail, __ATOMIC_ACQUIRE );
+		if ( head >= tail )
+			return NULL;
+
+		//The pusher can't reuse this slot until head has moved past it, and
+		//then the compare and swap fails
+		conn = __atomic_load_n ( &ring->tasks[head & ( WORK_RING_SIZE - 1 )], __ATOMIC_RELAXED );
+		if ( __atomic_compare_exchange_n ( &ring->head, &head, head + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED ) )
+			return conn;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : findWork
+// Description  : Find a connection for a worker, from its own ring first and
+//		  then from every other ring in turn
+//
+// Inputs       : self - the worker's number
+// Outputs      : the connection, or NULL if every ring is empty
+CLIENT_CONN * findWork ( int self ) {
+
+	int count = __atomic_load_n ( &ringCount, __ATOMIC_ACQUIRE );
+	CLIENT_CONN *conn;
+	WORK_RING *ring;
+
+	if ( (conn = takeConnection ( &workerRings[self] )) != NULL )
+		return conn;
+	for ( int i = 1; i <= count; i++ ) {
+		ring = rings[(self + i) % count];
+		if ( ring != &workerRings[self] && (conn = takeConnection ( ring )) != NULL )
+			return conn;
+	}
+	return NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : waitForWork
+// Description  : Find a connection for a worker, sleeping until one is pushed
+//		  if there is none. When busy polling, a worker that just
+//		  finished a connection keeps looking for the budget first,
+//		  and isn't counted idle while it does, so pushes don't wake it.
+//
+// Inputs       : self - the worker's number
+// Outputs      : the connection, or NULL when the workers are stopping
+CLIENT_CONN * waitForWork ( int self ) {
+
+	uint64_t bit = 1ULL << self, spinUntil = busyPollTime ();
+	struct timespec until;
+	CLIENT_CONN *conn;
+
+	if ( spinUntil ) {
+		spinUntil += monotonicTime ();
+		__atomic_fetch_or ( &spinningWorkers, bit, __ATOMIC_SEQ_CST );
+		while ( !__atomic_load_n ( &workersStopping, __ATOMIC_ACQUIRE ) && monotonicTime () < spinUntil ) {
+			if ( (conn = findWork ( self )) != NULL ) {
+				__atomic_fetch_and ( &spinningWorkers, ~bit, __ATOMIC_SEQ_CST );
+				return conn;
+			}
+			spinPause ();
+		}
+		//A push that saw us spinning didn't wake anyone, the look after
+		//the idle bit is set below finds it
+		__atomic_fetch_and ( &spinningWorkers, ~bit, __ATOMIC_SEQ_CST );
+	}
+
+	while ( !__atomic_load_n ( &workersStopping, __ATOMIC_ACQUIRE ) ) {
+		if ( (conn = findWork ( self )) != NULL )
+			return conn;
+
+		//Say we're idle before the last look, so a push that lands after
+		//it sees the bit and wakes us
+		__atomic_fetch_or ( &idleWorkers, bit, __ATOMIC_SEQ_CST );
+		if ( (conn = findWork ( self )) != NULL ) {
+			__atomic_fetch_and ( &idleWorkers, ~bit, __ATOMIC_SEQ_CST );
+			return conn;
+		}
+
+		clock_gettime ( CLOCK_REALTIME, &until );
+		until.tv_nsec += WORKER_IDLE_WAIT_MS * 1000000L;
+		if ( until.tv_nsec >= 1000000000L ) {
+			until.tv_sec++;
+			until.tv_nsec -= 1000000000L;
+		}
+		sem_timedwait ( &workerWake[self], &until );
+		__atomic_fetch_and ( &idleWorkers, ~bit, __ATOMIC_SEQ_CST );
+	}
+
+	return NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : wakeWorker
+// Description  : Wake an idle worker after a push, if there is one
+//
+// Inputs       : preferred - worker to wake if it is idle, -1 for any
+// Outputs      : none
+void wakeWorker ( int preferred ) {
+
+	uint64_t idle, bit;
+	int target;
+
+	//Pairs with the fence in waitForWork, either we see the worker's bit
+	//or it sees our push. A spinning worker finds the push itself
+	__atomic_thread_fence ( __ATOMIC_SEQ_CST );
+	if ( preferred >= 0 && ( __atomic_load_n ( &spinningWorkers, __ATOMIC_RELAXED ) & ( 1ULL << preferred ) ) )
+		return;
+	if ( (idle = __atomic_load_n ( &idleWorkers, __ATOMIC_RELAXED )) == 0 )
+		return;
+
+	target = ( preferred >= 0 && ( idle & ( 1ULL << preferred ) ) ) ? preferred : __builtin_ctzll ( idle );
+	bit = 1ULL << target;
+	if ( __atomic_fetch_and ( &idleWorkers, ~bit, __ATOMIC_SEQ_CST ) & bit )
+		sem_post ( &workerWake[target] );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ringDepth
+// Description  : Number of connections in a ring, as of a moment ago
+//
+// Inputs       : ring - the ring
+// Outputs      : the depth
+int ringDepth ( WORK_RING *ring ) {
+
+	int64_t depth = __atomic_load_n ( &ring->tail, __ATOMIC_ACQUIRE ) -
+			__atomic_load_n ( &ring->head, __ATOMIC_ACQUIRE );
+
+	return ( depth > 0 ) ? depth : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : workerLoop
+// Description  : Body of each worker thread. Waits for a connection, sheds it
+//		  if it went stale in the queue, and otherwise serves it.
+//
+// Inputs       : arg - this worker's MY_THREAD entry
+// Outputs      : NULL
+void * workerLoop ( void * arg ) {
+
+	MY_THREAD *self = (MY_THREAD *)arg;
+	int index = (int)(self - workerTable);
+	CLIENT_CONN *conn;
+	int ret;
+
+	while ( (conn = waitForWork ( index )) != NULL ) {
+
+		if ( shouldDropQueued ( conn, monotonicTime(), queueDepth() ) ) {
+			logMessage ( LOG_WARNING_LEVEL, "Shedding connection that waited %llu ms in the queue",
+					(unsigned long long)((monotonicTime() - conn->enqueueTime) / 1000000ULL) );
+			setCurrentConnection ( conn );
+			rejectConnection ( conn, 503, RETRY_AFTER_SECONDS );
+			setCurrentConnection ( NULL );
+			closeConnection ( conn );
+			continue;
+		}
+
+		logMessage ( LOG_INFO_LEVEL, "Request will be handled by the number %d thread", index + 1 );
+		setCurrentConnection ( conn );
+		ret = connectionHandler ( conn );
+		setCurrentConnection ( NULL );
 
-	return (threadCount < max );
+		//The I/O pool owns a suspended connection, the event loop a kept
+		//one, and whoever took it a detached one, from here on
+		if ( ret == CONN_SUSPENDED || ret == CONN_DETACHED )
+			continue;
+		if ( ret == CONN_KEEP_OPEN && keepConnection ( conn ) == 0 )
+			continue;
+		closeConnection ( conn );
+	}
 
+	return NULL;
 }
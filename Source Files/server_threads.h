@@ -1,17 +1,42 @@
+#ifndef SERVER_THREADS_INCLUDED
+#define SERVER_THREADS_INCLUDED
 
+#include <stdint.h>
+#include <smsa_threads.h>
+#include <server_conn.h>
 
-#include <smsa_threads.c>
+//
+// Constants
+
+#define WORK_RING_SIZE 256		//connections one ring holds, a power of two
+#define MAX_WORK_RINGS 80		//rings the workers take from, their own included
+#define MAX_SCHEDULED_WORKERS 64	//workers the idle mask has a bit for
+#define WORKER_IDLE_WAIT_MS 100		//longest an idle worker sleeps before looking again
 
 //
 // Type Definitions
 
+typedef int (*CONN_HANDLER) ( CLIENT_CONN *conn );
+
+// A ring of ready connections, with one producer and many consumers. Only
+// the thread that registered it pushes, at the tail, and every worker takes
+// from the head, racing the others with a compare and swap. The oldest
+// connection goes first and nobody takes a lock.
+typedef struct work_ring {
+	int64_t head __attribute__ ((aligned ( 64 )));		//next connection a worker takes
+	int64_t tail __attribute__ ((aligned ( 64 )));		//next free slot, only the producer moves it
+	CLIENT_CONN *tasks[WORK_RING_SIZE];
+} WORK_RING;
 
 //
 // Funtional Prototypes
 
 int setupThreads ( MY_THREAD * backlog, int max );
-int findFreeThread ( MY_THREAD * backlog, int max );
-int waitForThreads ( MY_THREAD *backlog, int max );
-int areThreadsMaxedOut ( int max );
-
-
+int startWorkers ( MY_THREAD * backlog, int max, CONN_HANDLER handler );
+int stopWorkers ( MY_THREAD * backlog, int max );
+int enqueueConnection ( CLIENT_CONN *conn );
+int registerRing ( WORK_RING *ring );
+int pushConnection ( WORK_RING *ring, CLIENT_CONN *conn );
+int queueDepth ( void );
+
+#endif
@@ -0,0 +1,206 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_timer.c
+//  Description   : Hierarchical timing wheel used for every connection deadline.
+//                  Level 0 holds timers due in the next 64 ticks, one slot per
+//                  tick. Each higher level covers 64 times the range of the one
+//                  below it, and its slots are cascaded down a level whenever
+//                  the level below wraps around.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+// Project Include Files
+#include <cmpsc311_log.h>
+#include <server_timer.h>
+
+//Functional Prototypes
+void linkTimer ( TIMER_WHEEL *wheel, TIMER_NODE *node );
+void unlinkTimer ( TIMER_NODE *node );
+void cascadeTimers ( TIMER_WHEEL *wheel, int level );
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : setupTimerWheel
+// Description  : Initialize an empty wheel starting at the current time
+//
+// Inputs       : wheel - the wheel to initialize
+//		  now - current monotonic time (ns)
+// Outputs      : 0 if successful, -1 if failure
+int setupTimerWheel ( TIMER_WHEEL *wheel, uint64_t now ) {
+
+	if ( pthread_mutex_init ( &wheel->lock, NULL ) ) {
+		logMessage ( LOG_ERROR_LEVEL, "_setupTimerWheel:Failed to initialize the wheel lock" );
+		return -1;
+	}
+
+	wheel->current = 0;
+	wheel->startTime = now;
+	for ( int l = 0; l < TIMER_LEVELS; l++ ) {
+		for ( int s = 0; s < TIMER_SLOTS; s++ ) {
+			wheel->slots[l][s].prev = &wheel->slots[l][s];
+			wheel->slots[l][s].next = &wheel->slots[l][s];
+		}
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : addTimer
+// Description  : Arm a timer, re-arming it if it is already pending
+//
+// Inputs       : wheel - the wheel
+//		  node - the timer
+//		  ms - milliseconds until it fires
+//		  callback - function to run when it fires
+//		  arg - argument for the callback
+// Outputs      : none
+void addTimer ( TIMER_WHEEL *wheel, TIMER_NODE *node, int ms, TIMER_CALLBACK callback, void *arg ) {
+
+	pthread_mutex_lock ( &wheel->lock );
+	if ( node->pending )
+		unlinkTimer ( node );
+	node->callback = callback;
+	node->arg = arg;
+	node->expires = wheel->current + 1 + ( ms + TIMER_TICK_MS - 1 ) / TIMER_TICK_MS;
+	linkTimer ( wheel, node );
+	pthread_mutex_unlock ( &wheel->lock );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cancelTimer
+// Description  : Disarm a timer. Once this returns the callback is not running
+//		  and will not run, so the memory holding the node may be freed.
+//
+// Inputs       : wheel - the wheel
+//		  node - the timer
+// Outputs      : none
+void cancelTimer ( TIMER_WHEEL *wheel, TIMER_NODE *node ) {
+
+	pthread_mutex_lock ( &wheel->lock );
+	if ( node->pending )
+		unlinkTimer ( node );
+	pthread_mutex_unlock ( &wheel->lock );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : advanceTimers
+// Description  : Move the wheel forward to the current time, running every
+//		  timer that comes due on the way
+//
+// Inputs       : wheel - the wheel
+//		  now - current monotonic time (ns)
+// Outputs      : number of timers that fired
+int advanceTimers ( TIMER_WHEEL *wheel, uint64_t now ) {
+
+	uint64_t target = ( now - wheel->startTime ) / ( (uint64_t)TIMER_TICK_MS * 1000000ULL );
+	TIMER_NODE *head, *node;
+	int fired = 0, rearm;
+
+	pthread_mutex_lock ( &wheel->lock );
+	while ( wheel->current < target ) {
+
+		wheel->current++;
+
+		//Pull the next range of timers down whenever level 0 wraps
+		if ( ( wheel->current & (TIMER_SLOTS - 1) ) == 0 )
+			cascadeTimers ( wheel, 1 );
+
+		head = &wheel->slots[0][wheel->current & (TIMER_SLOTS - 1)];
+		while ( (node = head->next) != head ) {
+			unlinkTimer ( node );
+			fired++;
+			if ( (rearm = node->callback ( node->arg )) > 0 ) {
+				node->expires = wheel->current + 1 + ( rearm + TIMER_TICK_MS - 1 ) / TIMER_TICK_MS;
+				linkTimer ( wheel, node );
+			}
+		}
+	}
+	pthread_mutex_unlock ( &wheel->lock );
+
+	return fired;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : linkTimer
+// Description  : Put a timer in the slot matching how far away it is. The
+//		  wheel lock must be held.
+//
+// Inputs       : wheel - the wheel
+//		  node - the timer, with expires set
+// Outputs      : none
+void linkTimer ( TIMER_WHEEL *wheel, TIMER_NODE *node ) {
+
+	uint64_t delta, maxDelta = ( 1ULL << (TIMER_SLOT_BITS * TIMER_LEVELS) ) - 1;
+	TIMER_NODE *head;
+	int level = 0;
+
+	//Only a cascade can link a timer due on the current tick, and that
+	//tick's level 0 slot is processed right after the cascade
+	if ( node->expires < wheel->current )
+		node->expires = wheel->current;
+	delta = node->expires - wheel->current;
+	if ( delta > maxDelta ) {
+		node->expires = wheel->current + maxDelta;
+		delta = maxDelta;
+	}
+
+	while ( level < TIMER_LEVELS - 1 && delta >= ( 1ULL << (TIMER_SLOT_BITS * (level + 1)) ) )
+		level++;
+
+	head = &wheel->slots[level][( node->expires >> (TIMER_SLOT_BITS * level) ) & (TIMER_SLOTS - 1)];
+	node->next = head;
+	node->prev = head->prev;
+	head->prev->next = node;
+	head->prev = node;
+	node->pending = 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : unlinkTimer
+// Description  : Take a timer out of its slot
+//
+// Inputs       : node - the timer
+// Outputs      : none
+void unlinkTimer ( TIMER_NODE *node ) {
+
+	node->prev->next = node->next;
+	node->next->prev = node->prev;
+	node->prev = node->next = NULL;
+	node->pending = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cascadeTimers
+// Description  : Re-file the timers in the current slot of a level into the
+//		  levels below, cascading the next level first if this one wrapped
+//
+// Inputs       : wheel - the wheel
+//		  level - the level to cascade
+// Outputs      : none
+void cascadeTimers ( TIMER_WHEEL *wheel, int level ) {
+
+	int index = ( wheel->current >> (TIMER_SLOT_BITS * level) ) & (TIMER_SLOTS - 1);
+	TIMER_NODE *head = &wheel->slots[level][index];
+	TIMER_NODE *node;
+
+	if ( index == 0 && level + 1 < TIMER_LEVELS )
+		cascadeTimers ( wheel, level + 1 );
+
+	while ( (node = head->next) != head ) {
+		unlinkTimer ( node );
+		linkTimer ( wheel, node );
+	}
+}
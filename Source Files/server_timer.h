@@ -0,0 +1,57 @@
+#ifndef SERVER_TIMER_INCLUDED
+#define SERVER_TIMER_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_timer.h
+//  Description   : A hierarchical timing wheel. Timers are intrusive nodes, so
+//                  adding and cancelling are O(1) and need no allocation. The
+//                  event loop advances the wheel once per tick.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#include <stdint.h>
+#include <pthread.h>
+
+//
+// Constants
+
+#define TIMER_TICK_MS 100		//resolution of the wheel
+#define TIMER_LEVELS 4			//64^4 ticks, a little over 19 days at 100ms
+#define TIMER_SLOT_BITS 6
+#define TIMER_SLOTS (1 << TIMER_SLOT_BITS)
+
+//
+// Type Definitions
+
+// Called with the wheel locked, so it must not add or cancel timers itself.
+// Returns 0 when done, or the number of milliseconds to re-arm the timer for.
+typedef int (*TIMER_CALLBACK) ( void *arg );
+
+typedef struct timer_node {
+	struct timer_node *prev;	//neighbours in the slot list
+	struct timer_node *next;
+	uint64_t expires;		//tick the timer fires on
+	TIMER_CALLBACK callback;	//function to run when it fires
+	void *arg;			//argument for the callback
+	int pending;			//currently linked into the wheel
+} TIMER_NODE;
+
+typedef struct timer_wheel {
+	pthread_mutex_t lock;
+	uint64_t current;				//last tick processed
+	uint64_t startTime;				//monotonic time (ns) of tick 0
+	TIMER_NODE slots[TIMER_LEVELS][TIMER_SLOTS];	//list heads for every slot
+} TIMER_WHEEL;
+
+//
+// Functional Prototypes
+
+int setupTimerWheel ( TIMER_WHEEL *wheel, uint64_t now );
+void addTimer ( TIMER_WHEEL *wheel, TIMER_NODE *node, int ms, TIMER_CALLBACK callback, void *arg );
+void cancelTimer ( TIMER_WHEEL *wheel, TIMER_NODE *node );
+int advanceTimers ( TIMER_WHEEL *wheel, uint64_t now );
+
+#endif
@@ -0,0 +1,266 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_tls.c
+//  Description   : The OpenSSL side of TLS termination. One context serves
+//                  every connection. Sessions can be resumed from the server
+//                  side cache by id, or from a ticket, so a returning client
+//                  skips the key exchange. The context asks OpenSSL to program
+//                  kTLS as soon as the traffic keys exist, and the handshake
+//                  records which directions the kernel accepted.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+// Project Include Files
+#include <cmpsc311_log.h>
+#include <server.h>
+#include <server_tls.h>
+
+// Global Variables
+SSL_CTX *tlsContext = NULL;		//shared by every TLS connection
+
+//Functional Prototypes
+int selectProtocol ( SSL *ssl, const unsigned char **out, unsigned char *outlen,
+		const unsigned char *in, unsigned int inlen, void *arg );
+void logTlsError ( const char *what );
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : setupTls
+// Description  : Load the certificate and key and build the TLS context
+//
+// Inputs       : certFile - PEM certificate chain
+//		  keyFile - PEM private key
+// Outputs      : 0 if successful, -1 if failure
+int setupTls ( const char *certFile, const char *keyFile ) {
+
+	if ( (tlsContext = SSL_CTX_new ( TLS_server_method() )) == NULL ) {
+		logTlsError ( "_setupTls:Can't create the TLS context" );
+		return -1;
+	}
+
+	//Every cipher offered is one the kernel can take over
+	SSL_CTX_set_min_proto_version ( tlsContext, TLS1_2_VERSION );
+	SSL_CTX_set_options ( tlsContext, SSL_OP_ENABLE_KTLS | SSL_OP_CIPHER_SERVER_PREFERENCE | SSL_OP_NO_RENEGOTIATION );
+	if ( !SSL_CTX_set_cipher_list ( tlsContext, "ECDHE+AESGCM:ECDHE+CHACHA20" ) ||
+	     !SSL_CTX_set_ciphersuites ( tlsContext, "TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384:TLS_CHACHA20_POLY1305_SHA256" ) ) {
+		logTlsError ( "_setupTls:Can't set the cipher list" );
+		return -1;
+	}
+
+	//A quiet connection gives back its record buffers, which are most of
+	//what OpenSSL holds for it
+	SSL_CTX_set_mode ( tlsContext, SSL_MODE_RELEASE_BUFFERS );
+
+	//Resumption by session id and by ticket
+	SSL_CTX_set_session_cache_mode ( tlsContext, SSL_SESS_CACHE_SERVER );
+	SSL_CTX_sess_set_cache_size ( tlsContext, TLS_SESSION_CACHE_SIZE );
+	SSL_CTX_set_timeout ( tlsContext, TLS_SESSION_TIMEOUT );
+	SSL_CTX_set_session_id_context ( tlsContext, (const unsigned char *)SERVER_NAME, strlen(SERVER_NAME) );
+
+	SSL_CTX_set_alpn_select_cb ( tlsContext, selectProtocol, NULL );
+
+	if ( SSL_CTX_use_certificate_chain_file ( tlsContext, certFile ) != 1 ||
+	     SSL_CTX_use_PrivateKey_file ( tlsContext, keyFile, SSL_FILETYPE_PEM ) != 1 ||
+	     SSL_CTX_check_private_key ( tlsContext ) != 1 ) {
+		logTlsError ( "_setupTls:Can't load the certificate and key" );
+		return -1;
+	}
+
+	logMessage ( LOG_INFO_LEVEL, "TLS configured with %s", certFile );
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : startTls
+// Description  : Attach TLS state to a freshly accepted connection. The socket
+//		  stays non-blocking until the handshake is done.
+//
+// Inputs       : conn - the connection
+// Outputs      : 0 if successful, -1 if failure
+int startTls ( CLIENT_CONN *conn ) {
+
+	if ( (conn->tls = SSL_new ( tlsContext )) == NULL || !SSL_set_fd ( conn->tls, conn->fd ) ) {
+		logTlsError ( "_startTls:Can't create the TLS connection" );
+		return -1;
+	}
+	SSL_set_accept_state ( conn->tls );
+	fcntl ( conn->fd, F_SETFL, fcntl ( conn->fd, F_GETFL ) | O_NONBLOCK );
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : handshakeTls
+// Description  : Move the handshake along as far as the socket allows. When it
+//		  finishes, record what the kernel took over and put the socket
+//		  back in blocking mode for the workers.
+//
+// Inputs       : conn - the connection
+// Outputs      : 0 when done, TLS_WANT_READ or TLS_WANT_WRITE to wait, -1 if failure
+int handshakeTls ( CLIENT_CONN *conn ) {
+
+	const unsigned char *alpn;
+	unsigned int alpnLength;
+	int ret;
+
+	if ( (ret = SSL_do_handshake ( conn->tls )) != 1 ) {
+		switch ( SSL_get_error ( conn->tls, ret ) ) {
+		case SSL_ERROR_WANT_READ:
+			return TLS_WANT_READ;
+		case SSL_ERROR_WANT_WRITE:
+			return TLS_WANT_WRITE;
+		default:
+			logTlsError ( "_handshakeTls:Handshake failed" );
+			return -1;
+		}
+	}
+
+	conn->tlsReady = 1;
+	SSL_get0_alpn_selected ( conn->tls, &alpn, &alpnLength );
+	conn->protocol = ( alpnLength == 2 && !memcmp ( alpn, "h2", 2 ) ) ? PROTOCOL_HTTP2 : PROTOCOL_HTTP1;
+	conn->tlsOffload = ( BIO_get_ktls_send ( SSL_get_wbio ( conn->tls ) ) ? TLS_OFFLOAD_SEND : 0 ) |
+			   ( BIO_get_ktls_recv ( SSL_get_rbio ( conn->tls ) ) ? TLS_OFFLOAD_RECV : 0 );
+	fcntl ( conn->fd, F_SETFL, fcntl ( conn->fd, F_GETFL ) & ~O_NONBLOCK );
+
+	logMessage ( LOG_INFO_LEVEL, "TLS handshake done, %s %s%s, %s, kernel %s", SSL_get_version ( conn->tls ),
+			SSL_get_cipher_name ( conn->tls ), ( SSL_session_reused ( conn->tls ) ) ? " resumed" : "",
+			( conn->protocol == PROTOCOL_HTTP2 ) ? "h2" : "http/1.1",
+			( conn->tlsOffload == ( TLS_OFFLOAD_SEND | TLS_OFFLOAD_RECV ) ) ? "send and receive" :
+			( conn->tlsOffload == TLS_OFFLOAD_SEND ) ? "send only" :
+			( conn->tlsOffload == TLS_OFFLOAD_RECV ) ? "receive only" : "off" );
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tlsPending
+// Description  : Check for request bytes OpenSSL already pulled off the socket,
+//		  which epoll can't report
+//
+// Inputs       : conn - the connection
+// Outputs      : 1 if there are buffered bytes, 0 if not
+int tlsPending ( CLIENT_CONN *conn ) {
+	return SSL_has_pending ( conn->tls );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tlsRead
+// Description  : Read decrypted bytes, with read() semantics
+//
+// Inputs       : conn - the connection
+//		  buf - place to put the bytes
+//		  len - most bytes to read
+// Outputs      : bytes read, 0 at end of stream, -1 if failure
+ssize_t tlsRead ( CLIENT_CONN *conn, void *buf, size_t len ) {
+
+	size_t got;
+
+	if ( SSL_read_ex ( conn->tls, buf, len, &got ) )
+		return got;
+
+	switch ( SSL_get_error ( conn->tls, 0 ) ) {
+	case SSL_ERROR_ZERO_RETURN:
+		return 0;			//close_notify
+	case SSL_ERROR_SYSCALL:
+		if ( errno == 0 )
+			return 0;		//closed without close_notify
+		return -1;
+	default:
+		errno = EIO;
+		return -1;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tlsWrite
+// Description  : Encrypt and send bytes, with write() semantics. On a
+//		  non-blocking socket a full send buffer fails with EAGAIN, and
+//		  the same bytes must be offered again once it drains.
+//
+// Inputs       : conn - the connection
+//		  buf - the bytes
+//		  len - how many to send
+// Outputs      : bytes sent, -1 if failure
+ssize_t tlsWrite ( CLIENT_CONN *conn, const void *buf, size_t len ) {
+
+	size_t sent;
+	int error;
+
+	if ( SSL_write_ex ( conn->tls, buf, len, &sent ) )
+		return sent;
+	error = SSL_get_error ( conn->tls, 0 );
+	if ( error == SSL_ERROR_WANT_WRITE || error == SSL_ERROR_WANT_READ )
+		errno = EAGAIN;
+	else if ( error != SSL_ERROR_SYSCALL || errno == 0 )
+		errno = EIO;
+	return -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : closeTls
+// Description  : Send close_notify if the handshake finished, and free the
+//		  TLS state
+//
+// Inputs       : conn - the connection
+// Outputs      : none
+void closeTls ( CLIENT_CONN *conn ) {
+
+	if ( conn->tlsReady && !conn->timedOut )
+		SSL_shutdown ( conn->tls );
+	SSL_free ( conn->tls );
+	conn->tls = NULL;
+	ERR_clear_error();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : selectProtocol
+// Description  : ALPN callback, picks the protocol spoken on the connection.
+//		  h2 is preferred when the client offers it.
+//
+// Inputs       : ssl - the connection
+//		  out, outlen - the chosen protocol
+//		  in, inlen - the client's protocol list
+//		  arg - unused
+// Outputs      : SSL_TLSEXT_ERR_OK, or SSL_TLSEXT_ERR_NOACK to carry on without ALPN
+int selectProtocol ( SSL *ssl, const unsigned char **out, unsigned char *outlen,
+		const unsigned char *in, unsigned int inlen, void *arg ) {
+
+	static const unsigned char supported[] = "\x02h2\x08http/1.1";
+
+	if ( SSL_select_next_proto ( (unsigned char **)out, outlen, supported, sizeof(supported) - 1,
+			in, inlen ) != OPENSSL_NPN_NEGOTIATED )
+		return SSL_TLSEXT_ERR_NOACK;
+	return SSL_TLSEXT_ERR_OK;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : logTlsError
+// Description  : Log a TLS failure with the reason from OpenSSL's error queue
+//
+// Inputs       : what - what was being done
+// Outputs      : none
+void logTlsError ( const char *what ) {
+
+	char reason[256];
+	unsigned long error = ERR_get_error();
+
+	ERR_error_string_n ( error, reason, sizeof(reason) );
+	logMessage ( LOG_WARNING_LEVEL, "%s [%s]", what, ( error ) ? reason : strerror(errno) );
+	ERR_clear_error();
+}
@@ -0,0 +1,50 @@
+#ifndef SERVER_TLS_INCLUDED
+#define SERVER_TLS_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_tls.h
+//  Description   : TLS termination with OpenSSL. Handshakes run non-blocking in
+//                  the event loop, so a slow client never holds a worker, and
+//                  once they finish the record layer is handed to the kernel
+//                  (kTLS) wherever the cipher allows. An offloaded direction
+//                  is plain read/write/sendfile on the socket, so the rest of
+//                  the server doesn't know the connection is encrypted. Only
+//                  a direction the kernel couldn't take goes through
+//                  SSL_read/SSL_write.
+//
+//                  Needs -lssl -lcrypto.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#include <sys/types.h>
+#include <server_conn.h>
+
+//
+// Constants
+
+#define TLS_SESSION_CACHE_SIZE 20480		//sessions kept for resumption by id
+#define TLS_SESSION_TIMEOUT 300			//seconds a session or ticket can be resumed
+
+// Directions the kernel took over, in CLIENT_CONN tlsOffload
+#define TLS_OFFLOAD_SEND 1
+#define TLS_OFFLOAD_RECV 2
+
+// What an unfinished handshake is waiting for
+#define TLS_WANT_READ 1
+#define TLS_WANT_WRITE 2
+
+//
+// Functional Prototypes
+
+int setupTls ( const char *certFile, const char *keyFile );
+int startTls ( CLIENT_CONN *conn );
+int handshakeTls ( CLIENT_CONN *conn );
+int tlsPending ( CLIENT_CONN *conn );
+ssize_t tlsRead ( CLIENT_CONN *conn, void *buf, size_t len );
+ssize_t tlsWrite ( CLIENT_CONN *conn, const void *buf, size_t len );
+void closeTls ( CLIENT_CONN *conn );
+
+#endif
@@ -0,0 +1,337 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_vhost.c
+//  Description   : Loads the virtual host config and resolves Host headers.
+//                  The host table is open addressing with linear probing, kept
+//                  at most half full, and each slot carries the full hash so a
+//                  probe only compares names when the hashes already match.
+//                  An exact name is one lookup. A miss then tries the wildcard
+//                  for each parent domain, and finally the default host.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <ctype.h>
+
+// Project Include Files
+#include <cmpsc311_log.h>
+#include <server_vhost.h>
+#include <server_body.h>
+#include <server_autoindex.h>
+#include <server_bundle.h>
+
+//
+// Type Definitions
+
+typedef struct vhost_slot {
+	unsigned int hash;		//hash of the host's name
+	VIRTUAL_HOST *host;		//NULL for an empty slot
+} VHOST_SLOT;
+
+//Functional Prototypes
+unsigned int hashHostName ( const char *name );
+VIRTUAL_HOST * lookupHostName ( VHOST_TABLE *table, const char *name );
+int parseHostLine ( char *line, VIRTUAL_HOST *host, const VIRTUAL_HOST *defaults, const char *filename, int lineNumber );
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : loadVirtualHosts
+// Description  : Read the virtual host config file and build a host table
+//
+// Inputs       : filename - path of the config file, NULL for a table with
+//			only the default host
+//		  defaults - settings of the default host, and of any host
+//			the file doesn't give them for
+// Outputs      : the table, or NULL on failure
+VHOST_TABLE * loadVirtualHosts ( const char *filename, const VIRTUAL_HOST *defaults ) {
+
+	char line[VHOST_PATH_MAX * 3];
+	FILE *config = NULL;
+	VHOST_TABLE *table;
+	VIRTUAL_HOST *host;
+	unsigned int size, slot;
+	int lineNumber = 0;
+
+	if ( (table = calloc ( 1, sizeof(VHOST_TABLE) )) == NULL ||
+	     (table->hosts = calloc ( ( filename ) ? MAX_VIRTUAL_HOSTS : 1, sizeof(VIRTUAL_HOST) )) == NULL ) {
+		logMessage ( LOG_ERROR_LEVEL, "_loadVirtualHosts:Out of memory for the host table" );
+		free ( table );
+		return NULL;
+	}
+
+	//Without a file there is just the default host, and nothing to look up
+	if ( filename == NULL ) {
+		table->hosts[0] = *defaults;
+		table->count = 1;
+		table->defaultHost = &table->hosts[0];
+		return table;
+	}
+
+	if ( (config = fopen ( filename, "r" )) == NULL ) {
+		logMessage ( LOG_ERROR_LEVEL, "_loadVirtualHosts:Can't open %s [%s]", filename, strerror(errno) );
+		freeVirtualHosts ( table );
+		return NULL;
+	}
+
+	while ( fgets ( line, sizeof(line), config ) != NULL ) {
+		lineNumber++;
+		if ( table->count >= MAX_VIRTUAL_HOSTS ) {
+			logMessage ( LOG_ERROR_LEVEL, "_loadVirtualHosts:%s has more than %d hosts", filename, MAX_VIRTUAL_HOSTS );
+			goto failed;
+		}
+		switch ( parseHostLine ( line, &table->hosts[table->count], defaults, filename, lineNumber ) ) {
+		case 0:
+			table->count++;
+			break;
+		case 1:
+			break;			//blank or comment
+		default:
+			//A bundle may be attached to the host that failed
+			if ( table->hosts[table->count].bundle != NULL )
+				closeBundle ( table->hosts[table->count].bundle );
+			goto failed;
+		}
+	}
+	fclose ( config );
+	config = NULL;
+
+	if ( table->count == 0 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_loadVirtualHosts:%s doesn't define any hosts", filename );
+		goto failed;
+	}
+
+	//Power of two table, at most half full
+	for ( size = 16; size < (unsigned int)table->count * 2; size <<= 1 )
+		;
+	if ( (table->slots = calloc ( size, sizeof(VHOST_SLOT) )) == NULL )
+		goto failed;
+	table->mask = size - 1;
+
+	table->defaultHost = &table->hosts[0];
+	for ( int i = 0; i < table->count; i++ ) {
+		host = &table->hosts[i];
+		if ( !strcmp ( host->name, "*" ) ) {
+			table->defaultHost = host;
+			continue;
+		}
+		if ( lookupHostName ( table, host->name ) != NULL ) {
+			logMessage ( LOG_ERROR_LEVEL, "_loadVirtualHosts:Host %s is defined twice", host->name );
+			goto failed;
+		}
+		unsigned int hash = hashHostName ( host->name );
+		for ( slot = hash & table->mask; table->slots[slot].host != NULL; slot = (slot + 1) & table->mask )
+			;
+		table->slots[slot].hash = hash;
+		table->slots[slot].host = host;
+	}
+
+	logMessage ( LOG_INFO_LEVEL, "Loaded %d virtual hosts from %s, default is %s",
+			table->count, filename, table->defaultHost->name );
+	return table;
+
+failed:
+	if ( config != NULL )
+		fclose ( config );
+	freeVirtualHosts ( table );
+	return NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : freeVirtualHosts
+// Description  : Free a host table, with its hosts' bundles and cached
+//		  listings. No request may still be using it.
+//
+// Inputs       : table - the table
+// Outputs      : none
+void freeVirtualHosts ( VHOST_TABLE *table ) {
+
+	if ( table == NULL )
+		return;
+
+	for ( int i = 0; i < table->count; i++ ) {
+		forgetListings ( &table->hosts[i] );
+		if ( table->hosts[i].bundle != NULL )
+			closeBundle ( table->hosts[i].bundle );
+	}
+	free ( table->slots );
+	free ( table->hosts );
+	free ( table );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : findVirtualHost
+// Description  : Resolve a Host header to its virtual host
+//
+// Inputs       : table - the host table
+//		  hostHeader - value of the Host header, may be empty
+// Outputs      : the host, never NULL
+VIRTUAL_HOST * findVirtualHost ( VHOST_TABLE *table, const char *hostHeader ) {
+
+	char name[VHOST_NAME_MAX + 2];
+	VIRTUAL_HOST *host;
+	int len = 0;
+	char *dot;
+
+	if ( table->slots == NULL || hostHeader == NULL )
+		return table->defaultHost;
+
+	//Lower case, without the port or a trailing dot
+	while ( hostHeader[len] && hostHeader[len] != ':' && len < VHOST_NAME_MAX ) {
+		name[len + 1] = tolower ( (unsigned char)hostHeader[len] );
+		len++;
+	}
+	if ( len > 0 && name[len] == '.' )
+		len--;
+	name[len + 1] = '\0';
+	if ( len == 0 )
+		return table->defaultHost;
+
+	//name[0] is spare room for the '*' of a wildcard
+	if ( (host = lookupHostName ( table, name + 1 )) != NULL )
+		return host;
+
+	//a.b.example.com tries *.b.example.com, then *.example.com, then *.com,
+	//overwriting the last character of each label it drops with the '*'
+	for ( dot = strchr ( name + 1, '.' ); dot != NULL; dot = strchr ( dot + 1, '.' ) ) {
+		dot[-1] = '*';
+		if ( (host = lookupHostName ( table, dot - 1 )) != NULL )
+			return host;
+	}
+
+	return table->defaultHost;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : docrootLength
+// Description  : Length of a host's docroot without its trailing slashes,
+//		  which is where the request path starts in a filename
+//
+// Inputs       : host - the virtual host
+// Outputs      : the length
+int docrootLength ( const VIRTUAL_HOST *host ) {
+
+	int len = strlen ( host->docroot );
+
+	while ( len > 0 && host->docroot[len - 1] == '/' )
+		len--;
+	return len;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hashHostName
+// Description  : FNV-1a hash of a host name
+//
+// Inputs       : name - lower case host name
+// Outputs      : the hash
+unsigned int hashHostName ( const char *name ) {
+
+	unsigned int hash = 2166136261u;
+
+	for ( ; *name; name++ ) {
+		hash ^= (unsigned char)*name;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lookupHostName
+// Description  : Probe the host table for an exact name
+//
+// Inputs       : table - the host table
+//		  name - lower case host name or wildcard
+// Outputs      : the host, or NULL if it isn't configured
+VIRTUAL_HOST * lookupHostName ( VHOST_TABLE *table, const char *name ) {
+
+	unsigned int hash = hashHostName ( name );
+	unsigned int slot;
+
+	for ( slot = hash & table->mask; table->slots[slot].host != NULL; slot = (slot + 1) & table->mask ) {
+		if ( table->slots[slot].hash == hash && !strcmp ( table->slots[slot].host->name, name ) )
+			return table->slots[slot].host;
+	}
+	return NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : parseHostLine
+// Description  : Parse one line of the config file
+//
+// Inputs       : line - the line
+//		  host - host to fill in
+//		  defaults - settings the line doesn't give
+//		  filename - config file name, for errors
+//		  lineNumber - line number, for errors
+// Outputs      : 0 for a host, 1 for a blank or comment line, -1 on error
+int parseHostLine ( char *line, VIRTUAL_HOST *host, const VIRTUAL_HOST *defaults, const char *filename, int lineNumber ) {
+
+	char *word, *value, *save;
+
+	if ( (word = strtok_r ( line, " \t\r\n", &save )) == NULL || word[0] == '#' )
+		return 1;
+
+	*host = *defaults;
+	host->bundle = NULL;			//a default host's bundle isn't shared
+	if ( strcmp ( word, "host" ) ) {
+		logMessage ( LOG_ERROR_LEVEL, "_parseHostLine:%s:%d: expected \"host\", found \"%s\"", filename, lineNumber, word );
+		return -1;
+	}
+
+	if ( (word = strtok_r ( NULL, " \t\r\n", &save )) == NULL || strlen(word) >= VHOST_NAME_MAX ) {
+		logMessage ( LOG_ERROR_LEVEL, "_parseHostLine:%s:%d: missing or bad host name", filename, lineNumber );
+		return -1;
+	}
+	for ( int i = 0; word[i]; i++ )
+		host->name[i] = tolower ( (unsigned char)word[i] );
+	host->name[strlen(word)] = '\0';
+
+	if ( (word = strtok_r ( NULL, " \t\r\n", &save )) == NULL || strlen(word) >= VHOST_PATH_MAX ) {
+		logMessage ( LOG_ERROR_LEVEL, "_parseHostLine:%s:%d: missing or bad docroot", filename, lineNumber );
+		return -1;
+	}
+	strcpy ( host->docroot, word );
+	if ( host->docroot[strlen(host->docroot) - 1] == '/' && strlen(host->docroot) > 1 )
+		host->docroot[strlen(host->docroot) - 1] = '\0';
+
+	while ( (word = strtok_r ( NULL, " \t\r\n", &save )) != NULL ) {
+		if ( (value = strchr ( word, '=' )) == NULL ) {
+			logMessage ( LOG_ERROR_LEVEL, "_parseHostLine:%s:%d: expected key=value, found \"%s\"", filename, lineNumber, word );
+			return -1;
+		}
+		*value++ = '\0';
+
+		if ( !strcmp ( word, "cgi" ) && value[0] == '/' && strlen(value) < VHOST_PATH_MAX )
+			strcpy ( host->cgiPrefix, value );
+		else if ( !strcmp ( word, "autoindex" ) && ( !strcmp ( value, "on" ) || !strcmp ( value, "off" ) ) )
+			host->autoindex = !strcmp ( value, "on" );
+		else if ( !strcmp ( word, "body" ) && atoll ( value ) > 0 )
+			host->maxBodySize = atoll ( value );
+		else if ( !strcmp ( word, "cache" ) && atol ( value ) >= 0 )
+			host->cacheBytes = atol ( value );
+		else if ( !strcmp ( word, "rate" ) && atol ( value ) >= 0 )
+			host->sendRate = atol ( value );
+		else if ( !strcmp ( word, "bundle" ) ) {
+			if ( attachBundle ( host, value ) )
+				return -1;
+		}
+		else {
+			logMessage ( LOG_ERROR_LEVEL, "_parseHostLine:%s:%d: bad setting %s=%s", filename, lineNumber, word, value );
+			return -1;
+		}
+	}
+
+	return 0;
+}
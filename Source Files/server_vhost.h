@@ -0,0 +1,75 @@
+#ifndef SERVER_VHOST_INCLUDED
+#define SERVER_VHOST_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_vhost.h
+//  Description   : Name based virtual hosts. Hosts are read from a config file
+//                  and compiled into an open addressing hash table that is
+//                  never written again, so workers resolve the Host header
+//                  without taking any locks. Reloading the server's config
+//                  builds a new table, and the old one is freed when the last
+//                  request using it is done.
+//
+//                  Config file lines look like
+//
+//                      host <name> <docroot> [key=value ...]
+//
+//                  where <name> is a host name, a wildcard like *.example.com
+//                  matching any subdomain, or * for the default host. Keys are
+//                  cgi=<uri prefix>, autoindex=on|off, body=<max body bytes>,
+//                  cache=<listing cache bytes>, rate=<bytes per second each
+//                  download may use, 0 for no limit> and bundle=<asset bundle>.
+//                  Blank lines and lines starting with # are ignored.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#include <stdint.h>
+
+struct bundle;
+struct vhost_slot;
+
+//
+// Constants
+
+#define VHOST_NAME_MAX 256		//longest host name
+#define VHOST_PATH_MAX 512		//longest docroot or cgi prefix
+#define MAX_VIRTUAL_HOSTS 4096		//hosts in one config file
+
+#define DEFAULT_DOCROOT ".."		//docroot when no config file is given
+#define DEFAULT_CGI_PREFIX "/cgi-bin/"	//uris under this run CGI programs
+
+//
+// Type Definitions
+
+typedef struct virtual_host {
+	char name[VHOST_NAME_MAX];	//host name, *.suffix, or * for the default
+	char docroot[VHOST_PATH_MAX];	//directory uris are resolved against
+	char cgiPrefix[VHOST_PATH_MAX];	//uri prefix served by CGI programs
+	int autoindex;			//list directories without an index page
+	int64_t maxBodySize;		//largest request body accepted
+	long cacheBytes;		//directory listing cache budget
+	long cachedBytes;		//listing cache bytes in use, under the listing cache lock
+	long sendRate;			//bytes per second a response body may use, 0 for no limit
+	struct bundle *bundle;		//asset bundle of the docroot, NULL if none
+} VIRTUAL_HOST;
+
+typedef struct vhost_table {
+	VIRTUAL_HOST *hosts;		//every configured host
+	int count;
+	VIRTUAL_HOST *defaultHost;	//the * host, or the first one
+	struct vhost_slot *slots;	//hash table of the named hosts, NULL if there are none
+	unsigned int mask;		//slots in the table, less one
+} VHOST_TABLE;
+
+//
+// Functional Prototypes
+
+VHOST_TABLE * loadVirtualHosts ( const char *filename, const VIRTUAL_HOST *defaults );
+void freeVirtualHosts ( VHOST_TABLE *table );
+VIRTUAL_HOST * findVirtualHost ( VHOST_TABLE *table, const char *hostHeader );
+int docrootLength ( const VIRTUAL_HOST *host );
+
+#endif
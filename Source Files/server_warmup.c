@@ -0,0 +1,369 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_warmup.c
+//  Description   : Saving the popular files and reading them back in. The
+//                  list is read before any worker process is forked, and its
+//                  counts seed the shared hit table. The warm-up threads take
+//                  files off the list in order, so the most popular are in
+//                  the caches first, and the saver writes the list to a
+//                  temporary file and renames it over the old one, so a
+//                  crash mid save never leaves half a list.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+
+// Project Include Files
+#include <cmpsc311_log.h>
+#include <server.h>
+#include <server_warmup.h>
+#include <server_shared.h>
+#include <server_config.h>
+
+// Global Variables
+char warmupFile[CONFIG_PATH_MAX];		//empty when there is no warm-up
+long warmupBytes = 0;				//bytes to read in at startup
+FILE_HITS *warmupList = NULL;			//the saved list, most hits first
+int warmupCount = 0;
+int warmupNext = 0;				//next file on the list to read in
+long warmupSpent = 0;				//bytes asked for so far
+int warmupFiles = 0;				//files read in so far
+int warmupDone = 0;				//threads that have run out of list
+uint64_t warmupStart = 0;			//monotonic time the warm-up started
+int warmupStopping = 0;
+int warmupThreadCount = 0, saverRunning = 0;	//threads started
+pthread_t warmupThreads[WARMUP_THREADS], saverThread;
+pthread_mutex_t warmupLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t warmupStop = PTHREAD_COND_INITIALIZER;
+
+//
+// Functional Prototypes
+
+int compareHits ( const void *a, const void *b );
+int loadWarmupList ( const char *filename );
+int saveWarmupList ( void );
+void warmFile ( const char *path );
+void * warmupLoop ( void *arg );
+void * saverLoop ( void *arg );
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : setupWarmup
+// Description  : Read the saved list and seed the hit counts with it, before
+//		  any worker process is forked. A missing list is an empty one.
+//
+// Inputs       : filename - the warm-up file, NULL or empty for no warm-up
+//		  bytes - most bytes to read in at startup
+// Outputs      : 0 if successful, -1 if failure
+int setupWarmup ( const char *filename, long bytes ) {
+
+	if ( filename == NULL || filename[0] == '\0' )
+		return 0;
+	if ( strlen ( filename ) >= sizeof(warmupFile) ) {
+		logMessage ( LOG_ERROR_LEVEL, "_setupWarmup:Warm-up file name too long" );
+		return -1;
+	}
+	strcpy ( warmupFile, filename );
+	warmupBytes = bytes;
+
+	if ( loadWarmupList ( filename ) )
+		return -1;
+	for ( int i = 0; i < warmupCount; i++ )
+		countFileHit ( warmupList[i].path, warmupList[i].hits );
+	logMessage ( LOG_INFO_LEVEL, "Warming up %d files from %s", warmupCount, filename );
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : startWarmup
+// Description  : Start reading the list in, and saving it, if this process
+//		  is the one that does
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+int startWarmup ( void ) {
+
+	sigset_t blocked, previous;
+	int ret = 0;
+
+	if ( !warmupFile[0] || currentSharedSlot() != 0 )
+		return 0;
+
+	warmupStopping = 0;
+	warmupNext = warmupDone = warmupFiles = 0;
+	warmupSpent = 0;
+	warmupStart = monotonicTime();
+
+	//Like the workers, these leave SIGINT and SIGHUP to the event loop
+	sigemptyset ( &blocked );
+	sigaddset ( &blocked, SIGINT );
+	sigaddset ( &blocked, SIGHUP );
+	pthread_sigmask ( SIG_BLOCK, &blocked, &previous );
+	while ( warmupThreadCount < WARMUP_THREADS && !ret ) {
+		if ( !(ret = pthread_create ( &warmupThreads[warmupThreadCount], NULL, warmupLoop, NULL )) )
+			warmupThreadCount++;
+	}
+	if ( !ret && !(ret = pthread_create ( &saverThread, NULL, saverLoop, NULL )) )
+		saverRunning = 1;
+	pthread_sigmask ( SIG_SETMASK, &previous, NULL );
+
+	if ( ret ) {
+		logMessage ( LOG_ERROR_LEVEL, "_startWarmup:Failed to create the warm-up threads" );
+		return -1;
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : stopWarmup
+// Description  : Stop the warm-up threads and save the list one last time.
+//		  The workers must already be stopped, so the counts are final.
+//
+// Inputs       : none
+// Outputs      : none
+void stopWarmup ( void ) {
+
+	if ( !warmupThreadCount )
+		return;
+
+	pthread_mutex_lock ( &warmupLock );
+	warmupStopping = 1;
+	pthread_cond_broadcast ( &warmupStop );
+	pthread_mutex_unlock ( &warmupLock );
+
+	if ( saverRunning )
+		pthread_join ( saverThread, NULL );
+	for ( int i = 0; i < warmupThreadCount; i++ )
+		pthread_join ( warmupThreads[i], NULL );
+	saverRunning = warmupThreadCount = 0;
+
+	saveWarmupList();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : countWarmupHit
+// Description  : Count a static file served, when there is a warm-up list
+//		  to keep
+//
+// Inputs       : filename - the file, with its docroot
+// Outputs      : none
+void countWarmupHit ( const char *filename ) {
+
+	if ( warmupFile[0] )
+		countFileHit ( filename, 1 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : compareHits
+// Description  : qsort comparison putting the most hits first
+//
+// Inputs       : a, b - the FILE_HITS to compare
+// Outputs      : less than, equal to or greater than 0
+int compareHits ( const void *a, const void *b ) {
+
+	uint64_t hitsA = ((const FILE_HITS *)a)->hits, hitsB = ((const FILE_HITS *)b)->hits;
+
+	return ( hitsA < hitsB ) - ( hitsA > hitsB );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : loadWarmupList
+// Description  : Read the saved list, halving its counts. Lines that don't
+//		  parse are skipped.
+//
+// Inputs       : filename - the warm-up file
+// Outputs      : 0 if successful, -1 if failure
+int loadWarmupList ( const char *filename ) {
+
+	char line[SHARED_HIT_PATH_MAX + 32], *path;
+	unsigned long long hits;
+	size_t length;
+	FILE *file;
+
+	if ( (warmupList = calloc ( WARMUP_SAVED_PATHS, sizeof(FILE_HITS) )) == NULL ) {
+		logMessage ( LOG_ERROR_LEVEL, "_loadWarmupList:Out of memory for the warm-up list" );
+		return -1;
+	}
+	if ( (file = fopen ( filename, "r" )) == NULL ) {
+		if ( errno == ENOENT )
+			return 0;
+		logMessage ( LOG_ERROR_LEVEL, "_loadWarmupList:Can't open %s [%s]", filename, strerror(errno) );
+		return -1;
+	}
+
+	while ( warmupCount < WARMUP_SAVED_PATHS && fgets ( line, sizeof(line), file ) != NULL ) {
+		hits = strtoull ( line, &path, 10 );
+		if ( path == line || *path != ' ' )
+			continue;
+		path++;
+		length = strcspn ( path, "\r\n" );
+		if ( length == 0 || length >= SHARED_HIT_PATH_MAX )
+			continue;
+		path[length] = '\0';
+		strcpy ( warmupList[warmupCount].path, path );
+		warmupList[warmupCount].hits = ( hits + 1 ) / 2;
+		warmupCount++;
+	}
+	fclose ( file );
+
+	//The list is saved in order, but one edited by hand may not be
+	qsort ( warmupList, warmupCount, sizeof(FILE_HITS), compareHits );
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : saveWarmupList
+// Description  : Write the most popular files out, replacing the saved list
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+int saveWarmupList ( void ) {
+
+	char temporary[CONFIG_PATH_MAX + 4];	//the file, with .tmp on the end
+	FILE_HITS *hits;
+	FILE *file;
+	int count, failed;
+
+	if ( (hits = malloc ( SHARED_HIT_SLOTS * sizeof(FILE_HITS) )) == NULL ) {
+		logMessage ( LOG_ERROR_LEVEL, "_saveWarmupList:Out of memory for the hit counts" );
+		return -1;
+	}
+	count = copyFileHits ( hits, SHARED_HIT_SLOTS );
+	qsort ( hits, count, sizeof(FILE_HITS), compareHits );
+	if ( count > WARMUP_SAVED_PATHS )
+		count = WARMUP_SAVED_PATHS;
+
+	snprintf ( temporary, sizeof(temporary), "%s.tmp", warmupFile );
+	if ( (file = fopen ( temporary, "w" )) == NULL ) {
+		logMessage ( LOG_ERROR_LEVEL, "_saveWarmupList:Can't create %s [%s]", temporary, strerror(errno) );
+		free ( hits );
+		return -1;
+	}
+	for ( int i = 0; i < count; i++ )
+		fprintf ( file, "%llu %s\n", (unsigned long long)hits[i].hits, hits[i].path );
+	failed = ferror ( file );
+	failed |= fclose ( file );
+	free ( hits );
+
+	if ( failed || rename ( temporary, warmupFile ) ) {
+		logMessage ( LOG_ERROR_LEVEL, "_saveWarmupList:Can't save %s [%s]", warmupFile, strerror(errno) );
+		unlink ( temporary );
+		return -1;
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : warmFile
+// Description  : Bring a file into the caches. Small files go into the shared
+//		  file cache, larger ones are read ahead into the page cache.
+//		  A file that is gone, or no longer a readable regular file,
+//		  is passed over.
+//
+// Inputs       : path - the file
+// Outputs      : none
+void warmFile ( const char *path ) {
+
+	char data[SHARED_CACHE_FILE_MAX];
+	struct stat sbuf, opened;
+	int fd;
+
+	if ( stat ( path, &sbuf ) || !S_ISREG( sbuf.st_mode ) || !(S_IRUSR & sbuf.st_mode) )
+		return;
+	if ( __atomic_add_fetch ( &warmupSpent, sbuf.st_size, __ATOMIC_RELAXED ) > warmupBytes )
+		return;
+
+	if ( sbuf.st_size <= SHARED_CACHE_FILE_MAX ) {
+		if ( readSmallFile ( (char *)path, &opened, data, sbuf.st_size ) == sbuf.st_size )
+			sharedCacheStore ( path, &opened, data, sbuf.st_size );
+	} else {
+		if ( (fd = open ( path, O_RDONLY | O_CLOEXEC )) == -1 )
+			return;
+		posix_fadvise ( fd, 0, 0, POSIX_FADV_WILLNEED );
+		readahead ( fd, 0, sbuf.st_size );
+		close ( fd );
+	}
+	__atomic_add_fetch ( &warmupFiles, 1, __ATOMIC_RELAXED );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : warmupLoop
+// Description  : Body of a warm-up thread. Takes files off the list until it
+//		  runs out, the byte budget does, or the server stops. The
+//		  thread's lower priority carries over to the disk, so requests
+//		  for files that are cold go ahead of it.
+//
+// Inputs       : arg - unused
+// Outputs      : NULL
+void * warmupLoop ( void *arg ) {
+
+	int next;
+
+	(void)arg;
+	setpriority ( PRIO_PROCESS, syscall ( SYS_gettid ), WARMUP_NICE );
+
+	while ( !__atomic_load_n ( &warmupStopping, __ATOMIC_RELAXED ) &&
+		__atomic_load_n ( &warmupSpent, __ATOMIC_RELAXED ) < warmupBytes &&
+		(next = __atomic_fetch_add ( &warmupNext, 1, __ATOMIC_RELAXED )) < warmupCount )
+		warmFile ( warmupList[next].path );
+
+	//The last thread out says how it went
+	if ( __atomic_add_fetch ( &warmupDone, 1, __ATOMIC_ACQ_REL ) == WARMUP_THREADS && warmupCount )
+		logMessage ( LOG_INFO_LEVEL, "Warmed up %d of %d files in %llu ms", __atomic_load_n ( &warmupFiles, __ATOMIC_RELAXED ),
+				warmupCount, (unsigned long long)( monotonicTime() - warmupStart ) / 1000000 );
+	return NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : saverLoop
+// Description  : Body of the saver thread. Saves the list every
+//		  WARMUP_SAVE_SECONDS until the server stops.
+//
+// Inputs       : arg - unused
+// Outputs      : NULL
+void * saverLoop ( void *arg ) {
+
+	struct timespec deadline;
+
+	(void)arg;
+	pthread_mutex_lock ( &warmupLock );
+	while ( !warmupStopping ) {
+		clock_gettime ( CLOCK_REALTIME, &deadline );
+		deadline.tv_sec += WARMUP_SAVE_SECONDS;
+		if ( pthread_cond_timedwait ( &warmupStop, &warmupLock, &deadline ) == ETIMEDOUT && !warmupStopping ) {
+			pthread_mutex_unlock ( &warmupLock );
+			saveWarmupList();
+			pthread_mutex_lock ( &warmupLock );
+		}
+	}
+	pthread_mutex_unlock ( &warmupLock );
+	return NULL;
+}
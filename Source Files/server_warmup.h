@@ -0,0 +1,47 @@
+#ifndef SERVER_WARMUP_INCLUDED
+#define SERVER_WARMUP_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_warmup.h
+//  Description   : Warming the caches after a restart. With warmup set, the
+//                  static files served are counted in the shared segment, and
+//                  the most popular of them are written to the warm-up file
+//                  every WARMUP_SAVE_SECONDS and at shutdown, one per line as
+//                  "<hits> <path>", most hits first.
+//
+//                  At startup the server is already serving while a few low
+//                  priority threads read the list back in that order. Files
+//                  small enough for the shared file cache are read into it,
+//                  larger ones are handed to readahead, until warmup-bytes
+//                  have been asked for. Either way their dentries and inodes
+//                  are cached too. The saved counts are halved as they are
+//                  read back, so files that fall out of use give way.
+//
+//                  In worker process mode the process in the first slot
+//                  warms up and saves the list for them all.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#include <stdint.h>
+
+//
+// Constants
+
+#define WARMUP_THREADS 2			//threads reading files in
+#define WARMUP_SAVED_PATHS 1024			//most popular files kept in the list
+#define WARMUP_SAVE_SECONDS 60			//how often the list is saved
+#define WARMUP_BYTES ( 256L * 1024 * 1024 )	//default bytes read in at startup
+#define WARMUP_NICE 10				//how much the threads lower their priority
+
+//
+// Functional Prototypes
+
+int setupWarmup ( const char *filename, long bytes );
+int startWarmup ( void );
+void stopWarmup ( void );
+void countWarmupHit ( const char *filename );
+
+#endif
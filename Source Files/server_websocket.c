@@ -0,0 +1,571 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_websocket.c
+//  Description   : The WebSocket handshake, frame reader and writer. Frames
+//                  are read whole with blocking reads, under the same rate
+//                  deadline as a request body, and only while the socket has
+//                  data, so a worker never waits on a quiet client. Control
+//                  frames are answered as they come, in between the fragments
+//                  of a message.
+//
+//                  Unmasking XORs the payload with the repeating 4 byte key.
+//                  The widest kernel the CPU runs is picked the first time,
+//                  and every kernel steps in whole multiples of the key, so
+//                  the tail is finished byte by byte with the same key.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <openssl/sha.h>
+#include <openssl/evp.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define WEBSOCKET_X86 1
+#endif
+
+// Project Include Files
+#include <cmpsc311_log.h>
+#include <server.h>
+#include <server_websocket.h>
+#include <server_event.h>
+#include <server_shared.h>
+#include <server_bufpool.h>
+
+//
+// Type Definitions
+
+typedef struct websocket_entry {
+	char prefix[MAXLINE];		//uri prefix the route serves
+	int prefixLen;
+	const WEBSOCKET_ROUTE *route;
+} WEBSOCKET_ENTRY;
+
+typedef void (*UNMASK_KERNEL) ( unsigned char *data, uint64_t length, uint32_t key );
+
+// Global Variables
+WEBSOCKET_ENTRY websocketRoutes[MAX_WEBSOCKET_ROUTES];
+int websocketRouteCount = 0;
+UNMASK_KERNEL unmaskKernel = NULL;	//picked on first use
+
+//
+// Functional Prototypes
+
+const WEBSOCKET_ROUTE * findWebSocketRoute ( const char *uri );
+int readWebSocketFrame ( WEBSOCKET *ws );
+int readControlFrame ( WEBSOCKET *ws, int opcode, unsigned char *payload, int length );
+int readExactly ( int fd, void *buf, uint64_t len );
+void unmaskScalar ( unsigned char *data, uint64_t length, uint32_t key );
+#ifdef WEBSOCKET_X86
+void unmaskSse2 ( unsigned char *data, uint64_t length, uint32_t key );
+void unmaskAvx2 ( unsigned char *data, uint64_t length, uint32_t key );
+#endif
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : registerWebSocket
+// Description  : Accept WebSocket upgrades for every uri starting with prefix.
+//		  Routes are registered at startup, before the workers run.
+//
+// Inputs       : prefix - uri prefix, e.g. "/live/"
+//		  route - the route's handlers
+// Outputs      : 0 if successful, -1 if failure
+int registerWebSocket ( const char *prefix, const WEBSOCKET_ROUTE *route ) {
+
+	if ( websocketRouteCount >= MAX_WEBSOCKET_ROUTES || strlen(prefix) >= MAXLINE || route->onMessage == NULL ) {
+		logMessage ( LOG_ERROR_LEVEL, "_registerWebSocket:Can't register a WebSocket route for %s", prefix );
+		return -1;
+	}
+
+	strcpy ( websocketRoutes[websocketRouteCount].prefix, prefix );
+	websocketRoutes[websocketRouteCount].prefixLen = strlen(prefix);
+	websocketRoutes[websocketRouteCount].route = route;
+	websocketRouteCount++;
+
+	logMessage ( LOG_INFO_LEVEL, "Registered WebSocket route for %s", prefix );
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : isWebSocketUpgrade
+// Description  : Check whether a request asks for a WebSocket on a route
+//		  that has one
+//
+// Inputs       : request - the parsed request
+// Outputs      : 1 if it does, 0 if not
+int isWebSocketUpgrade ( HTTP_REQUEST *request ) {
+
+	return headerHasToken ( request->upgrade, "websocket" ) && !strcmp ( request->version, "HTTP/1.1" ) &&
+	       !strcasecmp ( request->method, "GET" ) && findWebSocketRoute ( request->uri ) != NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : startWebSocket
+// Description  : Answer the handshake and switch the connection over
+//
+// Inputs       : conn - the connection
+//		  request - the upgrade request
+// Outputs      : 0 or 1 as processClient, or CONN_KEEP_OPEN
+int startWebSocket ( CLIENT_CONN *conn, HTTP_REQUEST *request ) {
+
+	char accept[SHA_DIGEST_LENGTH * 2], keyed[MAXLINE + sizeof(WEBSOCKET_GUID)], buf[MAXLINE];
+	unsigned char digest[SHA_DIGEST_LENGTH];
+	WEBSOCKET *ws;
+
+	if ( strcmp ( request->websocketVersion, WEBSOCKET_VERSION ) ) {
+		logMessage ( LOG_INFO_LEVEL, "WebSocket version %s asked for. 426 error", request->websocketVersion );
+		sendErrorResponse ( conn->fd, 426, "Upgrade Required", "Sec-WebSocket-Version: " WEBSOCKET_VERSION "\r\n" );
+		return 1;
+	}
+	if ( request->websocketKey[0] == '\0' || request->contentLength > 0 || request->chunked ) {
+		sendErrorResponse ( conn->fd, 400, "Bad Request", NULL );
+		return 1;
+	}
+	if ( (ws = calloc ( 1, sizeof(WEBSOCKET) )) == NULL ) {
+		logMessage ( LOG_ERROR_LEVEL, "_startWebSocket:Out of memory for a WebSocket" );
+		sendErrorResponse ( conn->fd, 500, "Internal Server Error", NULL );
+		return 1;
+	}
+	ws->conn = conn;
+	ws->route = findWebSocketRoute ( request->uri );
+
+	//The accept value proves we read the key, base64 of SHA-1 of it and the GUID
+	snprintf ( keyed, sizeof(keyed), "%s" WEBSOCKET_GUID, request->websocketKey );
+	SHA1 ( (unsigned char *)keyed, strlen(keyed), digest );
+	EVP_EncodeBlock ( (unsigned char *)accept, digest, SHA_DIGEST_LENGTH );
+	snprintf ( buf, sizeof(buf), "HTTP/1.1 101 Switching Protocols\r\n"
+			"Server: " SERVER_NAME "\r\n"
+			"Upgrade: websocket\r\n"
+			"Connection: Upgrade\r\n"
+			"Sec-WebSocket-Accept: %s\r\n\r\n", accept );
+	if ( sendBytes ( conn->fd, strlen(buf), buf ) ) {
+		free ( ws );
+		return 1;
+	}
+
+	conn->websocket = ws;
+	countStat ( STAT_WEBSOCKETS, 1 );
+	countStat ( STAT_CONNECTION_BYTES, sizeof(WEBSOCKET) );
+	if ( DEBUG )
+		logMessage ( LOG_INFO_LEVEL, "Switched to a WebSocket for %s", request->uri );
+	if ( ws->route->onOpen != NULL && ws->route->onOpen ( ws, request ) ) {
+		closeWebSocket ( ws, WS_CLOSE_POLICY );
+		return 0;
+	}
+
+	//Frames the client sent right behind the handshake are read now
+	return serveWebSocket ( conn );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : serveWebSocket
+// Description  : Read the frames a WebSocket has waiting, sending a ping
+//		  first if its deadline asked for one, then hand it back to
+//		  the event loop
+//
+// Inputs       : conn - the connection, with its WebSocket
+// Outputs      : 0 or 1 as processClient, or CONN_KEEP_OPEN
+int serveWebSocket ( CLIENT_CONN *conn ) {
+
+	WEBSOCKET *ws = conn->websocket;
+	int ret;
+
+	if ( ws->pingDue ) {
+		ws->pingDue = 0;
+		if ( ws->missedPings >= WEBSOCKET_MAX_MISSED_PINGS ) {
+			logMessage ( LOG_INFO_LEVEL, "WebSocket client stopped answering pings, closing" );
+			closeWebSocket ( ws, WS_CLOSE_GOING_AWAY );
+			return 1;
+		}
+		ws->missedPings++;
+		if ( sendWebSocket ( ws, WS_PING, NULL, 0 ) )
+			return 1;
+	}
+
+	//Frames are read under the same rate check as a request body
+	armDeadline ( conn, CONN_BODY );
+	while ( connReadable ( conn->fd, 0 ) ) {
+		if ( (ret = readWebSocketFrame ( ws )) )
+			return ( ret == -1 ) ? 1 : 0;
+	}
+	return CONN_KEEP_OPEN;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sendWebSocket
+// Description  : Send one unfragmented frame. Only the worker serving the
+//		  connection may call it.
+//
+// Inputs       : ws - the WebSocket
+//		  opcode - WS_ opcode
+//		  data - the payload, may be NULL when length is 0
+//		  length - its length
+// Outputs      : 0 if successful, -1 if failure
+int sendWebSocket ( WEBSOCKET *ws, int opcode, const void *data, uint64_t length ) {
+
+	unsigned char frame[1024];
+	int header = 2;
+
+	frame[0] = 0x80 | opcode;
+	if ( length < 126 )
+		frame[1] = length;
+	else if ( length <= 0xFFFF ) {
+		frame[1] = 126;
+		frame[2] = length >> 8;
+		frame[3] = length;
+		header = 4;
+	}
+	else {
+		frame[1] = 127;
+		for ( int i = 0; i < 8; i++ )
+			frame[2 + i] = length >> ( 56 - 8 * i );
+		header = 10;
+	}
+
+	//Small frames go out in one write
+	if ( length <= sizeof(frame) - header ) {
+		if ( length > 0 )
+			memcpy ( frame + header, data, length );
+		return sendBytes ( ws->conn->fd, header + length, (char *)frame );
+	}
+	if ( sendBytes ( ws->conn->fd, header, (char *)frame ) )
+		return -1;
+	for ( uint64_t sent = 0; sent < length; sent += MAXBUF ) {
+		if ( sendBytes ( ws->conn->fd, ( length - sent < MAXBUF ) ? length - sent : MAXBUF, (char *)data + sent ) )
+			return -1;
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : closeWebSocket
+// Description  : Send our close frame, once
+//
+// Inputs       : ws - the WebSocket
+//		  code - WS_CLOSE_ code
+// Outputs      : 0 if successful, -1 if failure
+int closeWebSocket ( WEBSOCKET *ws, int code ) {
+
+	unsigned char payload[2] = { code >> 8, code & 0xFF };
+
+	if ( ws->closeSent )
+		return 0;
+	ws->closeSent = 1;
+	return sendWebSocket ( ws, WS_CLOSE, payload, sizeof(payload) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : freeWebSocket
+// Description  : Tell the route the connection is gone and free its state
+//
+// Inputs       : conn - the connection
+// Outputs      : none
+void freeWebSocket ( CLIENT_CONN *conn ) {
+
+	WEBSOCKET *ws = conn->websocket;
+
+	if ( ws->route->onClose != NULL )
+		ws->route->onClose ( ws );
+	returnBuffer ( ws->message );
+	countStat ( STAT_CONNECTION_BYTES, -(uint64_t)sizeof(WEBSOCKET) );
+	free ( ws );
+	conn->websocket = NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : unmaskWebSocket
+// Description  : Unmask a frame payload in place
+//
+// Inputs       : data - the payload
+//		  length - its length
+//		  mask - the frame's masking key
+// Outputs      : none
+void unmaskWebSocket ( unsigned char *data, uint64_t length, const unsigned char mask[4] ) {
+
+	UNMASK_KERNEL kernel = __atomic_load_n ( &unmaskKernel, __ATOMIC_RELAXED );
+	uint32_t key;
+
+	//Every thread that races here picks the same kernel
+	if ( kernel == NULL ) {
+		kernel = unmaskScalar;
+#ifdef WEBSOCKET_X86
+		kernel = ( __builtin_cpu_supports ( "avx2" ) ) ? unmaskAvx2 : unmaskSse2;
+#endif
+		__atomic_store_n ( &unmaskKernel, kernel, __ATOMIC_RELAXED );
+	}
+
+	memcpy ( &key, mask, sizeof(key) );
+	kernel ( data, length, key );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : findWebSocketRoute
+// Description  : Find the route with the longest prefix matching the uri
+//
+// Inputs       : uri - the request uri
+// Outputs      : the route, or NULL if none matches
+const WEBSOCKET_ROUTE * findWebSocketRoute ( const char *uri ) {
+
+	const WEBSOCKET_ROUTE *found = NULL;
+	int longest = 0;
+
+	for ( int i = 0; i < websocketRouteCount; i++ ) {
+		if ( websocketRoutes[i].prefixLen > longest && !strncmp ( uri, websocketRoutes[i].prefix, websocketRoutes[i].prefixLen ) ) {
+			found = websocketRoutes[i].route;
+			longest = websocketRoutes[i].prefixLen;
+		}
+	}
+	return found;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : readWebSocketFrame
+// Description  : Read one frame and act on it. Data frames are added to the
+//		  message, which goes to the route when its last fragment
+//		  arrives.
+//
+// Inputs       : ws - the WebSocket
+// Outputs      : 0 to keep going, 1 if the connection closed cleanly, -1 on
+//		  an error
+int readWebSocketFrame ( WEBSOCKET *ws ) {
+
+	unsigned char head[2], extended[8], mask[4], control[125], *grown;
+	int fd = ws->conn->fd, fin, opcode, ret;
+	uint64_t length, capacity;
+
+	if ( readExactly ( fd, head, 2 ) )
+		return -1;
+	fin = head[0] & 0x80;
+	opcode = head[0] & 0x0F;
+	length = head[1] & 0x7F;
+
+	//Clients must mask, and nothing here negotiates an extension
+	if ( ( head[0] & 0x70 ) || !( head[1] & 0x80 ) ) {
+		logMessage ( LOG_INFO_LEVEL, "WebSocket frame with reserved bits or no mask, closing" );
+		closeWebSocket ( ws, WS_CLOSE_PROTOCOL_ERROR );
+		return -1;
+	}
+	if ( length == 126 ) {
+		if ( readExactly ( fd, extended, 2 ) )
+			return -1;
+		length = ( extended[0] << 8 ) | extended[1];
+	}
+	else if ( length == 127 ) {
+		if ( readExactly ( fd, extended, 8 ) )
+			return -1;
+		length = 0;
+		for ( int i = 0; i < 8; i++ )
+			length = ( length << 8 ) | extended[i];
+	}
+	if ( readExactly ( fd, mask, 4 ) )
+		return -1;
+	ws->missedPings = 0;
+
+	//Control frames are short, whole, and may come between fragments
+	if ( opcode & 0x8 ) {
+		if ( !fin || length > sizeof(control) ) {
+			closeWebSocket ( ws, WS_CLOSE_PROTOCOL_ERROR );
+			return -1;
+		}
+		if ( readExactly ( fd, control, length ) )
+			return -1;
+		unmaskWebSocket ( control, length, mask );
+		return readControlFrame ( ws, opcode, control, length );
+	}
+
+	//A continuation needs a message to continue, and a new message can't
+	//start in the middle of one
+	if ( ( opcode == WS_CONTINUATION ) != ( ws->opcode != 0 ) ||
+	     ( opcode != WS_CONTINUATION && opcode != WS_TEXT && opcode != WS_BINARY ) ) {
+		logMessage ( LOG_INFO_LEVEL, "WebSocket frame with opcode %d out of place, closing", opcode );
+		closeWebSocket ( ws, WS_CLOSE_PROTOCOL_ERROR );
+		return -1;
+	}
+	if ( length > WEBSOCKET_MAX_MESSAGE - ws->messageLength ) {
+		logMessage ( LOG_INFO_LEVEL, "WebSocket message over %d bytes, closing", WEBSOCKET_MAX_MESSAGE );
+		closeWebSocket ( ws, WS_CLOSE_TOO_BIG );
+		return -1;
+	}
+	if ( opcode != WS_CONTINUATION )
+		ws->opcode = opcode;
+
+	if ( ws->messageLength + length > ws->messageCapacity ) {
+		capacity = ( ws->messageCapacity ) ? ws->messageCapacity : 4096;
+		while ( capacity < ws->messageLength + length )
+			capacity *= 2;
+		if ( (grown = borrowBuffer ( capacity )) == NULL ) {
+			logMessage ( LOG_ERROR_LEVEL, "_readWebSocketFrame:Out of memory for a WebSocket message" );
+			return -1;
+		}
+		if ( ws->messageLength )
+			memcpy ( grown, ws->message, ws->messageLength );
+		returnBuffer ( ws->message );
+		ws->message = grown;
+		ws->messageCapacity = bufferSize ( grown );
+	}
+	if ( readExactly ( fd, ws->message + ws->messageLength, length ) )
+		return -1;
+	unmaskWebSocket ( ws->message + ws->messageLength, length, mask );
+	ws->messageLength += length;
+	if ( !fin )
+		return 0;
+
+	countStat ( STAT_WEBSOCKET_MESSAGES, 1 );
+	ret = ws->route->onMessage ( ws, ws->opcode, ws->message, ws->messageLength );
+	ws->opcode = 0;
+	ws->messageLength = 0;
+
+	//A connection between messages holds no buffer, the next message
+	//borrows one from the pool
+	returnBuffer ( ws->message );
+	ws->message = NULL;
+	ws->messageCapacity = 0;
+	if ( ret ) {
+		closeWebSocket ( ws, WS_CLOSE_NORMAL );
+		return 1;
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : readControlFrame
+// Description  : Answer a ping, note a pong, or finish the closing handshake
+//
+// Inputs       : ws - the WebSocket
+//		  opcode - WS_CLOSE, WS_PING or WS_PONG
+//		  payload - the unmasked payload
+//		  length - its length
+// Outputs      : 0 to keep going, 1 if the connection closed cleanly, -1 on
+//		  an error
+int readControlFrame ( WEBSOCKET *ws, int opcode, unsigned char *payload, int length ) {
+
+	switch ( opcode ) {
+	case WS_PING:
+		return ( sendWebSocket ( ws, WS_PONG, payload, length ) ) ? -1 : 0;
+
+	case WS_PONG:
+		return 0;
+
+	case WS_CLOSE:
+		//Echo the client's code back, which ends the handshake
+		if ( DEBUG )
+			logMessage ( LOG_INFO_LEVEL, "WebSocket closed by the client" );
+		closeWebSocket ( ws, ( length >= 2 ) ? ( payload[0] << 8 ) | payload[1] : WS_CLOSE_NORMAL );
+		return 1;
+
+	default:
+		closeWebSocket ( ws, WS_CLOSE_PROTOCOL_ERROR );
+		return -1;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : readExactly
+// Description  : Read exactly len bytes from the client
+//
+// Inputs       : fd - socket file handle
+//		  buf - place to put the bytes
+//		  len - how many to read
+// Outputs      : 0 if successful, -1 if the client went away
+int readExactly ( int fd, void *buf, uint64_t len ) {
+
+	ssize_t rb;
+	uint64_t got = 0;
+
+	while ( got < len ) {
+		if ( (rb = connRead ( fd, (char *)buf + got, len - got )) <= 0 ) {
+			if ( rb == -1 && errno == EINTR )
+				continue;
+			logMessage ( LOG_INFO_LEVEL, "WebSocket client went away [%s]", ( rb == 0 ) ? "end of stream" : strerror(errno) );
+			return -1;
+		}
+		countTransfer ( fd, rb, 0 );
+		got += rb;
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : unmaskScalar
+// Description  : Unmask eight bytes at a time, then the tail one at a time
+//
+// Inputs       : data - the payload
+//		  length - its length
+//		  key - the masking key, as it sits in memory
+// Outputs      : none
+void unmaskScalar ( unsigned char *data, uint64_t length, uint32_t key ) {
+
+	uint64_t wide = ( (uint64_t)key << 32 ) | key, word, i = 0;
+	const unsigned char *mask = (const unsigned char *)&key;
+
+	for ( ; i + 8 <= length; i += 8 ) {
+		memcpy ( &word, data + i, 8 );
+		word ^= wide;
+		memcpy ( data + i, &word, 8 );
+	}
+	for ( ; i < length; i++ )
+		data[i] ^= mask[i & 3];
+}
+
+#ifdef WEBSOCKET_X86
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : unmaskSse2
+// Description  : Unmask sixteen bytes at a time, every x86-64 CPU has SSE2
+//
+// Inputs       : data - the payload
+//		  length - its length
+//		  key - the masking key, as it sits in memory
+// Outputs      : none
+__attribute__ (( target ( "sse2" ) ))
+void unmaskSse2 ( unsigned char *data, uint64_t length, uint32_t key ) {
+
+	__m128i wide = _mm_set1_epi32 ( (int)key );
+	uint64_t i = 0;
+
+	for ( ; i + 16 <= length; i += 16 )
+		_mm_storeu_si128 ( (__m128i *)( data + i ),
+				_mm_xor_si128 ( _mm_loadu_si128 ( (const __m128i *)( data + i ) ), wide ) );
+	unmaskScalar ( data + i, length - i, key );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : unmaskAvx2
+// Description  : Unmask thirty-two bytes at a time
+//
+// Inputs       : data - the payload
+//		  length - its length
+//		  key - the masking key, as it sits in memory
+// Outputs      : none
+__attribute__ (( target ( "avx2" ) ))
+void unmaskAvx2 ( unsigned char *data, uint64_t length, uint32_t key ) {
+
+	__m256i wide = _mm256_set1_epi32 ( (int)key );
+	uint64_t i = 0;
+
+	for ( ; i + 32 <= length; i += 32 )
+		_mm256_storeu_si256 ( (__m256i *)( data + i ),
+				_mm256_xor_si256 ( _mm256_loadu_si256 ( (const __m256i *)( data + i ) ), wide ) );
+	unmaskScalar ( data + i, length - i, key );
+}
+#endif
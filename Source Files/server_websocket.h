@@ -0,0 +1,92 @@
+#ifndef SERVER_WEBSOCKET_INCLUDED
+#define SERVER_WEBSOCKET_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : server_websocket.h
+//  Description   : RFC 6455 WebSockets on the routes registered for them. An
+//                  HTTP/1.1 GET with "Upgrade: websocket" on such a route is
+//                  switched over, and from then on the connection waits in
+//                  the event loop like an HTTP/2 session. A worker takes it
+//                  whenever frames arrive, reassembles fragmented messages
+//                  and passes each whole message to the route's handler.
+//
+//                  A connection that stays quiet is pinged from its deadline
+//                  timer, and closed after WEBSOCKET_MAX_MISSED_PINGS pings go
+//                  unanswered. Client payloads are unmasked with SSE2 or AVX2
+//                  where the CPU has them.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Sun Oct 18 12:07:12 UTC 2026
+//
+
+#include <stdint.h>
+#include <server.h>
+
+//
+// Constants
+
+#define WEBSOCKET_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"	//RFC 6455 handshake constant
+#define WEBSOCKET_VERSION "13"			//the only version there is
+#define MAX_WEBSOCKET_ROUTES 16
+#define WEBSOCKET_MAX_MESSAGE ( 1024 * 1024 )	//largest message, after reassembly
+#define WEBSOCKET_PING_MS 30000			//quiet time before the server pings
+#define WEBSOCKET_MAX_MISSED_PINGS 2		//unanswered pings before the connection is closed
+
+// Frame opcodes
+#define WS_CONTINUATION 0x0
+#define WS_TEXT 0x1
+#define WS_BINARY 0x2
+#define WS_CLOSE 0x8
+#define WS_PING 0x9
+#define WS_PONG 0xA
+
+// Close codes
+#define WS_CLOSE_NORMAL 1000
+#define WS_CLOSE_GOING_AWAY 1001
+#define WS_CLOSE_PROTOCOL_ERROR 1002
+#define WS_CLOSE_POLICY 1008
+#define WS_CLOSE_TOO_BIG 1009
+
+//
+// Type Definitions
+
+typedef struct websocket WEBSOCKET;
+
+// What a route does with its connections. Each is called on the worker that
+// owns the connection, which is the only place sendWebSocket may be called.
+// onOpen runs once the connection has switched, and a non-zero return
+// closes it again. onMessage gets every whole text or binary message, and a
+// non-zero return closes the connection. onClose may be NULL.
+typedef struct websocket_route {
+	int (*onOpen) ( WEBSOCKET *ws, HTTP_REQUEST *request );
+	int (*onMessage) ( WEBSOCKET *ws, int opcode, const unsigned char *data, uint64_t length );
+	void (*onClose) ( WEBSOCKET *ws );
+} WEBSOCKET_ROUTE;
+
+struct websocket {
+	CLIENT_CONN *conn;			//the connection it runs on
+	const WEBSOCKET_ROUTE *route;
+	void *data;				//the route's own state
+	int opcode;				//WS_TEXT or WS_BINARY while a fragmented message arrives, else 0
+	unsigned char *message;			//the message so far
+	uint64_t messageLength;
+	uint64_t messageCapacity;
+	int pingDue;				//set by the deadline timer, a worker sends the ping
+	int missedPings;			//pings sent since the client was last heard from
+	int closeSent;				//our close frame went out
+};
+
+//
+// Functional Prototypes
+
+int registerWebSocket ( const char *prefix, const WEBSOCKET_ROUTE *route );
+int isWebSocketUpgrade ( HTTP_REQUEST *request );
+int startWebSocket ( CLIENT_CONN *conn, HTTP_REQUEST *request );
+int serveWebSocket ( CLIENT_CONN *conn );
+int sendWebSocket ( WEBSOCKET *ws, int opcode, const void *data, uint64_t length );
+int closeWebSocket ( WEBSOCKET *ws, int code );
+void freeWebSocket ( CLIENT_CONN *conn );
+void unmaskWebSocket ( unsigned char *data, uint64_t length, const unsigned char mask[4] );
+
+#endif